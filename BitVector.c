@@ -31,7 +31,8 @@
 #include "MBAssert.h"
 #include "MBUtil.h"
 
-void BitVector_CreateWithSize(BitVector *b, int size)
+void BitVector_CreateWithAllocator(BitVector *b, int64 size,
+                                   const CMBAllocator *alloc)
 {
 	ASSERT(size >= 0);
 	ASSERT(b != NULL);
@@ -42,19 +43,20 @@ void BitVector_CreateWithSize(BitVector *b, int size)
 	b->arrSize = 0;
 	b->fill = FALSE;
 	b->bits = NULL;
+	b->allocator = alloc;
 	BitVector_Resize(b, size);
 }
 
 void BitVector_Destroy(BitVector *b)
 {
 	ASSERT(b != NULL);
-	free(b->bits);
+	MBAlloc_Free(b->allocator, b->bits, b->arrSize * BVUNITBYTES);
 	b->bits = NULL;
 }
 
 void BitVector_Copy(BitVector *dest, const BitVector *src)
 {
-	int numBytes;
+	int64 numBytes;
 	ASSERT(dest != NULL);
 	ASSERT(src != NULL);
 
@@ -72,22 +74,23 @@ void BitVector_Consume(BitVector *dest, BitVector *src)
 	ASSERT(src != NULL);
 	bool oldFill;
 
-	free(dest->bits);
+	MBAlloc_Free(dest->allocator, dest->bits, dest->arrSize * BVUNITBYTES);
 	dest->bits = src->bits;
 
 	dest->size = src->size;
 	dest->arrSize = src->arrSize;
+	dest->allocator = src->allocator;
 
 	oldFill = src->fill;
-	BitVector_Create(src);
+	BitVector_CreateWithAllocator(src, 0, src->allocator);
 	src->fill = oldFill;
 }
 
-void BitVector_Resize(BitVector *b, int size)
+void BitVector_Resize(BitVector *b, int64 size)
 {
-	int oldSize;
-	int oldValidCellCount;
-	int newValidCellCount;
+	int64 oldSize;
+	int64 oldValidCellCount;
+	int64 newValidCellCount;
 
 	ASSERT(b != NULL);
 	ASSERT(size >= 0);
@@ -102,17 +105,20 @@ void BitVector_Resize(BitVector *b, int size)
 	newValidCellCount = (size + BVUNITBITS - 1) / BVUNITBITS;
 
 	if (oldValidCellCount < newValidCellCount) {
-		int byteLength;
+		int64 byteLength;
 		uint64 *tempPtr;
+		uint64 oldArrSize;
 
 		tempPtr = b->bits;
+		oldArrSize = b->arrSize;
 		b->arrSize = newValidCellCount;
-		b->bits = malloc(b->arrSize * BVUNITBYTES);
+		b->bits = MBAlloc_Alloc(b->allocator, b->arrSize * BVUNITBYTES);
 
-		byteLength = oldValidCellCount * BVUNITBYTES;
-		memcpy(BitVectorGetPtr(b), tempPtr, byteLength);
-
-		free(tempPtr);
+		if (tempPtr != NULL) {
+			byteLength = oldValidCellCount * BVUNITBYTES;
+			memcpy(BitVectorGetPtr(b), tempPtr, byteLength);
+			MBAlloc_Free(b->allocator, tempPtr, oldArrSize * BVUNITBYTES);
+		}
 	}
 
 	if (oldSize < size) {
@@ -125,17 +131,17 @@ void BitVector_Resize(BitVector *b, int size)
 	}
 }
 
-void BitVectorSetRangeGeneric(BitVector *b, int first, int last)
+void BitVectorSetRangeGeneric(BitVector *b, int64 first, int64 last)
 {
 	BitVectorWriteRangeGenericImpl(b, first, last, BITVECTOR_WRITE_SET);
 }
 
-void BitVectorResetRangeGeneric(BitVector *b, int first, int last)
+void BitVectorResetRangeGeneric(BitVector *b, int64 first, int64 last)
 {
 	BitVectorWriteRangeGenericImpl(b, first, last, BITVECTOR_WRITE_RESET);
 }
 
-void BitVectorFlipRangeGeneric(BitVector *b, int first, int last)
+void BitVectorFlipRangeGeneric(BitVector *b, int64 first, int64 last)
 {
 	BitVectorWriteRangeGenericImpl(b, first, last, BITVECTOR_WRITE_FLIP);
 }
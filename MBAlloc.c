@@ -0,0 +1,159 @@
+/*
+ * MBAlloc.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "MBAlloc.h"
+
+#define MBALLOC_HUGE_PAGE_SIZE MB_TO_BYTES(2)
+
+static void *MBAllocMMapAlloc(void *cbData, size_t size);
+static void *MBAllocMMapRealloc(void *cbData, void *ptr,
+                                size_t oldSize, size_t newSize);
+static void MBAllocMMapFree(void *cbData, void *ptr, size_t size);
+
+/*
+ * The cbData is just a flag for whether we want huge pages.
+ */
+static bool gMBAllocUseHuge = TRUE;
+static bool gMBAllocNoHuge = FALSE;
+
+static const CMBAllocator gMBAllocMMap = {
+    MBAllocMMapAlloc, MBAllocMMapRealloc, MBAllocMMapFree, &gMBAllocNoHuge,
+};
+
+static const CMBAllocator gMBAllocMMapHuge = {
+    MBAllocMMapAlloc, MBAllocMMapRealloc, MBAllocMMapFree, &gMBAllocUseHuge,
+};
+
+const CMBAllocator *MBAlloc_GetMMapAllocator(bool hugePages)
+{
+    return hugePages ? &gMBAllocMMapHuge : &gMBAllocMMap;
+}
+
+static size_t MBAllocMMapRound(void *cbData, size_t size)
+{
+    bool huge = *(bool *)cbData;
+    size_t align;
+
+    if (huge) {
+        align = MBALLOC_HUGE_PAGE_SIZE;
+    } else {
+        align = sysconf(_SC_PAGESIZE);
+    }
+    ASSERT(MBUtil_IsPow2(align));
+
+    return (size + align - 1) & ~(align - 1);
+}
+
+static void MBAllocMMapAdvise(void *cbData, void *ptr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    if (*(bool *)cbData) {
+        /*
+         * This is only a hint, so we don't care if the kernel
+         * doesn't support it.
+         */
+        madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+static void *MBAllocMMapAlloc(void *cbData, size_t size)
+{
+    void *ptr;
+
+    size = MBAllocMMapRound(cbData, size);
+    if (size == 0) {
+        return NULL;
+    }
+
+    /*
+     * Pages are only committed once they're touched, so this
+     * mostly just reserves address space.
+     */
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    MBAllocMMapAdvise(cbData, ptr, size);
+    return ptr;
+}
+
+static void MBAllocMMapFree(void *cbData, void *ptr, size_t size)
+{
+    size = MBAllocMMapRound(cbData, size);
+    ASSERT(size > 0);
+
+    int ret = munmap(ptr, size);
+    VERIFY(ret == 0);
+}
+
+static void *MBAllocMMapRealloc(void *cbData, void *ptr,
+                                size_t oldSize, size_t newSize)
+{
+    void *newPtr;
+
+    if (ptr == NULL) {
+        return MBAllocMMapAlloc(cbData, newSize);
+    }
+
+    oldSize = MBAllocMMapRound(cbData, oldSize);
+    newSize = MBAllocMMapRound(cbData, newSize);
+
+    if (oldSize == newSize) {
+        return ptr;
+    }
+
+#if defined(MB_LINUX) && defined(MREMAP_MAYMOVE)
+    /*
+     * Let the kernel move the page tables around instead of copying
+     * the whole buffer, and avoid needing both copies resident at once.
+     */
+    newPtr = mremap(ptr, oldSize, newSize, MREMAP_MAYMOVE);
+    if (newPtr == MAP_FAILED) {
+        return NULL;
+    }
+    MBAllocMMapAdvise(cbData, newPtr, newSize);
+#else
+    newPtr = MBAllocMMapAlloc(cbData, newSize);
+    if (newPtr == NULL) {
+        return NULL;
+    }
+    memcpy(newPtr, ptr, MIN(oldSize, newSize));
+    MBAllocMMapFree(cbData, ptr, oldSize);
+#endif
+
+    return newPtr;
+}
@@ -24,17 +24,477 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "MBCompare.h"
 #include "MBAssert.h"
+#include "MBThread.h"
+#include "MBParallel.h"
+
+int64
+MBCompare_FindMin(void *items, uint64 numItems, uint32 itemSize,
+                  CMBCompareFn compareFn, void *cbData)
+{
+    if (numItems == 0) {
+        return -1;
+    } else if (numItems == 1) {
+        return 0;
+    }
+
+#define GET_ITEM(_n) (&((uint8 *)items)[itemSize * _n])
+#define COMPARE(_lhs, _rhs) (compareFn(GET_ITEM(_lhs), GET_ITEM(_rhs), cbData))
+
+    ASSERT(numItems <= (uint64)MAX_INT64);
+
+    uint64 min = 0;
+    for (uint64 i = 1; i < numItems; i++) {
+        if (COMPARE(min, i) > 0) {
+            min = i;
+        }
+    }
+
+    return min;
+
+#undef GET_ITEM
+#undef COMPARE
+}
+
+/*
+ * Map a key to a uint64 that sorts the same way as the key does.
+ */
+static INLINE_ALWAYS uint64
+MBCompareRadixKey(const uint8 *item, MBCompareKeyType keyType)
+{
+    uint32 k32;
+    uint64 k64;
+
+    switch (keyType) {
+        case MBCOMPARE_KEY_UINT32:
+            memcpy(&k32, item, sizeof(k32));
+            return k32;
+        case MBCOMPARE_KEY_INT32:
+            memcpy(&k32, item, sizeof(k32));
+            return k32 ^ 0x80000000;
+        case MBCOMPARE_KEY_FLOAT:
+            memcpy(&k32, item, sizeof(k32));
+            return (k32 & 0x80000000) ? ~k32 : (k32 | 0x80000000);
+        case MBCOMPARE_KEY_UINT64:
+            memcpy(&k64, item, sizeof(k64));
+            return k64;
+        case MBCOMPARE_KEY_INT64:
+            memcpy(&k64, item, sizeof(k64));
+            return k64 ^ 0x8000000000000000ULL;
+        case MBCOMPARE_KEY_DOUBLE:
+            memcpy(&k64, item, sizeof(k64));
+            return (k64 & 0x8000000000000000ULL) ?
+                   ~k64 : (k64 | 0x8000000000000000ULL);
+    }
+
+    NOT_REACHED();
+}
+
+static INLINE_ALWAYS void
+MBCompareRadixCopy(uint8 *dest, const uint8 *src, uint32 itemSize)
+{
+    /*
+     * Constant sizes let the compiler turn these into plain moves.
+     */
+    if (itemSize == 4) {
+        memcpy(dest, src, 4);
+    } else if (itemSize == 8) {
+        memcpy(dest, src, 8);
+    } else {
+        memcpy(dest, src, itemSize);
+    }
+}
+
+static INLINE_ALWAYS void
+MBCompareRadixSortImpl(void *items, uint64 numItems, uint32 itemSize,
+                       uint32 keyOffset, MBCompareKeyType keyType,
+                       uint keyBytes)
+{
+    uint64 (*counts)[256];
+    uint8 *scratch;
+    uint8 *src;
+    uint8 *dest;
+
+    counts = calloc(keyBytes, sizeof(counts[0]));
+    scratch = malloc(numItems * itemSize);
+    VERIFY(counts != NULL);
+    VERIFY(scratch != NULL);
+
+    /*
+     * Build the histograms for every digit in one pass.
+     */
+    src = items;
+    for (uint64 i = 0; i < numItems; i++) {
+        uint64 key = MBCompareRadixKey(src + i * itemSize + keyOffset,
+                                       keyType);
+        for (uint d = 0; d < keyBytes; d++) {
+            counts[d][(key >> (d * 8)) & 0xFF]++;
+        }
+    }
+
+    dest = scratch;
+    for (uint d = 0; d < keyBytes; d++) {
+        uint64 offset = 0;
+        uint64 firstKey;
+
+        /*
+         * Skip the digits where everything lands in the same bucket.
+         */
+        firstKey = MBCompareRadixKey(src + keyOffset, keyType);
+        if (counts[d][(firstKey >> (d * 8)) & 0xFF] == numItems) {
+            continue;
+        }
+
+        for (uint b = 0; b < 256; b++) {
+            uint64 c = counts[d][b];
+            counts[d][b] = offset;
+            offset += c;
+        }
+
+        for (uint64 i = 0; i < numItems; i++) {
+            const uint8 *item = src + i * itemSize;
+            uint64 key = MBCompareRadixKey(item + keyOffset, keyType);
+            uint64 index = counts[d][(key >> (d * 8)) & 0xFF]++;
+            MBCompareRadixCopy(dest + index * itemSize, item, itemSize);
+        }
+
+        uint8 *tmp = src;
+        src = dest;
+        dest = tmp;
+    }
+
+    if (src != items) {
+        memcpy(items, src, numItems * itemSize);
+    }
+
+    free(scratch);
+    free(counts);
+}
+
+void MBCompare_RadixSort(void *items, uint64 numItems, uint32 itemSize,
+                         uint32 keyOffset, MBCompareKeyType keyType)
+{
+    ASSERT(itemSize > 0);
+
+    if (numItems <= 1) {
+        return;
+    }
+
+    /*
+     * Expand the common cases separately so the key type and item size
+     * are constants in the inner loops.
+     */
+    switch (keyType) {
+        case MBCOMPARE_KEY_UINT32:
+        case MBCOMPARE_KEY_INT32:
+        case MBCOMPARE_KEY_FLOAT:
+            ASSERT(keyOffset + sizeof(uint32) <= itemSize);
+            if (itemSize == sizeof(uint32) && keyType == MBCOMPARE_KEY_INT32) {
+                MBCompareRadixSortImpl(items, numItems, sizeof(uint32), 0,
+                                       MBCOMPARE_KEY_INT32, sizeof(uint32));
+            } else if (itemSize == sizeof(uint32) &&
+                       keyType == MBCOMPARE_KEY_UINT32) {
+                MBCompareRadixSortImpl(items, numItems, sizeof(uint32), 0,
+                                       MBCOMPARE_KEY_UINT32, sizeof(uint32));
+            } else if (itemSize == sizeof(uint32) &&
+                       keyType == MBCOMPARE_KEY_FLOAT) {
+                MBCompareRadixSortImpl(items, numItems, sizeof(uint32), 0,
+                                       MBCOMPARE_KEY_FLOAT, sizeof(uint32));
+            } else {
+                MBCompareRadixSortImpl(items, numItems, itemSize, keyOffset,
+                                       keyType, sizeof(uint32));
+            }
+            break;
+        case MBCOMPARE_KEY_UINT64:
+        case MBCOMPARE_KEY_INT64:
+        case MBCOMPARE_KEY_DOUBLE:
+            ASSERT(keyOffset + sizeof(uint64) <= itemSize);
+            MBCompareRadixSortImpl(items, numItems, itemSize, keyOffset,
+                                   keyType, sizeof(uint64));
+            break;
+        default:
+            NOT_IMPLEMENTED();
+    }
+}
+
+typedef struct MBCompareSortData {
+    uint8 *items;
+    uint32 itemSize;
+    CMBCompareFn compareFn;
+    void *cbData;
+    void *swapSpace;
+} MBCompareSortData;
+
+static INLINE_ALWAYS uint8 *
+MBCompareSortItem(MBCompareSortData *sd, uint64 i)
+{
+    return sd->items + i * sd->itemSize;
+}
+
+static INLINE_ALWAYS int
+MBCompareSortCompare(MBCompareSortData *sd, uint64 lhs, uint64 rhs)
+{
+    return sd->compareFn(MBCompareSortItem(sd, lhs),
+                         MBCompareSortItem(sd, rhs), sd->cbData);
+}
+
+static INLINE_ALWAYS void
+MBCompareSortSwap(MBCompareSortData *sd, uint64 lhs, uint64 rhs)
+{
+    uint8 *l = MBCompareSortItem(sd, lhs);
+    uint8 *r = MBCompareSortItem(sd, rhs);
+
+    if (sd->itemSize == sizeof(uint32)) {
+        uint32 tmp;
+        memcpy(&tmp, l, sizeof(tmp));
+        memcpy(l, r, sizeof(tmp));
+        memcpy(r, &tmp, sizeof(tmp));
+    } else if (sd->itemSize == sizeof(uint64)) {
+        uint64 tmp;
+        memcpy(&tmp, l, sizeof(tmp));
+        memcpy(l, r, sizeof(tmp));
+        memcpy(r, &tmp, sizeof(tmp));
+    } else {
+        memcpy(sd->swapSpace, l, sd->itemSize);
+        memcpy(l, r, sd->itemSize);
+        memcpy(r, sd->swapSpace, sd->itemSize);
+    }
+}
+
+static void
+MBCompareInsertionSort(MBCompareSortData *sd, uint64 first, uint64 numItems)
+{
+    for (uint64 i = first + 1; i < first + numItems; i++) {
+        uint64 k = i;
+        while (k > first && MBCompareSortCompare(sd, k - 1, k) > 0) {
+            MBCompareSortSwap(sd, k - 1, k);
+            k--;
+        }
+    }
+}
+
+static void
+MBCompareSiftDown(MBCompareSortData *sd, uint64 first,
+                  uint64 root, uint64 numItems)
+{
+    uint64 child;
+
+    while ((child = 2 * root + 1) < numItems) {
+        if (child + 1 < numItems &&
+            MBCompareSortCompare(sd, first + child, first + child + 1) < 0) {
+            child++;
+        }
+        if (MBCompareSortCompare(sd, first + root, first + child) >= 0) {
+            return;
+        }
+        MBCompareSortSwap(sd, first + root, first + child);
+        root = child;
+    }
+}
+
+static void
+MBCompareHeapSort(MBCompareSortData *sd, uint64 first, uint64 numItems)
+{
+    for (uint64 i = numItems / 2; i > 0; i--) {
+        MBCompareSiftDown(sd, first, i - 1, numItems);
+    }
+    for (uint64 i = numItems - 1; i > 0; i--) {
+        MBCompareSortSwap(sd, first, first + i);
+        MBCompareSiftDown(sd, first, 0, i);
+    }
+}
+
+/*
+ * Partition around a median-of-three pivot, and return the pivot's
+ * final index.
+ */
+static uint64
+MBCompareSortPartition(MBCompareSortData *sd, uint64 first, uint64 numItems)
+{
+    ASSERT(numItems >= 3);
+
+    /*
+     * Median-of-three into the first slot.  The pivot stays there
+     * during partitioning, so we never need to copy it out, and it
+     * doubles as a sentinel for the right-hand scan.
+     */
+    uint64 mid = first + numItems / 2;
+    uint64 last = first + numItems - 1;
+    if (MBCompareSortCompare(sd, mid, first) < 0) {
+        MBCompareSortSwap(sd, mid, first);
+    }
+    if (MBCompareSortCompare(sd, last, mid) < 0) {
+        MBCompareSortSwap(sd, last, mid);
+        if (MBCompareSortCompare(sd, mid, first) < 0) {
+            MBCompareSortSwap(sd, mid, first);
+        }
+    }
+    MBCompareSortSwap(sd, mid, first);
+
+    uint64 i = first;
+    uint64 k = first + numItems;
+    while (TRUE) {
+        do {
+            i++;
+        } while (i <= last && MBCompareSortCompare(sd, i, first) < 0);
+        do {
+            k--;
+        } while (MBCompareSortCompare(sd, first, k) < 0);
+
+        if (i >= k) {
+            break;
+        }
+        MBCompareSortSwap(sd, i, k);
+    }
+    MBCompareSortSwap(sd, first, k);
+    return k;
+}
+
+static uint
+MBCompareSortDepthLimit(uint64 numItems)
+{
+    uint depthLimit = 0;
+    for (uint64 n = numItems; n > 1; n >>= 1) {
+        depthLimit += 2;
+    }
+    return depthLimit;
+}
+
+static void
+MBCompareIntroSortLoop(MBCompareSortData *sd, uint64 first,
+                       uint64 numItems, uint depthLimit)
+{
+    while (numItems > MBCOMPARE_INSERTION_SORT_THRESHOLD) {
+        if (depthLimit == 0) {
+            MBCompareHeapSort(sd, first, numItems);
+            return;
+        }
+        depthLimit--;
+
+        uint64 k = MBCompareSortPartition(sd, first, numItems);
+
+        /*
+         * Recurse on the smaller side to bound the stack depth.
+         */
+        uint64 leftSize = k - first;
+        uint64 rightSize = numItems - leftSize - 1;
+        if (leftSize < rightSize) {
+            MBCompareIntroSortLoop(sd, first, leftSize, depthLimit);
+            first = k + 1;
+            numItems = rightSize;
+        } else {
+            MBCompareIntroSortLoop(sd, k + 1, rightSize, depthLimit);
+            numItems = leftSize;
+        }
+    }
+
+    MBCompareInsertionSort(sd, first, numItems);
+}
+
+/*
+ * Quickselect: partition only the side holding nth.  If that goes
+ * badly, just sort what's left.
+ */
+static void
+MBCompareNthElementLoop(MBCompareSortData *sd, uint64 nth,
+                        uint64 first, uint64 numItems)
+{
+    uint depthLimit = MBCompareSortDepthLimit(numItems);
+
+    while (numItems > MBCOMPARE_INSERTION_SORT_THRESHOLD) {
+        if (depthLimit == 0) {
+            MBCompareHeapSort(sd, first, numItems);
+            return;
+        }
+        depthLimit--;
+
+        uint64 k = MBCompareSortPartition(sd, first, numItems);
+        if (k == nth) {
+            return;
+        } else if (nth < k) {
+            numItems = k - first;
+        } else {
+            numItems -= k + 1 - first;
+            first = k + 1;
+        }
+    }
+
+    MBCompareInsertionSort(sd, first, numItems);
+}
+
+static void
+MBCompareSortDataCreate(MBCompareSortData *sd, void *stackSwap,
+                        uint32 stackSwapSize, void *items, uint32 itemSize,
+                        CMBCompareFn compareFn, void *cbData)
+{
+    sd->items = items;
+    sd->itemSize = itemSize;
+    sd->compareFn = compareFn;
+    sd->cbData = cbData;
+
+    if (itemSize <= stackSwapSize) {
+        sd->swapSpace = stackSwap;
+    } else {
+        sd->swapSpace = malloc(itemSize);
+    }
+}
+
+static void
+MBCompareSortDataDestroy(MBCompareSortData *sd, void *stackSwap)
+{
+    if (sd->swapSpace != stackSwap) {
+        free(sd->swapSpace);
+    }
+}
+
+void
+MBCompare_IntroSort(void *items, uint64 numItems, uint32 itemSize,
+                    CMBCompareFn compareFn, void *cbData)
+{
+    uint8 stackSwap[512];
+    MBCompareSortData sd;
+
+    if (numItems <= 1) {
+        return;
+    }
+
+    MBCompareSortDataCreate(&sd, stackSwap, sizeof(stackSwap),
+                            items, itemSize, compareFn, cbData);
+    MBCompareIntroSortLoop(&sd, 0, numItems,
+                           MBCompareSortDepthLimit(numItems));
+    MBCompareSortDataDestroy(&sd, stackSwap);
+}
+
+void
+MBCompare_NthElement(uint64 nth,
+                     void *items, uint64 numItems, uint32 itemSize,
+                     CMBCompareFn compareFn, void *cbData)
+{
+    uint8 stackSwap[512];
+    MBCompareSortData sd;
+
+    ASSERT(nth < numItems);
+
+    if (numItems <= 1) {
+        return;
+    }
+
+    MBCompareSortDataCreate(&sd, stackSwap, sizeof(stackSwap),
+                            items, itemSize, compareFn, cbData);
+    MBCompareNthElementLoop(&sd, nth, 0, numItems);
+    MBCompareSortDataDestroy(&sd, stackSwap);
+}
 
 void
-MBCompare_SortMinN(uint32 n,
-                   void *items, uint32 numItems, uint32 itemSize,
+MBCompare_SortMinN(uint64 n,
+                   void *items, uint64 numItems, uint32 itemSize,
                    CMBCompareFn compareFn, void *cbData)
 {
     uint8 stackSwap[512];
-    void *swapSpace;
+    MBCompareSortData sd;
 
     ASSERT(n <= numItems);
 
@@ -42,63 +502,545 @@ MBCompare_SortMinN(uint32 n,
         return;
     }
 
-#define GET_ITEM(_n) (&((uint8 *)items)[itemSize * _n])
-#define COMPARE(_lhs, _rhs) (compareFn(GET_ITEM(_lhs), GET_ITEM(_rhs), cbData))
+    MBCompareSortDataCreate(&sd, stackSwap, sizeof(stackSwap),
+                            items, itemSize, compareFn, cbData);
 
-    if (itemSize <= sizeof(stackSwap)) {
-        swapSpace = stackSwap;
+    if (n >= numItems / MBCOMPARE_SORTMINN_SELECT_RATIO) {
+        /*
+         * For a large fraction of the array, it's cheaper to select
+         * and then sort just the front.
+         */
+        if (n < numItems) {
+            MBCompareNthElementLoop(&sd, n - 1, 0, numItems);
+        }
+        MBCompareIntroSortLoop(&sd, 0, n, MBCompareSortDepthLimit(n));
     } else {
-        swapSpace = malloc(itemSize);
+        /*
+         * Keep the n smallest seen so far in a max-heap at the front,
+         * and only touch it when something beats the current max.
+         */
+        for (uint64 i = n / 2; i > 0; i--) {
+            MBCompareSiftDown(&sd, 0, i - 1, n);
+        }
+        for (uint64 i = n; i < numItems; i++) {
+            if (MBCompareSortCompare(&sd, i, 0) < 0) {
+                MBCompareSortSwap(&sd, i, 0);
+                MBCompareSiftDown(&sd, 0, 0, n);
+            }
+        }
+        for (uint64 i = n - 1; i > 0; i--) {
+            MBCompareSortSwap(&sd, 0, i);
+            MBCompareSiftDown(&sd, 0, 0, i);
+        }
+    }
+
+    MBCompareSortDataDestroy(&sd, stackSwap);
+}
+
+typedef struct MBCompareParallelSortData {
+    uint8 *items;
+    uint64 numItems;
+    uint32 itemSize;
+    uint numThreads;
+
+    CMBCompareFn compareFn;
+    void *cbData;
+    bool radix;
+    uint32 keyOffset;
+    MBCompareKeyType keyType;
+
+    /*
+     * The sorted runs in src are [runStart[r], runStart[r + 1]).
+     * Each merge round merges pairs of runs from src into dest, with
+     * each pair split into segsPerMerge independent pieces.
+     */
+    uint8 *src;
+    uint8 *dest;
+    uint64 *runStart;
+    uint numRuns;
+    uint segsPerMerge;
+} MBCompareParallelSortData;
+
+typedef struct MBCompareParallelTask {
+    MBCompareParallelSortData *ps;
+    uint id;
+    void (*fn)(MBCompareParallelSortData *ps, uint id);
+} MBCompareParallelTask;
+
+static INLINE_ALWAYS int
+MBCompareParallelCompare(MBCompareParallelSortData *ps,
+                         const uint8 *lhs, const uint8 *rhs)
+{
+    if (ps->radix) {
+        uint64 l = MBCompareRadixKey(lhs + ps->keyOffset, ps->keyType);
+        uint64 r = MBCompareRadixKey(rhs + ps->keyOffset, ps->keyType);
+        return (l > r) - (l < r);
+    }
+    return ps->compareFn(lhs, rhs, ps->cbData);
+}
+
+static void
+MBCompareParallelSortChunks(MBCompareParallelSortData *ps, uint id)
+{
+    for (uint r = id; r < ps->numRuns; r += ps->numThreads) {
+        uint8 *chunk = ps->items + ps->runStart[r] * ps->itemSize;
+        uint64 n = ps->runStart[r + 1] - ps->runStart[r];
+
+        if (ps->radix) {
+            MBCompare_RadixSort(chunk, n, ps->itemSize,
+                                ps->keyOffset, ps->keyType);
+        } else {
+            MBCompare_Sort(chunk, n, ps->itemSize, ps->compareFn, ps->cbData);
+        }
+    }
+}
+
+/*
+ * Find how many of the first k merged items come from a, so that the
+ * merge can be split at k.  Ties go to a, which keeps the merge stable.
+ */
+static uint64
+MBCompareParallelSplit(MBCompareParallelSortData *ps,
+                       const uint8 *a, uint64 aLen,
+                       const uint8 *b, uint64 bLen, uint64 k)
+{
+    uint32 itemSize = ps->itemSize;
+    uint64 lo = k > bLen ? k - bLen : 0;
+    uint64 hi = MIN(k, aLen);
+
+    while (lo < hi) {
+        uint64 i = lo + (hi - lo) / 2;
+        uint64 j = k - i;
+
+        if (MBCompareParallelCompare(ps, b + (j - 1) * itemSize,
+                                     a + i * itemSize) < 0) {
+            hi = i;
+        } else {
+            lo = i + 1;
+        }
     }
 
-    for (uint32 i = 0; i < n; i++) {
-        uint32 min = i;
+    return lo;
+}
+
+static void
+MBCompareParallelMergeRound(MBCompareParallelSortData *ps, uint id)
+{
+    uint32 itemSize = ps->itemSize;
+    uint numPairs = ps->numRuns / 2;
+    uint numTasks = numPairs * ps->segsPerMerge;
 
-        for (uint32 k = i + 1; k < numItems; k++) {
-            if (COMPARE(min, k) > 0) {
-                min = k;
+    for (uint t = id; t < numTasks; t += ps->numThreads) {
+        uint pair = t / ps->segsPerMerge;
+        uint seg = t % ps->segsPerMerge;
+        uint64 aStart = ps->runStart[2 * pair];
+        uint64 bStart = ps->runStart[2 * pair + 1];
+        uint64 aLen = bStart - aStart;
+        uint64 bLen = ps->runStart[2 * pair + 2] - bStart;
+        const uint8 *a = ps->src + aStart * itemSize;
+        const uint8 *b = ps->src + bStart * itemSize;
+        uint64 total = aLen + bLen;
+        uint64 outLo = total * seg / ps->segsPerMerge;
+        uint64 outHi = total * (seg + 1) / ps->segsPerMerge;
+        uint64 i = MBCompareParallelSplit(ps, a, aLen, b, bLen, outLo);
+        uint64 iEnd = MBCompareParallelSplit(ps, a, aLen, b, bLen, outHi);
+        uint64 j = outLo - i;
+        uint64 jEnd = outHi - iEnd;
+        uint8 *out = ps->dest + (aStart + outLo) * itemSize;
+
+        while (i < iEnd && j < jEnd) {
+            if (MBCompareParallelCompare(ps, b + j * itemSize,
+                                         a + i * itemSize) < 0) {
+                MBCompareRadixCopy(out, b + j * itemSize, itemSize);
+                j++;
+            } else {
+                MBCompareRadixCopy(out, a + i * itemSize, itemSize);
+                i++;
             }
+            out += itemSize;
         }
+        memcpy(out, a + i * itemSize, (iEnd - i) * itemSize);
+        out += (iEnd - i) * itemSize;
+        memcpy(out, b + j * itemSize, (jEnd - j) * itemSize);
+    }
 
-        if (min != i) {
-            memcpy(swapSpace, GET_ITEM(min), itemSize);
-            memcpy(GET_ITEM(min), GET_ITEM(i), itemSize);
-            memcpy(GET_ITEM(i), swapSpace ,itemSize);
+    /*
+     * An odd run out just gets carried over to the next round.
+     */
+    if (ps->numRuns % 2 == 1 && id == numTasks % ps->numThreads) {
+        uint64 start = ps->runStart[ps->numRuns - 1];
+        memcpy(ps->dest + start * itemSize, ps->src + start * itemSize,
+               (ps->numItems - start) * itemSize);
+    }
+}
+
+static void
+MBCompareParallelTaskMain(void *data)
+{
+    MBCompareParallelTask *task = data;
+    task->fn(task->ps, task->id);
+}
+
+/*
+ * Run fn on every id as a task on the MBParallel pool, with this
+ * thread taking id 0 and then helping with the rest.
+ */
+static void
+MBCompareParallelRun(MBCompareParallelSortData *ps,
+                     MBCompareParallelTask *tasks,
+                     void (*fn)(MBCompareParallelSortData *ps, uint id))
+{
+    MBThreadPool *pool = MBParallel_GetPool();
+    MBThreadPoolCounter counter;
+
+    MBThreadPoolCounter_Create(&counter);
+    for (uint t = 1; t < ps->numThreads; t++) {
+        tasks[t].ps = ps;
+        tasks[t].id = t;
+        tasks[t].fn = fn;
+        MBThreadPool_Submit(pool, &counter, MBCompareParallelTaskMain,
+                            &tasks[t]);
+    }
+    fn(ps, 0);
+    MBThreadPool_Wait(pool, &counter);
+}
+
+static void
+MBCompareParallelSortImpl(MBCompareParallelSortData *ps)
+{
+    MBCompareParallelTask *tasks;
+    uint64 numChunks;
+    uint8 *scratch;
+
+    /*
+     * One chunk per thread.
+     */
+    numChunks = ps->numThreads;
+
+    ps->numRuns = numChunks;
+    ps->runStart = malloc((numChunks + 1) * sizeof(ps->runStart[0]));
+    tasks = malloc(ps->numThreads * sizeof(tasks[0]));
+    scratch = malloc(ps->numItems * ps->itemSize);
+    VERIFY(ps->runStart != NULL);
+    VERIFY(tasks != NULL);
+    VERIFY(scratch != NULL);
+
+    for (uint64 r = 0; r <= numChunks; r++) {
+        ps->runStart[r] = ps->numItems * r / numChunks;
+    }
+
+    MBCompareParallelRun(ps, tasks, MBCompareParallelSortChunks);
+
+    ps->src = ps->items;
+    ps->dest = scratch;
+    while (ps->numRuns > 1) {
+        uint numPairs = ps->numRuns / 2;
+        ps->segsPerMerge = MAX(1, ps->numThreads / numPairs);
+
+        MBCompareParallelRun(ps, tasks, MBCompareParallelMergeRound);
+
+        for (uint r = 0; r < numPairs; r++) {
+            ps->runStart[r] = ps->runStart[2 * r];
+        }
+        if (ps->numRuns % 2 == 1) {
+            ps->runStart[numPairs] = ps->runStart[ps->numRuns - 1];
+            numPairs++;
         }
+        ps->runStart[numPairs] = ps->numItems;
+        ps->numRuns = numPairs;
+
+        uint8 *tmp = ps->src;
+        ps->src = ps->dest;
+        ps->dest = tmp;
     }
 
-    if (swapSpace != stackSwap) {
-        free(swapSpace);
+    if (ps->src != ps->items) {
+        memcpy(ps->items, ps->src, ps->numItems * ps->itemSize);
     }
 
-#undef GET_ITEM
-#undef COMPARE
+    free(scratch);
+    free(tasks);
+    free(ps->runStart);
 }
 
-int
-MBCompare_FindMin(void *items, uint32 numItems, uint32 itemSize,
-                  CMBCompareFn compareFn, void *cbData)
+static uint
+MBCompareParallelNumThreads(uint64 numItems, uint numThreads)
 {
-    if (numItems == 0) {
-        return -1;
-    } else if (numItems == 1) {
-        return 0;
+    if (!mb_has_mbthread) {
+        return 1;
     }
 
-#define GET_ITEM(_n) (&((uint8 *)items)[itemSize * _n])
-#define COMPARE(_lhs, _rhs) (compareFn(GET_ITEM(_lhs), GET_ITEM(_rhs), cbData))
+    if (numThreads == 0) {
+        numThreads = MBThreadPool_GetNumWorkers(MBParallel_GetPool());
+    }
 
-    ASSERT(numItems <= MAX_UINT32);
+    /*
+     * Don't bother splitting into pieces too small to be worth a thread.
+     */
+    numThreads = MIN(numThreads,
+                     numItems / (MBCOMPARE_PARALLEL_SORT_THRESHOLD / 4));
+    return MAX(1, numThreads);
+}
 
-    uint32 min = 0;
-    for (uint32 i = 1; i < numItems; i++) {
-        if (COMPARE(min, i) > 0) {
-            min = i;
+void
+MBCompare_ParallelSort(void *items, uint64 numItems, uint32 itemSize,
+                       CMBCompareFn compareFn, void *cbData, uint numThreads)
+{
+    MBCompareParallelSortData ps;
+
+    ASSERT(itemSize > 0);
+
+    numThreads = MBCompareParallelNumThreads(numItems, numThreads);
+    if (numItems < MBCOMPARE_PARALLEL_SORT_THRESHOLD || numThreads == 1) {
+        MBCompare_Sort(items, numItems, itemSize, compareFn, cbData);
+        return;
+    }
+
+    MBUtil_Zero(&ps, sizeof(ps));
+    ps.items = items;
+    ps.numItems = numItems;
+    ps.itemSize = itemSize;
+    ps.numThreads = numThreads;
+    ps.compareFn = compareFn;
+    ps.cbData = cbData;
+    ps.radix = FALSE;
+    MBCompareParallelSortImpl(&ps);
+}
+
+void
+MBCompare_ParallelRadixSort(void *items, uint64 numItems, uint32 itemSize,
+                            uint32 keyOffset, MBCompareKeyType keyType,
+                            uint numThreads)
+{
+    MBCompareParallelSortData ps;
+
+    ASSERT(itemSize > 0);
+
+    numThreads = MBCompareParallelNumThreads(numItems, numThreads);
+    if (numItems < MBCOMPARE_PARALLEL_SORT_THRESHOLD || numThreads == 1) {
+        MBCompare_RadixSort(items, numItems, itemSize, keyOffset, keyType);
+        return;
+    }
+
+    MBUtil_Zero(&ps, sizeof(ps));
+    ps.items = items;
+    ps.numItems = numItems;
+    ps.itemSize = itemSize;
+    ps.numThreads = numThreads;
+    ps.radix = TRUE;
+    ps.keyOffset = keyOffset;
+    ps.keyType = keyType;
+    MBCompareParallelSortImpl(&ps);
+}
+
+/*
+ * Stable merge of two sorted arrays: ties go to a.
+ */
+static void
+MBCompareMerge(uint8 *dest, const uint8 *a, uint64 aLen,
+               const uint8 *b, uint64 bLen, uint32 itemSize,
+               CMBCompareFn compareFn, void *cbData)
+{
+    const uint8 *aEnd = a + aLen * itemSize;
+    const uint8 *bEnd = b + bLen * itemSize;
+
+    /*
+     * Already in order is common enough to be worth one extra compare.
+     */
+    if (aLen > 0 && bLen > 0 &&
+        compareFn(b, aEnd - itemSize, cbData) >= 0) {
+        memcpy(dest, a, aLen * itemSize);
+        memcpy(dest + aLen * itemSize, b, bLen * itemSize);
+        return;
+    }
+
+    while (a < aEnd && b < bEnd) {
+        if (compareFn(b, a, cbData) < 0) {
+            MBCompareRadixCopy(dest, b, itemSize);
+            b += itemSize;
+        } else {
+            MBCompareRadixCopy(dest, a, itemSize);
+            a += itemSize;
         }
+        dest += itemSize;
     }
+    memcpy(dest, a, aEnd - a);
+    dest += aEnd - a;
+    memcpy(dest, b, bEnd - b);
+}
 
-    return min;
+void
+MBCompare_MergeSorted(void *dest,
+                      const void *a, uint64 aLen,
+                      const void *b, uint64 bLen, uint32 itemSize,
+                      CMBCompareFn compareFn, void *cbData)
+{
+    ASSERT(itemSize > 0);
+    MBCompareMerge(dest, a, aLen, b, bLen, itemSize, compareFn, cbData);
+}
 
-#undef GET_ITEM
-#undef COMPARE
+void
+MBCompare_StableSort(void *items, uint64 numItems, uint32 itemSize,
+                     CMBCompareFn compareFn, void *cbData)
+{
+    const uint64 runSize = MBCOMPARE_INSERTION_SORT_THRESHOLD;
+    uint8 stackSwap[512];
+    MBCompareSortData sd;
+    uint8 *scratch;
+    uint8 *src;
+    uint8 *dest;
+
+    ASSERT(itemSize > 0);
+
+    if (numItems <= 1) {
+        return;
+    }
+
+    /*
+     * Insertion sort only swaps strictly out-of-order neighbours, so
+     * it's stable.
+     */
+    MBCompareSortDataCreate(&sd, stackSwap, sizeof(stackSwap),
+                            items, itemSize, compareFn, cbData);
+    for (uint64 i = 0; i < numItems; i += runSize) {
+        sd.items = (uint8 *)items + i * itemSize;
+        MBCompareInsertionSort(&sd, 0, MIN(runSize, numItems - i));
+    }
+    MBCompareSortDataDestroy(&sd, stackSwap);
+
+    if (numItems <= runSize) {
+        return;
+    }
+
+    scratch = malloc(numItems * itemSize);
+    VERIFY(scratch != NULL);
+
+    src = items;
+    dest = scratch;
+    for (uint64 width = runSize; width < numItems; width *= 2) {
+        for (uint64 i = 0; i < numItems; i += 2 * width) {
+            uint64 aLen = MIN(width, numItems - i);
+            uint64 bLen = MIN(width, numItems - i - aLen);
+            MBCompareMerge(dest + i * itemSize,
+                           src + i * itemSize, aLen,
+                           src + (i + aLen) * itemSize, bLen,
+                           itemSize, compareFn, cbData);
+        }
+
+        uint8 *tmp = src;
+        src = dest;
+        dest = tmp;
+    }
+
+    if (src != items) {
+        memcpy(items, src, numItems * itemSize);
+    }
+    free(scratch);
+}
+
+typedef struct MBCompareLoserTree {
+    const uint8 **cur;
+    const uint8 **end;
+    uint32 *tree;
+    uint32 numSrcs;
+    CMBCompareFn compareFn;
+    void *cbData;
+} MBCompareLoserTree;
+
+/*
+ * Does source l's next item come out before source r's?  Exhausted
+ * sources lose to everything, and ties go to the lower source.
+ */
+static INLINE_ALWAYS bool
+MBCompareLoserTreeBeats(MBCompareLoserTree *lt, uint32 l, uint32 r)
+{
+    if (lt->cur[r] == lt->end[r]) {
+        return TRUE;
+    } else if (lt->cur[l] == lt->end[l]) {
+        return FALSE;
+    }
+
+    int c = lt->compareFn(lt->cur[l], lt->cur[r], lt->cbData);
+    return c < 0 || (c == 0 && l < r);
+}
+
+void
+MBCompare_MergeSortedK(void *dest, const void **srcs, const uint64 *lens,
+                       uint32 numSrcs, uint32 itemSize,
+                       CMBCompareFn compareFn, void *cbData)
+{
+    MBCompareLoserTree lt;
+    uint32 *winners;
+    uint8 *out = dest;
+    uint64 total = 0;
+
+    ASSERT(itemSize > 0);
+
+    if (numSrcs == 0) {
+        return;
+    } else if (numSrcs == 1) {
+        memcpy(dest, srcs[0], lens[0] * itemSize);
+        return;
+    } else if (numSrcs == 2) {
+        MBCompareMerge(dest, srcs[0], lens[0], srcs[1], lens[1],
+                       itemSize, compareFn, cbData);
+        return;
+    }
+
+    /*
+     * Leaves are the implicit nodes numSrcs..2*numSrcs-1, and each
+     * internal node keeps the loser of the match below it, so
+     * replacing the winner only replays one root-to-leaf path.
+     */
+    lt.numSrcs = numSrcs;
+    lt.compareFn = compareFn;
+    lt.cbData = cbData;
+    lt.cur = malloc(numSrcs * sizeof(lt.cur[0]));
+    lt.end = malloc(numSrcs * sizeof(lt.end[0]));
+    lt.tree = malloc(numSrcs * sizeof(lt.tree[0]));
+    winners = malloc(2 * numSrcs * sizeof(winners[0]));
+    VERIFY(lt.cur != NULL && lt.end != NULL);
+    VERIFY(lt.tree != NULL && winners != NULL);
+
+    for (uint32 i = 0; i < numSrcs; i++) {
+        lt.cur[i] = srcs[i];
+        lt.end[i] = lt.cur[i] + lens[i] * itemSize;
+        winners[numSrcs + i] = i;
+        total += lens[i];
+    }
+    for (uint32 n = numSrcs - 1; n >= 1; n--) {
+        uint32 l = winners[2 * n];
+        uint32 r = winners[2 * n + 1];
+        if (MBCompareLoserTreeBeats(&lt, l, r)) {
+            winners[n] = l;
+            lt.tree[n] = r;
+        } else {
+            winners[n] = r;
+            lt.tree[n] = l;
+        }
+    }
+    lt.tree[0] = winners[1];
+    free(winners);
+
+    for (uint64 i = 0; i < total; i++) {
+        uint32 w = lt.tree[0];
+
+        ASSERT(lt.cur[w] != lt.end[w]);
+        MBCompareRadixCopy(out, lt.cur[w], itemSize);
+        out += itemSize;
+        lt.cur[w] += itemSize;
+
+        for (uint32 n = (w + numSrcs) / 2; n >= 1; n /= 2) {
+            if (MBCompareLoserTreeBeats(&lt, lt.tree[n], w)) {
+                uint32 tmp = lt.tree[n];
+                lt.tree[n] = w;
+                w = tmp;
+            }
+        }
+        lt.tree[0] = w;
+    }
+
+    free(lt.cur);
+    free(lt.end);
+    free(lt.tree);
 }
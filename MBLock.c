@@ -0,0 +1,548 @@
+/*
+ * MBLock.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "MBLock.h"
+#include "MBUtil.h"
+
+#if defined(MB_LINUX) || defined(MB_MACOS)
+#include <sched.h>
+#endif
+
+#ifdef MB_LOCK_PROFILE
+#include <stdlib.h>
+#include <string.h>
+#if defined(MB_LINUX) || defined(MB_MACOS)
+#include <time.h>
+#elif defined(MBLOCK_SDL2)
+#include <SDL2/SDL_timer.h>
+#endif
+#endif
+
+#ifdef MBLOCK_FUTEX
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static void MBLockFutex(uint32 *addr, int op, uint32 val)
+{
+    /*
+     * Spurious wakeups and EAGAIN just send the callers back around
+     * their loops, so there's nothing to check here.
+     */
+    syscall(SYS_futex, addr, op | FUTEX_PRIVATE_FLAG, val, NULL, NULL, 0);
+}
+
+/*
+ * Drepper's mutex ("Futexes Are Tricky"): once a thread has had
+ * to wait, the lock is left at 2 until it's unlocked, so that unlock
+ * knows there might be someone to wake up.  Whoever takes the lock
+ * here also takes it at 2, since there might be other sleepers behind
+ * it.
+ */
+void MBLockLockSlow(MBLock *lock)
+{
+    while (MBAtomic_Exchange32(&lock->state, 2, MB_ATOMIC_ACQUIRE) != 0) {
+        MBLockFutex(&lock->state.value, FUTEX_WAIT, 2);
+    }
+}
+
+void MBLockUnlockSlow(MBLock *lock)
+{
+    MBLockFutex(&lock->state.value, FUTEX_WAKE, 1);
+}
+
+/*
+ * Sleepers read their wakeup counter before they look at the state
+ * for the last time, and wakers bump the counter after they change
+ * the state, so a wakeup between the check and the FUTEX_WAIT makes
+ * the wait return right away instead of getting lost.
+ */
+static void MBRWLockWakeReaders(MBRWLock *lock)
+{
+    MBAtomic_FetchAdd32(&lock->readerWakeups, 1, MB_ATOMIC_RELEASE);
+    MBLockFutex(&lock->readerWakeups.value, FUTEX_WAKE, INT_MAX);
+}
+
+void MBRWLockWakeWriter(MBRWLock *lock)
+{
+    MBAtomic_FetchAdd32(&lock->writerWakeups, 1, MB_ATOMIC_RELEASE);
+    MBLockFutex(&lock->writerWakeups.value, FUTEX_WAKE, 1);
+}
+
+void MBRWLockReadLockSlow(MBRWLock *lock)
+{
+    while (TRUE) {
+        uint32 wakeups = MBAtomic_Load32(&lock->readerWakeups,
+                                         MB_ATOMIC_ACQUIRE);
+        uint32 s = MBAtomic_Load32(&lock->state, MB_ATOMIC_ACQUIRE);
+
+        if ((s & (MBRWLOCK_WRITER | MBRWLOCK_WAITING_MASK)) == 0) {
+            ASSERT((s & MBRWLOCK_READER_MASK) != MBRWLOCK_READER_MASK);
+            if (MBAtomic_CompareExchange32(&lock->state, &s,
+                                           s + MBRWLOCK_READER,
+                                           MB_ATOMIC_ACQUIRE)) {
+                return;
+            }
+            continue;
+        }
+
+        /*
+         * Only sleep once the flag is in, so the writer that clears it
+         * knows to wake us up.
+         */
+        if ((s & MBRWLOCK_READERS_ASLEEP) == 0 &&
+            !MBAtomic_CompareExchange32(&lock->state, &s,
+                                        s | MBRWLOCK_READERS_ASLEEP,
+                                        MB_ATOMIC_RELAXED)) {
+            continue;
+        }
+        MBLockFutex(&lock->readerWakeups.value, FUTEX_WAIT, wakeups);
+    }
+}
+
+void MBRWLockWriteLockSlow(MBRWLock *lock)
+{
+    uint32 s = MBAtomic_FetchAdd32(&lock->state, MBRWLOCK_WAITING_WRITER,
+                                   MB_ATOMIC_RELAXED) +
+               MBRWLOCK_WAITING_WRITER;
+    ASSERT((s & MBRWLOCK_WAITING_MASK) != 0);
+
+    while (TRUE) {
+        uint32 wakeups = MBAtomic_Load32(&lock->writerWakeups,
+                                         MB_ATOMIC_ACQUIRE);
+        s = MBAtomic_Load32(&lock->state, MB_ATOMIC_ACQUIRE);
+
+        if ((s & (MBRWLOCK_WRITER | MBRWLOCK_READER_MASK)) == 0) {
+            uint32 n = s - MBRWLOCK_WAITING_WRITER + MBRWLOCK_WRITER;
+            if (MBAtomic_CompareExchange32(&lock->state, &s, n,
+                                           MB_ATOMIC_ACQUIRE)) {
+                return;
+            }
+            continue;
+        }
+        MBLockFutex(&lock->writerWakeups.value, FUTEX_WAIT, wakeups);
+    }
+}
+
+/*
+ * Hand off to the next writer if there is one.  Otherwise let the
+ * sleeping readers in.
+ */
+void MBRWLockWriteUnlockSlow(MBRWLock *lock)
+{
+    uint32 s = MBAtomic_Load32(&lock->state, MB_ATOMIC_RELAXED);
+    uint32 n;
+
+    do {
+        ASSERT(s & MBRWLOCK_WRITER);
+        n = s & ~MBRWLOCK_WRITER;
+        if ((n & MBRWLOCK_WAITING_MASK) == 0) {
+            n &= ~MBRWLOCK_READERS_ASLEEP;
+        }
+    } while (!MBAtomic_CompareExchange32(&lock->state, &s, n,
+                                         MB_ATOMIC_RELEASE));
+
+    if ((n & MBRWLOCK_WAITING_MASK) != 0) {
+        MBRWLockWakeWriter(lock);
+    } else if ((s & MBRWLOCK_READERS_ASLEEP) != 0) {
+        MBRWLockWakeReaders(lock);
+    }
+}
+
+void MBCondVarWake(MBCondVar *cv, bool all)
+{
+    MBLockFutex(&cv->seq.value, FUTEX_WAKE, all ? INT_MAX : 1);
+}
+
+/*
+ * The semaphore and event waiters count themselves before they sleep,
+ * and wakers change the futex word before they check the count, so
+ * either the waker sees the waiter, or the FUTEX_WAIT sees the new
+ * value and returns right away.
+ */
+void MBSemaphoreWaitSlow(MBSemaphore *sem)
+{
+    while (!MBSemaphore_TryWait(sem)) {
+        MBAtomic_FetchAdd32(&sem->numWaiters, 1, MB_ATOMIC_SEQ_CST);
+        MBLockFutex(&sem->count.value, FUTEX_WAIT, 0);
+        MBAtomic_FetchSub32(&sem->numWaiters, 1, MB_ATOMIC_RELAXED);
+    }
+}
+
+void MBSemaphoreWake(MBSemaphore *sem)
+{
+    MBLockFutex(&sem->count.value, FUTEX_WAKE, 1);
+}
+
+void MBEventWaitSlow(MBEvent *event)
+{
+    while (!MBEvent_TryWait(event)) {
+        MBAtomic_FetchAdd32(&event->numWaiters, 1, MB_ATOMIC_SEQ_CST);
+        MBLockFutex(&event->set.value, FUTEX_WAIT, 0);
+        MBAtomic_FetchSub32(&event->numWaiters, 1, MB_ATOMIC_RELAXED);
+    }
+}
+
+void MBEventWake(MBEvent *event)
+{
+    MBLockFutex(&event->set.value, FUTEX_WAKE, 1);
+}
+
+#endif // MBLOCK_FUTEX
+
+void MBLockYield(void)
+{
+#if defined(MB_LINUX) || defined(MB_MACOS)
+    sched_yield();
+#endif
+}
+
+static uint MBLockGetNumCPUs(void)
+{
+    static MBAtomic32 numCPUs;
+    uint n = MBAtomic_Load32(&numCPUs, MB_ATOMIC_RELAXED);
+
+    if (UNLIKELY(n == 0)) {
+        n = MBThread_GetNumCPUs();
+        MBAtomic_Store32(&numCPUs, n, MB_ATOMIC_RELAXED);
+    }
+    return n;
+}
+
+void MBSpinLockWait(MBSpinLock *lock, uint32 ticket)
+{
+    uint backoff = 1;
+
+    while (MBAtomic_Load32(&lock->owner, MB_ATOMIC_ACQUIRE) != ticket) {
+        if (backoff < MBSPINLOCK_MAX_BACKOFF &&
+            MBLockGetNumCPUs() > 1) {
+            for (uint i = 0; i < backoff; i++) {
+                MBAtomic_Pause();
+            }
+            backoff *= 2;
+        } else {
+            MBLockYield();
+        }
+    }
+}
+
+#ifdef MB_HAS_MBLOCK
+
+#define MBADAPTIVELOCK_MAX_SPINS 200
+
+void MBAdaptiveLockSpin(MBAdaptiveLock *lock)
+{
+    int32 estimate;
+    int32 maxSpins;
+
+    if (MBLockGetNumCPUs() == 1) {
+        MBLockAcquire(&lock->lock);
+        return;
+    }
+
+    /*
+     * The estimate is only written with the lock held, but it's read
+     * by all the spinners.
+     */
+    estimate = (int32)MBAtomic_Load32(&lock->spinEstimate, MB_ATOMIC_RELAXED);
+    maxSpins = MIN(MBADAPTIVELOCK_MAX_SPINS, estimate * 2 + 10);
+
+    for (int32 spins = 0; spins < maxSpins; spins++) {
+        MBAtomic_Pause();
+#ifdef MBLOCK_FUTEX
+        if (MBAtomic_Load32(&lock->lock.state, MB_ATOMIC_RELAXED) != 0) {
+            continue;
+        }
+#endif
+        if (MBLockTryAcquire(&lock->lock)) {
+            MBAtomic_Store32(&lock->spinEstimate,
+                             (uint32)(estimate + (spins - estimate) / 8),
+                             MB_ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    MBLockAcquire(&lock->lock);
+    MBAtomic_Store32(&lock->spinEstimate,
+                     (uint32)(estimate + (maxSpins - estimate) / 8),
+                     MB_ATOMIC_RELAXED);
+}
+
+void MBCondVar_Wait(MBCondVar *cv, MBLock *lock)
+{
+    ASSERT(cv != NULL);
+    ASSERT(MBLock_IsLocked(lock));
+
+#if defined(MBLOCK_FUTEX)
+    /*
+     * Read seq while we still hold the lock, so any signal for a
+     * change made after we let go of it will have bumped seq by the
+     * time we go to sleep.
+     */
+    MBAtomic_FetchAdd32(&cv->numWaiters, 1, MB_ATOMIC_SEQ_CST);
+    uint32 seq = MBAtomic_Load32(&cv->seq, MB_ATOMIC_SEQ_CST);
+
+    MBLock_Unlock(lock);
+    MBLockFutex(&cv->seq.value, FUTEX_WAIT, seq);
+    MBAtomic_FetchSub32(&cv->numWaiters, 1, MB_ATOMIC_RELAXED);
+    MBLock_Lock(lock);
+#else
+    /*
+     * The OS releases and retakes the mutex itself, so do the
+     * bookkeeping from MBLock_Unlock/MBLock_Lock around it.
+     */
+    MBLockDebugRelease(&lock->thread);
+#ifdef MB_LOCK_PROFILE
+    MBLockProfileReleasing(lock);
+#endif
+
+#if defined(MBLOCK_PTHREADS)
+    int ret = pthread_cond_wait(&cv->cond, &lock->mutex);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    int ret = SDL_CondWait(cv->sdlCond, lock->sdlMutex);
+    VERIFY(ret == 0);
+#endif
+
+#ifdef MB_LOCK_PROFILE
+    MBLockProfileAcquired(lock, 0);
+#endif
+    MBLockDebugAcquire(&lock->thread);
+#endif
+}
+
+#endif // MB_HAS_MBLOCK
+
+#if defined(MB_HAS_MBLOCK) && defined(MB_LOCK_PROFILE)
+
+/*
+ * Every live MBLock is on the live list.  When a lock that's been
+ * taken is destroyed, its numbers are added into the retired entry
+ * with the same name, so short-lived locks still show up.
+ *
+ * A zeroed MBSpinLock is a valid unlocked one, so this doesn't need
+ * any setup.
+ */
+static struct {
+    MBSpinLock lock;
+    MBLock *live;
+    MBLockProfile *retired;
+    uint numRetired;
+    uint retiredCapacity;
+} gMBLockProfile;
+
+uint64 MBLockProfileNow(void)
+{
+#if defined(MB_LINUX) || defined(MB_MACOS)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#elif defined(MBLOCK_SDL2)
+    return SDL_GetPerformanceCounter() * 1000000000.0 /
+           SDL_GetPerformanceFrequency();
+#endif
+}
+
+static const char *MBLockProfileName(const MBLockProfile *p)
+{
+    return p->name != NULL ? p->name : "(unnamed)";
+}
+
+void MBLockProfileRegister(MBLock *lock)
+{
+    MBUtil_Zero(&lock->profile, sizeof(lock->profile));
+    lock->holdStart = 0;
+    lock->profilePrev = NULL;
+
+    MBSpinLock_Lock(&gMBLockProfile.lock);
+    lock->profileNext = gMBLockProfile.live;
+    if (gMBLockProfile.live != NULL) {
+        gMBLockProfile.live->profilePrev = lock;
+    }
+    gMBLockProfile.live = lock;
+    MBSpinLock_Unlock(&gMBLockProfile.lock);
+}
+
+void MBLockProfileUnregister(MBLock *lock)
+{
+    const char *name = MBLockProfileName(&lock->profile);
+    MBLockProfile *r = NULL;
+
+    MBSpinLock_Lock(&gMBLockProfile.lock);
+
+    if (lock->profilePrev != NULL) {
+        lock->profilePrev->profileNext = lock->profileNext;
+    } else {
+        ASSERT(gMBLockProfile.live == lock);
+        gMBLockProfile.live = lock->profileNext;
+    }
+    if (lock->profileNext != NULL) {
+        lock->profileNext->profilePrev = lock->profilePrev;
+    }
+
+    if (lock->profile.acquires > 0) {
+        for (uint i = 0; i < gMBLockProfile.numRetired; i++) {
+            if (strcmp(gMBLockProfile.retired[i].name, name) == 0) {
+                r = &gMBLockProfile.retired[i];
+                break;
+            }
+        }
+
+        if (r == NULL) {
+            if (gMBLockProfile.numRetired ==
+                gMBLockProfile.retiredCapacity) {
+                gMBLockProfile.retiredCapacity =
+                    MAX(16, gMBLockProfile.retiredCapacity * 2);
+                gMBLockProfile.retired =
+                    realloc(gMBLockProfile.retired,
+                            gMBLockProfile.retiredCapacity *
+                            sizeof(gMBLockProfile.retired[0]));
+                VERIFY(gMBLockProfile.retired != NULL);
+            }
+            r = &gMBLockProfile.retired[gMBLockProfile.numRetired++];
+            MBUtil_Zero(r, sizeof(*r));
+
+            /*
+             * The caller's name can go away with the lock, so the
+             * retired entry keeps its own copy for the rest of the run.
+             */
+            r->name = strdup(name);
+            VERIFY(r->name != NULL);
+        }
+
+        r->acquires += lock->profile.acquires;
+        r->contended += lock->profile.contended;
+        r->waitNS += lock->profile.waitNS;
+        r->maxHoldNS = MAX(r->maxHoldNS, lock->profile.maxHoldNS);
+    }
+
+    MBSpinLock_Unlock(&gMBLockProfile.lock);
+}
+
+bool MBLock_GetProfile(MBLock *lock, MBLockProfile *profile)
+{
+    ASSERT(lock != NULL);
+    ASSERT(profile != NULL);
+
+    *profile = lock->profile;
+    return TRUE;
+}
+
+static int MBLockProfileCompare(const void *lhs, const void *rhs)
+{
+    const MBLockProfile *a = lhs;
+    const MBLockProfile *b = rhs;
+
+    if (a->contended != b->contended) {
+        return a->contended > b->contended ? -1 : 1;
+    }
+    if (a->waitNS != b->waitNS) {
+        return a->waitNS > b->waitNS ? -1 : 1;
+    }
+    if (a->acquires != b->acquires) {
+        return a->acquires > b->acquires ? -1 : 1;
+    }
+    return 0;
+}
+
+void MBLock_ReportProfile(FILE *f, uint maxLocks)
+{
+    MBLockProfile *all;
+    uint numLocks;
+    uint n = 0;
+
+    MBSpinLock_Lock(&gMBLockProfile.lock);
+
+    numLocks = gMBLockProfile.numRetired;
+    for (MBLock *l = gMBLockProfile.live; l != NULL; l = l->profileNext) {
+        numLocks++;
+    }
+
+    all = malloc(MAX(1, numLocks) * sizeof(all[0]));
+    VERIFY(all != NULL);
+
+    /*
+     * Copy the names too: a live lock may be destroyed (and its name
+     * freed) once we drop the profile lock below.
+     */
+    for (uint i = 0; i < gMBLockProfile.numRetired; i++) {
+        all[n] = gMBLockProfile.retired[i];
+        all[n].name = strdup(all[n].name);
+        VERIFY(all[n].name != NULL);
+        n++;
+    }
+    for (MBLock *l = gMBLockProfile.live; l != NULL; l = l->profileNext) {
+        all[n] = l->profile;
+        all[n].name = strdup(MBLockProfileName(&l->profile));
+        VERIFY(all[n].name != NULL);
+        n++;
+    }
+    ASSERT(n == numLocks);
+
+    MBSpinLock_Unlock(&gMBLockProfile.lock);
+
+    qsort(all, numLocks, sizeof(all[0]), MBLockProfileCompare);
+
+    fprintf(f, "%-24s %12s %12s %14s %14s %14s\n", "Lock", "Acquires",
+            "Contended", "Wait (us)", "Avg wait (us)", "Max hold (us)");
+    for (uint i = 0; i < numLocks && i < maxLocks; i++) {
+        MBLockProfile *p = &all[i];
+        uint64 avgWait = p->contended > 0 ? p->waitNS / p->contended : 0;
+
+        fprintf(f, "%-24s %12llu %12llu %14llu %14llu %14llu\n",
+                p->name, (unsigned long long)p->acquires,
+                (unsigned long long)p->contended,
+                (unsigned long long)(p->waitNS / 1000),
+                (unsigned long long)(avgWait / 1000),
+                (unsigned long long)(p->maxHoldNS / 1000));
+    }
+
+    for (uint i = 0; i < numLocks; i++) {
+        free((char *)all[i].name);
+    }
+    free(all);
+}
+
+#else
+
+#ifdef MB_HAS_MBLOCK
+bool MBLock_GetProfile(MBLock *lock, MBLockProfile *profile)
+{
+    return FALSE;
+}
+#endif
+
+void MBLock_ReportProfile(FILE *f, uint maxLocks)
+{
+    fprintf(f, "Lock profiling isn't enabled (MB_LOCK_PROFILE).\n");
+}
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * MBNumeric.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+
+#include "MBNumeric.h"
+#include "MBAssert.h"
+
+/*
+ * The loops below work on blocks of MBNUMERIC_LANES items with a
+ * fixed-size inner loop, which the compiler turns into vector code
+ * even at the cheaper -O2 vectorizer settings.  Anything left over
+ * is done one at a time.
+ *
+ * On x86_64 Linux, target_clones builds an AVX2 copy of each kernel
+ * alongside the baseline (SSE2) one, and the dynamic linker picks
+ * between them once at startup.
+ */
+#define MBNUMERIC_LANES 16
+
+#if defined(__GNUC__) && !defined(__clang__) && \
+    defined(ARCH_AMD64) && defined(MB_LINUX)
+#define MBNUMERIC_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define MBNUMERIC_KERNEL
+#endif
+
+MBNUMERIC_KERNEL
+int64 MBNumeric_SumInt32(const int32 *items, int64 numItems)
+{
+    int64 acc[MBNUMERIC_LANES] = { 0 };
+    int64 sum = 0;
+    int64 i = 0;
+
+    ASSERT(numItems >= 0);
+
+    for (; i + MBNUMERIC_LANES <= numItems; i += MBNUMERIC_LANES) {
+        for (int l = 0; l < MBNUMERIC_LANES; l++) {
+            acc[l] += items[i + l];
+        }
+    }
+    for (; i < numItems; i++) {
+        sum += items[i];
+    }
+    for (int l = 0; l < MBNUMERIC_LANES; l++) {
+        sum += acc[l];
+    }
+    return sum;
+}
+
+MBNUMERIC_KERNEL
+double MBNumeric_SumFloat(const float *items, int64 numItems)
+{
+    double acc[MBNUMERIC_LANES] = { 0 };
+    double sum = 0;
+    int64 i = 0;
+
+    ASSERT(numItems >= 0);
+
+    for (; i + MBNUMERIC_LANES <= numItems; i += MBNUMERIC_LANES) {
+        for (int l = 0; l < MBNUMERIC_LANES; l++) {
+            acc[l] += items[i + l];
+        }
+    }
+    for (int l = 0; l < MBNUMERIC_LANES; l++) {
+        sum += acc[l];
+    }
+    for (; i < numItems; i++) {
+        sum += items[i];
+    }
+    return sum;
+}
+
+MBNUMERIC_KERNEL
+int64 MBNumeric_FindInt32(const int32 *items, int64 numItems, int32 value)
+{
+    int64 i = 0;
+
+    ASSERT(numItems >= 0);
+
+    /*
+     * Check a whole block at once, and only look for the exact
+     * index once we know it's in there.
+     */
+    for (; i + MBNUMERIC_LANES <= numItems; i += MBNUMERIC_LANES) {
+        int32 hit = 0;
+        for (int l = 0; l < MBNUMERIC_LANES; l++) {
+            hit |= (items[i + l] == value);
+        }
+        if (hit) {
+            break;
+        }
+    }
+    for (; i < numItems; i++) {
+        if (items[i] == value) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+MBNUMERIC_KERNEL
+int64 MBNumeric_CountInt32(const int32 *items, int64 numItems, int32 value)
+{
+    int32 acc[MBNUMERIC_LANES] = { 0 };
+    int64 count = 0;
+    int64 i = 0;
+
+    ASSERT(numItems >= 0);
+
+    /*
+     * Flush the lane counters before they can overflow.
+     */
+    while (i + MBNUMERIC_LANES <= numItems) {
+        int64 blockEnd = MIN(numItems, i + (int64)MAX_INT32);
+        for (; i + MBNUMERIC_LANES <= blockEnd; i += MBNUMERIC_LANES) {
+            for (int l = 0; l < MBNUMERIC_LANES; l++) {
+                acc[l] += (items[i + l] == value);
+            }
+        }
+        for (int l = 0; l < MBNUMERIC_LANES; l++) {
+            count += acc[l];
+            acc[l] = 0;
+        }
+    }
+    for (; i < numItems; i++) {
+        count += (items[i] == value);
+    }
+    return count;
+}
+
+/*
+ * Find the extreme value lane-wise, and then go back for the first
+ * index that has it.
+ */
+#define MBNUMERIC_DEFINE_MINMAX(_name, _type, _better, _init)             \
+    MBNUMERIC_KERNEL                                                      \
+    int64 _name(const _type *items, int64 numItems)                      \
+    {                                                                     \
+        _type acc[MBNUMERIC_LANES];                                       \
+        _type best = (_init);                                             \
+        int64 i = 0;                                                      \
+                                                                          \
+        ASSERT(numItems >= 0);                                            \
+        if (numItems == 0) {                                              \
+            return -1;                                                    \
+        }                                                                 \
+                                                                          \
+        for (int l = 0; l < MBNUMERIC_LANES; l++) {                       \
+            acc[l] = (_init);                                             \
+        }                                                                 \
+        for (; i + MBNUMERIC_LANES <= numItems; i += MBNUMERIC_LANES) {   \
+            for (int l = 0; l < MBNUMERIC_LANES; l++) {                   \
+                _type x = items[i + l];                                   \
+                acc[l] = _better(x, acc[l]) ? x : acc[l];                 \
+            }                                                             \
+        }                                                                 \
+        for (int l = 0; l < MBNUMERIC_LANES; l++) {                       \
+            best = _better(acc[l], best) ? acc[l] : best;                 \
+        }                                                                 \
+        for (; i < numItems; i++) {                                       \
+            best = _better(items[i], best) ? items[i] : best;             \
+        }                                                                 \
+                                                                          \
+        for (i = 0; i < numItems; i++) {                                  \
+            if (items[i] == best) {                                       \
+                return i;                                                 \
+            }                                                             \
+        }                                                                 \
+                                                                          \
+        /* Only reachable for floats if everything is NaN. */            \
+        return 0;                                                         \
+    }
+
+#define MBNUMERIC_LESS(_a, _b) ((_a) < (_b))
+#define MBNUMERIC_GREATER(_a, _b) ((_a) > (_b))
+
+MBNUMERIC_DEFINE_MINMAX(MBNumeric_MinInt32, int32, MBNUMERIC_LESS, MAX_INT32)
+MBNUMERIC_DEFINE_MINMAX(MBNumeric_MaxInt32, int32, MBNUMERIC_GREATER, MIN_INT32)
+MBNUMERIC_DEFINE_MINMAX(MBNumeric_MinFloat, float, MBNUMERIC_LESS, INFINITY)
+MBNUMERIC_DEFINE_MINMAX(MBNumeric_MaxFloat, float, MBNUMERIC_GREATER, -INFINITY)
+
+MBNUMERIC_KERNEL
+void MBNumeric_FillInt32(int32 *items, int64 numItems, int32 value)
+{
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        items[i] = value;
+    }
+}
+
+MBNUMERIC_KERNEL
+void MBNumeric_FillFloat(float *items, int64 numItems, float value)
+{
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        items[i] = value;
+    }
+}
+
+MBNUMERIC_KERNEL
+void MBNumeric_AddInt32(int32 *dest, const int32 *src, int64 numItems)
+{
+    uint32 *udest = (uint32 *)dest;
+    const uint32 *usrc = (const uint32 *)src;
+
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        udest[i] += usrc[i];
+    }
+}
+
+MBNUMERIC_KERNEL
+void MBNumeric_AddFloat(float *dest, const float *src, int64 numItems)
+{
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        dest[i] += src[i];
+    }
+}
+
+MBNUMERIC_KERNEL
+void MBNumeric_ScaleInt32(int32 *items, int64 numItems,
+                          int32 scale, int32 offset)
+{
+    uint32 *uitems = (uint32 *)items;
+
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        uitems[i] = uitems[i] * (uint32)scale + (uint32)offset;
+    }
+}
+
+MBNUMERIC_KERNEL
+void MBNumeric_ScaleFloat(float *items, int64 numItems,
+                          float scale, float offset)
+{
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        items[i] = items[i] * scale + offset;
+    }
+}
+
+/*
+ * The prefix sums are a serial dependency chain, so there isn't much
+ * for the vector units to do here.
+ */
+void MBNumeric_PrefixSumInt32(int32 *items, int64 numItems)
+{
+    uint32 *uitems = (uint32 *)items;
+    uint32 sum = 0;
+
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        sum += uitems[i];
+        uitems[i] = sum;
+    }
+}
+
+void MBNumeric_PrefixSumFloat(float *items, int64 numItems)
+{
+    float sum = 0;
+
+    ASSERT(numItems >= 0);
+    for (int64 i = 0; i < numItems; i++) {
+        sum += items[i];
+        items[i] = sum;
+    }
+}
@@ -287,7 +287,8 @@ void MBOpt_PrintMBLibVersion(void)
 
     Warning("\tMBLib version %s\n", MBLIB_VERSION_STRING);
     Warning("\tMB_DEBUG=%d, MB_DEVEL=%d\n", mb_debug, mb_devel);
-    Warning("\tMB_HAS_SDL2=%d\n", mb_has_sdl2);
+    Warning("\tMB_HAS_SDL2=%d, MB_LOCK_PROFILE=%d\n", mb_has_sdl2,
+            mb_lock_profile);
     Warning("\n");
 }
 
@@ -0,0 +1,251 @@
+/*
+ * MBParallel.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "MBParallel.h"
+#include "MBAtomic.h"
+#include "MBUtil.h"
+
+/*
+ * Accumulators for the pieces a task splits off are kept on its stack
+ * when they fit.
+ */
+#define MBPARALLEL_STACK_ACCUM_BYTES 256
+#define MBPARALLEL_ACCUM_ALIGN       16
+
+typedef struct MBParallelJob {
+    MBThreadPool *pool;
+    int64 grain;
+    MBParallelForFn forFn;
+    MBParallelReduceFn reduceFn;
+    MBParallelCombineFn combineFn;
+    void *ctx;
+    const void *identity;
+    uint32 resultSize;
+    uint32 accumStride;
+} MBParallelJob;
+
+typedef struct MBParallelPiece {
+    MBParallelJob *job;
+    int64 start;
+    int64 end;
+    void *accum;
+} MBParallelPiece;
+
+static MBAtomicPtr gMBParallelPool;
+
+void MBParallel_Init(uint numWorkers)
+{
+    MBThreadPool *pool = MBThreadPool_Create(numWorkers);
+    void *expected = NULL;
+
+    VERIFY(MBAtomic_CompareExchangePtr(&gMBParallelPool, &expected, pool,
+                                       MB_ATOMIC_RELEASE));
+}
+
+void MBParallel_Exit(void)
+{
+    MBThreadPool *pool = MBAtomic_ExchangePtr(&gMBParallelPool, NULL,
+                                              MB_ATOMIC_ACQUIRE);
+    if (pool != NULL) {
+        MBThreadPool_Destroy(pool);
+    }
+}
+
+MBThreadPool *MBParallel_GetPool(void)
+{
+    MBThreadPool *pool = MBAtomic_LoadPtr(&gMBParallelPool,
+                                          MB_ATOMIC_ACQUIRE);
+    void *expected = NULL;
+
+    if (LIKELY(pool != NULL)) {
+        return pool;
+    }
+
+    /*
+     * If another thread got there first, use its pool instead.
+     */
+    pool = MBThreadPool_Create(0);
+    if (!MBAtomic_CompareExchangePtr(&gMBParallelPool, &expected, pool,
+                                     MB_ATOMIC_ACQ_REL)) {
+        MBThreadPool_Destroy(pool);
+        pool = expected;
+    }
+    return pool;
+}
+
+static void MBParallelRunPiece(void *data)
+{
+    MBParallelPiece *piece = data;
+    MBParallelJob *job = piece->job;
+    MBParallelPiece right[64];
+    uint8 stackAccums[MBPARALLEL_STACK_ACCUM_BYTES]
+        __attribute__((aligned(MBPARALLEL_ACCUM_ALIGN)));
+    uint8 *accums = NULL;
+    MBThreadPoolCounter counter;
+    int64 start = piece->start;
+    int64 end = piece->end;
+    uint numSplits = 0;
+
+    if (job->reduceFn != NULL && end - start > job->grain) {
+        uint64 size = job->accumStride;
+
+        for (int64 n = end - start; n > job->grain; n /= 2) {
+            numSplits++;
+        }
+        size *= numSplits;
+        accums = size <= sizeof(stackAccums) ? stackAccums : malloc(size);
+        VERIFY(accums != NULL);
+        numSplits = 0;
+    }
+
+    /*
+     * Hand off the right half until what's left is small enough, so
+     * the biggest pieces are the ones available to steal.
+     */
+    MBThreadPoolCounter_Create(&counter);
+    while (end - start > job->grain) {
+        int64 mid = start + (end - start) / 2;
+        MBParallelPiece *r = &right[numSplits];
+
+        ASSERT(numSplits < ARRAYSIZE(right));
+        r->job = job;
+        r->start = mid;
+        r->end = end;
+        r->accum = NULL;
+        if (accums != NULL) {
+            r->accum = accums + numSplits * job->accumStride;
+            memcpy(r->accum, job->identity, job->resultSize);
+        }
+        numSplits++;
+        MBThreadPool_Submit(job->pool, &counter, MBParallelRunPiece, r);
+        end = mid;
+    }
+
+    if (job->reduceFn != NULL) {
+        job->reduceFn(job->ctx, start, end, piece->accum);
+    } else {
+        job->forFn(job->ctx, start, end);
+    }
+
+    if (numSplits == 0) {
+        return;
+    }
+
+    MBThreadPool_Wait(job->pool, &counter);
+
+    if (job->reduceFn != NULL) {
+        /*
+         * The last piece split off is the one right next to ours.
+         */
+        for (uint i = numSplits; i-- > 0;) {
+            job->combineFn(job->ctx, piece->accum, right[i].accum);
+        }
+        if (accums != stackAccums) {
+            free(accums);
+        }
+    }
+}
+
+static void MBParallelRun(MBParallelJob *job, int64 start, int64 end,
+                          int64 grain, void *result)
+{
+    MBParallelPiece piece;
+    int64 numItems = end - start;
+
+    ASSERT(grain >= 0);
+
+    if (numItems <= 0) {
+        return;
+    }
+
+    job->pool = MBParallel_GetPool();
+    if (grain == 0) {
+        int64 numChunks = MBPARALLEL_CHUNKS_PER_THREAD *
+                          (MBThreadPool_GetNumWorkers(job->pool) + 1);
+        grain = (numItems + numChunks - 1) / numChunks;
+    }
+    job->grain = grain;
+
+    piece.job = job;
+    piece.start = start;
+    piece.end = end;
+    piece.accum = result;
+    MBParallelRunPiece(&piece);
+}
+
+void MBParallel_For(int64 start, int64 end, int64 grain,
+                    MBParallelForFn fn, void *ctx)
+{
+    MBParallelJob job;
+
+    ASSERT(fn != NULL);
+
+    MBUtil_Zero(&job, sizeof(job));
+    job.forFn = fn;
+    job.ctx = ctx;
+    MBParallelRun(&job, start, end, grain, NULL);
+}
+
+void MBParallel_Reduce(int64 start, int64 end, int64 grain,
+                       MBParallelReduceFn reduceFn,
+                       MBParallelCombineFn combineFn,
+                       void *ctx, void *result, uint32 resultSize)
+{
+    MBParallelJob job;
+    uint64 identity[MBPARALLEL_STACK_ACCUM_BYTES / sizeof(uint64)];
+    void *identityCopy = identity;
+
+    ASSERT(reduceFn != NULL);
+    ASSERT(combineFn != NULL);
+    ASSERT(result != NULL);
+    ASSERT(resultSize > 0);
+
+    /*
+     * The first piece accumulates straight into result, so every other
+     * piece starts from a copy of the identity.
+     */
+    if (resultSize > sizeof(identity)) {
+        identityCopy = malloc(resultSize);
+        VERIFY(identityCopy != NULL);
+    }
+    memcpy(identityCopy, result, resultSize);
+
+    MBUtil_Zero(&job, sizeof(job));
+    job.reduceFn = reduceFn;
+    job.combineFn = combineFn;
+    job.ctx = ctx;
+    job.identity = identityCopy;
+    job.resultSize = resultSize;
+    job.accumStride = (resultSize + MBPARALLEL_ACCUM_ALIGN - 1) &
+                      ~(MBPARALLEL_ACCUM_ALIGN - 1);
+    MBParallelRun(&job, start, end, grain, result);
+
+    if (identityCopy != identity) {
+        free(identityCopy);
+    }
+}
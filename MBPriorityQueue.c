@@ -0,0 +1,379 @@
+/*
+ * MBPriorityQueue.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "MBPriorityQueue.h"
+
+#define PQ_ITEM(_pq, _i) \
+    ((uint8 *)(_pq)->v.items + (uint64)(_i) * (_pq)->v.itemSize)
+#define PQ_LESS(_pq, _lhs, _rhs) \
+    ((_pq)->comp.compareFn((_lhs), (_rhs), (_pq)->comp.cbData) < 0)
+
+void CMBPriorityQueue_CreateWithArity(CMBPriorityQueue *pq,
+                                      const CMBComparator *comp,
+                                      uint32 arity)
+{
+    ASSERT(pq != NULL);
+    ASSERT(comp != NULL);
+    ASSERT(comp->itemSize > 0);
+    ASSERT(arity >= 2);
+
+    CMBVector_CreateEmpty(&pq->v, comp->itemSize);
+    pq->comp = *comp;
+    pq->arity = arity;
+}
+
+/*
+ * Move the value at *item down from the hole at index i, until it's no
+ * bigger than any of its children, among the first size items.
+ *
+ * item must not be any of the slots the hole passes through.
+ */
+static void
+MBPriorityQueueSiftDown(CMBPriorityQueue *pq, int64 i, int64 size,
+                        const void *item)
+{
+    uint32 itemSize = pq->v.itemSize;
+    uint32 arity = pq->arity;
+
+    while (TRUE) {
+        int64 first = i * arity + 1;
+        int64 last;
+        int64 best;
+
+        if (first >= size) {
+            break;
+        }
+
+        last = MIN(first + arity, size);
+        best = first;
+        for (int64 c = first + 1; c < last; c++) {
+            if (PQ_LESS(pq, PQ_ITEM(pq, c), PQ_ITEM(pq, best))) {
+                best = c;
+            }
+        }
+
+        if (!PQ_LESS(pq, PQ_ITEM(pq, best), item)) {
+            break;
+        }
+
+        memcpy(PQ_ITEM(pq, i), PQ_ITEM(pq, best), itemSize);
+        i = best;
+    }
+
+    memcpy(PQ_ITEM(pq, i), item, itemSize);
+}
+
+void CMBPriorityQueue_CreateFromVector(CMBPriorityQueue *pq,
+                                       CMBVector *src,
+                                       const CMBComparator *comp,
+                                       uint32 arity)
+{
+    int64 size;
+
+    ASSERT(src != NULL);
+    ASSERT(CMBVector_ItemSize(src) == comp->itemSize);
+
+    CMBPriorityQueue_CreateWithArity(pq, comp, arity);
+    CMBVector_Consume(&pq->v, src);
+
+    size = CMBVector_Size(&pq->v);
+    if (size <= 1) {
+        return;
+    }
+
+    /*
+     * Use the slot just past the end to hold the item being sifted.
+     */
+    CMBVector_EnsureCapacity(&pq->v, size + 1);
+    for (int64 i = (size - 2) / arity + 1; i > 0; i--) {
+        memcpy(PQ_ITEM(pq, size), PQ_ITEM(pq, i - 1), pq->v.itemSize);
+        MBPriorityQueueSiftDown(pq, i - 1, size, PQ_ITEM(pq, size));
+    }
+}
+
+void CMBPriorityQueue_Push(CMBPriorityQueue *pq, const void *item)
+{
+    uint32 itemSize = pq->v.itemSize;
+    int64 i;
+
+    ASSERT(item != NULL);
+
+    i = CMBVector_Size(&pq->v);
+    ASSERT((const uint8 *)item < PQ_ITEM(pq, 0) ||
+           (const uint8 *)item >= PQ_ITEM(pq, i));
+    CMBVector_Grow(&pq->v);
+
+    /*
+     * Slide parents down into the hole until we find where the new
+     * item goes.
+     */
+    while (i > 0) {
+        int64 parent = (i - 1) / pq->arity;
+        if (!PQ_LESS(pq, item, PQ_ITEM(pq, parent))) {
+            break;
+        }
+        memcpy(PQ_ITEM(pq, i), PQ_ITEM(pq, parent), itemSize);
+        i = parent;
+    }
+
+    memcpy(PQ_ITEM(pq, i), item, itemSize);
+}
+
+void CMBPriorityQueue_Pop(CMBPriorityQueue *pq, void *item)
+{
+    int64 size = CMBVector_Size(&pq->v);
+
+    ASSERT(size > 0);
+
+    if (item != NULL) {
+        memcpy(item, PQ_ITEM(pq, 0), pq->v.itemSize);
+    }
+
+    /*
+     * Sift the last item down from the root.  It stays put in its old
+     * slot until we're done, since the hole never reaches it.
+     */
+    if (size > 1) {
+        MBPriorityQueueSiftDown(pq, 0, size - 1, PQ_ITEM(pq, size - 1));
+    }
+    CMBVector_Shrink(&pq->v);
+}
+
+void CMBIndexedHeap_CreateWithArity(CMBIndexedHeap *h, uint32 arity)
+{
+    ASSERT(h != NULL);
+    ASSERT(arity >= 2);
+
+    CMBIndexedHeapVec_CreateEmpty(&h->heap);
+    CMBIntVec_CreateEmpty(&h->position);
+    h->arity = arity;
+}
+
+void CMBIndexedHeap_Destroy(CMBIndexedHeap *h)
+{
+    ASSERT(h != NULL);
+    CMBIndexedHeapVec_Destroy(&h->heap);
+    CMBIntVec_Destroy(&h->position);
+}
+
+void CMBIndexedHeap_MakeEmpty(CMBIndexedHeap *h)
+{
+    int64 size = CMBIndexedHeap_Size(h);
+    CMBIndexedHeapEntry *heap = CMBIndexedHeapVec_GetCArray(&h->heap);
+    int *position = CMBIntVec_GetCArray(&h->position);
+
+    /*
+     * Only reset the ids that are actually in the heap, so this is
+     * O(size) instead of O(max id).
+     */
+    for (int64 i = 0; i < size; i++) {
+        position[heap[i].id] = -1;
+    }
+    CMBIndexedHeapVec_MakeEmpty(&h->heap);
+}
+
+double CMBIndexedHeap_GetKey(const CMBIndexedHeap *h, int id)
+{
+    ASSERT(CMBIndexedHeap_Contains(h, id));
+    int64 i = CMBIntVec_GetValue(&h->position, id);
+    return CMBIndexedHeapVec_GetValue(&h->heap, i).key;
+}
+
+/*
+ * Move entry e up from the hole at index i, and store it where it
+ * lands.
+ */
+static void
+MBIndexedHeapSiftUp(CMBIndexedHeap *h, int64 i, CMBIndexedHeapEntry e)
+{
+    CMBIndexedHeapEntry *heap = CMBIndexedHeapVec_GetCArray(&h->heap);
+    int *position = CMBIntVec_GetCArray(&h->position);
+
+    while (i > 0) {
+        int64 parent = (i - 1) / h->arity;
+        if (!(e.key < heap[parent].key)) {
+            break;
+        }
+        heap[i] = heap[parent];
+        position[heap[i].id] = i;
+        i = parent;
+    }
+
+    heap[i] = e;
+    position[e.id] = i;
+}
+
+static void
+MBIndexedHeapSiftDown(CMBIndexedHeap *h, int64 i, CMBIndexedHeapEntry e)
+{
+    CMBIndexedHeapEntry *heap = CMBIndexedHeapVec_GetCArray(&h->heap);
+    int *position = CMBIntVec_GetCArray(&h->position);
+    int64 size = CMBIndexedHeap_Size(h);
+    uint32 arity = h->arity;
+
+    while (TRUE) {
+        int64 first = i * arity + 1;
+        int64 last;
+        int64 best;
+
+        if (first >= size) {
+            break;
+        }
+
+        last = MIN(first + arity, size);
+        best = first;
+        for (int64 c = first + 1; c < last; c++) {
+            if (heap[c].key < heap[best].key) {
+                best = c;
+            }
+        }
+
+        if (!(heap[best].key < e.key)) {
+            break;
+        }
+
+        heap[i] = heap[best];
+        position[heap[i].id] = i;
+        i = best;
+    }
+
+    heap[i] = e;
+    position[e.id] = i;
+}
+
+void CMBIndexedHeap_Push(CMBIndexedHeap *h, int id, double key)
+{
+    CMBIndexedHeapEntry e;
+    int64 oldSize;
+
+    ASSERT(id >= 0);
+    ASSERT(!CMBIndexedHeap_Contains(h, id));
+
+    oldSize = CMBIntVec_Size(&h->position);
+    if (id >= oldSize) {
+        CMBIntVec_Resize(&h->position, MAX(id + 1, oldSize * 2));
+        int *position = CMBIntVec_GetCArray(&h->position);
+        for (int64 i = oldSize; i < CMBIntVec_Size(&h->position); i++) {
+            position[i] = -1;
+        }
+    }
+
+    e.key = key;
+    e.id = id;
+    CMBIndexedHeapVec_Grow(&h->heap);
+    MBIndexedHeapSiftUp(h, CMBIndexedHeap_Size(h) - 1, e);
+}
+
+void CMBIndexedHeap_DecreaseKey(CMBIndexedHeap *h, int id, double key)
+{
+    CMBIndexedHeapEntry e;
+    int64 i;
+
+    ASSERT(CMBIndexedHeap_Contains(h, id));
+    i = CMBIntVec_GetValue(&h->position, id);
+    ASSERT(!(CMBIndexedHeapVec_GetPtr(&h->heap, i)->key < key));
+
+    e.key = key;
+    e.id = id;
+    MBIndexedHeapSiftUp(h, i, e);
+}
+
+void CMBIndexedHeap_IncreaseKey(CMBIndexedHeap *h, int id, double key)
+{
+    CMBIndexedHeapEntry e;
+    int64 i;
+
+    ASSERT(CMBIndexedHeap_Contains(h, id));
+    i = CMBIntVec_GetValue(&h->position, id);
+    ASSERT(!(key < CMBIndexedHeapVec_GetPtr(&h->heap, i)->key));
+
+    e.key = key;
+    e.id = id;
+    MBIndexedHeapSiftDown(h, i, e);
+}
+
+void CMBIndexedHeap_UpdateKey(CMBIndexedHeap *h, int id, double key)
+{
+    if (key < CMBIndexedHeap_GetKey(h, id)) {
+        CMBIndexedHeap_DecreaseKey(h, id, key);
+    } else {
+        CMBIndexedHeap_IncreaseKey(h, id, key);
+    }
+}
+
+bool CMBIndexedHeap_PushOrDecrease(CMBIndexedHeap *h, int id, double key)
+{
+    if (!CMBIndexedHeap_Contains(h, id)) {
+        CMBIndexedHeap_Push(h, id, key);
+        return TRUE;
+    } else if (key < CMBIndexedHeap_GetKey(h, id)) {
+        CMBIndexedHeap_DecreaseKey(h, id, key);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void CMBIndexedHeap_Remove(CMBIndexedHeap *h, int id)
+{
+    CMBIndexedHeapEntry last;
+    int64 i;
+
+    ASSERT(CMBIndexedHeap_Contains(h, id));
+    i = CMBIntVec_GetValue(&h->position, id);
+    last = *CMBIndexedHeapVec_GetLastPtr(&h->heap);
+
+    CMBIntVec_PutValue(&h->position, id, -1);
+    CMBIndexedHeapVec_Shrink(&h->heap);
+
+    /*
+     * Put the last entry in the hole, and move it whichever way it
+     * needs to go.
+     */
+    if (i < CMBIndexedHeap_Size(h)) {
+        CMBIndexedHeapEntry *heap = CMBIndexedHeapVec_GetCArray(&h->heap);
+        int64 parent = (i - 1) / h->arity;
+        if (i > 0 && last.key < heap[parent].key) {
+            MBIndexedHeapSiftUp(h, i, last);
+        } else {
+            MBIndexedHeapSiftDown(h, i, last);
+        }
+    }
+}
+
+int CMBIndexedHeap_Pop(CMBIndexedHeap *h, double *key)
+{
+    CMBIndexedHeapEntry top;
+
+    ASSERT(!CMBIndexedHeap_IsEmpty(h));
+    top = *CMBIndexedHeapVec_GetPtr(&h->heap, 0);
+
+    if (key != NULL) {
+        *key = top.key;
+    }
+    CMBIndexedHeap_Remove(h, top.id);
+    return top.id;
+}
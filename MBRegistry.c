@@ -43,6 +43,7 @@ typedef struct MBRegistry {
     CMBVector data[BUCKETS];
     MBStrTable *backingTable;
     bool ownTable;
+    const CMBAllocator *allocator;
 } MBRegistry;
 
 typedef struct MBRegistryNode {
@@ -65,33 +66,42 @@ static inline uint8 MBRegistryHashString(const char *str) {
            ((h >> 24) & 0xFF);
 }
 
-static void MBRegistryAddToTable(MBRegistry *mreg, char *s);
 static const char *MBRegistryDupToTable(MBRegistry *mreg, const char *s);
 
 MBRegistry *MBRegistry_Alloc()
 {
-    MBRegistry *mreg = MBUtil_ZAlloc(sizeof(*mreg));
-    ASSERT(mreg != NULL);
+    return MBRegistry_AllocWithAllocator(NULL);
+}
+
+MBRegistry *MBRegistry_AllocWithAllocator(const CMBAllocator *alloc)
+{
+    MBRegistry *mreg = MBAlloc_Alloc(alloc, sizeof(*mreg));
+    VERIFY(mreg != NULL);
+    MBUtil_Zero(mreg, sizeof(*mreg));
     DEBUG_ONLY(
         mreg->magic = ((uintptr_t)mreg) ^ MBREGISTRY_MAGIC;
     );
 
     for (uint b = 0; b < ARRAYSIZE(mreg->data); b++) {
-        CMBVector_CreateEmpty(&mreg->data[b], sizeof(MBRegistryNode));
+        CMBVector_CreateWithAllocator(&mreg->data[b], sizeof(MBRegistryNode),
+                                      0, 1, alloc);
     }
     mreg->backingTable = NULL;
     mreg->ownTable = FALSE;
+    mreg->allocator = alloc;
     return mreg;
 }
 
 MBRegistry *MBRegistry_AllocCopy(MBRegistry *toCopy)
 {
-    MBRegistry *mreg = MBRegistry_Alloc();
+    MBRegistry *mreg;
 
     if (toCopy == NULL) {
-        return mreg;
+        return MBRegistry_Alloc();
     }
 
+    mreg = MBRegistry_AllocWithAllocator(toCopy->allocator);
+
     ASSERT(mreg->magic == ((uintptr_t)mreg ^ MBREGISTRY_MAGIC));
     ASSERT(toCopy->magic == ((uintptr_t)toCopy ^ MBREGISTRY_MAGIC));
 
@@ -129,7 +139,7 @@ void MBRegistry_Free(MBRegistry *mreg)
         MBStrTable_Unreference(mreg->backingTable);
     }
 
-    free(mreg);
+    MBAlloc_Free(mreg->allocator, mreg, sizeof(*mreg));
 }
 
 bool MBRegistry_ContainsKey(MBRegistry *mreg, const char *key)
@@ -282,10 +292,10 @@ static void MBRegistryAllocTable(MBRegistry *mreg)
     /*
      * We defer the creation of our own table until first use.
      * It's safe to interact with the parent table because the MBStrTable
-     * reference counts only use global locks.
+     * reference counts are atomic.
      */
     if (mreg->backingTable == NULL) {
-        mreg->backingTable = MBStrTable_Alloc();
+        mreg->backingTable = MBStrTable_AllocWithAllocator(mreg->allocator);
         mreg->ownTable = TRUE;
     } else if (!mreg->ownTable) {
         MBStrTable *parent = mreg->backingTable;
@@ -295,12 +305,6 @@ static void MBRegistryAllocTable(MBRegistry *mreg)
     }
 }
 
-static void MBRegistryAddToTable(MBRegistry *mreg, char *s)
-{
-    MBRegistryAllocTable(mreg);
-    MBStrTable_AddFree(mreg->backingTable, s);
-}
-
 static const char *MBRegistryDupToTable(MBRegistry *mreg, const char *s)
 {
     MBRegistryAllocTable(mreg);
@@ -386,11 +390,13 @@ MBRegistryLoad(MBRegistry *mreg, const char *filename,
             MBString_Truncate(&value, 1, length - 2);
         }
 
-        char *ckey = MBString_DupCStr(&key);
-        char *cvalue = MBString_DupCStr(&value);
-
-        MBRegistryAddToTable(mreg, ckey);
-        MBRegistryAddToTable(mreg, cvalue);
+        /*
+         * Copy straight into the table, so the strings come from its
+         * allocator.
+         */
+        const char *ckey = MBRegistryDupToTable(mreg, MBString_GetCStr(&key));
+        const char *cvalue =
+            MBRegistryDupToTable(mreg, MBString_GetCStr(&value));
 
         if (subset) {
             ASSERT(MBRegistry_ContainsKey(mreg, ckey));
@@ -27,38 +27,38 @@
 
 void MBRingResizeHelper(MBRing *ring)
 {
-    int oldRSize = MBRing_Size(ring);
+    int64 oldRSize = MBRing_Size(ring);
     ASSERT(oldRSize > 0);
 
     CMBVector v;
     int itemSize = CMBVector_ItemSize(&ring->vector);
     CMBVector_CreateEmpty(&v, itemSize);
     CMBVector_Consume(&v, &ring->vector);
-    int size = CMBVector_Size(&v);
+    int64 size = CMBVector_Size(&v);
     ASSERT(size > 0);
     ASSERT(size * 2 > size);
     CMBVector_Resize(&ring->vector, size * 2);
 
     if (ring->tail >= ring->head) {
-        int numItems = ring->tail - ring->head;
+        int64 numItems = ring->tail - ring->head;
         ASSERT(numItems > 0);
-        int memSize = numItems * itemSize;
+        int64 memSize = numItems * itemSize;
         ASSERT(memSize > 0);
         ASSERT(memSize >= numItems);
         ASSERT(memSize >= itemSize);
         memcpy(CMBVector_GetPtr(&ring->vector, 0),
                 CMBVector_GetPtr(&v, ring->head), memSize);
     } else {
-        int numItems = size - ring->head;
+        int64 numItems = size - ring->head;
         ASSERT(numItems > 0);
-        int memSize = numItems * itemSize;
+        int64 memSize = numItems * itemSize;
         ASSERT(memSize > 0);
         ASSERT(memSize >= numItems);
         ASSERT(memSize >= itemSize);
         memcpy(CMBVector_GetPtr(&ring->vector, 0),
                 CMBVector_GetPtr(&v, ring->head), memSize);
 
-        int firstItems = numItems;
+        int64 firstItems = numItems;
         numItems = ring->tail;
         if (numItems > 0) {
             memSize = numItems * itemSize;
@@ -25,69 +25,51 @@
 
 #include <stdint.h>
 #include "MBStrTable.h"
-#include "MBLock.h"
+#include "MBAtomic.h"
 
 #define MBSTRTABLE_MAGIC 0x1874919423812155
 
+/*
+ * Child tables hold a reference on their parent, so the parent's
+ * strings stay around as long as any child does.
+ */
 typedef struct MBStrTable {
     DEBUG_ONLY(
         uint64 magic;
     );
 
-    uint referenceCount;
+    MBAtomic32 referenceCount;
     MBStrTable *parent;
-    bool everHadReference;
+    const CMBAllocator *allocator;
     CMBCStrVec strings;
 } MBStrTable;
 
-struct {
-    MBLock lock;
-    bool lockInitialized;
-} gMBStrTableData;
-
+/*
+ * The reference counts are atomic, so there's no global state left to
+ * set up.
+ */
 void MBStrTable_Init()
 {
-    if (!mb_lock) {
-        ASSERT(!gMBStrTableData.lockInitialized);
-    } else {
-        MBLock_Create(&gMBStrTableData.lock);
-        gMBStrTableData.lockInitialized = TRUE;
-    }
 }
 
 void MBStrTable_Exit()
 {
-    if (!mb_lock) {
-        ASSERT(!gMBStrTableData.lockInitialized);
-    } else {
-        ASSERT(gMBStrTableData.lockInitialized);
-        MBLock_Destroy(&gMBStrTableData.lock);
-        gMBStrTableData.lockInitialized = FALSE;
-    }
 }
 
-static void MBStrTableLock()
-{
-    if (mb_lock) {
-        ASSERT(gMBStrTableData.lockInitialized);
-        MBLock_Lock(&gMBStrTableData.lock);
-    }
-}
-
-static void MBStrTableUnlock()
+MBStrTable *MBStrTable_Alloc()
 {
-    if (mb_lock) {
-        ASSERT(gMBStrTableData.lockInitialized);
-        MBLock_Unlock(&gMBStrTableData.lock);
-    }
+    return MBStrTable_AllocWithAllocator(NULL);
 }
 
-MBStrTable *MBStrTable_Alloc()
+MBStrTable *MBStrTable_AllocWithAllocator(const CMBAllocator *alloc)
 {
     MBStrTable *st;
-    st = MBUtil_ZAlloc(sizeof(*st));
-    CMBCStrVec_CreateEmpty(&st->strings);
-    st->referenceCount = 1;
+    st = MBAlloc_Alloc(alloc, sizeof(*st));
+    VERIFY(st != NULL);
+    MBUtil_Zero(st, sizeof(*st));
+    st->allocator = alloc;
+    CMBCStrVec_CreateWithAllocator(&st->strings, 0, 1, alloc);
+    MBAtomic_Store32(&st->referenceCount, 1, MB_ATOMIC_RELAXED);
 
     DEBUG_ONLY(
         st->magic = ((uintptr_t)st) ^ MBSTRTABLE_MAGIC;
@@ -102,22 +84,29 @@ MBStrTable *MBStrTable_AllocChild(MBStrTable *parent)
         return NULL;
     }
 
-    MBStrTable *st = MBStrTable_Alloc();
+    ASSERT(parent->magic == ((uintptr_t)parent ^ MBSTRTABLE_MAGIC));
 
-    st->parent = parent;
+    MBStrTable *st = MBStrTable_AllocWithAllocator(parent->allocator);
 
-    ASSERT(parent->magic == ((uintptr_t)parent ^ MBSTRTABLE_MAGIC));
+    st->parent = parent;
 
     MBStrTable_Reference(parent);
     return st;
 }
 
+const CMBAllocator *MBStrTable_GetAllocator(const MBStrTable *st)
+{
+    ASSERT(st != NULL);
+    return st->allocator;
+}
+
 static void MBStrTableFreeHelper(MBStrTable *st)
 {
+    const CMBAllocator *alloc = st->allocator;
     uint i;
 
     ASSERT(st != NULL);
-    ASSERT(st->referenceCount == 0);
+    ASSERT(MBAtomic_Load32(&st->referenceCount, MB_ATOMIC_RELAXED) == 0);
 
     DEBUG_ONLY(
         ASSERT(st->magic == ((uintptr_t)st ^ MBSTRTABLE_MAGIC));
@@ -128,12 +117,12 @@ static void MBStrTableFreeHelper(MBStrTable *st)
         const char *cstr;
         cstr = CMBCStrVec_GetValue(&st->strings, i);
         if (cstr != NULL) {
-            free((char *)cstr);
+            MBAlloc_Free(alloc, (char *)cstr, strlen(cstr) + 1);
         }
     }
 
     CMBCStrVec_Destroy(&st->strings);
-    free(st);
+    MBAlloc_Free(alloc, st, sizeof(*st));
 }
 
 void MBStrTable_Free(MBStrTable *st)
@@ -145,66 +134,38 @@ void MBStrTable_Free(MBStrTable *st)
     MBStrTable_Unreference(st);
 }
 
+/*
+ * New references can only come from someone that already holds one,
+ * so taking a reference doesn't need to order anything.  Dropping one
+ * has to publish this thread's writes to whoever frees the table.
+ */
 void MBStrTable_Reference(MBStrTable *st)
 {
-    /*
-     * Callers probably shouldn't be using this without the
-     * locking system initialized.
-     */
-    VERIFY(mb_lock);
-    ASSERT(gMBStrTableData.lockInitialized);
+    ASSERT(st->magic == ((uintptr_t)st ^ MBSTRTABLE_MAGIC));
+    ASSERT(MBAtomic_Load32(&st->referenceCount, MB_ATOMIC_RELAXED) > 0);
 
-    MBStrTableLock();
-    st->referenceCount++;
-    st->everHadReference = TRUE;
-    MBStrTableUnlock();
+    MBAtomic_FetchAdd32(&st->referenceCount, 1, MB_ATOMIC_RELAXED);
 }
 
 void MBStrTable_Unreference(MBStrTable *st)
 {
-    bool doFree = FALSE;
-    bool freeParent = FALSE;
+    MBStrTable *parent;
+    uint32 old;
 
     ASSERT(st->magic == ((uintptr_t)st ^ MBSTRTABLE_MAGIC));
 
-    if (st->everHadReference || st->parent != NULL) {
-        MBStrTableLock();
-
-        ASSERT(st->referenceCount > 0);
-        st->referenceCount--;
-
-        if (st->referenceCount == 0) {
-            doFree = TRUE;
-
-            if (st->parent != NULL) {
-                ASSERT(st->parent->referenceCount >= 1);
-                if (st->parent->referenceCount > 1) {
-                    st->parent->referenceCount--;
-                } else {
-                    ASSERT(st->parent->referenceCount == 1);
-                    freeParent = TRUE;
-                }
-            }
-        }
-        MBStrTableUnlock();
-    } else {
-        ASSERT(st->parent == NULL);
-        ASSERT(!st->everHadReference);
-
-        ASSERT(st->referenceCount == 1);
-        st->referenceCount = 0;
-        doFree = TRUE;
+    old = MBAtomic_FetchSub32(&st->referenceCount, 1, MB_ATOMIC_RELEASE);
+    ASSERT(old > 0);
+    if (old > 1) {
+        return;
     }
 
-    if (freeParent) {
-        ASSERT(doFree);
-        ASSERT(st->parent->referenceCount == 1);
-        MBStrTable_Unreference(st->parent);
-        st->parent = NULL;
-    }
+    MBAtomic_Fence(MB_ATOMIC_ACQUIRE);
+    parent = st->parent;
+    MBStrTableFreeHelper(st);
 
-    if (doFree) {
-        MBStrTableFreeHelper(st);
+    if (parent != NULL) {
+        MBStrTable_Unreference(parent);
     }
 }
 
@@ -216,14 +177,18 @@ const char *MBStrTable_AddCopy(MBStrTable *st, const char *cstr)
     /*
      * XXX: Could use hashes to check if the string was already here?
      */
-    const char *newCStr = strdup(cstr);
+    size_t size = strlen(cstr) + 1;
+    char *newCStr = MBAlloc_Alloc(st->allocator, size);
+    VERIFY(newCStr != NULL);
+    memcpy(newCStr, cstr, size);
     MBStrTable_AddFree(st, newCStr);
     return newCStr;
 }
 
 /*
  * Adds the provided string to this table.  It will free it when
- * the table is freed.
+ * the table is freed, so it must have come from the table's allocator
+ * (malloc, if it doesn't have one).
  */
 void MBStrTable_AddFree(MBStrTable *st, const char *cstr)
 {
@@ -0,0 +1,135 @@
+/*
+ * MBThread.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "MBThread.h"
+
+#ifdef MBTHREAD_PTHREADS
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef MBTHREAD_SDL2
+#include <SDL2/SDL_cpuinfo.h>
+#endif
+
+#if defined(MBTHREAD_PTHREADS)
+
+static void *MBThreadMain(void *data)
+{
+    MBThread *t = data;
+    t->fn(t->data);
+    return NULL;
+}
+
+void MBThread_Create(MBThread *t, MBThreadFn fn, void *data)
+{
+    ASSERT(t != NULL);
+    ASSERT(fn != NULL);
+
+    t->fn = fn;
+    t->data = data;
+
+    int ret = pthread_create(&t->thread, NULL, MBThreadMain, t);
+    VERIFY(ret == 0);
+}
+
+void MBThread_Join(MBThread *t)
+{
+    int ret = pthread_join(t->thread, NULL);
+    VERIFY(ret == 0);
+}
+
+uint MBThread_GetNumCPUs(void)
+{
+    long n;
+
+#if defined(MB_LINUX) && defined(CPU_COUNT)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        n = CPU_COUNT(&set);
+        if (n > 0) {
+            return n;
+        }
+    }
+#endif
+
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+#elif defined(MBTHREAD_SDL2)
+
+static int MBThreadMain(void *data)
+{
+    MBThread *t = data;
+    t->fn(t->data);
+    return 0;
+}
+
+void MBThread_Create(MBThread *t, MBThreadFn fn, void *data)
+{
+    ASSERT(t != NULL);
+    ASSERT(fn != NULL);
+
+    t->fn = fn;
+    t->data = data;
+    t->thread = SDL_CreateThread(MBThreadMain, "MBThread", t);
+    VERIFY(t->thread != NULL);
+}
+
+void MBThread_Join(MBThread *t)
+{
+    SDL_WaitThread(t->thread, NULL);
+    t->thread = NULL;
+}
+
+uint MBThread_GetNumCPUs(void)
+{
+    int n = SDL_GetCPUCount();
+    return n > 0 ? n : 1;
+}
+
+#else // !MB_HAS_MBTHREAD
+
+void MBThread_Create(MBThread *t, MBThreadFn fn, void *data)
+{
+    NOT_IMPLEMENTED();
+}
+
+void MBThread_Join(MBThread *t)
+{
+    NOT_IMPLEMENTED();
+}
+
+uint MBThread_GetNumCPUs(void)
+{
+    return 1;
+}
+
+#endif
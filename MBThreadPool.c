@@ -0,0 +1,800 @@
+/*
+ * MBThreadPool.c -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "MBThreadPool.h"
+#include "MBThread.h"
+#include "MBLock.h"
+#include "MBUtil.h"
+
+#ifdef MB_HAS_MBTHREAD
+
+#if defined(MBTHREAD_SDL2)
+#include <SDL2/SDL_mutex.h>
+#endif
+
+#define MBTHREADPOOL_INITIAL_CAPACITY 256
+#define MBTHREADPOOL_IDLE_SPINS       64
+
+/*
+ * Each task a waiter runs can wait in turn, and every one of those
+ * nested waits takes more stack.  Past this many, a worker only takes
+ * tasks from the bottom of its own deque, which are the ones it just
+ * submitted, and threads outside the pool just sleep, so the stack
+ * stops growing with the size of the whole task graph.  (Outside
+ * threads would take the oldest tasks from the shared queue, which
+ * tend to be the biggest.)
+ */
+#define MBTHREADPOOL_MAX_STEAL_DEPTH  16
+
+typedef struct MBThreadPoolTask {
+    MBThreadPoolFn fn;
+    void *data;
+    MBThreadPoolCounter *counter;
+} MBThreadPoolTask;
+
+/*
+ * A task as it sits in a deque buffer.  Thieves read the slots while
+ * the owner might be overwriting them, so every field is atomic.
+ */
+typedef struct MBThreadPoolSlot {
+    MBAtomicPtr fn;
+    MBAtomicPtr data;
+    MBAtomicPtr counter;
+} MBThreadPoolSlot;
+
+/*
+ * Buffers are replaced when they fill up, but a thief might still be
+ * reading the old one, so they're kept until the pool is destroyed.
+ */
+typedef struct MBThreadPoolBuffer {
+    uint64 mask;
+    struct MBThreadPoolBuffer *retired;
+    MBThreadPoolSlot slots[];
+} MBThreadPoolBuffer;
+
+/*
+ * A Chase-Lev deque, with the memory orders from Lê et al., "Correct
+ * and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ *
+ * Only the owner pushes and takes, at the bottom.  Anyone can steal
+ * from the top.  The indices only ever increase, so top <= bottom
+ * except briefly inside Take.
+ */
+typedef struct MBThreadPoolDeque {
+    MBAtomic64 top;
+    MB_CACHE_PAD(topPad, sizeof(MBAtomic64));
+    MBAtomic64 bottom;
+    MBAtomicPtr buffer;
+    MB_CACHE_PAD(bottomPad, sizeof(MBAtomic64) + sizeof(MBAtomicPtr));
+} MBThreadPoolDeque;
+
+typedef enum MBThreadPoolStealResult {
+    MBTHREADPOOL_STEAL_EMPTY,
+    MBTHREADPOOL_STEAL_ABORT,
+    MBTHREADPOOL_STEAL_OK,
+} MBThreadPoolStealResult;
+
+typedef struct MBThreadPoolWorker {
+    MBThreadPoolDeque deque;
+    MBThreadPool *pool;
+    MBThread thread;
+    uint32 rng;
+} MBThreadPoolWorker;
+
+struct MBThreadPool {
+    uint numWorkers;
+    uint numCPUs;
+    MBThreadPoolWorker *workers;
+
+    /*
+     * Tasks from outside the pool.  The lock makes the submitters
+     * collectively the deque's owner.
+     */
+    MBLock injectLock;
+    MBThreadPoolDeque inject;
+
+    MBAtomic32 shutdown;
+    MBAtomic32 numSleeping;
+    MBAtomic32 numSleepingWaiters;
+
+    /*
+     * Sleepers that have been signalled but haven't woken up yet, so
+     * wakers can skip the sleep mutex when there's nobody left to
+     * wake.  Only changed with the sleep mutex held.
+     */
+    MBAtomic32 numWakesPending;
+
+    /*
+     * Protected by the sleep mutex.  The epoch is bumped on every
+     * wakeup, so that sleepers can tell a real wakeup from a spurious
+     * one.
+     *
+     * Waiters past MBTHREADPOOL_MAX_STEAL_DEPTH can only run their own
+     * tasks, which nobody else submits, so they sleep on ownCond and
+     * only wake for broadcasts.  That keeps single wakeups on sleepCond,
+     * and numWaiting only counts the sleepers there.
+     */
+    uint64 sleepEpoch;
+    uint numWaiting;
+#if defined(MBTHREAD_PTHREADS)
+    pthread_mutex_t sleepMutex;
+    pthread_cond_t sleepCond;
+    pthread_cond_t ownCond;
+#elif defined(MBTHREAD_SDL2)
+    SDL_mutex *sleepMutex;
+    SDL_cond *sleepCond;
+    SDL_cond *ownCond;
+#endif
+};
+
+static THREAD_LOCAL MBThreadPoolWorker *gMBThreadPoolWorker;
+static THREAD_LOCAL uint gMBThreadPoolWaitDepth;
+
+static void MBThreadPoolSleepLock(MBThreadPool *pool)
+{
+#if defined(MBTHREAD_PTHREADS)
+    int ret = pthread_mutex_lock(&pool->sleepMutex);
+    VERIFY(ret == 0);
+#elif defined(MBTHREAD_SDL2)
+    int ret = SDL_LockMutex(pool->sleepMutex);
+    VERIFY(ret == 0);
+#endif
+}
+
+static void MBThreadPoolSleepUnlock(MBThreadPool *pool)
+{
+#if defined(MBTHREAD_PTHREADS)
+    int ret = pthread_mutex_unlock(&pool->sleepMutex);
+    VERIFY(ret == 0);
+#elif defined(MBTHREAD_SDL2)
+    int ret = SDL_UnlockMutex(pool->sleepMutex);
+    VERIFY(ret == 0);
+#endif
+}
+
+static void MBThreadPoolSleepWait(MBThreadPool *pool, bool steal)
+{
+#if defined(MBTHREAD_PTHREADS)
+    int ret = pthread_cond_wait(steal ? &pool->sleepCond : &pool->ownCond,
+                                &pool->sleepMutex);
+    VERIFY(ret == 0);
+#elif defined(MBTHREAD_SDL2)
+    int ret = SDL_CondWait(steal ? pool->sleepCond : pool->ownCond,
+                           pool->sleepMutex);
+    VERIFY(ret == 0);
+#endif
+}
+
+static void MBThreadPoolSleepSignal(MBThreadPool *pool, bool all)
+{
+#if defined(MBTHREAD_PTHREADS)
+    int ret = all ? pthread_cond_broadcast(&pool->sleepCond) :
+                    pthread_cond_signal(&pool->sleepCond);
+    VERIFY(ret == 0);
+    if (all) {
+        ret = pthread_cond_broadcast(&pool->ownCond);
+        VERIFY(ret == 0);
+    }
+#elif defined(MBTHREAD_SDL2)
+    int ret = all ? SDL_CondBroadcast(pool->sleepCond) :
+                    SDL_CondSignal(pool->sleepCond);
+    VERIFY(ret == 0);
+    if (all) {
+        ret = SDL_CondBroadcast(pool->ownCond);
+        VERIFY(ret == 0);
+    }
+#endif
+}
+
+/*
+ * A thief that reads a half-written task always loses the CAS on top
+ * and throws it away, so relaxed accesses are enough here.
+ */
+static INLINE_ALWAYS void
+MBThreadPoolLoadTask(MBThreadPoolSlot *slot, MBThreadPoolTask *task)
+{
+    task->fn = (MBThreadPoolFn)MBAtomic_LoadPtr(&slot->fn,
+                                                MB_ATOMIC_RELAXED);
+    task->data = MBAtomic_LoadPtr(&slot->data, MB_ATOMIC_RELAXED);
+    task->counter = MBAtomic_LoadPtr(&slot->counter, MB_ATOMIC_RELAXED);
+}
+
+static INLINE_ALWAYS void
+MBThreadPoolStoreTask(MBThreadPoolSlot *slot, const MBThreadPoolTask *task)
+{
+    MBAtomic_StorePtr(&slot->fn, (void *)task->fn, MB_ATOMIC_RELAXED);
+    MBAtomic_StorePtr(&slot->data, task->data, MB_ATOMIC_RELAXED);
+    MBAtomic_StorePtr(&slot->counter, task->counter, MB_ATOMIC_RELAXED);
+}
+
+static MBThreadPoolBuffer *MBThreadPoolBufferAlloc(uint64 capacity)
+{
+    MBThreadPoolBuffer *buf;
+
+    ASSERT(capacity > 0);
+    ASSERT((capacity & (capacity - 1)) == 0);
+
+    buf = malloc(sizeof(*buf) + capacity * sizeof(buf->slots[0]));
+    VERIFY(buf != NULL);
+    buf->mask = capacity - 1;
+    buf->retired = NULL;
+    return buf;
+}
+
+static void MBThreadPoolDequeCreate(MBThreadPoolDeque *d)
+{
+    MBUtil_Zero(d, sizeof(*d));
+    MBAtomic_StorePtr(&d->buffer,
+                      MBThreadPoolBufferAlloc(MBTHREADPOOL_INITIAL_CAPACITY),
+                      MB_ATOMIC_RELAXED);
+}
+
+static void MBThreadPoolDequeDestroy(MBThreadPoolDeque *d)
+{
+    MBThreadPoolBuffer *buf = MBAtomic_LoadPtr(&d->buffer, MB_ATOMIC_RELAXED);
+
+    ASSERT(MBAtomic_Load64(&d->top, MB_ATOMIC_RELAXED) ==
+           MBAtomic_Load64(&d->bottom, MB_ATOMIC_RELAXED));
+
+    while (buf != NULL) {
+        MBThreadPoolBuffer *retired = buf->retired;
+        free(buf);
+        buf = retired;
+    }
+}
+
+static bool MBThreadPoolDequeIsEmpty(MBThreadPoolDeque *d)
+{
+    uint64 t = MBAtomic_Load64(&d->top, MB_ATOMIC_ACQUIRE);
+    uint64 b = MBAtomic_Load64(&d->bottom, MB_ATOMIC_ACQUIRE);
+    return (int64)(b - t) <= 0;
+}
+
+static MBThreadPoolBuffer *
+MBThreadPoolDequeGrow(MBThreadPoolDeque *d, MBThreadPoolBuffer *old,
+                      uint64 t, uint64 b)
+{
+    MBThreadPoolBuffer *buf = MBThreadPoolBufferAlloc((old->mask + 1) * 2);
+
+    for (uint64 i = t; i != b; i++) {
+        MBThreadPoolTask task;
+        MBThreadPoolLoadTask(&old->slots[i & old->mask], &task);
+        MBThreadPoolStoreTask(&buf->slots[i & buf->mask], &task);
+    }
+
+    buf->retired = old;
+    MBAtomic_StorePtr(&d->buffer, buf, MB_ATOMIC_RELEASE);
+    return buf;
+}
+
+static void
+MBThreadPoolDequePush(MBThreadPoolDeque *d, const MBThreadPoolTask *task)
+{
+    uint64 b = MBAtomic_Load64(&d->bottom, MB_ATOMIC_RELAXED);
+    uint64 t = MBAtomic_Load64(&d->top, MB_ATOMIC_ACQUIRE);
+    MBThreadPoolBuffer *buf = MBAtomic_LoadPtr(&d->buffer, MB_ATOMIC_RELAXED);
+
+    if (UNLIKELY(b - t > buf->mask)) {
+        buf = MBThreadPoolDequeGrow(d, buf, t, b);
+    }
+
+    MBThreadPoolStoreTask(&buf->slots[b & buf->mask], task);
+    MBAtomic_Fence(MB_ATOMIC_RELEASE);
+    MBAtomic_Store64(&d->bottom, b + 1, MB_ATOMIC_RELAXED);
+}
+
+static bool
+MBThreadPoolDequeTake(MBThreadPoolDeque *d, MBThreadPoolTask *task)
+{
+    uint64 b = MBAtomic_Load64(&d->bottom, MB_ATOMIC_RELAXED) - 1;
+    MBThreadPoolBuffer *buf = MBAtomic_LoadPtr(&d->buffer, MB_ATOMIC_RELAXED);
+    uint64 t;
+    bool found = TRUE;
+
+    MBAtomic_Store64(&d->bottom, b, MB_ATOMIC_RELAXED);
+    MBAtomic_Fence(MB_ATOMIC_SEQ_CST);
+    t = MBAtomic_Load64(&d->top, MB_ATOMIC_RELAXED);
+
+    if ((int64)(b - t) < 0) {
+        MBAtomic_Store64(&d->bottom, b + 1, MB_ATOMIC_RELAXED);
+        return FALSE;
+    }
+
+    MBThreadPoolLoadTask(&buf->slots[b & buf->mask], task);
+    if (b == t) {
+        /*
+         * This is the last task, so race the thieves for it.
+         */
+        found = MBAtomic_CompareExchange64(&d->top, &t, t + 1,
+                                           MB_ATOMIC_SEQ_CST);
+        MBAtomic_Store64(&d->bottom, b + 1, MB_ATOMIC_RELAXED);
+    }
+    return found;
+}
+
+static MBThreadPoolStealResult
+MBThreadPoolDequeSteal(MBThreadPoolDeque *d, MBThreadPoolTask *task)
+{
+    uint64 t = MBAtomic_Load64(&d->top, MB_ATOMIC_ACQUIRE);
+    uint64 b;
+    MBThreadPoolBuffer *buf;
+
+    MBAtomic_Fence(MB_ATOMIC_SEQ_CST);
+    b = MBAtomic_Load64(&d->bottom, MB_ATOMIC_ACQUIRE);
+    if ((int64)(b - t) <= 0) {
+        return MBTHREADPOOL_STEAL_EMPTY;
+    }
+
+    buf = MBAtomic_LoadPtr(&d->buffer, MB_ATOMIC_ACQUIRE);
+    MBThreadPoolLoadTask(&buf->slots[t & buf->mask], task);
+    if (!MBAtomic_CompareExchange64(&d->top, &t, t + 1, MB_ATOMIC_SEQ_CST)) {
+        return MBTHREADPOOL_STEAL_ABORT;
+    }
+    return MBTHREADPOOL_STEAL_OK;
+}
+
+/*
+ * Wake up sleepers, if there are any.
+ *
+ * Sleepers announce themselves in numSleeping before their last check
+ * for work, and wakers check numSleeping after publishing the work, so
+ * with the fences in between at least one of them sees the other.
+ */
+static void MBThreadPoolWake(MBThreadPool *pool, bool all)
+{
+    uint32 numSleeping;
+    uint32 numPending;
+
+    MBAtomic_Fence(MB_ATOMIC_SEQ_CST);
+    numSleeping = MBAtomic_Load32(&pool->numSleeping, MB_ATOMIC_RELAXED);
+    if (numSleeping == 0) {
+        return;
+    }
+
+    /*
+     * If every sleeper is already on its way up, they'll all look for
+     * work again before they sleep.
+     */
+    numPending = MBAtomic_Load32(&pool->numWakesPending, MB_ATOMIC_RELAXED);
+    if (!all && numPending >= numSleeping) {
+        return;
+    }
+
+    MBThreadPoolSleepLock(pool);
+    numPending = MBAtomic_Load32(&pool->numWakesPending, MB_ATOMIC_RELAXED);
+    if (all) {
+        pool->sleepEpoch++;
+        MBAtomic_Store32(&pool->numWakesPending, pool->numWaiting,
+                         MB_ATOMIC_RELAXED);
+        MBThreadPoolSleepSignal(pool, TRUE);
+    } else if (numPending < pool->numWaiting) {
+        pool->sleepEpoch++;
+        MBAtomic_Store32(&pool->numWakesPending, numPending + 1,
+                         MB_ATOMIC_RELAXED);
+        MBThreadPoolSleepSignal(pool, FALSE);
+    }
+    MBThreadPoolSleepUnlock(pool);
+}
+
+/*
+ * Submitters only wake one thread at a time, so a thief that finds
+ * more work behind the task it stole passes the wakeup along.
+ */
+static void
+MBThreadPoolWakeIfMore(MBThreadPool *pool, MBThreadPoolDeque *d)
+{
+    if (!MBThreadPoolDequeIsEmpty(d)) {
+        MBThreadPoolWake(pool, FALSE);
+    }
+}
+
+static bool
+MBThreadPoolHasWork(MBThreadPool *pool, MBThreadPoolWorker *self, bool steal)
+{
+    if (!steal) {
+        return self != NULL && !MBThreadPoolDequeIsEmpty(&self->deque);
+    }
+
+    if (!MBThreadPoolDequeIsEmpty(&pool->inject)) {
+        return TRUE;
+    }
+    for (uint i = 0; i < pool->numWorkers; i++) {
+        if (!MBThreadPoolDequeIsEmpty(&pool->workers[i].deque)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Look for a task: our own deque first, then the shared queue, and
+ * then the other workers, starting from a random one so the thieves
+ * spread out.  Without steal, only our own deque.
+ */
+static bool
+MBThreadPoolFindTask(MBThreadPool *pool, MBThreadPoolWorker *self,
+                     bool steal, MBThreadPoolTask *task)
+{
+    bool retry;
+
+    do {
+        MBThreadPoolStealResult r;
+        uint start;
+
+        retry = FALSE;
+
+        if (self != NULL && MBThreadPoolDequeTake(&self->deque, task)) {
+            return TRUE;
+        }
+        if (!steal) {
+            return FALSE;
+        }
+
+        r = MBThreadPoolDequeSteal(&pool->inject, task);
+        if (r == MBTHREADPOOL_STEAL_OK) {
+            MBThreadPoolWakeIfMore(pool, &pool->inject);
+            return TRUE;
+        }
+        retry |= r == MBTHREADPOOL_STEAL_ABORT;
+
+        if (self != NULL) {
+            self->rng ^= self->rng << 13;
+            self->rng ^= self->rng >> 17;
+            self->rng ^= self->rng << 5;
+            start = self->rng % pool->numWorkers;
+        } else {
+            start = (uint)(MBThread_GetID() >> 4) % pool->numWorkers;
+        }
+
+        for (uint i = 0; i < pool->numWorkers; i++) {
+            MBThreadPoolWorker *victim =
+                &pool->workers[(start + i) % pool->numWorkers];
+
+            if (victim == self) {
+                continue;
+            }
+
+            r = MBThreadPoolDequeSteal(&victim->deque, task);
+            if (r == MBTHREADPOOL_STEAL_OK) {
+                MBThreadPoolWakeIfMore(pool, &victim->deque);
+                return TRUE;
+            }
+            retry |= r == MBTHREADPOOL_STEAL_ABORT;
+        }
+    } while (retry);
+
+    return FALSE;
+}
+
+/*
+ * Spin for a bit before giving up, unless there's only one CPU, in
+ * which case whoever we're waiting for can't run while we spin.
+ */
+static bool
+MBThreadPoolSpinForTask(MBThreadPool *pool, MBThreadPoolWorker *self,
+                        bool steal, MBThreadPoolCounter *counter,
+                        MBThreadPoolTask *task)
+{
+    if (pool->numCPUs == 1) {
+        return FALSE;
+    }
+
+    for (uint i = 0; i < MBTHREADPOOL_IDLE_SPINS; i++) {
+        MBAtomic_Pause();
+        if (counter != NULL && MBThreadPoolCounter_IsDone(counter)) {
+            return FALSE;
+        }
+        if (MBThreadPoolFindTask(pool, self, steal, task)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Sleep until there's a task to run, or counter is done, or (for
+ * workers) the pool is shutting down.
+ */
+static void
+MBThreadPoolSleep(MBThreadPool *pool, MBThreadPoolWorker *self, bool steal,
+                  MBThreadPoolCounter *counter)
+{
+    uint64 epoch;
+    bool done;
+
+    MBThreadPoolSleepLock(pool);
+    epoch = pool->sleepEpoch;
+    MBAtomic_FetchAdd32(&pool->numSleeping, 1, MB_ATOMIC_SEQ_CST);
+    if (counter != NULL) {
+        MBAtomic_FetchAdd32(&pool->numSleepingWaiters, 1, MB_ATOMIC_SEQ_CST);
+    }
+    MBAtomic_Fence(MB_ATOMIC_SEQ_CST);
+
+    if (counter != NULL) {
+        done = MBThreadPoolCounter_IsDone(counter);
+    } else {
+        done = MBAtomic_Load32(&pool->shutdown, MB_ATOMIC_ACQUIRE);
+    }
+
+    if (!done && !MBThreadPoolHasWork(pool, self, steal)) {
+        if (steal) {
+            pool->numWaiting++;
+        }
+        while (epoch == pool->sleepEpoch) {
+            MBThreadPoolSleepWait(pool, steal);
+        }
+        if (steal) {
+            pool->numWaiting--;
+            if (MBAtomic_Load32(&pool->numWakesPending,
+                                MB_ATOMIC_RELAXED) > 0) {
+                MBAtomic_FetchSub32(&pool->numWakesPending, 1,
+                                    MB_ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    if (counter != NULL) {
+        MBAtomic_FetchSub32(&pool->numSleepingWaiters, 1, MB_ATOMIC_RELAXED);
+    }
+    MBAtomic_FetchSub32(&pool->numSleeping, 1, MB_ATOMIC_RELAXED);
+    MBThreadPoolSleepUnlock(pool);
+}
+
+static void MBThreadPoolRunTask(MBThreadPool *pool, MBThreadPoolTask *task)
+{
+    MBThreadPoolCounter *counter = task->counter;
+
+    task->fn(task->data);
+
+    /*
+     * Once the counter hits zero its owner can free it, so it's
+     * off-limits after this.  We don't know which sleeper is waiting
+     * on it, so wake them all, but only if any of them are waiters.
+     */
+    if (counter != NULL &&
+        MBAtomic_FetchSub64(&counter->pending, 1, MB_ATOMIC_ACQ_REL) == 1) {
+        MBAtomic_Fence(MB_ATOMIC_SEQ_CST);
+        if (MBAtomic_Load32(&pool->numSleepingWaiters,
+                            MB_ATOMIC_RELAXED) > 0) {
+            MBThreadPoolWake(pool, TRUE);
+        }
+    }
+}
+
+static void MBThreadPoolWorkerMain(void *data)
+{
+    MBThreadPoolWorker *w = data;
+    MBThreadPool *pool = w->pool;
+    MBThreadPoolTask task;
+
+    gMBThreadPoolWorker = w;
+
+    while (TRUE) {
+        if (MBThreadPoolFindTask(pool, w, TRUE, &task) ||
+            MBThreadPoolSpinForTask(pool, w, TRUE, NULL, &task)) {
+            MBThreadPoolRunTask(pool, &task);
+            continue;
+        }
+
+        if (MBAtomic_Load32(&pool->shutdown, MB_ATOMIC_ACQUIRE)) {
+            break;
+        }
+        MBThreadPoolSleep(pool, w, TRUE, NULL);
+    }
+
+    gMBThreadPoolWorker = NULL;
+}
+
+MBThreadPool *MBThreadPool_Create(uint numWorkers)
+{
+    MBThreadPool *pool = MBUtil_ZAlloc(sizeof(*pool));
+    VERIFY(pool != NULL);
+
+    pool->numCPUs = MBThread_GetNumCPUs();
+    pool->numWorkers = numWorkers > 0 ? numWorkers : pool->numCPUs;
+
+#if defined(MBTHREAD_PTHREADS)
+    int ret = pthread_mutex_init(&pool->sleepMutex, NULL);
+    VERIFY(ret == 0);
+    ret = pthread_cond_init(&pool->sleepCond, NULL);
+    VERIFY(ret == 0);
+    ret = pthread_cond_init(&pool->ownCond, NULL);
+    VERIFY(ret == 0);
+#elif defined(MBTHREAD_SDL2)
+    pool->sleepMutex = SDL_CreateMutex();
+    VERIFY(pool->sleepMutex != NULL);
+    pool->sleepCond = SDL_CreateCond();
+    VERIFY(pool->sleepCond != NULL);
+    pool->ownCond = SDL_CreateCond();
+    VERIFY(pool->ownCond != NULL);
+#endif
+
+    MBLock_Create(&pool->injectLock);
+    MBLock_SetName(&pool->injectLock, "MBThreadPool");
+    MBThreadPoolDequeCreate(&pool->inject);
+
+    pool->workers = MBUtil_ZAlloc(pool->numWorkers * sizeof(pool->workers[0]));
+    VERIFY(pool->workers != NULL);
+
+    /*
+     * Set up all the deques before any worker can try to steal.
+     */
+    for (uint i = 0; i < pool->numWorkers; i++) {
+        MBThreadPoolWorker *w = &pool->workers[i];
+        MBThreadPoolDequeCreate(&w->deque);
+        w->pool = pool;
+        w->rng = 2 * i + 1;
+    }
+    for (uint i = 0; i < pool->numWorkers; i++) {
+        MBThread_Create(&pool->workers[i].thread, MBThreadPoolWorkerMain,
+                        &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void MBThreadPool_Destroy(MBThreadPool *pool)
+{
+    ASSERT(pool != NULL);
+    ASSERT(gMBThreadPoolWorker == NULL ||
+           gMBThreadPoolWorker->pool != pool);
+
+    MBAtomic_Store32(&pool->shutdown, TRUE, MB_ATOMIC_SEQ_CST);
+    MBThreadPoolWake(pool, TRUE);
+
+    for (uint i = 0; i < pool->numWorkers; i++) {
+        MBThread_Join(&pool->workers[i].thread);
+    }
+    for (uint i = 0; i < pool->numWorkers; i++) {
+        MBThreadPoolDequeDestroy(&pool->workers[i].deque);
+    }
+    free(pool->workers);
+
+    MBThreadPoolDequeDestroy(&pool->inject);
+    MBLock_Destroy(&pool->injectLock);
+
+#if defined(MBTHREAD_PTHREADS)
+    int ret = pthread_cond_destroy(&pool->ownCond);
+    VERIFY(ret == 0);
+    ret = pthread_cond_destroy(&pool->sleepCond);
+    VERIFY(ret == 0);
+    ret = pthread_mutex_destroy(&pool->sleepMutex);
+    VERIFY(ret == 0);
+#elif defined(MBTHREAD_SDL2)
+    SDL_DestroyCond(pool->ownCond);
+    SDL_DestroyCond(pool->sleepCond);
+    SDL_DestroyMutex(pool->sleepMutex);
+#endif
+
+    free(pool);
+}
+
+uint MBThreadPool_GetNumWorkers(MBThreadPool *pool)
+{
+    ASSERT(pool != NULL);
+    return pool->numWorkers;
+}
+
+void MBThreadPool_Submit(MBThreadPool *pool, MBThreadPoolCounter *counter,
+                         MBThreadPoolFn fn, void *data)
+{
+    MBThreadPoolWorker *w = gMBThreadPoolWorker;
+    MBThreadPoolTask task;
+
+    ASSERT(pool != NULL);
+    ASSERT(fn != NULL);
+    ASSERT(!MBAtomic_Load32(&pool->shutdown, MB_ATOMIC_RELAXED));
+
+    task.fn = fn;
+    task.data = data;
+    task.counter = counter;
+
+    if (counter != NULL) {
+        MBAtomic_FetchAdd64(&counter->pending, 1, MB_ATOMIC_RELAXED);
+    }
+
+    if (w != NULL && w->pool == pool) {
+        MBThreadPoolDequePush(&w->deque, &task);
+    } else {
+        MBLock_Lock(&pool->injectLock);
+        MBThreadPoolDequePush(&pool->inject, &task);
+        MBLock_Unlock(&pool->injectLock);
+    }
+
+    MBThreadPoolWake(pool, FALSE);
+}
+
+void MBThreadPool_Wait(MBThreadPool *pool, MBThreadPoolCounter *counter)
+{
+    MBThreadPoolWorker *w = gMBThreadPoolWorker;
+    MBThreadPoolTask task;
+    bool steal;
+
+    ASSERT(pool != NULL);
+    ASSERT(counter != NULL);
+
+    /*
+     * A worker from some other pool helps out like any other thread.
+     */
+    if (w != NULL && w->pool != pool) {
+        w = NULL;
+    }
+
+    steal = gMBThreadPoolWaitDepth < MBTHREADPOOL_MAX_STEAL_DEPTH;
+    gMBThreadPoolWaitDepth++;
+
+    while (!MBThreadPoolCounter_IsDone(counter)) {
+        if (MBThreadPoolFindTask(pool, w, steal, &task) ||
+            MBThreadPoolSpinForTask(pool, w, steal, counter, &task)) {
+            MBThreadPoolRunTask(pool, &task);
+            continue;
+        }
+
+        if (!MBThreadPoolCounter_IsDone(counter)) {
+            MBThreadPoolSleep(pool, w, steal, counter);
+        }
+    }
+
+    gMBThreadPoolWaitDepth--;
+}
+
+#else // !MB_HAS_MBTHREAD
+
+struct MBThreadPool {
+    uint numWorkers;
+};
+
+MBThreadPool *MBThreadPool_Create(uint numWorkers)
+{
+    MBThreadPool *pool = MBUtil_ZAlloc(sizeof(*pool));
+    VERIFY(pool != NULL);
+    return pool;
+}
+
+void MBThreadPool_Destroy(MBThreadPool *pool)
+{
+    free(pool);
+}
+
+uint MBThreadPool_GetNumWorkers(MBThreadPool *pool)
+{
+    return 0;
+}
+
+void MBThreadPool_Submit(MBThreadPool *pool, MBThreadPoolCounter *counter,
+                         MBThreadPoolFn fn, void *data)
+{
+    ASSERT(fn != NULL);
+    fn(data);
+}
+
+void MBThreadPool_Wait(MBThreadPool *pool, MBThreadPoolCounter *counter)
+{
+    ASSERT(MBThreadPoolCounter_IsDone(counter));
+}
+
+#endif // MB_HAS_MBTHREAD
@@ -23,15 +23,25 @@
  * SOFTWARE.
  */
 
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
 #include "MBUnitTest.h"
 
 #include "MBConfig.h"
 
 #ifdef MB_HAS_SDL2
 #include <SDL2/SDL.h>
-#include "MBLock.h"
 #endif
 
+#include "MBLock.h"
+#include "MBAtomic.h"
+#include "MBThreadPool.h"
+#include "MBParallel.hpp"
+
 #include "MBAssert.h"
 #include "MBString.hpp"
 #include "MBStack.hpp"
@@ -41,6 +51,7 @@
 #include "BitVector.hpp"
 #include "MBUtil.h"
 #include "Random.h"
+#include "MBThread.h"
 #include "MBMap.hpp"
 #include "MBQueue.hpp"
 #include "IntMap.hpp"
@@ -48,6 +59,10 @@
 #include "MBStrTable.h"
 #include "MBOpt.h"
 #include "MBRegistry.h"
+#include "MBVarMap.h"
+#include "MBAlloc.h"
+#include "MBNumeric.h"
+#include "MBPriorityQueue.hpp"
 
 typedef struct MBUnitTestBenchmark {
     bool enabled;
@@ -132,9 +147,23 @@ void MBUnitTestRunTests(bool benchmark)
             { 1, 4,    MBUnitTest_MBRegistry   },
             { 1, 1,    MBUnitTest_MBCompare    },
             { 1, 1,    MBUnitTest_MBLock       },
+            { 1, 4,    MBUnitTest_MBCondVar    },
+            { 1, 1,    MBUnitTest_MBAtomic     },
+            { 1, 10,   MBUnitTest_MBThreadPool },
+            { 1, 10,   MBUnitTest_MBParallel   },
             { 1, 1,    MBUnitTest_MBRing       },
             { 1, 1,    MBUnitTest_Types        },
             { 1, 1,    MBUnitTest_Random       },
+            { 1, 10,   MBUnitTest_RandomEngines },
+            { 1, 10,   MBUnitTest_RandomFill },
+            { 1, 10,   MBUnitTest_RandomInt },
+            { 1, 10,   MBUnitTest_RandomEnum },
+            { 1, 10,   MBUnitTest_RandomStreams },
+            { 1, 10,   MBUnitTest_RandomDistributions },
+            { 1, 10,   MBUnitTest_RandomSample },
+            { 1, 20,   MBUnitTest_MBAlloc      },
+            { 1, 40,   MBUnitTest_MBNumeric    },
+            { 1, 30,   MBUnitTest_MBPriorityQueue },
     };
 
     for (uint32 x = 0; x < ARRAYSIZE(tests); x++) {
@@ -178,6 +207,7 @@ void MBUnitTestRunTests(bool benchmark)
         }
     }
 
+    MBParallel_Exit();
     Random_Exit();
 
     printf("%s successful!\n\n", benchmark ? "Benchmark" : "Tests");
@@ -789,6 +819,32 @@ void MBUnitTest_BitVector(void)
         }
     }
 
+    // Test indices past 32-bits
+    {
+        int64 bigIndex = (((int64)1) << 32) + 5 + ((uint64)mbtest.seed % 64);
+        uint64 numCells = bigIndex / BVUNITBITS + 1;
+
+        /*
+         * This is mostly untouched zero pages, so it's cheaper than it looks.
+         */
+        uint64 *rawbits = (uint64 *)calloc(numCells, sizeof(uint64));
+        VERIFY(rawbits != NULL);
+
+        TEST(!BitVector_GetRaw(bigIndex, rawbits));
+        BitVector_SetRaw(bigIndex, rawbits);
+        TEST(BitVector_GetRaw(bigIndex, rawbits));
+        TEST(!BitVector_GetRaw(bigIndex - 1, rawbits));
+        TEST(!BitVector_GetRaw(bigIndex - (((int64)1) << 32), rawbits));
+        TEST(rawbits[bigIndex / BVUNITBITS] ==
+             ((uint64)1) << (bigIndex % BVUNITBITS));
+        BitVector_FlipRaw(bigIndex, rawbits);
+        TEST(!BitVector_GetRaw(bigIndex, rawbits));
+        BitVector_FlipRaw(bigIndex, rawbits);
+        BitVector_ResetRaw(bigIndex, rawbits);
+        TEST(rawbits[bigIndex / BVUNITBITS] == 0);
+
+        free(rawbits);
+    }
 }
 
 void MBUnitTest_MBMap()
@@ -1108,210 +1164,3168 @@ void MBUnitTest_Random(void)
     }
 }
 
-void MBUnitTest_MBQueue(void)
+/*
+ * Basic statistical sanity checks on each engine.  The bounds are wide
+ * enough (~6 sigma) that a working engine essentially never trips them.
+ */
+void MBUnitTest_RandomEngines(void)
 {
-    MBQueue<int> q;
-    const int count = 1000;
-    int result;
+    const int n = 16 * 1024;
+
+    for (int e = 0; e < RANDOM_ENGINE_MAX; e++) {
+        RandomEngineType engine = (RandomEngineType)e;
+        RandomState r;
+        RandomState r2;
+        int bitCounts[64];
+        int highBuckets[16];
+        int lowBuckets[16];
+        double floatSum = 0.0;
+        double chiHigh = 0.0;
+        double chiLow = 0.0;
+
+        RandomState_CreateWithEngine(&r, engine, mbtest.seed);
+        RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+        TEST(RandomState_GetEngine(&r) == engine);
+        TEST(RandomState_GetEngineName(engine) != NULL);
+
+        for (int x = 0; x < 100; x++) {
+            TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+        }
+        RandomState_SetSeed(&r2, (uint64)mbtest.seed + 1);
+        TEST(RandomState_Uint64(&r) != RandomState_Uint64(&r2));
 
-    for (int x = 0; x < count; x++) {
-        q.enqueue(x);
+        MBUtil_Zero(bitCounts, sizeof(bitCounts));
+        MBUtil_Zero(highBuckets, sizeof(highBuckets));
+        MBUtil_Zero(lowBuckets, sizeof(lowBuckets));
 
-        result = q.size();
-        TEST(result == x + 1);
-    }
+        for (int x = 0; x < n; x++) {
+            uint64 v = RandomState_Uint64(&r);
+            for (int b = 0; b < 64; b++) {
+                bitCounts[b] += (v >> b) & 1;
+            }
+            lowBuckets[v & 0xF]++;
+            highBuckets[RandomState_Uint32(&r) >> 28]++;
+            floatSum += RandomState_UnitFloat(&r);
+        }
 
-    for (int x = 0; x < count; x++) {
-        result = q.dequeue();
-        TEST(result == x);
+        for (int b = 0; b < 64; b++) {
+            TEST(abs(bitCounts[b] - n / 2) < 6 * 64);
+        }
+        for (int b = 0; b < 16; b++) {
+            double expected = n / 16.0;
+            chiHigh += (highBuckets[b] - expected) *
+                       (highBuckets[b] - expected) / expected;
+            chiLow += (lowBuckets[b] - expected) *
+                      (lowBuckets[b] - expected) / expected;
+        }
+        // 15 degrees of freedom.
+        TEST(chiHigh < 60.0);
+        TEST(chiLow < 60.0);
+        TEST(fabs(floatSum / n - 0.5) < 0.015);
 
-        result = q.size();
-        TEST(result == count - (x + 1));
+        RandomState_Destroy(&r);
+        RandomState_Destroy(&r2);
     }
-}
-
 
-void MBUnitTest_MBRegistry(void)
-{
-    MBRegistry *mreg;
-    const char *s;
+    /*
+     * The default engine is still the original LCG, and SplitMix64
+     * matches the reference output.
+     */
+    {
+        RandomState r;
+        RandomState r2;
 
-    mreg = MBRegistry_Alloc();
-    MBRegistry_Free(mreg);
+        RandomState_CreateWithSeed(&r, mbtest.seed);
+        RandomState_CreateWithEngine(&r2, RANDOM_ENGINE_LCG, mbtest.seed);
+        TEST(RandomState_GetEngine(&r) == RANDOM_ENGINE_LCG);
+        TEST(RandomState_Uint32(&r) == RandomState_Uint32(&r2));
 
-    mreg = MBRegistry_Alloc();
-    MBRegistry_PutConst(mreg, "key", "value");
-    TEST(strcmp(MBRegistry_Get(mreg, "key"), "value") == 0);
-    s = "OtherValue";
-    MBRegistry_PutConst(mreg, "OtherKey", s);
-    TEST(MBRegistry_Get(mreg, "OtherKey") == s);
-    MBRegistry_PutConst(mreg, "key", s);
-    TEST(MBRegistry_Get(mreg, "key") == s);
-    MBRegistry_Remove(mreg, "key");
-    MBRegistry_Remove(mreg, "OtherKey");
-    TEST(MBRegistry_Get(mreg, "key") == NULL);
-    TEST(MBRegistry_Get(mreg, "OtherKey") == NULL);
-    MBRegistry_Free(mreg);
+        RandomState_CreateWithEngine(&r, RANDOM_ENGINE_SPLITMIX64, 0);
+        TEST(RandomState_Uint64(&r) == 0xE220A8397B1DCDAFULL);
+    }
 }
 
-int testCompareUint32(const void *lhs, const void *rhs, void *cbData)
+/*
+ * Chi-squared statistic for numBuckets equally likely buckets.
+ */
+static double MBUnitTestChiSquared(const int *buckets, int numBuckets,
+                                   int total)
 {
-    uint32 *lhsT = (uint32*)lhs;
-    uint32 *rhsT = (uint32*)rhs;
+    double expected = total / (double)numBuckets;
+    double chi = 0.0;
 
-    ASSERT(cbData == NULL);
-
-    if (*lhsT < *rhsT) {
-        return -1;
-    } else if (*lhsT == *rhsT) {
-        return 0;
-    } else {
-        return 1;
+    for (int b = 0; b < numBuckets; b++) {
+        chi += (buckets[b] - expected) * (buckets[b] - expected) / expected;
     }
+    return chi;
 }
 
-void MBUnitTest_MBCompare(void)
+void MBUnitTest_RandomInt(void)
 {
-    uint32 array[10];
+    const int n = 30 * 1000;
+    RandomState r;
 
-    for (uint32 i = 0; i < ARRAYSIZE(array); i++) {
-        array[i] = 100 - i;
+    RandomState_CreateWithSeed(&r, mbtest.seed);
+
+    for (int x = 0; x < 1000; x++) {
+        TEST(RandomState_Int(&r, 7, 7) == 7);
+        TEST(RandomState_Int(&r, MIN_INT32, MIN_INT32) == MIN_INT32);
+        TEST(RandomState_Int(&r, MAX_INT32, MAX_INT32) == MAX_INT32);
+        TEST(RandomState_Int64(&r, MIN_INT64, MIN_INT64) == MIN_INT64);
+        TEST(RandomState_Uint32Below(&r, 1) == 0);
+        TEST(RandomState_Uint64Below(&r, 1) == 0);
+
+        int v = RandomState_Int(&r, MAX_INT32 - 1, MAX_INT32);
+        TEST(v == MAX_INT32 - 1 || v == MAX_INT32);
+        v = RandomState_Int(&r, MIN_INT32, MIN_INT32 + 1);
+        TEST(v == MIN_INT32 || v == MIN_INT32 + 1);
+        v = RandomState_Int(&r, -3, 3);
+        TEST(v >= -3 && v <= 3);
+
+        int64 v64 = RandomState_Int64(&r, MAX_INT64 - 2, MAX_INT64);
+        TEST(v64 >= MAX_INT64 - 2);
+        v64 = RandomState_Int64(&r, -5, 5);
+        TEST(v64 >= -5 && v64 <= 5);
     }
 
-    MBCompare_SortFallback(array, ARRAYSIZE(array), sizeof(array[0]),
-                           testCompareUint32, NULL);
+    /*
+     * Small ranges, including negative ones.
+     */
+    {
+        int buckets[13];
 
-    for (uint32 i = 1; i < ARRAYSIZE(array); i++) {
-        TEST(array[i-1] <= array[i]);
+        MBUtil_Zero(buckets, sizeof(buckets));
+        for (int x = 0; x < n; x++) {
+            buckets[RandomState_Int(&r, -6, 6) + 6]++;
+        }
+        // 12 degrees of freedom.
+        TEST(MBUnitTestChiSquared(buckets, 13, n) < 65.0);
     }
 
-    for (uint32 i = 0; i < ARRAYSIZE(array); i++) {
-        array[i] = 100 - i;
+    /*
+     * A range of 3 * 2^30 (and 3 * 2^62) can't be done with a plain
+     * modulus of 32 (or 64) bits without skewing towards the
+     * bottom third, so check each third gets its share.
+     */
+    {
+        int b32[3], b64[3], bInt[3], bInt64[3];
+        const uint32 bound32 = 3U << 30;
+        const uint64 bound64 = 3ULL << 62;
+
+        MBUtil_Zero(b32, sizeof(b32));
+        MBUtil_Zero(b64, sizeof(b64));
+        MBUtil_Zero(bInt, sizeof(bInt));
+        MBUtil_Zero(bInt64, sizeof(bInt64));
+
+        for (int x = 0; x < n; x++) {
+            uint32 u = RandomState_Uint32Below(&r, bound32);
+            uint64 u64 = RandomState_Uint64Below(&r, bound64);
+            int i = RandomState_Int(&r, MIN_INT32,
+                                    (int)(MIN_INT32 + (int64)bound32 - 1));
+            int64 i64 = RandomState_Int64(&r, MIN_INT64,
+                                          (int64)((uint64)MIN_INT64 +
+                                                  bound64 - 1));
+            TEST(u < bound32);
+            TEST(u64 < bound64);
+            b32[u >> 30]++;
+            b64[u64 >> 62]++;
+            bInt[((int64)i - MIN_INT32) >> 30]++;
+            bInt64[((uint64)i64 - (uint64)MIN_INT64) >> 62]++;
+        }
+        // 2 degrees of freedom.
+        TEST(MBUnitTestChiSquared(b32, 3, n) < 32.0);
+        TEST(MBUnitTestChiSquared(b64, 3, n) < 32.0);
+        TEST(MBUnitTestChiSquared(bInt, 3, n) < 32.0);
+        TEST(MBUnitTestChiSquared(bInt64, 3, n) < 32.0);
     }
 
-    MBCompare_Sort(array, ARRAYSIZE(array), sizeof(array[0]),
-                   testCompareUint32, NULL);
+    /*
+     * Full ranges: check the sign and the low bit are balanced.
+     */
+    {
+        int b[4], b64[4];
+
+        MBUtil_Zero(b, sizeof(b));
+        MBUtil_Zero(b64, sizeof(b64));
+        for (int x = 0; x < n; x++) {
+            int i = RandomState_Int(&r, MIN_INT32, MAX_INT32);
+            int64 i64 = RandomState_Int64(&r, MIN_INT64, MAX_INT64);
+            b[(i < 0) * 2 + (i & 1)]++;
+            b64[(i64 < 0) * 2 + (int)(i64 & 1)]++;
+        }
+        // 3 degrees of freedom.
+        TEST(MBUnitTestChiSquared(b, 4, n) < 35.0);
+        TEST(MBUnitTestChiSquared(b64, 4, n) < 35.0);
+    }
 
-    for (uint32 i = 1; i < ARRAYSIZE(array); i++) {
-        TEST(array[i-1] <= array[i]);
+    /*
+     * The batch versions.
+     */
+    {
+        int64 *items = (int64 *)malloc(n * sizeof(items[0]));
+        int b[5];
+        int b3[3];
+
+        MBUtil_Zero(b, sizeof(b));
+        RandomState_FillInt64Range(&r, items, n, -2, 2);
+        for (int x = 0; x < n; x++) {
+            TEST(items[x] >= -2 && items[x] <= 2);
+            b[items[x] + 2]++;
+        }
+        // 4 degrees of freedom.
+        TEST(MBUnitTestChiSquared(b, 5, n) < 40.0);
+
+        MBUtil_Zero(b3, sizeof(b3));
+        RandomState_FillInt64Range(&r, items, n, 0, (int64)(3ULL << 61) - 1);
+        for (int x = 0; x < n; x++) {
+            TEST(items[x] >= 0 && items[x] < (int64)(3ULL << 61));
+            b3[items[x] >> 61]++;
+        }
+        TEST(MBUnitTestChiSquared(b3, 3, n) < 32.0);
+
+        RandomState_FillInt64Range(&r, items, n, MIN_INT64, MAX_INT64);
+
+        int *ints = (int *)items;
+        MBUtil_Zero(b3, sizeof(b3));
+        RandomState_FillIntRange(&r, ints, n, MIN_INT32,
+                                 (int)(MIN_INT32 + (int64)(3U << 30) - 1));
+        for (int x = 0; x < n; x++) {
+            b3[((int64)ints[x] - MIN_INT32) >> 30]++;
+        }
+        TEST(MBUnitTestChiSquared(b3, 3, n) < 32.0);
+
+        free(items);
     }
+
+    RandomState_Destroy(&r);
 }
 
-void MBUnitTest_MBLock(void)
+void MBUnitTest_RandomEnum(void)
 {
-#ifdef MB_HAS_SDL2
-    MBLock lock;
+    const int n = 50 * 1000;
+    int *out = (int *)malloc(n * sizeof(out[0]));
+    RandomState r;
+    RandomEnumSampler s;
 
-    MBLock_Create(&lock);
+    RandomState_CreateWithSeed(&r, mbtest.seed);
 
-    if (mb_debug) {
-        TEST(!MBLock_IsLocked(&lock));
+    /*
+     * Unnormalized weights, with a zero in the middle, and values that
+     * aren't the indices.
+     */
+    {
+        EnumDistribution dist[] = {
+            { 10, 1.0f }, { 20, 2.0f }, { 30, 0.0f }, { 40, 4.0f },
+            { 50, 0.5f }, { 60, 0.5f },
+        };
+        int numValues = ARRAYSIZE(dist);
+        float total = 8.0f;
+
+        RandomEnumSampler_Create(&s, dist, numValues);
+
+        for (int pass = 0; pass < 2; pass++) {
+            int counts[ARRAYSIZE(dist)];
+            double chi = 0.0;
+
+            MBUtil_Zero(counts, sizeof(counts));
+            if (pass == 0) {
+                for (int x = 0; x < n; x++) {
+                    out[x] = RandomState_SampleEnum(&r, &s);
+                }
+            } else {
+                RandomState_FillEnum(&r, &s, out, n);
+            }
+
+            for (int x = 0; x < n; x++) {
+                TEST(out[x] % 10 == 0 && out[x] >= 10 && out[x] <= 60);
+                counts[out[x] / 10 - 1]++;
+            }
+
+            TEST(counts[2] == 0);
+            for (int i = 0; i < numValues; i++) {
+                double expected = n * dist[i].probability / total;
+                if (expected > 0) {
+                    chi += (counts[i] - expected) * (counts[i] - expected) /
+                           expected;
+                }
+            }
+            // 4 degrees of freedom.
+            TEST(chi < 40.0);
+        }
+
+        RandomEnumSampler_Destroy(&s);
     }
-    MBLock_Lock(&lock);
 
-    if (mb_debug) {
-        TEST(MBLock_IsLocked(&lock));
+    /*
+     * A single value.
+     */
+    {
+        EnumDistribution one = { -7, 0.25f };
+
+        RandomEnumSampler_Create(&s, &one, 1);
+        TEST(RandomState_SampleEnum(&r, &s) == -7);
+        RandomState_FillEnum(&r, &s, out, 100);
+        for (int x = 0; x < 100; x++) {
+            TEST(out[x] == -7);
+        }
+        RandomEnumSampler_Destroy(&s);
     }
 
-    MBLock_Unlock(&lock);
-    MBLock_Destroy(&lock);
-#endif
+    /*
+     * A big random table: the per-value counts should track the
+     * weights, and the batch draws are reproducible.
+     */
+    {
+        const int numValues = 1000;
+        EnumDistribution *dist =
+            (EnumDistribution *)malloc(numValues * sizeof(dist[0]));
+        int *counts = (int *)malloc(numValues * sizeof(counts[0]));
+        int *out2 = (int *)malloc(n * sizeof(out2[0]));
+        double total = 0.0;
+        double chi = 0.0;
+        RandomState r2;
+
+        for (int i = 0; i < numValues; i++) {
+            dist[i].value = i;
+            dist[i].probability = RandomState_UnitFloat(&r) + 0.1f;
+            total += dist[i].probability;
+        }
+        RandomEnumSampler_Create(&s, dist, numValues);
+
+        MBUtil_Zero(counts, numValues * sizeof(counts[0]));
+        for (int pass = 0; pass < 4; pass++) {
+            RandomState_FillEnum(&r, &s, out, n);
+            for (int x = 0; x < n; x++) {
+                TEST(out[x] >= 0 && out[x] < numValues);
+                counts[out[x]]++;
+            }
+        }
+        for (int i = 0; i < numValues; i++) {
+            double expected = 4.0 * n * dist[i].probability / total;
+            chi += (counts[i] - expected) * (counts[i] - expected) / expected;
+        }
+        // 999 degrees of freedom, so the stddev is ~45.
+        TEST(chi < 999 + 6 * 45);
+
+        RandomState_CreateWithSeed(&r2, mbtest.seed);
+        RandomState_CreateWithSeed(&r, mbtest.seed);
+        RandomState_FillEnum(&r, &s, out, n);
+        RandomState_FillEnum(&r2, &s, out2, n);
+        TEST(memcmp(out, out2, n * sizeof(out[0])) == 0);
+
+        RandomEnumSampler_Destroy(&s);
+        RandomState_Destroy(&r2);
+        free(dist);
+        free(counts);
+        free(out2);
+    }
+
+    RandomState_Destroy(&r);
+    free(out);
 }
 
-void MBUnitTest_MBRing(void)
+/*
+ * Check the sample mean and variance against the expected ones, to
+ * within 6 standard errors.  The standard error of the sample variance
+ * depends on the distribution's kurtosis.
+ */
+static void MBUnitTestCheckMoments(const double *samples, int n,
+                                   double mean, double variance,
+                                   double kurtosis)
 {
-    MBRing r;
-    MBRing_Create(&r, sizeof(int));
-    TEST(MBRing_Size(&r) == 0);
+    double sum = 0.0;
+    double sumSq = 0.0;
+    double sampleMean;
+    double sampleVar;
 
-    for (int x = 0; x < 100; x++) {
-        TEST(MBRing_Size(&r) == x);
-        MBRing_InsertHead(&r, &x, sizeof(x));
-        TEST(MBRing_Size(&r) == x + 1);
+    for (int x = 0; x < n; x++) {
+        sum += samples[x];
     }
-    for (int x = 0; x < 100; x++) {
-        int v;
-        MBRing_RemoveTail(&r, &v, sizeof(v));
-        TEST(v == x);
+    sampleMean = sum / n;
+    for (int x = 0; x < n; x++) {
+        sumSq += (samples[x] - sampleMean) * (samples[x] - sampleMean);
     }
-    TEST(MBRing_Size(&r) == 0);
+    sampleVar = sumSq / (n - 1);
 
-    for (int x = 0; x < 100; x++) {
-        TEST(MBRing_Size(&r) == x);
-        MBRing_InsertTail(&r, &x, sizeof(x));
-        TEST(MBRing_Size(&r) == x + 1);
-    }
-    for (int x = 0; x < 100; x++) {
-        int v;
-        MBRing_RemoveHead(&r, &v, sizeof(v));
-        TEST(v == x);
-    }
-    TEST(MBRing_Size(&r) == 0);
+    TEST(fabs(sampleMean - mean) <= 6.0 * sqrt(variance / n) + 1e-9);
+    TEST(fabs(sampleVar - variance) <=
+         6.0 * variance * sqrt(MAX(kurtosis - 1.0, 0.1) / n) + 1e-9);
+}
 
-    for (int x = 0; x < 100; x++) {
-        TEST(MBRing_Size(&r) == x);
-        MBRing_InsertHead(&r, &x, sizeof(x));
-        TEST(MBRing_Size(&r) == x + 1);
-    }
-    for (int x = 99; x >= 0; x--) {
-        int v;
-        MBRing_RemoveHead(&r, &v, sizeof(v));
-        TEST(v == x);
-    }
-    TEST(MBRing_Size(&r) == 0);
+void MBUnitTest_RandomDistributions(void)
+{
+    const int n = 50 * 1000;
+    double *samples = (double *)malloc(n * sizeof(samples[0]));
+    RandomState r;
 
-    for (int x = 0; x < 100; x++) {
-        TEST(MBRing_Size(&r) == x);
-        MBRing_InsertTail(&r, &x, sizeof(x));
-        TEST(MBRing_Size(&r) == x + 1);
-    }
-    for (int x = 99; x >= 0; x--) {
-        int v;
-        MBRing_RemoveTail(&r, &v, sizeof(v));
-        TEST(v == x);
-    }
-    TEST(MBRing_Size(&r) == 0);
+    RandomState_CreateWithSeed(&r, mbtest.seed);
 
-    for (int x = 0; x < 100; x++) {
-        MBRing_InsertHead(&r, &x, sizeof(x));
-        MBRing_InsertTail(&r, &x, sizeof(x));
-    }
-    for (int x = 99; x >= 0; x--) {
-        int v;
-        MBRing_RemoveHead(&r, &v, sizeof(v));
-        TEST(v == x);
+    /*
+     * Normal: moments, plus a histogram against the CDF that reaches
+     * out past the ziggurat's base strip.
+     */
+    {
+        const double edges[] = { -3.7, -3, -2, -1.5, -1, -0.5, 0,
+                                 0.5, 1, 1.5, 2, 3, 3.7 };
+        const int numBuckets = ARRAYSIZE(edges) + 1;
+        int buckets[ARRAYSIZE(edges) + 1];
+        double chi = 0.0;
+
+        MBUtil_Zero(buckets, sizeof(buckets));
+        for (int x = 0; x < n; x++) {
+            int b = 0;
+            samples[x] = RandomState_Normal(&r, 0.0, 1.0);
+            while (b < numBuckets - 1 && samples[x] >= edges[b]) {
+                b++;
+            }
+            buckets[b]++;
+        }
+        MBUnitTestCheckMoments(samples, n, 0.0, 1.0, 3.0);
+
+        for (int b = 0; b < numBuckets; b++) {
+            double lo = b == 0 ? 0.0 : 0.5 * erfc(-edges[b - 1] / sqrt(2.0));
+            double hi = b == numBuckets - 1 ?
+                        1.0 : 0.5 * erfc(-edges[b] / sqrt(2.0));
+            double expected = n * (hi - lo);
+            chi += (buckets[b] - expected) * (buckets[b] - expected) /
+                   expected;
+        }
+        // 13 degrees of freedom.
+        TEST(chi < 55.0);
 
-        MBRing_RemoveTail(&r, &v, sizeof(v));
-        TEST(v == x);
+        for (int x = 0; x < 1000; x++) {
+            samples[x] = RandomState_Normal(&r, -5.0, 0.25);
+        }
+        MBUnitTestCheckMoments(samples, 1000, -5.0, 0.25 * 0.25, 3.0);
+        TEST(RandomState_Normal(&r, 3.0, 0.0) == 3.0);
     }
-    TEST(MBRing_Size(&r) == 0);
 
-    RandomState rs;
-    RandomState_CreateWithSeed(&rs, 0x1234567);
-    uint count = 0;
-    for (int x = 0; x < 1000; x++) {
-        int v = (int)RandomState_Uint32(&rs);
-        int z = RandomState_Int(&rs, 0, 3);
-        if (z == 0) {
-            count++;
-            MBRing_InsertHead(&r, &v, sizeof(v));
-        } else if (z == 1) {
-            count++;
-            MBRing_InsertTail(&r, &v, sizeof(v));
-        } else if (z == 2) {
-            if (count > 0) {
-                MBRing_RemoveHead(&r, &v, sizeof(v));
-                count--;
-            }
-        } else {
-            if (count > 0) {
-                MBRing_RemoveTail(&r, &v, sizeof(v));
-                count--;
+    /*
+     * Exponential: the same, with buckets well into the tail past R.
+     */
+    {
+        const double edges[] = { 0.1, 0.25, 0.5, 1, 1.5, 2, 3, 4, 6, 8 };
+        const int numBuckets = ARRAYSIZE(edges) + 1;
+        int buckets[ARRAYSIZE(edges) + 1];
+        double chi = 0.0;
+
+        MBUtil_Zero(buckets, sizeof(buckets));
+        for (int x = 0; x < n; x++) {
+            int b = 0;
+            samples[x] = RandomState_Exponential(&r, 1.0);
+            TEST(samples[x] >= 0.0);
+            while (b < numBuckets - 1 && samples[x] >= edges[b]) {
+                b++;
             }
+            buckets[b]++;
         }
+        MBUnitTestCheckMoments(samples, n, 1.0, 1.0, 9.0);
+
+        for (int b = 0; b < numBuckets; b++) {
+            double lo = b == 0 ? 0.0 : 1.0 - exp(-edges[b - 1]);
+            double hi = b == numBuckets - 1 ? 1.0 : 1.0 - exp(-edges[b]);
+            double expected = n * (hi - lo);
+            chi += (buckets[b] - expected) * (buckets[b] - expected) /
+                   expected;
+        }
+        // 10 degrees of freedom.
+        TEST(chi < 45.0);
 
-        TEST(MBRing_Size(&r) == count);
+        for (int x = 0; x < 1000; x++) {
+            samples[x] = RandomState_Exponential(&r, 20.0);
+        }
+        MBUnitTestCheckMoments(samples, 1000, 20.0, 400.0, 9.0);
     }
 
-    MBRing_Destroy(&r);
-}
\ No newline at end of file
+    /*
+     * Poisson, on both sides of the switch to transformed rejection.
+     */
+    {
+        const double means[] = { 0.0, 0.5, 4.0, 9.9, 10.0, 30.0, 1e4 };
+
+        for (uint i = 0; i < ARRAYSIZE(means); i++) {
+            for (int x = 0; x < n / 4; x++) {
+                int64 k = RandomState_Poisson(&r, means[i]);
+                TEST(k >= 0);
+                samples[x] = (double)k;
+            }
+            MBUnitTestCheckMoments(samples, n / 4, means[i], means[i],
+                                   3.0 + 1.0 / MAX(means[i], 1e-9));
+        }
+
+        /*
+         * Check the pmf itself around a mean of 30.
+         */
+        int buckets[12];
+        double chi = 0.0;
+        double pmfLeft = 0.0;
+
+        MBUtil_Zero(buckets, sizeof(buckets));
+        for (int x = 0; x < n; x++) {
+            int64 k = RandomState_Poisson(&r, 30.0);
+            int b = k < 20 ? 0 : (k >= 40 ? 11 : 1 + (int)(k - 20) / 2);
+            buckets[b]++;
+        }
+        for (int b = 0; b < 12; b++) {
+            double prob = 0.0;
+            int kLo = b == 0 ? 0 : 20 + 2 * (b - 1);
+            int kHi = b == 0 ? 20 : kLo + 2;
+
+            if (b == 11) {
+                prob = 1.0 - pmfLeft;
+            } else {
+                for (int k = kLo; k < kHi; k++) {
+                    prob += exp(k * log(30.0) - 30.0 - lgamma(k + 1.0));
+                }
+            }
+            pmfLeft += prob;
+            chi += (buckets[b] - n * prob) * (buckets[b] - n * prob) /
+                   (n * prob);
+        }
+        // 11 degrees of freedom.
+        TEST(chi < 50.0);
+    }
+
+    /*
+     * Binomial, including the p > 0.5 flip and the edges.
+     */
+    {
+        const struct {
+            int64 trials;
+            double p;
+        } params[] = {
+            { 1, 0.5 }, { 20, 0.3 }, { 100, 0.099 }, { 100, 0.1 },
+            { 1000, 0.4 }, { 1000, 0.9 }, { 1000000, 0.25 },
+        };
+
+        for (uint i = 0; i < ARRAYSIZE(params); i++) {
+            int64 trials = params[i].trials;
+            double p = params[i].p;
+
+            for (int x = 0; x < n / 4; x++) {
+                int64 k = RandomState_Binomial(&r, trials, p);
+                TEST(k >= 0 && k <= trials);
+                samples[x] = (double)k;
+            }
+            double npq = trials * p * (1.0 - p);
+            MBUnitTestCheckMoments(samples, n / 4, trials * p, npq,
+                                   3.0 + (1.0 - 6.0 * p * (1.0 - p)) / npq);
+        }
+
+        TEST(RandomState_Binomial(&r, 0, 0.5) == 0);
+        TEST(RandomState_Binomial(&r, 50, 0.0) == 0);
+        TEST(RandomState_Binomial(&r, 50, 1.0) == 50);
+    }
+
+    /*
+     * DiceSum, on both the per-die and per-face paths.
+     */
+    {
+        for (int x = 0; x < 1000; x++) {
+            int v = RandomState_DiceSum(&r, 3, 6);
+            TEST(v >= 3 && v <= 18);
+            TEST(RandomState_DiceSum(&r, 5000, 1) == 5000);
+        }
+
+        for (int x = 0; x < 2000; x++) {
+            int v = RandomState_DiceSum(&r, 1000, 6);
+            TEST(v >= 1000 && v <= 6000);
+            samples[x] = v;
+        }
+        MBUnitTestCheckMoments(samples, 2000, 3500.0, 1000.0 * 35.0 / 12.0,
+                               3.0);
+    }
+
+    RandomState_Destroy(&r);
+    free(samples);
+}
+
+typedef struct MBUnitTestRandomThread {
+    MBThread thread;
+    uint64 streamId;
+    uint32 values[100];
+} MBUnitTestRandomThread;
+
+static void MBUnitTestRandomThreadFn(void *data)
+{
+    MBUnitTestRandomThread *t = (MBUnitTestRandomThread *)data;
+
+    Random_InitThread(t->streamId);
+    for (uint i = 0; i < ARRAYSIZE(t->values); i++) {
+        t->values[i] = Random_Uint32();
+    }
+    Random_ExitThread();
+}
+
+void MBUnitTest_RandomStreams(void)
+{
+    for (int e = 0; e < RANDOM_ENGINE_MAX; e++) {
+        RandomEngineType engine = (RandomEngineType)e;
+        RandomState r;
+        RandomState r2;
+        RandomState child;
+        RandomState child2;
+        uint64 n;
+
+        /*
+         * Jumping matches stepping, on both sides of the cutoff for
+         * stepping xoshiro256 directly.
+         */
+        uint64 lens[] = { 0, 1, 255, 256, 257, 1000,
+                          (uint32)mbtest.seed % 5000 };
+        for (uint i = 0; i < ARRAYSIZE(lens); i++) {
+            RandomState_CreateWithEngine(&r, engine, mbtest.seed);
+            RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+
+            RandomState_Jump(&r, lens[i]);
+            for (uint64 x = 0; x < lens[i]; x++) {
+                RandomState_Uint32(&r2);
+            }
+            for (int x = 0; x < 10; x++) {
+                TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+            }
+        }
+
+        /*
+         * Big jumps compose.
+         */
+        n = (1ULL << 40) + (uint32)mbtest.seed;
+        RandomState_CreateWithEngine(&r, engine, mbtest.seed);
+        RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+        RandomState_Jump(&r, n);
+        RandomState_Jump(&r, 1ULL << 62);
+        RandomState_Jump(&r2, n + (1ULL << 62));
+        TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+        RandomState_Jump(&r, MAX_UINT64);
+        RandomState_Jump(&r2, MAX_UINT64 - 1);
+        RandomState_Uint32(&r2);
+        TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+
+        /*
+         * Split is deterministic, and moves the parent along.
+         */
+        RandomState_CreateWithEngine(&r, engine, mbtest.seed);
+        RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+        RandomState_Split(&r, &child);
+        RandomState_Split(&r2, &child2);
+        TEST(RandomState_GetEngine(&child) == engine);
+        TEST(RandomState_Uint64(&child) == RandomState_Uint64(&child2));
+        TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+        RandomState_Split(&r, &child2);
+        TEST(RandomState_Uint64(&child) != RandomState_Uint64(&child2));
+
+        /*
+         * CreateStream only depends on the parent's seed and the id.
+         */
+        RandomState_CreateWithEngine(&r, engine, mbtest.seed);
+        RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+        RandomState_CreateStream(&child, &r, 7);
+        RandomState_Uint64(&r2);
+        RandomState_CreateStream(&child2, &r2, 7);
+        TEST(RandomState_Uint64(&child) == RandomState_Uint64(&child2));
+        RandomState_CreateStream(&child2, &r, 8);
+        TEST(RandomState_Uint64(&child) != RandomState_Uint64(&child2));
+        RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+        TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+
+        RandomState_Destroy(&r);
+        RandomState_Destroy(&r2);
+        RandomState_Destroy(&child);
+        RandomState_Destroy(&child2);
+    }
+
+    /*
+     * Per-thread streams for the Random_* functions.
+     */
+    if (mb_has_mbthread) {
+        MBUnitTestRandomThread threads[3];
+        RandomState module;
+        uint64 moduleSeed = Random_GetSeed();
+
+        RandomState_CreateWithSeed(&module, moduleSeed);
+
+        for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+            threads[i].streamId = i;
+            MBThread_Create(&threads[i].thread, MBUnitTestRandomThreadFn,
+                            &threads[i]);
+        }
+        // The main thread keeps using the shared state meanwhile.
+        Random_Uint32();
+        for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+            MBThread_Join(&threads[i].thread);
+        }
+
+        for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+            RandomState expected;
+            RandomState_CreateStream(&expected, &module, i);
+            for (uint x = 0; x < ARRAYSIZE(threads[i].values); x++) {
+                TEST(threads[i].values[x] == RandomState_Uint32(&expected));
+            }
+            RandomState_Destroy(&expected);
+        }
+        TEST(Random_GetSeed() == moduleSeed);
+
+        Random_InitThread(1);
+        TEST(Random_Uint32() == threads[1].values[0]);
+        Random_ExitThread();
+
+        RandomState_Destroy(&module);
+    }
+}
+
+static uint64 MBUnitTestSplitMix64(uint64 *x)
+{
+    uint64 z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64 MBUnitTestXoshiro256(uint64 *s)
+{
+    uint64 x = s[1] * 5;
+    uint64 result = ((x << 7) | (x >> 57)) * 9;
+    uint64 t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+void MBUnitTest_RandomFill(void)
+{
+    const int lanes = 8;
+    const int n = 64 * 1024 + 13;
+    uint32 *u32 = (uint32 *)malloc(n * sizeof(u32[0]));
+    uint32 *u32b = (uint32 *)malloc(n * sizeof(u32b[0]));
+    uint64 *u64 = (uint64 *)malloc(n * sizeof(u64[0]));
+    float *f = (float *)malloc(n * sizeof(f[0]));
+    int *ints = (int *)malloc(n * sizeof(ints[0]));
+    RandomState r;
+    RandomState r2;
+
+    /*
+     * The lanes are plain xoshiro256** streams seeded by SplitMix64
+     * from one Uint64 of the parent state.
+     */
+    {
+        uint64 state[8][4];
+        uint64 sm;
+        int count = 3 * lanes + 5;
+
+        RandomState_CreateWithSeed(&r, mbtest.seed);
+        RandomState_CreateWithSeed(&r2, mbtest.seed);
+        sm = RandomState_Uint64(&r2);
+        for (int i = 0; i < 4; i++) {
+            for (int l = 0; l < lanes; l++) {
+                state[l][i] = MBUnitTestSplitMix64(&sm);
+            }
+        }
+
+        RandomState_FillUint64(&r, u64, count);
+        for (int x = 0; x < count; x++) {
+            TEST(u64[x] == MBUnitTestXoshiro256(state[x % lanes]));
+        }
+
+        // Both consumed exactly one Uint64.
+        TEST(RandomState_Uint64(&r) == RandomState_Uint64(&r2));
+    }
+
+    /*
+     * Reproducible for a seed, and a shorter fill is a prefix of
+     * a longer one.
+     */
+    for (int e = 0; e < RANDOM_ENGINE_MAX; e++) {
+        RandomEngineType engine = (RandomEngineType)e;
+        int m = (uint32)mbtest.seed % 100;
+
+        RandomState_CreateWithEngine(&r, engine, mbtest.seed);
+        RandomState_CreateWithEngine(&r2, engine, mbtest.seed);
+        RandomState_FillUint32(&r, u32, n);
+        RandomState_FillUint32(&r2, u32b, m);
+        TEST(memcmp(u32, u32b, m * sizeof(u32[0])) == 0);
+
+        RandomState_FillUint32(&r, u32, n);
+        RandomState_FillUint32(&r2, u32b, n);
+        TEST(memcmp(u32, u32b, n * sizeof(u32[0])) == 0);
+
+        RandomState_FillUint32(&r2, u32b, n);
+        TEST(memcmp(u32, u32b, n * sizeof(u32[0])) != 0);
+    }
+
+    RandomState_CreateWithSeed(&r, mbtest.seed);
+
+    {
+        int bitCounts[32];
+        MBUtil_Zero(bitCounts, sizeof(bitCounts));
+
+        RandomState_FillUint32(&r, u32, n);
+        for (int x = 0; x < n; x++) {
+            for (int b = 0; b < 32; b++) {
+                bitCounts[b] += (u32[x] >> b) & 1;
+            }
+        }
+        for (int b = 0; b < 32; b++) {
+            TEST(abs(bitCounts[b] - n / 2) < 6 * 128);
+        }
+    }
+
+    {
+        double sum = 0.0;
+
+        RandomState_FillUnitFloat(&r, f, n);
+        for (int x = 0; x < n; x++) {
+            TEST(f[x] >= 0.0f && f[x] < 1.0f);
+            sum += f[x];
+        }
+        TEST(fabs(sum / n - 0.5) < 0.01);
+    }
+
+    {
+        int buckets[7];
+        double chi = 0.0;
+        int min = ((int)((uint32)mbtest.seed % 1000)) - 500;
+
+        MBUtil_Zero(buckets, sizeof(buckets));
+        RandomState_FillIntRange(&r, ints, n, min, min + 6);
+        for (int x = 0; x < n; x++) {
+            TEST(ints[x] >= min && ints[x] <= min + 6);
+            buckets[ints[x] - min]++;
+        }
+        for (int b = 0; b < 7; b++) {
+            double expected = n / 7.0;
+            chi += (buckets[b] - expected) * (buckets[b] - expected) / expected;
+        }
+        // 6 degrees of freedom.
+        TEST(chi < 40.0);
+
+        RandomState_FillIntRange(&r, ints, n, 5, 5);
+        for (int x = 0; x < n; x++) {
+            TEST(ints[x] == 5);
+        }
+
+        RandomState_FillIntRange(&r, ints, n, MIN_INT32, MAX_INT32);
+        RandomState_FillIntRange(&r, ints, n, -1, MAX_INT32);
+        for (int x = 0; x < n; x++) {
+            TEST(ints[x] >= -1);
+        }
+    }
+
+    RandomState_FillUint64(&r, u64, 0);
+    RandomState_FillUint32(&r, u32, 1);
+
+    RandomState_Destroy(&r);
+    RandomState_Destroy(&r2);
+    free(u32);
+    free(u32b);
+    free(u64);
+    free(f);
+    free(ints);
+}
+
+void MBUnitTest_MBQueue(void)
+{
+    MBQueue<int> q;
+    const int count = 1000;
+    int result;
+
+    for (int x = 0; x < count; x++) {
+        q.enqueue(x);
+
+        result = q.size();
+        TEST(result == x + 1);
+    }
+
+    for (int x = 0; x < count; x++) {
+        result = q.dequeue();
+        TEST(result == x);
+
+        result = q.size();
+        TEST(result == count - (x + 1));
+    }
+}
+
+
+void MBUnitTest_MBRegistry(void)
+{
+    MBRegistry *mreg;
+    const char *s;
+
+    mreg = MBRegistry_Alloc();
+    MBRegistry_Free(mreg);
+
+    mreg = MBRegistry_Alloc();
+    MBRegistry_PutConst(mreg, "key", "value");
+    TEST(strcmp(MBRegistry_Get(mreg, "key"), "value") == 0);
+    s = "OtherValue";
+    MBRegistry_PutConst(mreg, "OtherKey", s);
+    TEST(MBRegistry_Get(mreg, "OtherKey") == s);
+    MBRegistry_PutConst(mreg, "key", s);
+    TEST(MBRegistry_Get(mreg, "key") == s);
+    MBRegistry_Remove(mreg, "key");
+    MBRegistry_Remove(mreg, "OtherKey");
+    TEST(MBRegistry_Get(mreg, "key") == NULL);
+    TEST(MBRegistry_Get(mreg, "OtherKey") == NULL);
+    MBRegistry_Free(mreg);
+}
+
+int testCompareUint32(const void *lhs, const void *rhs, void *cbData)
+{
+    uint32 *lhsT = (uint32*)lhs;
+    uint32 *rhsT = (uint32*)rhs;
+
+    ASSERT(cbData == NULL);
+
+    if (*lhsT < *rhsT) {
+        return -1;
+    } else if (*lhsT == *rhsT) {
+        return 0;
+    } else {
+        return 1;
+    }
+}
+
+int testCompareInt32(const void *lhs, const void *rhs, void *cbData)
+{
+    int32 l = *(int32 *)lhs;
+    int32 r = *(int32 *)rhs;
+    return (l > r) - (l < r);
+}
+
+static int testCompareUint64(const void *lhs, const void *rhs, void *cbData)
+{
+    uint64 l = *(uint64 *)lhs;
+    uint64 r = *(uint64 *)rhs;
+    return (l > r) - (l < r);
+}
+
+typedef struct TestRadixItem {
+    uint16 pad;
+    float key;
+    int32 order;
+} TestRadixItem;
+
+#define TEST_GREATER(_lhs, _rhs) ((_lhs) > (_rhs))
+DECLARE_CMBVECTOR_TYPE(uint64, TestUint64Vec);
+DECLARE_CMBVECTOR_SORT(uint64, TestUint64Vec, TEST_GREATER);
+
+static void MBUnitTestMBCompareTyped(void)
+{
+    RandomState rs;
+    int sizes[] = { 0, 1, 2, 17, 100, 511, 512, 2000, 10 * 1000 };
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    for (uint s = 0; s < ARRAYSIZE(sizes); s++) {
+        int n = sizes[s];
+        int range = (s % 2 == 0) ? 10 : MAX_INT32 / 2;
+        CMBIntVec iv;
+        CMBIntVec ref;
+        CMBFloatVec fv;
+        TestUint64Vec uv;
+
+        CMBIntVec_CreateWithSize(&iv, n);
+        CMBIntVec_CreateWithSize(&ref, n);
+        CMBFloatVec_CreateWithSize(&fv, n);
+        TestUint64Vec_CreateWithSize(&uv, n);
+
+        for (int x = 0; x < n; x++) {
+            int v = RandomState_Int(&rs, -range, range);
+            CMBIntVec_PutValue(&iv, x, v);
+            CMBIntVec_PutValue(&ref, x, v);
+            CMBFloatVec_PutValue(&fv, x, v / 4.0f);
+            TestUint64Vec_PutValue(&uv, x, RandomState_Uint64(&rs));
+        }
+
+        MBCompare_Sort(CMBIntVec_GetCArray(&ref), n, sizeof(int),
+                       testCompareInt32, NULL);
+        CMBIntVec_Sort(&iv);
+        CMBFloatVec_Sort(&fv);
+        TestUint64Vec_Sort(&uv);
+
+        for (int x = 0; x < n; x++) {
+            TEST(CMBIntVec_GetValue(&iv, x) == CMBIntVec_GetValue(&ref, x));
+            TEST(CMBFloatVec_GetValue(&fv, x) ==
+                 CMBIntVec_GetValue(&ref, x) / 4.0f);
+            if (x > 0) {
+                TEST(TestUint64Vec_GetValue(&uv, x - 1) >=
+                     TestUint64Vec_GetValue(&uv, x));
+            }
+        }
+
+        // Already sorted input.
+        CMBIntVec_Sort(&iv);
+        for (int x = 0; x < n; x++) {
+            TEST(CMBIntVec_GetValue(&iv, x) == CMBIntVec_GetValue(&ref, x));
+        }
+
+        CMBIntVec_Destroy(&iv);
+        CMBIntVec_Destroy(&ref);
+        CMBFloatVec_Destroy(&fv);
+        TestUint64Vec_Destroy(&uv);
+    }
+
+    /*
+     * Sort structs by an embedded float key, and check that it's stable.
+     */
+    {
+        const int n = 1000;
+        TestRadixItem *items = (TestRadixItem *)malloc(n * sizeof(items[0]));
+
+        for (int x = 0; x < n; x++) {
+            items[x].pad = 0;
+            items[x].key = RandomState_Int(&rs, -20, 20) / 2.0f;
+            items[x].order = x;
+        }
+
+        MBCompare_RadixSort(items, n, sizeof(items[0]),
+                            OFFSETOF(TestRadixItem, key), MBCOMPARE_KEY_FLOAT);
+
+        for (int x = 1; x < n; x++) {
+            TEST(items[x - 1].key <= items[x].key);
+            if (items[x - 1].key == items[x].key) {
+                TEST(items[x - 1].order < items[x].order);
+            }
+        }
+        free(items);
+    }
+
+    {
+        int64 items[] = { 5, -1, MAX_INT64, MIN_INT64, 0, -7, 3 };
+        double ditems[] = { 0.5, -1.5, 1e300, -1e300, 0.0, -7.25, 3.0 };
+        MBCompare_RadixSortInt64(items, ARRAYSIZE(items));
+        MBCompare_RadixSortDouble(ditems, ARRAYSIZE(ditems));
+        for (uint x = 1; x < ARRAYSIZE(items); x++) {
+            TEST(items[x - 1] <= items[x]);
+            TEST(ditems[x - 1] <= ditems[x]);
+        }
+        TEST(items[0] == MIN_INT64);
+        TEST(ditems[0] == -1e300);
+    }
+}
+
+typedef struct TestBigItem {
+    int32 key;
+    uint8 payload[600];
+} TestBigItem;
+
+static int testCompareBigItem(const void *lhs, const void *rhs, void *cbData)
+{
+    const TestBigItem *l = (const TestBigItem *)lhs;
+    const TestBigItem *r = (const TestBigItem *)rhs;
+    return testCompareInt32(&l->key, &r->key, cbData);
+}
+
+static int testCompareRadixItem(const void *lhs, const void *rhs, void *cbData)
+{
+    const TestRadixItem *l = (const TestRadixItem *)lhs;
+    const TestRadixItem *r = (const TestRadixItem *)rhs;
+    return testCompareInt32(&l->order, &r->order, cbData);
+}
+
+/*
+ * Exercise the generic introsort across item sizes, including one
+ * bigger than its stack swap buffer.
+ */
+static void MBUnitTestMBCompareIntroSort(void)
+{
+    RandomState rs;
+    int sizes[] = { 0, 1, 2, 3, 16, 17, 100, 1000, 5000 };
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    for (uint s = 0; s < ARRAYSIZE(sizes); s++) {
+        int n = sizes[s];
+        int range = (s % 2 == 0) ? 5 : MAX_INT32 / 2;
+        int32 *ints = (int32 *)malloc((n + 1) * sizeof(ints[0]));
+        uint64 *wide = (uint64 *)malloc((n + 1) * sizeof(wide[0]));
+        TestRadixItem *mids = (TestRadixItem *)malloc((n + 1) * sizeof(mids[0]));
+        TestBigItem *bigs = (TestBigItem *)malloc((n + 1) * sizeof(bigs[0]));
+
+        for (int x = 0; x < n; x++) {
+            ints[x] = RandomState_Int(&rs, -range, range);
+            wide[x] = RandomState_Uint64(&rs);
+            mids[x].pad = x;
+            mids[x].key = (float)x;
+            mids[x].order = RandomState_Int(&rs, -range, range);
+            bigs[x].key = RandomState_Int(&rs, -range, range);
+            memset(bigs[x].payload, (uint8)bigs[x].key, sizeof(bigs[x].payload));
+        }
+
+        MBCompare_IntroSort(ints, n, sizeof(ints[0]), testCompareInt32, NULL);
+        MBCompare_IntroSort(wide, n, sizeof(wide[0]), testCompareUint64, NULL);
+        MBCompare_IntroSort(mids, n, sizeof(mids[0]),
+                            testCompareRadixItem, NULL);
+        MBCompare_IntroSort(bigs, n, sizeof(bigs[0]), testCompareBigItem, NULL);
+
+        for (int x = 0; x < n; x++) {
+            TEST(mids[x].key == (float)mids[x].pad);
+            TEST(bigs[x].payload[0] == (uint8)bigs[x].key);
+            TEST(bigs[x].payload[sizeof(bigs[x].payload) - 1] ==
+                 (uint8)bigs[x].key);
+
+            if (x > 0) {
+                TEST(ints[x - 1] <= ints[x]);
+                TEST(wide[x - 1] <= wide[x]);
+                TEST(mids[x - 1].order <= mids[x].order);
+                TEST(bigs[x - 1].key <= bigs[x].key);
+            }
+        }
+
+        /*
+         * Reverse sorted input shouldn't fall over either.
+         */
+        for (int x = 0; x < n; x++) {
+            ints[x] = n - x;
+        }
+        MBCompare_IntroSort(ints, n, sizeof(ints[0]), testCompareInt32, NULL);
+        for (int x = 0; x < n; x++) {
+            TEST(ints[x] == x + 1);
+        }
+
+        free(ints);
+        free(wide);
+        free(mids);
+        free(bigs);
+    }
+}
+
+/*
+ * Check SortMinN and NthElement against a full sort, on both sides of
+ * the point where SortMinN switches from the heap to selecting.
+ */
+static void MBUnitTestMBCompareSelect(void)
+{
+    RandomState rs;
+    int sizes[] = { 1, 2, 17, 100, 1000, 5000 };
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    for (uint s = 0; s < ARRAYSIZE(sizes); s++) {
+        int n = sizes[s];
+        int range = (s % 2 == 0) ? 5 : MAX_INT32 / 2;
+        int32 *ref = (int32 *)malloc(n * sizeof(ref[0]));
+        int32 *items = (int32 *)malloc(n * sizeof(items[0]));
+        int32 *orig = (int32 *)malloc(n * sizeof(orig[0]));
+        int ks[] = { 0, 1, n / 100, n / MBCOMPARE_SORTMINN_SELECT_RATIO,
+                     n / 2, n - 1, n,
+                     RandomState_Int(&rs, 0, n) };
+
+        for (int x = 0; x < n; x++) {
+            orig[x] = RandomState_Int(&rs, -range, range);
+            ref[x] = orig[x];
+        }
+        MBCompare_IntroSort(ref, n, sizeof(ref[0]), testCompareInt32, NULL);
+
+        for (uint i = 0; i < ARRAYSIZE(ks); i++) {
+            int k = ks[i];
+            int64 sum = 0;
+
+            memcpy(items, orig, n * sizeof(items[0]));
+            MBCompare_SortMinN(k, items, n, sizeof(items[0]),
+                               testCompareInt32, NULL);
+            for (int x = 0; x < n; x++) {
+                if (x < k) {
+                    TEST(items[x] == ref[x]);
+                } else if (k > 0) {
+                    TEST(items[x] >= ref[k - 1]);
+                }
+                sum += items[x] - orig[x];
+            }
+            TEST(sum == 0);
+
+            if (k < n) {
+                memcpy(items, orig, n * sizeof(items[0]));
+                MBCompare_NthElement(k, items, n, sizeof(items[0]),
+                                     testCompareInt32, NULL);
+                TEST(items[k] == ref[k]);
+                for (int x = 0; x < n; x++) {
+                    TEST(x > k || items[x] <= items[k]);
+                    TEST(x < k || items[x] >= items[k]);
+                }
+            }
+        }
+
+        free(ref);
+        free(items);
+        free(orig);
+    }
+}
+
+static void MBUnitTestMBCompareParallel(void)
+{
+    RandomState rs;
+    uint threads[] = { 0, 1, 2, 3, 8 };
+    int n = MBCOMPARE_PARALLEL_SORT_THRESHOLD * 2 + 17;
+    int32 *items = (int32 *)malloc(n * sizeof(items[0]));
+    TestRadixItem *ritems = (TestRadixItem *)malloc(n * sizeof(ritems[0]));
+    CMBIntVec iv;
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+    CMBIntVec_CreateWithSize(&iv, n);
+
+    for (uint t = 0; t < ARRAYSIZE(threads); t++) {
+        for (int x = 0; x < n; x++) {
+            items[x] = RandomState_Int(&rs, -1000, 1000);
+            CMBIntVec_PutValue(&iv, x, items[x]);
+        }
+
+        MBCompare_ParallelSort(items, n, sizeof(items[0]),
+                               testCompareInt32, NULL, threads[t]);
+        CMBIntVec_ParallelSort(&iv, threads[t]);
+        for (int x = 1; x < n; x++) {
+            TEST(items[x - 1] <= items[x]);
+            TEST(CMBIntVec_GetValue(&iv, x - 1) <= CMBIntVec_GetValue(&iv, x));
+        }
+
+        /*
+         * The radix version should stay stable across the merges.
+         */
+        for (int x = 0; x < n; x++) {
+            ritems[x].pad = 0;
+            ritems[x].key = RandomState_Int(&rs, -50, 50) / 4.0f;
+            ritems[x].order = x;
+        }
+        MBCompare_ParallelRadixSort(ritems, n, sizeof(ritems[0]),
+                                    OFFSETOF(TestRadixItem, key),
+                                    MBCOMPARE_KEY_FLOAT, threads[t]);
+        for (int x = 1; x < n; x++) {
+            TEST(ritems[x - 1].key <= ritems[x].key);
+            if (ritems[x - 1].key == ritems[x].key) {
+                TEST(ritems[x - 1].order < ritems[x].order);
+            }
+        }
+    }
+
+    CMBIntVec_Destroy(&iv);
+    free(items);
+    free(ritems);
+}
+
+static int testCompareRadixItemKey(const void *lhs, const void *rhs,
+                                   void *cbData)
+{
+    const TestRadixItem *l = (const TestRadixItem *)lhs;
+    const TestRadixItem *r = (const TestRadixItem *)rhs;
+    return (l->key > r->key) - (l->key < r->key);
+}
+
+static void MBUnitTestMBCompareMerge(void)
+{
+    RandomState rs;
+    int sizes[] = { 0, 1, 2, 16, 17, 33, 1000, 5000 };
+    CMBComparator comp;
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    comp.itemSize = sizeof(TestRadixItem);
+    comp.compareFn = testCompareRadixItemKey;
+    comp.cbData = NULL;
+
+    /*
+     * Stable sort on the key, with the original order as a tie-break.
+     */
+    for (uint s = 0; s < ARRAYSIZE(sizes); s++) {
+        int n = sizes[s];
+        TestRadixItem *items = (TestRadixItem *)malloc((n + 1) * sizeof(items[0]));
+
+        for (int x = 0; x < n; x++) {
+            items[x].pad = 0;
+            items[x].key = RandomState_Int(&rs, -10, 10);
+            items[x].order = x;
+        }
+        MBCompare_StableSort(items, n, sizeof(items[0]),
+                             testCompareRadixItemKey, NULL);
+        for (int x = 1; x < n; x++) {
+            TEST(items[x - 1].key <= items[x].key);
+            if (items[x - 1].key == items[x].key) {
+                TEST(items[x - 1].order < items[x].order);
+            }
+        }
+        free(items);
+    }
+
+    /*
+     * Merge k sorted vectors, tagging each item with its source so we
+     * can check that ties come out in source order.
+     */
+    for (uint32 k = 0; k <= 9; k++) {
+        CMBVector srcVecs[9];
+        CMBVector *srcs[9];
+        CMBVector dest;
+        int64 total = 0;
+
+        for (uint32 i = 0; i < k; i++) {
+            int n = RandomState_Int(&rs, 0, i == 3 ? 0 : 300);
+            CMBVector_CreateEmpty(&srcVecs[i], sizeof(TestRadixItem));
+            CMBVector_Resize(&srcVecs[i], n);
+            for (int x = 0; x < n; x++) {
+                TestRadixItem *item =
+                    (TestRadixItem *)CMBVector_GetPtr(&srcVecs[i], x);
+                item->pad = i;
+                item->key = RandomState_Int(&rs, 0, 50);
+                item->order = x;
+            }
+            CMBVector_StableSort(&srcVecs[i], &comp);
+            srcs[i] = &srcVecs[i];
+            total += n;
+        }
+
+        CMBVector_CreateEmpty(&dest, sizeof(TestRadixItem));
+        CMBVector_MergeSorted(&dest, srcs, k, &comp);
+        TEST(CMBVector_Size(&dest) == total);
+
+        for (int64 x = 1; x < total; x++) {
+            TestRadixItem *l = (TestRadixItem *)CMBVector_GetPtr(&dest, x - 1);
+            TestRadixItem *r = (TestRadixItem *)CMBVector_GetPtr(&dest, x);
+            TEST(l->key <= r->key);
+            if (l->key == r->key) {
+                TEST(l->pad < r->pad ||
+                     (l->pad == r->pad && l->order < r->order));
+            }
+        }
+
+        if (k == 2) {
+            TestRadixItem *two = (TestRadixItem *)malloc((total + 1) *
+                                                         sizeof(two[0]));
+            MBCompare_MergeSorted(two,
+                                  CMBVector_GetCArray(srcs[0]),
+                                  CMBVector_Size(srcs[0]),
+                                  CMBVector_GetCArray(srcs[1]),
+                                  CMBVector_Size(srcs[1]),
+                                  sizeof(two[0]), testCompareRadixItemKey,
+                                  NULL);
+            TEST(total == 0 ||
+                 memcmp(two, CMBVector_GetCArray(&dest),
+                        total * sizeof(two[0])) == 0);
+            free(two);
+        }
+
+        CMBVector_Destroy(&dest);
+        for (uint32 i = 0; i < k; i++) {
+            CMBVector_Destroy(&srcVecs[i]);
+        }
+    }
+}
+
+void MBUnitTest_MBCompare(void)
+{
+    uint32 array[10];
+
+    for (uint32 i = 0; i < ARRAYSIZE(array); i++) {
+        array[i] = 100 - i;
+    }
+
+    MBCompare_SortFallback(array, ARRAYSIZE(array), sizeof(array[0]),
+                           testCompareUint32, NULL);
+
+    for (uint32 i = 1; i < ARRAYSIZE(array); i++) {
+        TEST(array[i-1] <= array[i]);
+    }
+
+    for (uint32 i = 0; i < ARRAYSIZE(array); i++) {
+        array[i] = 100 - i;
+    }
+
+    MBCompare_Sort(array, ARRAYSIZE(array), sizeof(array[0]),
+                   testCompareUint32, NULL);
+
+    for (uint32 i = 1; i < ARRAYSIZE(array); i++) {
+        TEST(array[i-1] <= array[i]);
+    }
+
+    MBUnitTestMBCompareTyped();
+    MBUnitTestMBCompareIntroSort();
+    MBUnitTestMBCompareSelect();
+    MBUnitTestMBCompareParallel();
+    MBUnitTestMBCompareMerge();
+}
+
+static int testCompareIndexedHeapEntry(const void *lhs, const void *rhs,
+                                       void *cbData)
+{
+    const CMBIndexedHeapEntry *l = (const CMBIndexedHeapEntry *)lhs;
+    const CMBIndexedHeapEntry *r = (const CMBIndexedHeapEntry *)rhs;
+    return (l->key > r->key) - (l->key < r->key);
+}
+
+static void MBUnitTestMBIndexedHeap(void)
+{
+    RandomState rs;
+    const int numIds = 200;
+    double keys[numIds];
+    bool present[numIds];
+    uint32 arities[] = { 2, 3, 4 };
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    for (uint a = 0; a < ARRAYSIZE(arities); a++) {
+        CMBIndexedHeap h;
+        int64 count = 0;
+
+        CMBIndexedHeap_CreateWithArity(&h, arities[a]);
+        for (int id = 0; id < numIds; id++) {
+            present[id] = FALSE;
+        }
+
+        for (int x = 0; x < 5000; x++) {
+            int id = RandomState_Int(&rs, 0, numIds - 1);
+            double key = RandomState_Int(&rs, -1000, 1000);
+            int op = RandomState_Int(&rs, 0, 4);
+
+            TEST(CMBIndexedHeap_Contains(&h, id) == present[id]);
+
+            if (!present[id]) {
+                CMBIndexedHeap_Push(&h, id, key);
+                keys[id] = key;
+                present[id] = TRUE;
+                count++;
+            } else if (op == 0) {
+                CMBIndexedHeap_Remove(&h, id);
+                present[id] = FALSE;
+                count--;
+            } else if (op == 1) {
+                CMBIndexedHeap_UpdateKey(&h, id, key);
+                keys[id] = key;
+            } else if (op == 2) {
+                TEST(CMBIndexedHeap_PushOrDecrease(&h, id, key) ==
+                     (key < keys[id]));
+                keys[id] = MIN(keys[id], key);
+            } else {
+                int minId = -1;
+                double popKey;
+
+                for (int i = 0; i < numIds; i++) {
+                    if (present[i] && (minId == -1 || keys[i] < keys[minId])) {
+                        minId = i;
+                    }
+                }
+                TEST(CMBIndexedHeap_PeekKey(&h) == keys[minId]);
+                int popped = CMBIndexedHeap_Pop(&h, &popKey);
+                TEST(popKey == keys[minId]);
+                TEST(keys[popped] == keys[minId]);
+                present[popped] = FALSE;
+                count--;
+            }
+
+            TEST(CMBIndexedHeap_Size(&h) == count);
+            TEST(!present[id] || CMBIndexedHeap_GetKey(&h, id) == keys[id]);
+        }
+
+        CMBIndexedHeap_MakeEmpty(&h);
+        for (int id = 0; id < numIds; id++) {
+            TEST(!CMBIndexedHeap_Contains(&h, id));
+        }
+        CMBIndexedHeap_Destroy(&h);
+    }
+
+    /*
+     * Dijkstra on a random graph, against the lazy-deletion version
+     * with a plain priority queue.
+     */
+    {
+        const int numNodes = 300;
+        const int degree = 4;
+        int edges[numNodes][degree];
+        double weights[numNodes][degree];
+        double distA[numNodes];
+        double distB[numNodes];
+        CMBIndexedHeap h;
+        CMBPriorityQueue pq;
+        CMBComparator comp;
+
+        for (int n = 0; n < numNodes; n++) {
+            for (int e = 0; e < degree; e++) {
+                edges[n][e] = RandomState_Int(&rs, 0, numNodes - 1);
+                weights[n][e] = RandomState_Int(&rs, 1, 100);
+            }
+            distA[n] = -1;
+            distB[n] = -1;
+        }
+
+        CMBIndexedHeap_Create(&h);
+        CMBIndexedHeap_Push(&h, 0, 0);
+        while (!CMBIndexedHeap_IsEmpty(&h)) {
+            double d;
+            int n = CMBIndexedHeap_Pop(&h, &d);
+            distA[n] = d;
+            for (int e = 0; e < degree; e++) {
+                if (distA[edges[n][e]] < 0) {
+                    CMBIndexedHeap_PushOrDecrease(&h, edges[n][e],
+                                                  d + weights[n][e]);
+                }
+            }
+        }
+        CMBIndexedHeap_Destroy(&h);
+
+        comp.compareFn = testCompareIndexedHeapEntry;
+        comp.cbData = NULL;
+        comp.itemSize = sizeof(CMBIndexedHeapEntry);
+        CMBPriorityQueue_Create(&pq, &comp);
+        CMBIndexedHeapEntry start = { 0, 0 };
+        CMBPriorityQueue_Push(&pq, &start);
+        while (!CMBPriorityQueue_IsEmpty(&pq)) {
+            CMBIndexedHeapEntry cur;
+            CMBPriorityQueue_Pop(&pq, &cur);
+            if (distB[cur.id] >= 0) {
+                continue;
+            }
+            distB[cur.id] = cur.key;
+            for (int e = 0; e < degree; e++) {
+                CMBIndexedHeapEntry next;
+                next.id = edges[cur.id][e];
+                next.key = cur.key + weights[cur.id][e];
+                if (distB[next.id] < 0) {
+                    CMBPriorityQueue_Push(&pq, &next);
+                }
+            }
+        }
+        CMBPriorityQueue_Destroy(&pq);
+
+        for (int n = 0; n < numNodes; n++) {
+            TEST(distA[n] == distB[n]);
+        }
+    }
+}
+
+void MBUnitTest_MBPriorityQueue(void)
+{
+    RandomState rs;
+    CMBComparator comp;
+    uint32 arities[] = { 2, 3, 4, 8 };
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    comp.compareFn = testCompareInt32;
+    comp.cbData = NULL;
+    comp.itemSize = sizeof(int32);
+
+    /*
+     * Random pushes and pops, checked against a linear FindMin.
+     */
+    for (uint a = 0; a < ARRAYSIZE(arities); a++) {
+        CMBPriorityQueue pq;
+        CMBIntVec ref;
+
+        CMBPriorityQueue_CreateWithArity(&pq, &comp, arities[a]);
+        CMBIntVec_CreateEmpty(&ref);
+
+        for (int x = 0; x < 2000; x++) {
+            if (CMBIntVec_Size(&ref) == 0 || RandomState_Int(&rs, 0, 2) > 0) {
+                int32 v = RandomState_Int(&rs, -100, 100);
+                CMBPriorityQueue_Push(&pq, &v);
+                CMBIntVec_GrowBy(&ref, 1);
+                CMBIntVec_PutValue(&ref, CMBIntVec_Size(&ref) - 1, v);
+            } else {
+                int64 min = CMBIntVec_FindMin(&ref);
+                int32 v;
+
+                TEST(*(int32 *)CMBPriorityQueue_Peek(&pq) ==
+                     CMBIntVec_GetValue(&ref, min));
+                CMBPriorityQueue_Pop(&pq, &v);
+                TEST(v == CMBIntVec_GetValue(&ref, min));
+
+                int64 last = CMBIntVec_Size(&ref) - 1;
+                CMBIntVec_PutValue(&ref, min, CMBIntVec_GetValue(&ref, last));
+                CMBIntVec_Shrink(&ref);
+            }
+            TEST(CMBPriorityQueue_Size(&pq) == CMBIntVec_Size(&ref));
+        }
+
+        CMBPriorityQueue_Destroy(&pq);
+        CMBIntVec_Destroy(&ref);
+    }
+
+    /*
+     * Heapify an existing vector, and drain it in order.
+     */
+    for (uint a = 0; a < ARRAYSIZE(arities); a++) {
+        CMBPriorityQueue pq;
+        CMBVector v;
+        int n = RandomState_Int(&rs, 0, 1000);
+        int32 last = MIN_INT32;
+
+        CMBVector_CreateWithSize(&v, sizeof(int32), n);
+        for (int x = 0; x < n; x++) {
+            *(int32 *)CMBVector_GetPtr(&v, x) = RandomState_Int(&rs, -500, 500);
+        }
+
+        CMBPriorityQueue_CreateFromVector(&pq, &v, &comp, arities[a]);
+        TEST(CMBVector_Size(&v) == 0);
+        TEST(CMBPriorityQueue_Size(&pq) == n);
+
+        for (int x = 0; x < n; x++) {
+            int32 cur;
+            CMBPriorityQueue_Pop(&pq, &cur);
+            TEST(cur >= last);
+            last = cur;
+        }
+        TEST(CMBPriorityQueue_IsEmpty(&pq));
+
+        CMBPriorityQueue_Destroy(&pq);
+        CMBVector_Destroy(&v);
+    }
+
+    {
+        MBPriorityQueue<int32> q(&comp);
+        const int count = 1000;
+
+        for (int x = 0; x < count; x++) {
+            q.push((x * 7919) % count);
+        }
+        TEST(q.size() == count);
+        for (int x = 0; x < count; x++) {
+            TEST(q.peek() == x);
+            TEST(q.pop() == x);
+        }
+        TEST(q.isEmpty());
+    }
+
+    MBUnitTestMBIndexedHeap();
+}
+
+typedef enum MBUnitTestLockType {
+    MBUNITTEST_LOCK_SPIN,
+    MBUNITTEST_LOCK_MBLOCK,
+    MBUNITTEST_LOCK_ADAPTIVE,
+    MBUNITTEST_LOCK_RW,
+    MBUNITTEST_LOCK_MAX,
+} MBUnitTestLockType;
+
+typedef struct MBUnitTestLockData {
+    MBUnitTestLockType type;
+    MBSpinLock spinLock;
+#ifdef MB_HAS_MBLOCK
+    MBLock lock;
+    MBAdaptiveLock adaptiveLock;
+    MBRWLock rwLock;
+#endif
+    int iterations;
+
+    /*
+     * Not atomic, so lost updates would show up in the totals, and
+     * readers can check that writers always leave them equal.
+     */
+    volatile int64 counter;
+    volatile int64 counter2;
+    MBAtomic32 activeReaders;
+} MBUnitTestLockData;
+
+typedef struct MBUnitTestLockThread {
+    MBThread thread;
+    MBUnitTestLockData *d;
+    bool reader;
+} MBUnitTestLockThread;
+
+static void MBUnitTestLockWrite(MBUnitTestLockData *d)
+{
+    int64 c = d->counter;
+    d->counter = c + 1;
+    c = d->counter2;
+    d->counter2 = c + 1;
+}
+
+static void MBUnitTestLockThreadFn(void *data)
+{
+    MBUnitTestLockThread *t = (MBUnitTestLockThread *)data;
+    MBUnitTestLockData *d = t->d;
+
+    for (int i = 0; i < d->iterations; i++) {
+        switch (d->type) {
+        case MBUNITTEST_LOCK_SPIN:
+            MBSpinLock_Lock(&d->spinLock);
+            if (mb_debug) {
+                TEST(MBSpinLock_IsLocked(&d->spinLock));
+            }
+            MBUnitTestLockWrite(d);
+            MBSpinLock_Unlock(&d->spinLock);
+            break;
+#ifdef MB_HAS_MBLOCK
+        case MBUNITTEST_LOCK_MBLOCK:
+            MBLock_Lock(&d->lock);
+            if (mb_debug) {
+                TEST(MBLock_IsLocked(&d->lock));
+            }
+            MBUnitTestLockWrite(d);
+            MBLock_Unlock(&d->lock);
+            break;
+        case MBUNITTEST_LOCK_ADAPTIVE:
+            MBAdaptiveLock_Lock(&d->adaptiveLock);
+            if (mb_debug) {
+                TEST(MBAdaptiveLock_IsLocked(&d->adaptiveLock));
+            }
+            MBUnitTestLockWrite(d);
+            MBAdaptiveLock_Unlock(&d->adaptiveLock);
+            break;
+        case MBUNITTEST_LOCK_RW:
+            if (t->reader) {
+                MBRWLock_ReadLock(&d->rwLock);
+                MBAtomic_FetchAdd32(&d->activeReaders, 1, MB_ATOMIC_RELAXED);
+                TEST(d->counter == d->counter2);
+                MBAtomic_FetchSub32(&d->activeReaders, 1, MB_ATOMIC_RELAXED);
+                MBRWLock_ReadUnlock(&d->rwLock);
+            } else {
+                MBRWLock_WriteLock(&d->rwLock);
+                if (mb_debug) {
+                    TEST(MBRWLock_IsWriteLocked(&d->rwLock));
+                }
+                TEST(MBAtomic_Load32(&d->activeReaders,
+                                     MB_ATOMIC_RELAXED) == 0);
+                MBUnitTestLockWrite(d);
+                MBRWLock_WriteUnlock(&d->rwLock);
+            }
+            break;
+#endif
+        default:
+            NOT_REACHED();
+        }
+    }
+}
+
+void MBUnitTest_MBLock(void)
+{
+    MBSpinLock spinLock;
+
+    MBSpinLock_Create(&spinLock);
+    MBSpinLock_Lock(&spinLock);
+    if (mb_debug) {
+        TEST(MBSpinLock_IsLocked(&spinLock));
+    }
+    MBSpinLock_Unlock(&spinLock);
+    if (mb_debug) {
+        TEST(!MBSpinLock_IsLocked(&spinLock));
+    }
+    MBSpinLock_Destroy(&spinLock);
+
+#ifdef MB_HAS_MBLOCK
+    MBLock lock;
+    MBLockProfile profile;
+
+    MBLock_Create(&lock);
+    MBLock_SetName(&lock, "MBUnitTest");
+
+    if (mb_debug) {
+        TEST(!MBLock_IsLocked(&lock));
+    }
+    MBLock_Lock(&lock);
+
+    if (mb_debug) {
+        TEST(MBLock_IsLocked(&lock));
+    }
+
+    MBLock_Unlock(&lock);
+
+    TEST(MBLock_TryLock(&lock));
+    MBLock_Unlock(&lock);
+
+    TEST(MBLock_GetProfile(&lock, &profile) == mb_lock_profile);
+    if (mb_lock_profile) {
+        TEST(strcmp(profile.name, "MBUnitTest") == 0);
+        TEST(profile.acquires == 2);
+        TEST(profile.contended == 0);
+        TEST(profile.waitNS == 0);
+    }
+    MBLock_Destroy(&lock);
+
+    /*
+     * Any number of readers, or one writer.
+     */
+    MBRWLock rwLock;
+    MBRWLock_Create(&rwLock);
+    MBRWLock_ReadLock(&rwLock);
+    MBRWLock_ReadLock(&rwLock);
+    if (mb_debug) {
+        TEST(!MBRWLock_IsWriteLocked(&rwLock));
+    }
+    MBRWLock_ReadUnlock(&rwLock);
+    MBRWLock_ReadUnlock(&rwLock);
+    MBRWLock_WriteLock(&rwLock);
+    if (mb_debug) {
+        TEST(MBRWLock_IsWriteLocked(&rwLock));
+    }
+    MBRWLock_WriteUnlock(&rwLock);
+    MBRWLock_Destroy(&rwLock);
+#endif
+
+    if (mb_has_mbthread) {
+        MBUnitTestLockData d;
+        MBUnitTestLockThread threads[4];
+
+        for (int type = 0; type < MBUNITTEST_LOCK_MAX; type++) {
+            int numWriters = 0;
+
+            if (!mb_lock && type != MBUNITTEST_LOCK_SPIN) {
+                continue;
+            }
+
+            d.type = (MBUnitTestLockType)type;
+            d.counter = 0;
+            d.counter2 = 0;
+            MBAtomic_Store32(&d.activeReaders, 0, MB_ATOMIC_RELAXED);
+            d.iterations = 10 * 1000;
+            MBSpinLock_Create(&d.spinLock);
+#ifdef MB_HAS_MBLOCK
+            MBLock_Create(&d.lock);
+            MBAdaptiveLock_Create(&d.adaptiveLock);
+            MBRWLock_Create(&d.rwLock);
+#endif
+
+            for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+                threads[i].d = &d;
+                threads[i].reader = type == MBUNITTEST_LOCK_RW && i % 2 == 1;
+                numWriters += !threads[i].reader;
+                MBThread_Create(&threads[i].thread, MBUnitTestLockThreadFn,
+                                &threads[i]);
+            }
+            for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+                MBThread_Join(&threads[i].thread);
+            }
+
+            TEST(d.counter == (int64)numWriters * d.iterations);
+            TEST(d.counter2 == d.counter);
+
+#ifdef MB_LOCK_PROFILE
+            if (type == MBUNITTEST_LOCK_MBLOCK ||
+                type == MBUNITTEST_LOCK_ADAPTIVE) {
+                MBLock *l = type == MBUNITTEST_LOCK_MBLOCK ?
+                            &d.lock : &d.adaptiveLock.lock;
+                MBLockProfile p;
+
+                MBLock_GetProfile(l, &p);
+                TEST(p.acquires == (uint64)d.counter);
+                TEST(p.contended <= p.acquires);
+            }
+#endif
+
+            MBSpinLock_Destroy(&d.spinLock);
+#ifdef MB_HAS_MBLOCK
+            MBLock_Destroy(&d.lock);
+            MBAdaptiveLock_Destroy(&d.adaptiveLock);
+            MBRWLock_Destroy(&d.rwLock);
+#endif
+        }
+    }
+}
+
+#ifdef MB_HAS_MBLOCK
+#define MBUNITTEST_CONDVAR_QUEUE_SIZE 8
+
+typedef struct MBUnitTestCondVarData {
+    MBLock lock;
+    MBCondVar notEmpty;
+    MBCondVar notFull;
+    int queue[MBUNITTEST_CONDVAR_QUEUE_SIZE];
+    uint head;
+    uint count;
+    int itemsPerProducer;
+    int64 consumed;
+
+    MBSemaphore ping;
+    MBSemaphore pong;
+    MBEvent pingEvent;
+    MBEvent pongEvent;
+    int iterations;
+} MBUnitTestCondVarData;
+
+static void MBUnitTestCondVarProducer(void *data)
+{
+    MBUnitTestCondVarData *d = (MBUnitTestCondVarData *)data;
+
+    for (int i = 1; i <= d->itemsPerProducer; i++) {
+        MBLock_Lock(&d->lock);
+        while (d->count == MBUNITTEST_CONDVAR_QUEUE_SIZE) {
+            MBCondVar_Wait(&d->notFull, &d->lock);
+        }
+        d->queue[(d->head + d->count) % MBUNITTEST_CONDVAR_QUEUE_SIZE] = i;
+        d->count++;
+        MBLock_Unlock(&d->lock);
+        MBCondVar_Signal(&d->notEmpty);
+    }
+}
+
+/*
+ * Consumes until it sees a 0.
+ */
+static void MBUnitTestCondVarConsumer(void *data)
+{
+    MBUnitTestCondVarData *d = (MBUnitTestCondVarData *)data;
+    int item;
+
+    do {
+        MBLock_Lock(&d->lock);
+        while (d->count == 0) {
+            MBCondVar_Wait(&d->notEmpty, &d->lock);
+        }
+        item = d->queue[d->head];
+        d->head = (d->head + 1) % MBUNITTEST_CONDVAR_QUEUE_SIZE;
+        d->count--;
+        d->consumed += item;
+        MBLock_Unlock(&d->lock);
+        MBCondVar_Broadcast(&d->notFull);
+    } while (item != 0);
+}
+
+static void MBUnitTestCondVarPong(void *data)
+{
+    MBUnitTestCondVarData *d = (MBUnitTestCondVarData *)data;
+
+    for (int i = 0; i < d->iterations; i++) {
+        MBSemaphore_Wait(&d->ping);
+        MBSemaphore_Post(&d->pong);
+    }
+    for (int i = 0; i < d->iterations; i++) {
+        MBEvent_Wait(&d->pingEvent);
+        MBEvent_Set(&d->pongEvent);
+    }
+}
+#endif
+
+void MBUnitTest_MBCondVar(void)
+{
+#ifdef MB_HAS_MBLOCK
+    MBUnitTestCondVarData d;
+    MBThread threads[4];
+    MBThread pong;
+
+    MBSemaphore_Create(&d.ping, 2);
+    TEST(MBSemaphore_TryWait(&d.ping));
+    MBSemaphore_Wait(&d.ping);
+    TEST(!MBSemaphore_TryWait(&d.ping));
+    MBSemaphore_Post(&d.ping);
+    MBSemaphore_Post(&d.ping);
+    MBSemaphore_Wait(&d.ping);
+    MBSemaphore_Wait(&d.ping);
+    TEST(!MBSemaphore_TryWait(&d.ping));
+    MBSemaphore_Destroy(&d.ping);
+
+    /*
+     * Sets don't add up.
+     */
+    MBEvent_Create(&d.pingEvent, TRUE);
+    TEST(MBEvent_TryWait(&d.pingEvent));
+    TEST(!MBEvent_TryWait(&d.pingEvent));
+    MBEvent_Set(&d.pingEvent);
+    MBEvent_Set(&d.pingEvent);
+    MBEvent_Wait(&d.pingEvent);
+    TEST(!MBEvent_TryWait(&d.pingEvent));
+    MBEvent_Destroy(&d.pingEvent);
+
+    if (!mb_has_mbthread) {
+        return;
+    }
+
+    /*
+     * Two producers and two consumers on a small queue, so both sides
+     * have to wait.
+     */
+    MBLock_Create(&d.lock);
+    MBCondVar_Create(&d.notEmpty);
+    MBCondVar_Create(&d.notFull);
+    d.head = 0;
+    d.count = 0;
+    d.consumed = 0;
+    d.itemsPerProducer = 1000 + (uint)mbtest.seed % 1000;
+
+    MBThread_Create(&threads[0], MBUnitTestCondVarProducer, &d);
+    MBThread_Create(&threads[1], MBUnitTestCondVarProducer, &d);
+    MBThread_Create(&threads[2], MBUnitTestCondVarConsumer, &d);
+    MBThread_Create(&threads[3], MBUnitTestCondVarConsumer, &d);
+    MBThread_Join(&threads[0]);
+    MBThread_Join(&threads[1]);
+
+    /*
+     * One 0 for each consumer.
+     */
+    for (uint i = 0; i < 2; i++) {
+        MBLock_Lock(&d.lock);
+        while (d.count == MBUNITTEST_CONDVAR_QUEUE_SIZE) {
+            MBCondVar_Wait(&d.notFull, &d.lock);
+        }
+        d.queue[(d.head + d.count) % MBUNITTEST_CONDVAR_QUEUE_SIZE] = 0;
+        d.count++;
+        MBLock_Unlock(&d.lock);
+        MBCondVar_Broadcast(&d.notEmpty);
+    }
+    MBThread_Join(&threads[2]);
+    MBThread_Join(&threads[3]);
+
+    TEST(d.count == 0);
+    TEST(d.consumed ==
+         (int64)d.itemsPerProducer * (d.itemsPerProducer + 1));
+    MBCondVar_Destroy(&d.notFull);
+    MBCondVar_Destroy(&d.notEmpty);
+    MBLock_Destroy(&d.lock);
+
+    /*
+     * Ping-pong, so every Wait has to sleep until the other thread
+     * wakes it.
+     */
+    MBSemaphore_Create(&d.ping, 0);
+    MBSemaphore_Create(&d.pong, 0);
+    MBEvent_Create(&d.pingEvent, FALSE);
+    MBEvent_Create(&d.pongEvent, FALSE);
+    d.iterations = 1000;
+
+    MBThread_Create(&pong, MBUnitTestCondVarPong, &d);
+    for (int i = 0; i < d.iterations; i++) {
+        MBSemaphore_Post(&d.ping);
+        MBSemaphore_Wait(&d.pong);
+    }
+    for (int i = 0; i < d.iterations; i++) {
+        MBEvent_Set(&d.pingEvent);
+        MBEvent_Wait(&d.pongEvent);
+    }
+    MBThread_Join(&pong);
+
+    TEST(!MBSemaphore_TryWait(&d.ping));
+    TEST(!MBSemaphore_TryWait(&d.pong));
+    TEST(!MBEvent_TryWait(&d.pingEvent));
+    TEST(!MBEvent_TryWait(&d.pongEvent));
+    MBEvent_Destroy(&d.pongEvent);
+    MBEvent_Destroy(&d.pingEvent);
+    MBSemaphore_Destroy(&d.pong);
+    MBSemaphore_Destroy(&d.ping);
+#endif
+}
+
+typedef struct MBUnitTestAtomicData {
+    MBAtomic32 counter;
+    MB_CACHE_PAD(pad, sizeof(MBAtomic32));
+    MBAtomic64 casCounter;
+    MBStrTable *table;
+    int iterations;
+} MBUnitTestAtomicData;
+
+static void MBUnitTestAtomicThreadFn(void *data)
+{
+    MBUnitTestAtomicData *d = (MBUnitTestAtomicData *)data;
+
+    for (int i = 0; i < d->iterations; i++) {
+        uint64 c;
+
+        MBAtomic_FetchAdd32(&d->counter, 1, MB_ATOMIC_RELAXED);
+
+        c = MBAtomic_Load64(&d->casCounter, MB_ATOMIC_RELAXED);
+        while (!MBAtomic_CompareExchange64(&d->casCounter, &c, c + 3,
+                                           MB_ATOMIC_ACQ_REL)) {
+            MBAtomic_Pause();
+        }
+
+        MBStrTable_Reference(d->table);
+        MBStrTable_Unreference(d->table);
+    }
+}
+
+void MBUnitTest_MBAtomic(void)
+{
+    MBAtomic32 a32;
+    MBAtomic64 a64;
+    MBAtomicPtr ap;
+    uint32 e32;
+    uint64 e64;
+    void *ep;
+    int x, y;
+
+    MBAtomic_Store32(&a32, 5, MB_ATOMIC_RELAXED);
+    TEST(MBAtomic_Load32(&a32, MB_ATOMIC_ACQUIRE) == 5);
+    TEST(MBAtomic_Exchange32(&a32, 7, MB_ATOMIC_ACQ_REL) == 5);
+
+    e32 = 6;
+    TEST(!MBAtomic_CompareExchange32(&a32, &e32, 8, MB_ATOMIC_RELEASE));
+    TEST(e32 == 7);
+    TEST(MBAtomic_CompareExchange32(&a32, &e32, 8, MB_ATOMIC_SEQ_CST));
+    TEST(MBAtomic_Load32(&a32, MB_ATOMIC_RELAXED) == 8);
+
+    TEST(MBAtomic_FetchAdd32(&a32, 4, MB_ATOMIC_RELAXED) == 8);
+    TEST(MBAtomic_FetchSub32(&a32, 2, MB_ATOMIC_RELAXED) == 12);
+    TEST(MBAtomic_FetchOr32(&a32, 0x100, MB_ATOMIC_RELAXED) == 10);
+    TEST(MBAtomic_FetchAnd32(&a32, 0xF00, MB_ATOMIC_RELAXED) == 0x10A);
+    TEST(MBAtomic_Load32(&a32, MB_ATOMIC_RELAXED) == 0x100);
+    MBAtomic_Store32(&a32, 0, MB_ATOMIC_RELAXED);
+    TEST(MBAtomic_FetchSub32(&a32, 1, MB_ATOMIC_RELAXED) == 0);
+    TEST(MBAtomic_Load32(&a32, MB_ATOMIC_RELAXED) == MAX_UINT32);
+
+    MBAtomic_Store64(&a64, 1ULL << 40, MB_ATOMIC_RELEASE);
+    TEST(MBAtomic_FetchAdd64(&a64, 1ULL << 40, MB_ATOMIC_RELAXED) ==
+         1ULL << 40);
+    e64 = 1ULL << 41;
+    TEST(MBAtomic_CompareExchange64(&a64, &e64, 3, MB_ATOMIC_ACQUIRE));
+    TEST(MBAtomic_Exchange64(&a64, MAX_UINT64, MB_ATOMIC_RELAXED) == 3);
+    TEST(MBAtomic_Load64(&a64, MB_ATOMIC_RELAXED) == MAX_UINT64);
+
+    MBAtomic_StorePtr(&ap, &x, MB_ATOMIC_RELAXED);
+    ep = &y;
+    TEST(!MBAtomic_CompareExchangePtr(&ap, &ep, NULL, MB_ATOMIC_ACQ_REL));
+    TEST(ep == &x);
+    TEST(MBAtomic_CompareExchangePtr(&ap, &ep, &y, MB_ATOMIC_ACQ_REL));
+    TEST(MBAtomic_ExchangePtr(&ap, NULL, MB_ATOMIC_RELAXED) == &y);
+    TEST(MBAtomic_LoadPtr(&ap, MB_ATOMIC_RELAXED) == NULL);
+    MBAtomic_Fence(MB_ATOMIC_SEQ_CST);
+
+    TEST(offsetof(MBUnitTestAtomicData, casCounter) == MB_CACHE_LINE_SIZE);
+
+    if (mb_has_mbthread) {
+        MBUnitTestAtomicData d;
+        MBThread threads[4];
+
+        MBAtomic_Store32(&d.counter, 0, MB_ATOMIC_RELAXED);
+        MBAtomic_Store64(&d.casCounter, 0, MB_ATOMIC_RELAXED);
+        d.table = MBStrTable_Alloc();
+        MBStrTable_AddCopy(d.table, "MBUnitTest");
+        d.iterations = 10 * 1000;
+
+        for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+            MBThread_Create(&threads[i], MBUnitTestAtomicThreadFn, &d);
+        }
+        for (uint i = 0; i < ARRAYSIZE(threads); i++) {
+            MBThread_Join(&threads[i]);
+        }
+
+        TEST(MBAtomic_Load32(&d.counter, MB_ATOMIC_RELAXED) ==
+             ARRAYSIZE(threads) * d.iterations);
+        TEST(MBAtomic_Load64(&d.casCounter, MB_ATOMIC_RELAXED) ==
+             3 * ARRAYSIZE(threads) * d.iterations);
+        MBStrTable_Free(d.table);
+    }
+}
+
+static void MBUnitTestPoolRunFn(void *data)
+{
+    MBAtomic_FetchAdd32((MBAtomic32 *)data, 1, MB_ATOMIC_RELAXED);
+}
+
+typedef struct MBUnitTestPoolFib {
+    MBThreadPool *pool;
+    int n;
+    uint64 result;
+} MBUnitTestPoolFib;
+
+/*
+ * Every level waits on its own subtasks, so this only finishes if
+ * waiting workers run other tasks.
+ */
+static void MBUnitTestPoolFibFn(void *data)
+{
+    MBUnitTestPoolFib *f = (MBUnitTestPoolFib *)data;
+    MBUnitTestPoolFib a, b;
+    MBThreadPoolCounter counter;
+
+    if (f->n < 2) {
+        f->result = f->n;
+        return;
+    }
+
+    a.pool = b.pool = f->pool;
+    a.n = f->n - 1;
+    b.n = f->n - 2;
+
+    MBThreadPoolCounter_Create(&counter);
+    MBThreadPool_Submit(f->pool, &counter, MBUnitTestPoolFibFn, &a);
+    MBThreadPool_Submit(f->pool, &counter, MBUnitTestPoolFibFn, &b);
+    MBThreadPool_Wait(f->pool, &counter);
+
+    f->result = a.result + b.result;
+}
+
+/*
+ * MBThreadPool stops stealing once a thread is 16 waits deep, so nesting
+ * 20 deep leaves the outside thread's innermost waits running only their
+ * own tasks.
+ */
+#define MBUNITTEST_POOL_STEAL_DEPTH 16
+#define MBUNITTEST_POOL_NEST_DEPTH  20
+
+typedef struct MBUnitTestPoolNest {
+    MBThreadPool *pool;
+    MBAtomic32 numHeld;
+    MBSemaphore hold;
+    MBEvent deepWait;
+    MBEvent leafRunning;
+    MBEvent release;
+} MBUnitTestPoolNest;
+
+typedef struct MBUnitTestPoolNestLevel {
+    MBUnitTestPoolNest *n;
+    uint depth;
+} MBUnitTestPoolNestLevel;
+
+static void MBUnitTestPoolHoldFn(void *data)
+{
+    MBUnitTestPoolNest *n = (MBUnitTestPoolNest *)data;
+
+    MBAtomic_FetchAdd32(&n->numHeld, 1, MB_ATOMIC_RELAXED);
+    MBSemaphore_Wait(&n->hold);
+}
+
+static void MBUnitTestPoolReleaseFn(void *data)
+{
+    MBEvent_Set(&((MBUnitTestPoolNest *)data)->release);
+}
+
+static void MBUnitTestPoolNestFn(void *data)
+{
+    MBUnitTestPoolNestLevel *l = (MBUnitTestPoolNestLevel *)data;
+    MBUnitTestPoolNestLevel child;
+    MBThreadPoolCounter counter;
+
+    if (l->depth == MBUNITTEST_POOL_NEST_DEPTH) {
+        MBEvent_Set(&l->n->leafRunning);
+        MBEvent_Wait(&l->n->release);
+        return;
+    }
+
+    child.n = l->n;
+    child.depth = l->depth + 1;
+    MBThreadPoolCounter_Create(&counter);
+    MBThreadPool_Submit(l->n->pool, &counter, MBUnitTestPoolNestFn, &child);
+    if (l->depth >= MBUNITTEST_POOL_STEAL_DEPTH) {
+        MBEvent_Set(&l->n->deepWait);
+    }
+    MBThreadPool_Wait(l->n->pool, &counter);
+}
+
+static void MBUnitTestPoolNestThreadFn(void *data)
+{
+    MBUnitTestPoolNestLevel top;
+
+    top.n = (MBUnitTestPoolNest *)data;
+    top.depth = 0;
+    MBUnitTestPoolNestFn(&top);
+}
+
+/*
+ * An outside thread nests its waits past the steal depth limit while
+ * the workers are held busy, so it ends up asleep waiting on a task that
+ * only a worker can run.  That task blocks until another outside
+ * submission runs, and the wakeup for that one has to reach the idle
+ * worker rather than the sleeper that can't take it.
+ */
+static void MBUnitTestThreadPoolNestedWait(void)
+{
+    MBUnitTestPoolNest n;
+    MBThreadPoolCounter counter;
+    MBThread thread;
+    uint numWorkers = 2;
+
+    if (!mb_has_mbthread) {
+        return;
+    }
+
+    n.pool = MBThreadPool_Create(numWorkers);
+    MBAtomic_Store32(&n.numHeld, 0, MB_ATOMIC_RELAXED);
+    MBSemaphore_Create(&n.hold, 0);
+    MBEvent_Create(&n.deepWait, FALSE);
+    MBEvent_Create(&n.leafRunning, FALSE);
+    MBEvent_Create(&n.release, FALSE);
+    MBThreadPoolCounter_Create(&counter);
+
+    for (uint i = 0; i < numWorkers; i++) {
+        MBThreadPool_Submit(n.pool, NULL, MBUnitTestPoolHoldFn, &n);
+    }
+    while (MBAtomic_Load32(&n.numHeld, MB_ATOMIC_RELAXED) < numWorkers) {
+        usleep(1000);
+    }
+
+    MBThread_Create(&thread, MBUnitTestPoolNestThreadFn, &n);
+    MBEvent_Wait(&n.deepWait);
+    usleep(10 * 1000);
+
+    for (uint i = 0; i < numWorkers; i++) {
+        MBSemaphore_Post(&n.hold);
+    }
+    MBEvent_Wait(&n.leafRunning);
+    usleep(10 * 1000);
+
+    MBThreadPool_Submit(n.pool, &counter, MBUnitTestPoolReleaseFn, &n);
+    MBThread_Join(&thread);
+    MBThreadPool_Wait(n.pool, &counter);
+
+    MBEvent_Destroy(&n.release);
+    MBEvent_Destroy(&n.leafRunning);
+    MBEvent_Destroy(&n.deepWait);
+    MBSemaphore_Destroy(&n.hold);
+    MBThreadPool_Destroy(n.pool);
+}
+
+void MBUnitTest_MBThreadPool(void)
+{
+    MBThreadPool *pool;
+    MBThreadPoolCounter counter;
+    MBAtomic32 runs[1000];
+    MBUnitTestPoolFib fib;
+    uint numWorkers = 1 + (uint)mbtest.seed % 4;
+
+    pool = MBThreadPool_Create(numWorkers);
+    TEST(MBThreadPool_GetNumWorkers(pool) ==
+         (mb_has_mbthread ? numWorkers : 0));
+
+    /*
+     * Enough tasks to make the shared queue grow.
+     */
+    MBThreadPoolCounter_Create(&counter);
+    for (uint i = 0; i < ARRAYSIZE(runs); i++) {
+        MBAtomic_Store32(&runs[i], 0, MB_ATOMIC_RELAXED);
+        MBThreadPool_Submit(pool, &counter, MBUnitTestPoolRunFn, &runs[i]);
+    }
+    MBThreadPool_Wait(pool, &counter);
+    TEST(MBThreadPoolCounter_IsDone(&counter));
+    for (uint i = 0; i < ARRAYSIZE(runs); i++) {
+        TEST(MBAtomic_Load32(&runs[i], MB_ATOMIC_RELAXED) == 1);
+    }
+
+    /*
+     * Nested fork-join, which also fills the workers' own deques.
+     */
+    fib.pool = pool;
+    fib.n = 15;
+    MBThreadPoolCounter_Create(&counter);
+    MBThreadPool_Submit(pool, &counter, MBUnitTestPoolFibFn, &fib);
+    MBThreadPool_Wait(pool, &counter);
+    TEST(fib.result == 610);
+
+    MBThreadPool_Destroy(pool);
+
+    MBUnitTestThreadPoolNestedWait();
+
+    pool = MBThreadPool_Create(0);
+    TEST(MBThreadPool_GetNumWorkers(pool) ==
+         (mb_has_mbthread ? MBThread_GetNumCPUs() : 0));
+    MBThreadPool_Destroy(pool);
+}
+
+static void MBUnitTestParallelForFn(void *ctx, int64 start, int64 end)
+{
+    CMBVector *v = (CMBVector *)ctx;
+
+    for (int64 i = start; i < end; i++) {
+        (*(int *)CMBVector_GetPtr(v, i))++;
+    }
+}
+
+static void MBUnitTestParallelSumFn(void *ctx, int64 start, int64 end,
+                                    void *accum)
+{
+    for (int64 i = start; i < end; i++) {
+        *(float *)accum += 1.0f / (i + 1);
+    }
+}
+
+static void MBUnitTestParallelCombineFn(void *ctx, void *accum,
+                                        const void *other)
+{
+    *(float *)accum += *(const float *)other;
+}
+
+static float MBUnitTestParallelSum(int64 numItems, int64 grain)
+{
+    float sum = 0.0f;
+
+    MBParallel_Reduce(0, numItems, grain, MBUnitTestParallelSumFn,
+                      MBUnitTestParallelCombineFn, NULL, &sum, sizeof(sum));
+    return sum;
+}
+
+void MBUnitTest_MBParallel(void)
+{
+    CMBVector cv;
+    MBVector<int64> v;
+    int64 numItems = 1 + (uint)mbtest.seed % 10000;
+    int64 grain = (uint)mbtest.seed % 3 == 0 ? 0 : 1 + (uint)mbtest.seed % 64;
+    int64 total = numItems * (numItems - 1) / 2;
+    float sum;
+
+    /*
+     * The parallel sorts in the other tests may have already created
+     * the default pool.
+     */
+    MBParallel_Exit();
+    MBParallel_Init(1 + (uint)mbtest.seed % 4);
+
+    /*
+     * Every index exactly once.
+     */
+    CMBVector_CreateWithSize(&cv, sizeof(int), numItems);
+    for (int64 i = 0; i < numItems; i++) {
+        *(int *)CMBVector_GetPtr(&cv, i) = 0;
+    }
+    CMBVector_ParallelFor(&cv, grain, MBUnitTestParallelForFn, &cv);
+    for (int64 i = 0; i < numItems; i++) {
+        TEST(*(int *)CMBVector_GetPtr(&cv, i) == 1);
+    }
+    CMBVector_Destroy(&cv);
+
+    v.resize(numItems);
+    MBParallel_For(0, numItems, [&v](int64 i) { v[i] = i; }, grain);
+    MBParallel_ForEach(v, [](int64 &item) { item *= 2; }, grain);
+    for (int64 i = 0; i < numItems; i++) {
+        TEST(v[i] == 2 * i);
+    }
+
+    TEST(MBParallel_Reduce(v, (int64)0,
+                           [](int64 &accum, int64 item) { accum += item; },
+                           [](int64 &accum, int64 other) { accum += other; },
+                           grain) == 2 * total);
+
+    /*
+     * Nested loops, with the inner ones splitting off tasks from inside
+     * pool workers.
+     */
+    TEST(MBParallel_Reduce(0, 16, (int64)0,
+                           [numItems, grain](int64 &accum, int64 i) {
+                               accum += MBParallel_Reduce(0, numItems,
+                                   (int64)0,
+                                   [](int64 &a, int64 j) { a += j; },
+                                   [](int64 &a, int64 b) { a += b; },
+                                   grain);
+                           },
+                           [](int64 &accum, int64 other) { accum += other; },
+                           1) == 16 * total);
+
+    /*
+     * Empty ranges don't call anything.
+     */
+    MBParallel_For(5, 5, [](int64 i) { TEST(FALSE); });
+    MBParallel_ForRange(5, 0, [](int64 start, int64 end) { TEST(FALSE); });
+
+    /*
+     * With a fixed grain, float sums come out bit-for-bit the same, no
+     * matter how many workers there are.
+     */
+    sum = MBUnitTestParallelSum(numItems, 7);
+    MBParallel_Exit();
+    MBParallel_Init(1);
+    TEST(MBUnitTestParallelSum(numItems, 7) == sum);
+    MBParallel_Exit();
+
+    /*
+     * Without MBParallel_Init, the first loop creates the pool.
+     */
+    TEST(MBParallel_Reduce(0, numItems, (int64)0,
+                           [](int64 &accum, int64 i) { accum += i; },
+                           [](int64 &accum, int64 other) { accum += other; },
+                           grain) == total);
+    TEST(MBThreadPool_GetNumWorkers(MBParallel_GetPool()) ==
+         (mb_has_mbthread ? MBThread_GetNumCPUs() : 0));
+    MBParallel_Exit();
+}
+
+typedef struct TestAllocData {
+    int64 liveBytes;
+    int numAllocs;
+    int numFrees;
+} TestAllocData;
+
+static void *TestAllocAlloc(void *cbData, size_t size)
+{
+    TestAllocData *d = (TestAllocData *)cbData;
+    d->liveBytes += size;
+    d->numAllocs++;
+    return malloc(size);
+}
+
+static void TestAllocFree(void *cbData, void *ptr, size_t size)
+{
+    TestAllocData *d = (TestAllocData *)cbData;
+    d->liveBytes -= size;
+    d->numFrees++;
+    free(ptr);
+}
+
+void MBUnitTest_MBAlloc(void)
+{
+    TestAllocData data;
+    CMBAllocator alloc;
+
+    MBUtil_Zero(&data, sizeof(data));
+    alloc.allocFn = TestAllocAlloc;
+    alloc.reallocFn = NULL;
+    alloc.freeFn = TestAllocFree;
+    alloc.cbData = &data;
+
+    {
+        CMBIntVec v;
+        CMBIntVec w;
+        CMBIntVec_CreateWithAllocator(&v, 0, 1, &alloc);
+        TEST(CMBVector_GetAllocator(&v.v) == &alloc);
+
+        for (int x = 0; x < 1000; x++) {
+            CMBIntVec_AppendValue(&v, x + mbtest.seed);
+        }
+        for (int x = 0; x < 1000; x++) {
+            TEST(CMBIntVec_GetValue(&v, x) == x + mbtest.seed);
+        }
+        TEST(data.liveBytes >= (int64)(1000 * sizeof(int)));
+
+        CMBIntVec_CreateEmpty(&w);
+        CMBIntVec_Consume(&w, &v);
+        TEST(CMBVector_GetAllocator(&w.v) == &alloc);
+        TEST(CMBVector_GetAllocator(&v.v) == &alloc);
+        TEST(CMBIntVec_Size(&w) == 1000);
+        TEST(CMBIntVec_GetValue(&w, 999) == 999 + mbtest.seed);
+
+        CMBIntVec_Destroy(&v);
+        CMBIntVec_Destroy(&w);
+        TEST(data.liveBytes == 0);
+    }
+
+    {
+        MBRing r;
+        MBRing_CreateWithAllocator(&r, sizeof(int), &alloc);
+        for (int x = 0; x < 100; x++) {
+            MBRing_InsertTail(&r, &x, sizeof(x));
+        }
+        for (int x = 0; x < 100; x++) {
+            int v;
+            MBRing_RemoveHead(&r, &v, sizeof(v));
+            TEST(v == x);
+        }
+        MBRing_Destroy(&r);
+        TEST(data.liveBytes == 0);
+    }
+
+    {
+        CMBIntMap map;
+        CMBIntMap_CreateWithAllocator(&map, &alloc);
+        CMBIntMap_SetEmptyValue(&map, -1);
+        for (int x = 0; x < 1000; x++) {
+            CMBIntMap_Put(&map, x, x + 1);
+        }
+        for (int x = 0; x < 1000; x++) {
+            TEST(CMBIntMap_Get(&map, x) == x + 1);
+        }
+        CMBIntMap_Destroy(&map);
+        TEST(data.liveBytes == 0);
+    }
+
+    {
+        MBRegistry *mreg;
+        MBRegistry *copy;
+        int numAllocs = data.numAllocs;
+        char key[32];
+        char value[32];
+
+        mreg = MBRegistry_AllocWithAllocator(&alloc);
+        TEST(data.numAllocs > numAllocs);
+        for (int x = 0; x < 100; x++) {
+            snprintf(key, sizeof(key), "key%d", x);
+            snprintf(value, sizeof(value), "%d", x + mbtest.seed);
+            MBRegistry_PutCopy(mreg, key, value);
+        }
+
+        /*
+         * The copy shares the original's strings, and makes its own
+         * child table for new ones.
+         */
+        copy = MBRegistry_AllocCopy(mreg);
+        MBRegistry_PutCopy(copy, "extra", "value");
+        MBRegistry_Free(mreg);
+
+        for (int x = 0; x < 100; x++) {
+            snprintf(key, sizeof(key), "key%d", x);
+            TEST(MBRegistry_GetInt(copy, key) == x + mbtest.seed);
+        }
+        TEST(strcmp(MBRegistry_GetCStr(copy, "extra"), "value") == 0);
+        MBRegistry_Free(copy);
+        TEST(data.liveBytes == 0);
+    }
+
+    TEST(data.numAllocs == data.numFrees);
+
+    for (int h = 0; h < 2; h++) {
+        const CMBAllocator *mmapAlloc = MBAlloc_GetMMapAllocator(h);
+        CMBIntVec v;
+        const int count = 100 * 1000;
+
+        CMBIntVec_CreateWithAllocator(&v, 0, 0, mmapAlloc);
+        for (int x = 0; x < count; x++) {
+            CMBIntVec_AppendValue(&v, x + mbtest.seed);
+        }
+        for (int x = 0; x < count; x++) {
+            TEST(CMBIntVec_GetValue(&v, x) == x + mbtest.seed);
+        }
+        CMBIntVec_Resize(&v, 10);
+        CMBIntVec_Destroy(&v);
+    }
+}
+
+static double MBUnitTestNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Append numItems ints to a CMBIntVec with each allocator.  Each one
+ * runs in its own child process, so getrusage's max RSS covers just
+ * that allocator.
+ */
+void MBUnitTest_AllocBenchmark(uint64 numItems)
+{
+    struct {
+        const char *name;
+        const CMBAllocator *alloc;
+    } allocs[] = {
+        { "reallocarray", NULL },
+        { "mmap",         MBAlloc_GetMMapAllocator(FALSE) },
+        { "mmap + THP",   MBAlloc_GetMMapAllocator(TRUE) },
+    };
+
+    VERIFY(numItems > 0);
+    printf("Appending %llu ints:\n", (unsigned long long)numItems);
+    printf("%-14s %10s %14s\n", "Allocator", "Time (s)", "Max RSS (MB)");
+
+    for (uint i = 0; i < ARRAYSIZE(allocs); i++) {
+        struct rusage ru;
+        int status;
+        pid_t pid;
+
+        fflush(stdout);
+        pid = fork();
+        VERIFY(pid >= 0);
+
+        if (pid == 0) {
+            CMBIntVec v;
+            double start = MBUnitTestNow();
+
+            CMBIntVec_CreateWithAllocator(&v, 0, 1, allocs[i].alloc);
+            for (uint64 x = 0; x < numItems; x++) {
+                CMBIntVec_AppendValue(&v, (int)x);
+            }
+            printf("%-14s %10.2f", allocs[i].name, MBUnitTestNow() - start);
+            VERIFY(CMBIntVec_GetValue(&v, numItems - 1) ==
+                   (int)(numItems - 1));
+            CMBIntVec_Destroy(&v);
+            fflush(stdout);
+            _exit(0);
+        }
+
+        VERIFY(wait4(pid, &status, 0, &ru) == pid);
+        VERIFY(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+#ifdef MB_MACOS
+        // macOS reports max RSS in bytes, Linux in KB.
+        printf(" %14ld\n", (long)(ru.ru_maxrss / (1024 * 1024)));
+#else
+        printf(" %14ld\n", (long)(ru.ru_maxrss / 1024));
+#endif
+    }
+}
+
+/*
+ * Sort numItems random ints with the comparator and radix parallel
+ * sorts, on 1, 2, 4, ... up to one thread per CPU.  The MBParallel pool
+ * is resized to match each thread count, so the sort can't borrow any
+ * extra workers.
+ */
+void MBUnitTest_SortBenchmark(uint64 numItems)
+{
+    RandomState rs;
+    int32 *orig = (int32 *)malloc(numItems * sizeof(orig[0]));
+    int32 *items = (int32 *)malloc(numItems * sizeof(items[0]));
+    uint numCPUs = mb_has_mbthread ? MBThread_GetNumCPUs() : 1;
+    double base[2] = { 0.0, 0.0 };
+
+    VERIFY(numItems > 0);
+    VERIFY(orig != NULL);
+    VERIFY(items != NULL);
+
+    RandomState_CreateWithSeed(&rs, 0);
+    for (uint64 x = 0; x < numItems; x++) {
+        orig[x] = (int32)RandomState_Uint32(&rs);
+    }
+
+    printf("Sorting %llu ints on up to %u CPUs:\n",
+           (unsigned long long)numItems, numCPUs);
+    printf("%-8s %14s %8s %14s %8s\n", "Threads", "Comparator (s)",
+           "Speedup", "Radix (s)", "Speedup");
+
+    MBParallel_Exit();
+    for (uint threads = 1; ; threads = MIN(threads * 2, numCPUs)) {
+        double secs[2];
+
+        MBParallel_Init(threads);
+
+        for (uint r = 0; r < ARRAYSIZE(secs); r++) {
+            double start;
+
+            memcpy(items, orig, numItems * sizeof(items[0]));
+            start = MBUnitTestNow();
+            if (r == 0) {
+                MBCompare_ParallelSort(items, numItems, sizeof(items[0]),
+                                       testCompareInt32, NULL, threads);
+            } else {
+                MBCompare_ParallelRadixSort(items, numItems, sizeof(items[0]),
+                                            0, MBCOMPARE_KEY_INT32, threads);
+            }
+            secs[r] = MBUnitTestNow() - start;
+            if (threads == 1) {
+                base[r] = secs[r];
+            }
+
+            for (uint64 x = 1; x < numItems; x++) {
+                VERIFY(items[x - 1] <= items[x]);
+            }
+        }
+
+        printf("%-8u %14.3f %7.2fx %14.3f %7.2fx\n", threads,
+               secs[0], base[0] / secs[0], secs[1], base[1] / secs[1]);
+        MBParallel_Exit();
+
+        if (threads == numCPUs) {
+            break;
+        }
+    }
+
+    free(orig);
+    free(items);
+}
+
+void MBUnitTest_MBNumeric(void)
+{
+    RandomState rs;
+    int sizes[] = { 0, 1, 7, 16, 17, 100, 1000, 10 * 1000 };
+
+    RandomState_CreateWithSeed(&rs, mbtest.seed);
+
+    for (uint s = 0; s < ARRAYSIZE(sizes); s++) {
+        int n = sizes[s];
+        CMBIntVec iv;
+        CMBIntVec iv2;
+        CMBFloatVec fv;
+
+        CMBIntVec_CreateWithSize(&iv, n);
+        CMBIntVec_CreateWithSize(&iv2, n);
+        CMBFloatVec_CreateWithSize(&fv, n);
+
+        for (int x = 0; x < n; x++) {
+            int v = RandomState_Int(&rs, -1000, 1000);
+            CMBIntVec_PutValue(&iv, x, v);
+            CMBIntVec_PutValue(&iv2, x, v);
+            CMBFloatVec_PutValue(&fv, x, v / 8.0f);
+        }
+
+        int64 sum = 0;
+        int64 minI = -1;
+        int64 maxI = -1;
+        double fsum = 0;
+        int64 fminI = -1;
+        int64 fmaxI = -1;
+        int64 count = 0;
+        int64 first = -1;
+        int target = n > 0 ? CMBIntVec_GetValue(&iv, n / 2) : 0;
+
+        for (int x = 0; x < n; x++) {
+            int v = CMBIntVec_GetValue(&iv, x);
+            float f = CMBFloatVec_GetValue(&fv, x);
+            sum += v;
+            fsum += f;
+            if (minI == -1 || v < CMBIntVec_GetValue(&iv, minI)) {
+                minI = x;
+            }
+            if (maxI == -1 || v > CMBIntVec_GetValue(&iv, maxI)) {
+                maxI = x;
+            }
+            if (fminI == -1 || f < CMBFloatVec_GetValue(&fv, fminI)) {
+                fminI = x;
+            }
+            if (fmaxI == -1 || f > CMBFloatVec_GetValue(&fv, fmaxI)) {
+                fmaxI = x;
+            }
+            if (v == target) {
+                count++;
+                if (first == -1) {
+                    first = x;
+                }
+            }
+        }
+
+        TEST(CMBIntVec_Sum(&iv) == sum);
+        TEST(CMBIntVec_FindMin(&iv) == minI);
+        TEST(CMBIntVec_FindMax(&iv) == maxI);
+        TEST(CMBIntVec_Find(&iv, target) == first);
+        TEST(CMBIntVec_Count(&iv, target) == count);
+        TEST(CMBIntVec_Find(&iv, 5000) == -1);
+        TEST(CMBIntVec_Count(&iv, 5000) == 0);
+
+        // Every item is a multiple of 1/8, so the sums are exact.
+        TEST(CMBFloatVec_Sum(&fv) == fsum);
+        TEST(CMBFloatVec_FindMin(&fv) == fminI);
+        TEST(CMBFloatVec_FindMax(&fv) == fmaxI);
+
+        MBNumeric_AddInt32(CMBIntVec_GetCArray(&iv2),
+                           CMBIntVec_GetCArray(&iv), n);
+        MBNumeric_ScaleInt32(CMBIntVec_GetCArray(&iv2), n, 3, -1);
+        for (int x = 0; x < n; x++) {
+            int v = CMBIntVec_GetValue(&iv, x);
+            TEST(CMBIntVec_GetValue(&iv2, x) == 2 * v * 3 - 1);
+        }
+
+        MBNumeric_ScaleFloat(CMBFloatVec_GetCArray(&fv), n, 2.0f, 0.5f);
+        for (int x = 0; x < n; x++) {
+            int v = CMBIntVec_GetValue(&iv, x);
+            TEST(CMBFloatVec_GetValue(&fv, x) == (v / 8.0f) * 2.0f + 0.5f);
+        }
+
+        MBNumeric_PrefixSumInt32(CMBIntVec_GetCArray(&iv2),  n);
+        sum = 0;
+        for (int x = 0; x < n; x++) {
+            sum += 2 * CMBIntVec_GetValue(&iv, x) * 3 - 1;
+            TEST(CMBIntVec_GetValue(&iv2, x) == sum);
+        }
+
+        CMBIntVec_Fill(&iv, 7);
+        CMBFloatVec_Fill(&fv, 1.5f);
+        TEST(CMBIntVec_Count(&iv, 7) == n);
+        TEST(CMBIntVec_Sum(&iv) == 7 * n);
+        TEST(CMBFloatVec_Sum(&fv) == 1.5 * n);
+        MBNumeric_PrefixSumFloat(CMBFloatVec_GetCArray(&fv), n);
+        for (int x = 0; x < n; x++) {
+            TEST(CMBFloatVec_GetValue(&fv, x) == 1.5f * (x + 1));
+        }
+
+        CMBIntVec_Destroy(&iv);
+        CMBIntVec_Destroy(&iv2);
+        CMBFloatVec_Destroy(&fv);
+    }
+
+    {
+        MBVector<float> v;
+        v.resize(33);
+        v.fill(NAN);
+        TEST(MBNumeric_MinFloat(v.getCArray(), v.size()) == 0);
+        v[20] = 3.0f;
+        v[30] = -3.0f;
+        TEST(MBNumeric_MinFloat(v.getCArray(), v.size()) == 30);
+        TEST(MBNumeric_MaxFloat(v.getCArray(), v.size()) == 20);
+    }
+}
+
+void MBUnitTest_MBRing(void)
+{
+    MBRing r;
+    MBRing_Create(&r, sizeof(int));
+    TEST(MBRing_Size(&r) == 0);
+
+    for (int x = 0; x < 100; x++) {
+        TEST(MBRing_Size(&r) == x);
+        MBRing_InsertHead(&r, &x, sizeof(x));
+        TEST(MBRing_Size(&r) == x + 1);
+    }
+    for (int x = 0; x < 100; x++) {
+        int v;
+        MBRing_RemoveTail(&r, &v, sizeof(v));
+        TEST(v == x);
+    }
+    TEST(MBRing_Size(&r) == 0);
+
+    for (int x = 0; x < 100; x++) {
+        TEST(MBRing_Size(&r) == x);
+        MBRing_InsertTail(&r, &x, sizeof(x));
+        TEST(MBRing_Size(&r) == x + 1);
+    }
+    for (int x = 0; x < 100; x++) {
+        int v;
+        MBRing_RemoveHead(&r, &v, sizeof(v));
+        TEST(v == x);
+    }
+    TEST(MBRing_Size(&r) == 0);
+
+    for (int x = 0; x < 100; x++) {
+        TEST(MBRing_Size(&r) == x);
+        MBRing_InsertHead(&r, &x, sizeof(x));
+        TEST(MBRing_Size(&r) == x + 1);
+    }
+    for (int x = 99; x >= 0; x--) {
+        int v;
+        MBRing_RemoveHead(&r, &v, sizeof(v));
+        TEST(v == x);
+    }
+    TEST(MBRing_Size(&r) == 0);
+
+    for (int x = 0; x < 100; x++) {
+        TEST(MBRing_Size(&r) == x);
+        MBRing_InsertTail(&r, &x, sizeof(x));
+        TEST(MBRing_Size(&r) == x + 1);
+    }
+    for (int x = 99; x >= 0; x--) {
+        int v;
+        MBRing_RemoveTail(&r, &v, sizeof(v));
+        TEST(v == x);
+    }
+    TEST(MBRing_Size(&r) == 0);
+
+    for (int x = 0; x < 100; x++) {
+        MBRing_InsertHead(&r, &x, sizeof(x));
+        MBRing_InsertTail(&r, &x, sizeof(x));
+    }
+    for (int x = 99; x >= 0; x--) {
+        int v;
+        MBRing_RemoveHead(&r, &v, sizeof(v));
+        TEST(v == x);
+
+        MBRing_RemoveTail(&r, &v, sizeof(v));
+        TEST(v == x);
+    }
+    TEST(MBRing_Size(&r) == 0);
+
+    RandomState rs;
+    RandomState_CreateWithSeed(&rs, 0x1234567);
+    uint count = 0;
+    for (int x = 0; x < 1000; x++) {
+        int v = (int)RandomState_Uint32(&rs);
+        int z = RandomState_Int(&rs, 0, 3);
+        if (z == 0) {
+            count++;
+            MBRing_InsertHead(&r, &v, sizeof(v));
+        } else if (z == 1) {
+            count++;
+            MBRing_InsertTail(&r, &v, sizeof(v));
+        } else if (z == 2) {
+            if (count > 0) {
+                MBRing_RemoveHead(&r, &v, sizeof(v));
+                count--;
+            }
+        } else {
+            if (count > 0) {
+                MBRing_RemoveTail(&r, &v, sizeof(v));
+                count--;
+            }
+        }
+
+        TEST(MBRing_Size(&r) == count);
+    }
+
+    MBRing_Destroy(&r);
+}
+
+void MBUnitTest_RandomSample(void)
+{
+    RandomState r;
+
+    RandomState_CreateWithSeed(&r, mbtest.seed);
+
+    /*
+     * Shuffles are permutations, for each of the swap paths.
+     */
+    {
+        const int n = 1000;
+        CMBIntVec v;
+        uint64 v64[n];
+        struct { char c[100]; } big[50];
+        bool seen[n];
+
+        CMBIntVec_Create(&v, n, n);
+        for (int x = 0; x < n; x++) {
+            CMBIntVec_PutValue(&v, x, x);
+            v64[x] = (uint64)x << 32;
+        }
+        for (int x = 0; x < (int)ARRAYSIZE(big); x++) {
+            memset(big[x].c, x, sizeof(big[x].c));
+        }
+
+        CMBIntVec_Shuffle(&v, &r);
+        RandomState_Shuffle(&r, v64, n, sizeof(v64[0]));
+        RandomState_Shuffle(&r, big, ARRAYSIZE(big), sizeof(big[0]));
+
+        MBUtil_Zero(seen, sizeof(seen));
+        for (int x = 0; x < n; x++) {
+            int i = CMBIntVec_GetValue(&v, x);
+            TEST(i >= 0 && i < n && !seen[i]);
+            seen[i] = TRUE;
+        }
+        MBUtil_Zero(seen, sizeof(seen));
+        for (int x = 0; x < n; x++) {
+            uint64 i = v64[x] >> 32;
+            TEST((uint32)v64[x] == 0);
+            TEST(i < (uint64)n && !seen[i]);
+            seen[i] = TRUE;
+        }
+        MBUtil_Zero(seen, sizeof(seen));
+        for (int x = 0; x < (int)ARRAYSIZE(big); x++) {
+            int i = big[x].c[0];
+            TEST(i >= 0 && i < (int)ARRAYSIZE(big) && !seen[i]);
+            TEST(big[x].c[sizeof(big[x].c) - 1] == i);
+            seen[i] = TRUE;
+        }
+
+        CMBIntVec_Destroy(&v);
+    }
+
+    /*
+     * All 24 orders of 4 items are equally likely.
+     */
+    {
+        const int trials = 24 * 1000;
+        int counts[256];
+        int buckets[24];
+        int numBuckets = 0;
+
+        MBUtil_Zero(counts, sizeof(counts));
+        for (int t = 0; t < trials; t++) {
+            uint8 a[4] = { 0, 1, 2, 3 };
+            RandomState_Shuffle(&r, a, ARRAYSIZE(a), sizeof(a[0]));
+            counts[a[0] << 6 | a[1] << 4 | a[2] << 2 | a[3]]++;
+        }
+        for (int x = 0; x < (int)ARRAYSIZE(counts); x++) {
+            if (counts[x] > 0) {
+                TEST(numBuckets < (int)ARRAYSIZE(buckets));
+                buckets[numBuckets++] = counts[x];
+            }
+        }
+        TEST(numBuckets == 24);
+        // 23 degrees of freedom.
+        TEST(MBUnitTestChiSquared(buckets, 24, trials) < 75.0);
+    }
+
+    /*
+     * A partial shuffle leaves a uniform sample at the front.
+     */
+    {
+        const int n = 10;
+        const int k = 3;
+        const int trials = 10 * 1000;
+        int counts[n];
+        MBVector<int> v;
+
+        MBUtil_Zero(counts, sizeof(counts));
+        for (int x = 0; x < n; x++) {
+            v.push(x);
+        }
+        for (int t = 0; t < trials; t++) {
+            v.partialShuffle(&r, k);
+            for (int x = 0; x < k; x++) {
+                counts[v[x]]++;
+            }
+        }
+
+        int sum = 0;
+        for (int x = 0; x < n; x++) {
+            sum += v[x];
+        }
+        TEST(sum == n * (n - 1) / 2);
+        // 9 degrees of freedom.
+        TEST(MBUnitTestChiSquared(counts, n, trials * k) < 50.0);
+    }
+
+    /*
+     * Reservoirs, both while they fill and on long streams where most
+     * of the items are skipped.
+     */
+    {
+        RandomReservoir res;
+        int slots[20];
+        int counts[10];
+
+        RandomReservoir_Create(&res, &r, 0);
+        for (int x = 0; x < 100; x++) {
+            TEST(RandomReservoir_Offer(&res, &r) == -1);
+        }
+
+        RandomReservoir_Create(&res, &r, ARRAYSIZE(slots));
+        for (int x = 0; x < 15; x++) {
+            TEST(RandomReservoir_Offer(&res, &r) == x);
+        }
+
+        for (int pass = 0; pass < 2; pass++) {
+            const int k = pass == 0 ? 5 : 10;
+            const int length = pass == 0 ? 50 : 100 * 1000;
+            const int trials = pass == 0 ? 20 * 1000 / k : 200;
+
+            MBUtil_Zero(counts, sizeof(counts));
+            for (int t = 0; t < trials; t++) {
+                RandomReservoir_Create(&res, &r, k);
+                for (int x = 0; x < length; x++) {
+                    int64 slot = RandomReservoir_Offer(&res, &r);
+                    TEST(slot >= -1 && slot < k);
+                    if (slot >= 0) {
+                        slots[slot] = x;
+                    }
+                }
+                for (int x = 0; x < k; x++) {
+                    counts[slots[x] * 10 / length]++;
+                }
+            }
+            // 9 degrees of freedom.
+            TEST(MBUnitTestChiSquared(counts, 10, trials * k) < 50.0);
+        }
+    }
+
+    /*
+     * Weighted sampling.
+     */
+    {
+        float w[] = { 1.0f, 2.0f, 0.0f, 4.0f, 1.0f };
+        float sparse[] = { 0.0f, 1.0f, 0.0f, 2.0f };
+        int64 out[ARRAYSIZE(w)];
+        const int trials = 8 * 1000;
+        int counts[ARRAYSIZE(w)];
+        double chi = 0.0;
+
+        TEST(RandomState_WeightedSample(&r, w, ARRAYSIZE(w), out, 0) == 0);
+        TEST(RandomState_WeightedSample(&r, sparse, ARRAYSIZE(sparse),
+                                        out, 3) == 2);
+        TEST((out[0] == 1 && out[1] == 3) || (out[0] == 3 && out[1] == 1));
+
+        MBUtil_Zero(counts, sizeof(counts));
+        for (int t = 0; t < trials; t++) {
+            TEST(RandomState_WeightedSample(&r, w, ARRAYSIZE(w),
+                                            out, 2) == 2);
+            TEST(out[0] != out[1]);
+            TEST(out[0] != 2 && out[1] != 2);
+            counts[out[0]]++;
+        }
+        for (int x = 0; x < (int)ARRAYSIZE(w); x++) {
+            double expected = trials * w[x] / 8.0;
+            if (expected > 0) {
+                chi += (counts[x] - expected) * (counts[x] - expected) /
+                       expected;
+            }
+        }
+        TEST(counts[2] == 0);
+        // 3 degrees of freedom.
+        TEST(chi < 35.0);
+    }
+
+    /*
+     * The first pick should still follow the weights when it usually
+     * comes from past the first k items.
+     */
+    {
+        const int n = 200;
+        const int k = 5;
+        const int trials = 4000;
+        float w[n];
+        int64 out[k];
+        int counts[4];
+        double chi = 0.0;
+        bool seen[n];
+
+        for (int x = 0; x < n; x++) {
+            w[x] = 1.0f + x % 4;
+        }
+
+        MBUtil_Zero(counts, sizeof(counts));
+        for (int t = 0; t < trials; t++) {
+            TEST(RandomState_WeightedSample(&r, w, n, out, k) == k);
+            MBUtil_Zero(seen, sizeof(seen));
+            for (int x = 0; x < k; x++) {
+                TEST(out[x] >= 0 && out[x] < n && !seen[out[x]]);
+                seen[out[x]] = TRUE;
+            }
+            counts[out[0] % 4]++;
+        }
+        for (int x = 0; x < 4; x++) {
+            double expected = trials * (1.0 + x) / 10.0;
+            chi += (counts[x] - expected) * (counts[x] - expected) / expected;
+        }
+        // 3 degrees of freedom.
+        TEST(chi < 35.0);
+    }
+
+    RandomState_Destroy(&r);
+}
@@ -39,10 +39,17 @@ static void CMBVarMapRehash(CMBVarMap *map);
 
 void CMBVarMap_Create(CMBVarMap *map)
 {
-    CMBVarVec_CreateWithSize(&map->myKeys, DEFAULT_SPACE);
-    CMBVarVec_CreateWithSize(&map->myValues, DEFAULT_SPACE);
+    CMBVarMap_CreateWithAllocator(map, NULL);
+}
+
+void CMBVarMap_CreateWithAllocator(CMBVarMap *map, const CMBAllocator *alloc)
+{
+    CMBVarVec_CreateWithAllocator(&map->myKeys, DEFAULT_SPACE, DEFAULT_SPACE,
+                                  alloc);
+    CMBVarVec_CreateWithAllocator(&map->myValues, DEFAULT_SPACE, DEFAULT_SPACE,
+                                  alloc);
 
-    BitVector_CreateWithSize(&map->myFlags, DEFAULT_SPACE * 2);
+    BitVector_CreateWithAllocator(&map->myFlags, DEFAULT_SPACE * 2, alloc);
     ASSERT(BitVector_GetFillValue(&map->myFlags) == FALSE);
 
     map->mySize = 0;
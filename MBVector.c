@@ -27,35 +27,81 @@
 
 #include "MBVector.h"
 
-void CMBVector_EnsureCapacity(CMBVector *vector, int capacity)
+void CMBVector_EnsureCapacity(CMBVector *vector, int64 capacity)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
-    ASSERT(vector->capacity < MAX_INT32 / 2);
-    ASSERT(vector->size >= 0);
-    ASSERT(vector->size < MAX_INT32 / 2);
-    ASSERT(capacity < MAX_INT32 / 2);
     ASSERT(vector->itemSize > 0);
     ASSERT(vector->itemSize < MAX_INT32 / 2);
 
+    /*
+     * Keep the byte size of the array representable, so that none of
+     * the index * itemSize math can overflow.
+     */
+    const int64 maxCapacity = MAX_INT64 / 2 / vector->itemSize;
+
+    ASSERT(vector->capacity < maxCapacity);
+    ASSERT(vector->size >= 0);
+    ASSERT(vector->size <= vector->capacity);
+    ASSERT(capacity < maxCapacity);
+
     if (vector->capacity >= capacity) {
         return;
     }
 
     ASSERT(vector->pinCount == 0);
 
-    uint32 oldCapacity = vector->capacity;
+    int64 oldCapacity = vector->capacity;
 
-    uint32 newCap = MAX(capacity, vector->capacity * 2);
+    int64 newCap = MAX(capacity, MIN(vector->capacity * 2, maxCapacity));
     ASSERT(newCap > vector->capacity);
     ASSERT(newCap >= capacity);
-    ASSERT(newCap < MAX_INT32 / 2);
+    ASSERT(newCap <= maxCapacity);
     vector->capacity = newCap;
 
-    void *newItems = reallocarray(vector->items, newCap, vector->itemSize);
+    void *newItems;
+    if (vector->allocator == NULL) {
+        newItems = reallocarray(vector->items, newCap, vector->itemSize);
+    } else {
+        newItems = MBAlloc_Realloc(vector->allocator, vector->items,
+                                   (size_t)oldCapacity * vector->itemSize,
+                                   (size_t)newCap * vector->itemSize);
+    }
     if (newItems != NULL) {
         vector->items = newItems;
     } else {
         PANIC("Unable to resize CMBVector: out of memory "
-              "(oldSize=%d, newSize=%d)", oldCapacity, capacity);
+              "(oldSize=%lld, newSize=%lld)", oldCapacity, capacity);
     }
 }
+
+void CMBVector_MergeSorted(CMBVector *dest, CMBVector * const *srcs,
+                           uint32 numSrcs, const CMBComparator *comp)
+{
+    const void **items;
+    uint64 *lens;
+    int64 total = 0;
+
+    ASSERT(dest->magic == CMBVECTOR_MAGIC);
+    ASSERT(comp != NULL);
+    ASSERT(dest->itemSize == comp->itemSize);
+
+    items = malloc(numSrcs * sizeof(items[0]));
+    lens = malloc(numSrcs * sizeof(lens[0]));
+    VERIFY(numSrcs == 0 || (items != NULL && lens != NULL));
+
+    for (uint32 i = 0; i < numSrcs; i++) {
+        ASSERT(srcs[i]->magic == CMBVECTOR_MAGIC);
+        ASSERT(srcs[i] != dest);
+        ASSERT(srcs[i]->itemSize == dest->itemSize);
+        items[i] = srcs[i]->items;
+        lens[i] = srcs[i]->size;
+        total += srcs[i]->size;
+    }
+
+    CMBVector_Resize(dest, total);
+    MBCompare_MergeSortedK(dest->items, items, lens, numSrcs, dest->itemSize,
+                           comp->compareFn, comp->cbData);
+
+    free(items);
+    free(lens);
+}
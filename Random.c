@@ -23,7 +23,9 @@
  * SOFTWARE.
  */
 
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -42,6 +44,19 @@ typedef struct RandomGlobalData {
 
 static RandomGlobalData randomData;
 
+/*
+ * Threads that have called Random_InitThread use their own stream for
+ * the Random_* functions instead of the shared randomData.rs.
+ */
+static THREAD_LOCAL RandomState *randomThreadState;
+static THREAD_LOCAL RandomState randomThreadStorage;
+
+static INLINE_ALWAYS RandomState *RandomGetState(void)
+{
+    RandomState *rs = randomThreadState;
+    return UNLIKELY(rs != NULL) ? rs : &randomData.rs;
+}
+
 
 void RandomState_Create(RandomState *r)
 {
@@ -55,6 +70,32 @@ void RandomState_CreateWithSeed(RandomState *r, uint64 seed)
     RandomState_SetSeed(r, seed);
 }
 
+void RandomState_CreateWithEngine(RandomState *r, RandomEngineType engine,
+                                  uint64 seed)
+{
+    ASSERT(engine < RANDOM_ENGINE_MAX);
+
+    MBUtil_Zero(r, sizeof(*r));
+    r->engine = engine;
+    RandomState_SetSeed(r, seed);
+}
+
+RandomEngineType RandomState_GetEngine(RandomState *r)
+{
+    return r->engine;
+}
+
+const char *RandomState_GetEngineName(RandomEngineType engine)
+{
+    static const char *names[] = {
+        "LCG", "XOSHIRO256", "PCG64", "SPLITMIX64",
+    };
+
+    ASSERT(ARRAYSIZE(names) == RANDOM_ENGINE_MAX);
+    ASSERT(engine < RANDOM_ENGINE_MAX);
+    return names[engine];
+}
+
 void RandomState_Destroy(RandomState *r)
 {
     // Nothing to do...
@@ -77,28 +118,361 @@ uint64 RandomState_GetSeed(RandomState *r)
     return r->seed;
 }
 
+static INLINE_ALWAYS uint64 RandomSplitMix64(uint64 *x)
+{
+    uint64 z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static INLINE_ALWAYS uint64 RandomRotl64(uint64 x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static INLINE_ALWAYS uint64 RandomXoshiro256(uint64 *s)
+{
+    uint64 result = RandomRotl64(s[1] * 5, 7) * 9;
+    uint64 t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = RandomRotl64(s[3], 45);
+
+    return result;
+}
+
+/*
+ * PCG XSL-RR 128/64: state is s[0..1] (lo, hi), and the stream
+ * increment is s[2..3], which must be odd.
+ */
+#define RANDOM_PCG_MULT_HI 2549297995355413924ULL
+#define RANDOM_PCG_MULT_LO 4865540595714422341ULL
+
+static INLINE_ALWAYS uint64 RandomRotr64(uint64 x, uint r)
+{
+    return (x >> r) | (x << ((-r) & 63));
+}
+
+/*
+ * High and low halves of the full 64x64-bit product.
+ */
+static INLINE_ALWAYS uint64 RandomMul64(uint64 a, uint64 b, uint64 *lo)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 p = (unsigned __int128)a * b;
+    *lo = (uint64)p;
+    return (uint64)(p >> 64);
+#else
+    uint64 a0 = a & 0xFFFFFFFF, a1 = a >> 32;
+    uint64 b0 = b & 0xFFFFFFFF, b1 = b >> 32;
+    uint64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64 mid = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+    *lo = (mid << 32) | (p00 & 0xFFFFFFFF);
+    return p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+static INLINE_ALWAYS uint64 RandomPCG64(uint64 *s)
+{
+    uint64 lo = s[0];
+    uint64 hi = s[1];
+
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 state = ((unsigned __int128)hi << 64) | lo;
+    unsigned __int128 mult = ((unsigned __int128)RANDOM_PCG_MULT_HI << 64) |
+                             RANDOM_PCG_MULT_LO;
+    unsigned __int128 inc = ((unsigned __int128)s[3] << 64) | s[2];
+    state = state * mult + inc;
+    s[0] = (uint64)state;
+    s[1] = (uint64)(state >> 64);
+#else
+    /*
+     * 128-bit multiply-add by hand, from 32-bit partial products.
+     */
+    uint64 m = RANDOM_PCG_MULT_LO;
+    uint64 a0 = lo & 0xFFFFFFFF, a1 = lo >> 32;
+    uint64 b0 = m & 0xFFFFFFFF, b1 = m >> 32;
+    uint64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64 mid = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+    uint64 newLo = (mid << 32) | (p00 & 0xFFFFFFFF);
+    uint64 newHi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32) +
+                   hi * RANDOM_PCG_MULT_LO + lo * RANDOM_PCG_MULT_HI;
+    s[0] = newLo + s[2];
+    s[1] = newHi + s[3] + (s[0] < newLo);
+#endif
+
+    return RandomRotr64(s[1] ^ s[0], s[1] >> 58);
+}
+
 void RandomState_SetSeed(RandomState *r, uint64 seed)
 {
+    uint64 sm = seed;
+
     r->seed = seed;
     r->value = r->seed;
 
     r->bitBucket = 0;
     r->bitBucketSize = 0;
+
+    switch (r->engine) {
+        case RANDOM_ENGINE_LCG:
+            break;
+        case RANDOM_ENGINE_XOSHIRO256:
+            /*
+             * SplitMix64 never produces four zeros in a row, so this
+             * can't land on the all-zero state.
+             */
+            for (uint i = 0; i < ARRAYSIZE(r->state); i++) {
+                r->state[i] = RandomSplitMix64(&sm);
+            }
+            break;
+        case RANDOM_ENGINE_PCG64:
+            r->state[0] = RandomSplitMix64(&sm);
+            r->state[1] = RandomSplitMix64(&sm);
+            r->state[2] = RandomSplitMix64(&sm) | 1;
+            r->state[3] = RandomSplitMix64(&sm);
+            break;
+        case RANDOM_ENGINE_SPLITMIX64:
+            r->state[0] = seed;
+            break;
+        default:
+            NOT_REACHED();
+    }
 }
 
+/*
+ * Jumping ahead.
+ *
+ * The LCG, PCG64 and SplitMix64 are all affine maps on their state, so
+ * n steps is x -> A^n x + (A^(n-1) + ... + 1) C, which we build up by
+ * repeated squaring (Brown, "Random Number Generation with Arbitrary
+ * Strides").
+ *
+ * xoshiro256 is linear over GF(2), so n steps is J(T) for the step
+ * matrix T, where J(x) = x^n mod P(x) and P is the characteristic
+ * polynomial of T.  J(T) s is then just 256 steps, xor-ing in the
+ * state for each set coefficient of J.  The constants published with
+ * xoshiro256 for its 2^128 jump are J for n = 2^128.
+ */
+#define RANDOM_LCG_MULT 2862933555777941757ULL
+#define RANDOM_LCG_INC  3037000493ULL
+
+#define RANDOM_SPLITMIX_GAMMA 0x9E3779B97F4A7C15ULL
 
 /*
- * The Workhorse of the entire module.
+ * P(x) - x^256 for xoshiro256, low word first.
  */
-uint32 RandomState_Uint32(RandomState *r)
+static const uint64 randomXoshiroPoly[4] = {
+    0x9d116f2bb0f0f001ULL, 0x0280002bcefd1a5eULL,
+    0x04b4edcf26259f85ULL, 0x0003c03c3f3ecb19ULL,
+};
+
+static void RandomLCGJump(uint64 *x, uint64 n)
+{
+    uint64 curMult = RANDOM_LCG_MULT;
+    uint64 curInc = RANDOM_LCG_INC;
+    uint64 accMult = 1;
+    uint64 accInc = 0;
+
+    while (n > 0) {
+        if (n & 1) {
+            accMult *= curMult;
+            accInc = accInc * curMult + curInc;
+        }
+        curInc = (curMult + 1) * curInc;
+        curMult *= curMult;
+        n >>= 1;
+    }
+    *x = accMult * *x + accInc;
+}
+
+/*
+ * 128-bit a * b, truncated, on (lo, hi) pairs.
+ */
+static INLINE_ALWAYS void
+RandomMul128(uint64 *lo, uint64 *hi, uint64 bLo, uint64 bHi)
 {
-    static const uint64 constA = 2862933555777941757ULL;
-    static const uint64 constB = 3037000493ULL;
+    uint64 pLo;
+    uint64 pHi = RandomMul64(*lo, bLo, &pLo);
 
-    r->value = constA * r->value + constB;
+    pHi += *lo * bHi + *hi * bLo;
+    *lo = pLo;
+    *hi = pHi;
+}
+
+static INLINE_ALWAYS void
+RandomAdd128(uint64 *lo, uint64 *hi, uint64 bLo, uint64 bHi)
+{
+    uint64 sum = *lo + bLo;
+
+    *hi += bHi + (sum < *lo);
+    *lo = sum;
+}
+
+static void RandomPCG64Jump(uint64 *s, uint64 n)
+{
+    uint64 curMultLo = RANDOM_PCG_MULT_LO, curMultHi = RANDOM_PCG_MULT_HI;
+    uint64 curIncLo = s[2], curIncHi = s[3];
+    uint64 accMultLo = 1, accMultHi = 0;
+    uint64 accIncLo = 0, accIncHi = 0;
+
+    while (n > 0) {
+        if (n & 1) {
+            RandomMul128(&accMultLo, &accMultHi, curMultLo, curMultHi);
+            RandomMul128(&accIncLo, &accIncHi, curMultLo, curMultHi);
+            RandomAdd128(&accIncLo, &accIncHi, curIncLo, curIncHi);
+        }
+
+        // curInc = (curMult + 1) * curInc
+        uint64 tLo = curMultLo, tHi = curMultHi;
+        RandomAdd128(&tLo, &tHi, 1, 0);
+        RandomMul128(&curIncLo, &curIncHi, tLo, tHi);
+
+        RandomMul128(&curMultLo, &curMultHi, curMultLo, curMultHi);
+        n >>= 1;
+    }
+
+    RandomMul128(&s[0], &s[1], accMultLo, accMultHi);
+    RandomAdd128(&s[0], &s[1], accIncLo, accIncHi);
+}
+
+/*
+ * a = a * b mod P, for polynomials over GF(2) of degree < 256.
+ */
+static void RandomXoshiroPolyMulMod(uint64 *a, const uint64 *b)
+{
+    uint64 acc[4] = { 0, 0, 0, 0 };
+    uint64 x[4];
+
+    memcpy(x, a, sizeof(x));
+    for (uint i = 0; i < 256; i++) {
+        if ((b[i / 64] >> (i % 64)) & 1) {
+            for (uint w = 0; w < 4; w++) {
+                acc[w] ^= x[w];
+            }
+        }
+
+        // x = x * (the polynomial x) mod P
+        uint64 carry = x[3] >> 63;
+        x[3] = (x[3] << 1) | (x[2] >> 63);
+        x[2] = (x[2] << 1) | (x[1] >> 63);
+        x[1] = (x[1] << 1) | (x[0] >> 63);
+        x[0] <<= 1;
+        if (carry) {
+            for (uint w = 0; w < 4; w++) {
+                x[w] ^= randomXoshiroPoly[w];
+            }
+        }
+    }
+    memcpy(a, acc, sizeof(acc));
+}
+
+static void RandomXoshiroJump(uint64 *s, uint64 n)
+{
+    uint64 jump[4] = { 1, 0, 0, 0 };
+    uint64 base[4] = { 2, 0, 0, 0 };
+    uint64 acc[4] = { 0, 0, 0, 0 };
+
+    /*
+     * Short jumps are cheaper to just step through.
+     */
+    if (n <= 256) {
+        while (n-- > 0) {
+            RandomXoshiro256(s);
+        }
+        return;
+    }
+
+    while (n > 0) {
+        if (n & 1) {
+            RandomXoshiroPolyMulMod(jump, base);
+        }
+        RandomXoshiroPolyMulMod(base, base);
+        n >>= 1;
+    }
+
+    for (uint i = 0; i < 256; i++) {
+        if ((jump[i / 64] >> (i % 64)) & 1) {
+            for (uint w = 0; w < 4; w++) {
+                acc[w] ^= s[w];
+            }
+        }
+        RandomXoshiro256(s);
+    }
+    memcpy(s, acc, sizeof(acc));
+}
+
+void RandomState_Jump(RandomState *r, uint64 n)
+{
+    switch (r->engine) {
+        case RANDOM_ENGINE_LCG:
+            RandomLCGJump(&r->value, n);
+            break;
+        case RANDOM_ENGINE_XOSHIRO256:
+            RandomXoshiroJump(r->state, n);
+            break;
+        case RANDOM_ENGINE_PCG64:
+            RandomPCG64Jump(r->state, n);
+            break;
+        case RANDOM_ENGINE_SPLITMIX64:
+            r->state[0] += n * RANDOM_SPLITMIX_GAMMA;
+            break;
+        default:
+            NOT_REACHED();
+    }
+}
+
+/*
+ * The child's seed is hashed from one draw of the parent, and SetSeed
+ * runs it through SplitMix64 again for the 64-bit engines.
+ */
+void RandomState_Split(RandomState *r, RandomState *child)
+{
+    RandomState_CreateWithEngine(child, r->engine, RandomState_Uint64(r));
+}
+
+void RandomState_CreateStream(RandomState *r, const RandomState *parent,
+                              uint64 streamId)
+{
+    uint64 sm = streamId;
+    uint64 x = parent->seed ^ RandomSplitMix64(&sm);
+
+    RandomState_CreateWithEngine(r, parent->engine, RandomSplitMix64(&x));
+}
+
+static INLINE_ALWAYS uint32 RandomLCG(RandomState *r)
+{
+    r->value = RANDOM_LCG_MULT * r->value + RANDOM_LCG_INC;
     return r->value >> 32;
 }
 
+/*
+ * The Workhorse of the entire module.
+ *
+ * The 64-bit engines return their high bits here, since those are the
+ * strongest ones for xoshiro256**.
+ */
+uint32 RandomState_Uint32(RandomState *r)
+{
+    switch (r->engine) {
+        case RANDOM_ENGINE_LCG:
+            return RandomLCG(r);
+        case RANDOM_ENGINE_XOSHIRO256:
+            return RandomXoshiro256(r->state) >> 32;
+        case RANDOM_ENGINE_PCG64:
+            return RandomPCG64(r->state) >> 32;
+        case RANDOM_ENGINE_SPLITMIX64:
+            return RandomSplitMix64(&r->state[0]) >> 32;
+        default:
+            NOT_REACHED();
+    }
+}
+
 bool RandomState_Bit(RandomState *r)
 {
     bool val;
@@ -218,144 +592,1293 @@ uint64 RandomState_Uint64(RandomState *r)
     uint64 a;
     uint32 b;
 
-    a = RandomState_Uint32(r);
-    b = RandomState_Uint32(r);
+    switch (r->engine) {
+        case RANDOM_ENGINE_XOSHIRO256:
+            return RandomXoshiro256(r->state);
+        case RANDOM_ENGINE_PCG64:
+            return RandomPCG64(r->state);
+        case RANDOM_ENGINE_SPLITMIX64:
+            return RandomSplitMix64(&r->state[0]);
+        default:
+            break;
+    }
+
+    ASSERT(r->engine == RANDOM_ENGINE_LCG);
+    a = RandomLCG(r);
+    b = RandomLCG(r);
 
     return (a << 32) | b;
 }
 
 /*
- * Random_Int --
- *   Returns a uniformly distributed int in the range [min, max] (inclusive).
- *   XXX: Not verified for negative values or ranges near max int.
+ * The bulk fills run RANDOM_LANES xoshiro256** streams in lockstep,
+ * with the state stored lane-major so each step is a handful of vector
+ * shifts/xors/adds (the multiplies are by 5 and 9).  Each block of
+ * outputs is laid out as the low halves of every lane, then the high
+ * halves, so the stores are contiguous too.
+ *
+ * On x86_64 Linux, target_clones builds an AVX2 copy of the kernels
+ * alongside the baseline one.  They're pure integer code, so both give
+ * the same bits.
  */
-int RandomState_Int(RandomState *r, int min, int max)
-{
-    int range;
-    int rval;
+#define RANDOM_LANES 8
 
-    ASSERT(max >= min);
+/*
+ * FillIntRange maps the raw values a chunk at a time, while they're
+ * still in cache.  This must be a multiple of the 2 * RANDOM_LANES
+ * block size, so the chunking doesn't change the output.
+ */
+#define RANDOM_RANGE_CHUNK 1024
 
-    range = (max - min) + 1;
-    rval = RandomState_Uint32(r);
-    rval &= ~(1 << 31);
+#if defined(__GNUC__) && !defined(__clang__) && \
+    defined(ARCH_AMD64) && defined(MB_LINUX)
+#define RANDOM_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define RANDOM_KERNEL
+#endif
 
-    ASSERT(rval >= 0);
-    rval = (rval % range) + min;
+typedef struct RandomLanes {
+    uint64 s[4][RANDOM_LANES];
 
-    ASSERT(rval <= max);
-    ASSERT(rval >= min);
+    /*
+     * Separate scalar stream for the rare FillIntRange redraws.
+     */
+    uint64 fixup[4];
+} RandomLanes;
 
-    return rval;
+static void RandomLanesCreate(RandomLanes *ls, RandomState *r)
+{
+    uint64 sm = RandomState_Uint64(r);
+
+    for (uint i = 0; i < 4; i++) {
+        for (uint l = 0; l < RANDOM_LANES; l++) {
+            ls->s[i][l] = RandomSplitMix64(&sm);
+        }
+    }
+    for (uint i = 0; i < 4; i++) {
+        ls->fixup[i] = RandomSplitMix64(&sm);
+    }
 }
 
+#define RANDOM_LANES_STEP(_s0, _s1, _s2, _s3, _result)                 \
+    do {                                                                \
+        uint64 _t = (_s1) << 17;                                        \
+        (_result) = RandomRotl64((_s1) * 5, 7) * 9;                     \
+        (_s2) ^= (_s0);                                                 \
+        (_s3) ^= (_s1);                                                 \
+        (_s1) ^= (_s2);                                                 \
+        (_s0) ^= (_s3);                                                 \
+        (_s2) ^= _t;                                                    \
+        (_s3) = RandomRotl64((_s3), 45);                                \
+    } while (FALSE)
+
 /*
- * Random_UnitFloat --
- *     Returns a uniformly distributed float in the range [0, 1).
+ * Declares a kernel that writes numBlocks blocks of 2 * RANDOM_LANES
+ * 32-bit outputs, passing each raw uint32 through _xform.
  */
-float RandomState_UnitFloat(RandomState *r)
-{
-    float rval;
+#define RANDOM_DEFINE_FILL32(_name, _type, _xform)                      \
+    RANDOM_KERNEL                                                       \
+    static void _name(RandomLanes *ls, _type *out, int64 numBlocks)     \
+    {                                                                   \
+        uint64 s0[RANDOM_LANES], s1[RANDOM_LANES];                      \
+        uint64 s2[RANDOM_LANES], s3[RANDOM_LANES];                      \
+                                                                        \
+        memcpy(s0, ls->s[0], sizeof(s0));                               \
+        memcpy(s1, ls->s[1], sizeof(s1));                               \
+        memcpy(s2, ls->s[2], sizeof(s2));                               \
+        memcpy(s3, ls->s[3], sizeof(s3));                               \
+                                                                        \
+        for (int64 b = 0; b < numBlocks; b++) {                         \
+            _type *o = out + b * 2 * RANDOM_LANES;                      \
+            for (int l = 0; l < RANDOM_LANES; l++) {                    \
+                uint64 v;                                               \
+                RANDOM_LANES_STEP(s0[l], s1[l], s2[l], s3[l], v);       \
+                o[l] = _xform((uint32)v);                               \
+                o[RANDOM_LANES + l] = _xform((uint32)(v >> 32));        \
+            }                                                           \
+        }                                                               \
+                                                                        \
+        memcpy(ls->s[0], s0, sizeof(s0));                               \
+        memcpy(ls->s[1], s1, sizeof(s1));                               \
+        memcpy(ls->s[2], s2, sizeof(s2));                               \
+        memcpy(ls->s[3], s3, sizeof(s3));                               \
+    }
 
-    rval = ((float) RandomState_Uint32(r)) / (float) ((uint32) -1);
+#define RANDOM_XFORM_UINT32(_u) (_u)
+#define RANDOM_XFORM_UNIT_FLOAT(_u) ((float)((_u) >> 8) * (1.0f / 16777216.0f))
 
-    return rval;
+RANDOM_DEFINE_FILL32(RandomLanesFillUint32, uint32, RANDOM_XFORM_UINT32)
+RANDOM_DEFINE_FILL32(RandomLanesFillUnitFloat, float, RANDOM_XFORM_UNIT_FLOAT)
+
+RANDOM_KERNEL
+static void RandomLanesFillUint64(RandomLanes *ls, uint64 *out,
+                                  int64 numBlocks)
+{
+    uint64 s0[RANDOM_LANES], s1[RANDOM_LANES];
+    uint64 s2[RANDOM_LANES], s3[RANDOM_LANES];
+
+    memcpy(s0, ls->s[0], sizeof(s0));
+    memcpy(s1, ls->s[1], sizeof(s1));
+    memcpy(s2, ls->s[2], sizeof(s2));
+    memcpy(s3, ls->s[3], sizeof(s3));
+
+    for (int64 b = 0; b < numBlocks; b++) {
+        uint64 *o = out + b * RANDOM_LANES;
+        for (int l = 0; l < RANDOM_LANES; l++) {
+            RANDOM_LANES_STEP(s0[l], s1[l], s2[l], s3[l], o[l]);
+        }
+    }
+
+    memcpy(ls->s[0], s0, sizeof(s0));
+    memcpy(ls->s[1], s1, sizeof(s1));
+    memcpy(ls->s[2], s2, sizeof(s2));
+    memcpy(ls->s[3], s3, sizeof(s3));
 }
 
 /*
- * Sum numDice random die, between 1 and diceMax, inclusive.
+ * Map raw uint32s in out to [min, min + range) in place.  Rejections
+ * are rare, so check a block at a time with vector code and only walk
+ * a block one by one if something in it needs a redraw.
  */
-int RandomState_DiceSum(RandomState *r, int numDice, int diceMax)
+static INLINE_ALWAYS uint32
+RandomMapRangeSlow(RandomLanes *ls, uint32 u, int min,
+                   uint32 range, uint32 threshold)
 {
-    int x;
-    int oup = 0;
-
-    ASSERT(numDice >= 0 );
+    uint64 m = (uint64)u * range;
 
-    for (x = 0; x < numDice; x++) {
-        oup += RandomState_Int(r, 1, diceMax);
+    while ((uint32)m < threshold) {
+        m = (RandomXoshiro256(ls->fixup) >> 32) * range;
     }
+    return (uint32)min + (uint32)(m >> 32);
+}
 
-    return oup;
+RANDOM_KERNEL
+static void RandomLanesMapRange(RandomLanes *ls, int *out, int64 numItems,
+                                int min, uint32 range, uint32 threshold)
+{
+    const int block = 2 * RANDOM_LANES;
+    uint32 *uout = (uint32 *)out;
+    int64 i = 0;
+
+    for (; i + block <= numItems; i += block) {
+        uint32 *o = uout + i;
+        uint32 reject = 0;
+
+        for (int l = 0; l < block; l++) {
+            reject |= (uint32)((uint64)o[l] * range) < threshold;
+        }
+
+        if (LIKELY(!reject)) {
+            for (int l = 0; l < block; l++) {
+                o[l] = (uint32)min + (uint32)(((uint64)o[l] * range) >> 32);
+            }
+        } else {
+            for (int l = 0; l < block; l++) {
+                o[l] = RandomMapRangeSlow(ls, o[l], min, range, threshold);
+            }
+        }
+    }
+    for (; i < numItems; i++) {
+        uout[i] = RandomMapRangeSlow(ls, uout[i], min, range, threshold);
+    }
 }
 
 /*
- * Initializes the random module.
- * This will generate a random seed if one has not
- * been previously set.
+ * Run the kernel over all the whole blocks, and then do one more block
+ * into a temporary for any leftovers.
  */
-void Random_Init(void)
+#define RANDOM_FILL(_kernel, _type, _blockSize, _ls, _out, _numItems)   \
+    do {                                                                \
+        int64 _blocks = (_numItems) / (_blockSize);                     \
+        int64 _done = _blocks * (_blockSize);                           \
+                                                                        \
+        ASSERT((_numItems) >= 0);                                       \
+        _kernel((_ls), (_out), _blocks);                                \
+        if (_done < (_numItems)) {                                      \
+            _type _tmp[_blockSize];                                     \
+            _kernel((_ls), _tmp, 1);                                    \
+            memcpy((_out) + _done, _tmp,                                \
+                   ((_numItems) - _done) * sizeof(_type));              \
+        }                                                               \
+    } while (FALSE)
+
+void RandomState_FillUint32(RandomState *r, uint32 *out, int64 numItems)
 {
-    randomData.initializedCount++;
+    RandomLanes ls;
 
-    if (randomData.initializedCount > 1) {
+    RandomLanesCreate(&ls, r);
+    RANDOM_FILL(RandomLanesFillUint32, uint32, 2 * RANDOM_LANES,
+                &ls, out, numItems);
+}
+
+void RandomState_FillUint64(RandomState *r, uint64 *out, int64 numItems)
+{
+    RandomLanes ls;
+
+    RandomLanesCreate(&ls, r);
+    RANDOM_FILL(RandomLanesFillUint64, uint64, RANDOM_LANES,
+                &ls, out, numItems);
+}
+
+void RandomState_FillUnitFloat(RandomState *r, float *out, int64 numItems)
+{
+    RandomLanes ls;
+
+    RandomLanesCreate(&ls, r);
+    RANDOM_FILL(RandomLanesFillUnitFloat, float, 2 * RANDOM_LANES,
+                &ls, out, numItems);
+}
+
+void RandomState_FillIntRange(RandomState *r, int *out, int64 numItems,
+                              int min, int max)
+{
+    RandomLanes ls;
+    uint64 range;
+    uint32 threshold;
+
+    ASSERT(max >= min);
+
+    RandomLanesCreate(&ls, r);
+
+    range = (uint64)((int64)max - (int64)min) + 1;
+    if (range > MAX_UINT32) {
+        // The raw values already cover the whole int range.
+        RANDOM_FILL(RandomLanesFillUint32, uint32, 2 * RANDOM_LANES,
+                    &ls, (uint32 *)out, numItems);
         return;
     }
 
-    if (!randomData.haveSeed) {
-        Random_GenerateSeed();
-        ASSERT(randomData.haveSeed);
+    /*
+     * Lemire's multiply-shift: the high half of u * range is uniform
+     * once we reject the few u whose low half lands below
+     * 2^32 mod range.
+     */
+    threshold = (uint32)(-(uint32)range) % (uint32)range;
+
+    for (int64 c = 0; c < numItems; c += RANDOM_RANGE_CHUNK) {
+        int64 chunkSize = MIN(numItems - c, RANDOM_RANGE_CHUNK);
+        RANDOM_FILL(RandomLanesFillUint32, uint32, 2 * RANDOM_LANES,
+                    &ls, (uint32 *)out + c, chunkSize);
+        RandomLanesMapRange(&ls, out + c, chunkSize, min,
+                            (uint32)range, threshold);
     }
 }
 
-void Random_Exit(void)
+void RandomState_FillInt64Range(RandomState *r, int64 *out, int64 numItems,
+                                int64 min, int64 max)
 {
-    ASSERT(randomData.initializedCount > 0);
-    randomData.initializedCount--;
+    RandomLanes ls;
+    uint64 range;
+    uint64 threshold;
+    uint64 *uout = (uint64 *)out;
 
-    if (randomData.initializedCount > 0) {
+    ASSERT(max >= min);
+
+    RandomLanesCreate(&ls, r);
+    range = (uint64)max - (uint64)min + 1;
+
+    if (range == 0) {
+        RANDOM_FILL(RandomLanesFillUint64, uint64, RANDOM_LANES,
+                    &ls, uout, numItems);
         return;
     }
 
-    randomData.haveSeed = FALSE;
+    /*
+     * There's no 64x64->128 vector multiply to be had, so only the raw
+     * generation is vectorized here.
+     */
+    threshold = -range % range;
+    for (int64 c = 0; c < numItems; c += RANDOM_RANGE_CHUNK) {
+        int64 chunkSize = MIN(numItems - c, RANDOM_RANGE_CHUNK);
+
+        RANDOM_FILL(RandomLanesFillUint64, uint64, RANDOM_LANES,
+                    &ls, uout + c, chunkSize);
+        for (int64 i = c; i < c + chunkSize; i++) {
+            uint64 hi, lo;
+
+            hi = RandomMul64(uout[i], range, &lo);
+            while (UNLIKELY(lo < threshold)) {
+                hi = RandomMul64(RandomXoshiro256(ls.fixup), range, &lo);
+            }
+            uout[i] = (uint64)min + hi;
+        }
+    }
 }
 
-
 /*
- * Generate a new random seed for the module.
+ * Lemire's "Fast Random Integer Generation in an Interval": the high
+ * half of u * bound is in [0, bound), and it's exactly uniform once we
+ * reject the u whose low half lands below 2^N mod bound.  Since that
+ * threshold is less than bound, we only need the divide to compute it
+ * when the low half is below bound, which is rare unless bound is huge,
+ * and for bounds over 2^(N-1) it's just 2^N - bound anyway.
+ *
+ * Past RANDOM_BOUND32_MAX, the 32-bit version would be taking that
+ * slow path often enough to hurt, so it draws 64 bits instead.
  */
-void Random_GenerateSeed()
+#define RANDOM_BOUND32_MAX (1 << 24)
+
+static uint64
+RandomBelow64Slow(RandomState *r, uint64 bound, uint64 hi, uint64 lo)
 {
-    uint64 seed;
+    uint64 threshold = -bound;
 
-    bool haveSeed = FALSE;
+    if (threshold >= bound) {
+        threshold %= bound;
+    }
+    while (lo < threshold) {
+        hi = RandomMul64(RandomState_Uint64(r), bound, &lo);
+    }
+    return hi;
+}
 
-    int fd;
+static INLINE_ALWAYS uint64 RandomBelow64(RandomState *r, uint64 bound)
+{
+    uint64 hi, lo;
 
-    fd = open ("/dev/urandom", O_RDONLY);
+    ASSERT(bound > 0);
 
-    if (fd != -1) {
-        int count;
-        count = read(fd, &seed, sizeof(seed));
-        if (count == sizeof(seed)) {
-            haveSeed = TRUE;
-        }
-        close (fd);
+    hi = RandomMul64(RandomState_Uint64(r), bound, &lo);
+    if (UNLIKELY(lo < bound)) {
+        return RandomBelow64Slow(r, bound, hi, lo);
     }
+    return hi;
+}
 
-    if (!haveSeed) {
-        pid_t pid = getpid();
-        seed = time(0) * pid + pid;
-        Random_SetSeed(seed);
+static uint32
+RandomBelow32Slow(RandomState *r, uint32 bound, uint64 m)
+{
+    uint32 threshold = -bound;
 
-        Random_Uint64();
-        seed = Random_Uint64();
-        haveSeed = TRUE;
+    if (threshold >= bound) {
+        threshold %= bound;
     }
-
-    ASSERT(haveSeed);
-    Random_SetSeed(seed);
+    while ((uint32)m < threshold) {
+        m = (uint64)RandomState_Uint32(r) * bound;
+    }
+    return (uint32)(m >> 32);
 }
 
-/*
- * Returns the seed being used for this run.
- * (At least since the last time it was set...)
- */
-uint64 Random_GetSeed()
+static INLINE_ALWAYS uint32 RandomBelow32(RandomState *r, uint32 bound)
 {
-    ASSERT(randomData.haveSeed);
-    return RandomState_GetSeed(&randomData.rs);
-}
+    uint64 m;
+
+    ASSERT(bound > 0);
+
+    if (UNLIKELY(bound > RANDOM_BOUND32_MAX)) {
+        return (uint32)RandomBelow64(r, bound);
+    }
+
+    m = (uint64)RandomState_Uint32(r) * bound;
+    if (UNLIKELY((uint32)m < bound)) {
+        return RandomBelow32Slow(r, bound, m);
+    }
+    return (uint32)(m >> 32);
+}
+
+uint32 RandomState_Uint32Below(RandomState *r, uint32 bound)
+{
+    return RandomBelow32(r, bound);
+}
+
+uint64 RandomState_Uint64Below(RandomState *r, uint64 bound)
+{
+    return RandomBelow64(r, bound);
+}
+
+/*
+ * RandomState_Int --
+ *   Returns a uniformly distributed int in the range [min, max] (inclusive).
+ */
+int RandomState_Int(RandomState *r, int min, int max)
+{
+    uint32 range;
+
+    ASSERT(max >= min);
+
+    /*
+     * This wraps to 0 for the full range.
+     */
+    range = (uint32)max - (uint32)min + 1;
+    if (UNLIKELY(range == 0)) {
+        return (int)RandomState_Uint32(r);
+    }
+
+    return (int)((uint32)min + RandomBelow32(r, range));
+}
+
+int64 RandomState_Int64(RandomState *r, int64 min, int64 max)
+{
+    uint64 range;
+
+    ASSERT(max >= min);
+
+    range = (uint64)max - (uint64)min + 1;
+    if (UNLIKELY(range == 0)) {
+        return (int64)RandomState_Uint64(r);
+    }
+
+    return (int64)((uint64)min + RandomBelow64(r, range));
+}
+
+/*
+ * Random_UnitFloat --
+ *     Returns a uniformly distributed float in the range [0, 1).
+ */
+float RandomState_UnitFloat(RandomState *r)
+{
+    float rval;
+
+    rval = ((float) RandomState_Uint32(r)) / (float) ((uint32) -1);
+
+    return rval;
+}
+
+/*
+ * Uniform double in [0, 1), with 53 bits.
+ */
+static INLINE_ALWAYS double RandomUnitDouble(RandomState *r)
+{
+    return (RandomState_Uint64(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Ziggurat tables, in Doornik's layout ("An Improved Ziggurat Method to
+ * Generate Normal Random Samples", 2005): RANDOM_ZIG_LAYERS strips of
+ * equal area V under the density f, where strip 0 is the base strip
+ * plus the tail past R.  x[i] is the right edge of strip i, and a draw
+ * lands in the part of the strip that's entirely under the curve with
+ * probability ratio[i] = x[i + 1] / x[i].
+ *
+ * These only depend on the constants, and get built once at load time.
+ */
+#define RANDOM_ZIG_LAYERS 256
+
+#define RANDOM_ZIG_NORMAL_R 3.6541528853610088
+#define RANDOM_ZIG_NORMAL_V 0.00492867323399
+
+#define RANDOM_ZIG_EXP_R 7.69711747013104972
+#define RANDOM_ZIG_EXP_V 0.0039496598225815571993
+
+typedef struct RandomZigTable {
+    double x[RANDOM_ZIG_LAYERS + 1];
+    double ratio[RANDOM_ZIG_LAYERS];
+} RandomZigTable;
+
+static RandomZigTable randomZigNormal;
+static RandomZigTable randomZigExp;
+
+static void RandomZigBuild(RandomZigTable *t, double r, double v, bool normal)
+{
+    t->x[0] = v / (normal ? exp(-0.5 * r * r) : exp(-r));
+    t->x[1] = r;
+
+    for (int i = 2; i < RANDOM_ZIG_LAYERS; i++) {
+        double prev = t->x[i - 1];
+        if (normal) {
+            t->x[i] = sqrt(-2.0 * log(v / prev + exp(-0.5 * prev * prev)));
+        } else {
+            t->x[i] = -log(v / prev + exp(-prev));
+        }
+    }
+    t->x[RANDOM_ZIG_LAYERS] = 0.0;
+
+    for (int i = 0; i < RANDOM_ZIG_LAYERS; i++) {
+        t->ratio[i] = t->x[i + 1] / t->x[i];
+    }
+}
+
+static void __attribute__((constructor)) RandomZigInit(void)
+{
+    RandomZigBuild(&randomZigNormal, RANDOM_ZIG_NORMAL_R,
+                   RANDOM_ZIG_NORMAL_V, TRUE);
+    RandomZigBuild(&randomZigExp, RANDOM_ZIG_EXP_R, RANDOM_ZIG_EXP_V, FALSE);
+}
+
+/*
+ * Standard normal.  One Uint64 gives both the strip (low 8 bits) and
+ * the position in it (high 53 bits), and ~99% of draws stop there.
+ */
+static double RandomStdNormal(RandomState *r)
+{
+    const RandomZigTable *t = &randomZigNormal;
+
+    while (TRUE) {
+        uint64 bits = RandomState_Uint64(r);
+        uint i = bits & (RANDOM_ZIG_LAYERS - 1);
+        double u = 2.0 * ((bits >> 11) * (1.0 / 9007199254740992.0)) - 1.0;
+        double x;
+
+        if (LIKELY(fabs(u) < t->ratio[i])) {
+            return u * t->x[i];
+        }
+
+        if (i == 0) {
+            /*
+             * Marsaglia's tail method, past R.
+             */
+            double y;
+            do {
+                x = log(1.0 - RandomUnitDouble(r)) / RANDOM_ZIG_NORMAL_R;
+                y = log(1.0 - RandomUnitDouble(r));
+            } while (-2.0 * y < x * x);
+            return u < 0 ? x - RANDOM_ZIG_NORMAL_R : RANDOM_ZIG_NORMAL_R - x;
+        }
+
+        /*
+         * The wedge between the strip and the curve, relative to f(x).
+         */
+        x = u * t->x[i];
+        double f0 = exp(-0.5 * (t->x[i] * t->x[i] - x * x));
+        double f1 = exp(-0.5 * (t->x[i + 1] * t->x[i + 1] - x * x));
+        if (f1 + RandomUnitDouble(r) * (f0 - f1) < 1.0) {
+            return x;
+        }
+    }
+}
+
+/*
+ * Standard exponential, the same way.  The tail past R is just R plus
+ * another exponential.
+ */
+static double RandomStdExponential(RandomState *r)
+{
+    const RandomZigTable *t = &randomZigExp;
+    double offset = 0.0;
+
+    while (TRUE) {
+        uint64 bits = RandomState_Uint64(r);
+        uint i = bits & (RANDOM_ZIG_LAYERS - 1);
+        double u = (bits >> 11) * (1.0 / 9007199254740992.0);
+        double x;
+
+        if (LIKELY(u < t->ratio[i])) {
+            return offset + u * t->x[i];
+        }
+
+        if (i == 0) {
+            offset += RANDOM_ZIG_EXP_R;
+            continue;
+        }
+
+        x = u * t->x[i];
+        double f0 = exp(-(t->x[i] - x));
+        double f1 = exp(-(t->x[i + 1] - x));
+        if (f1 + RandomUnitDouble(r) * (f0 - f1) < 1.0) {
+            return offset + x;
+        }
+    }
+}
+
+double RandomState_Normal(RandomState *r, double mean, double stddev)
+{
+    ASSERT(stddev >= 0.0);
+    return mean + stddev * RandomStdNormal(r);
+}
+
+double RandomState_Exponential(RandomState *r, double mean)
+{
+    ASSERT(mean >= 0.0);
+    return mean * RandomStdExponential(r);
+}
+
+/*
+ * log(k!), exactly from a table for small k and from Stirling's series
+ * past that.  (lgamma isn't thread-safe on glibc, since it sets
+ * signgam.)
+ */
+#define RANDOM_LOG_FACTORIAL_TABLE 16
+
+static double RandomLogFactorial(int64 k)
+{
+    static const double table[RANDOM_LOG_FACTORIAL_TABLE] = {
+        0.0, 0.0, 0.69314718055994531, 1.7917594692280550,
+        3.1780538303479458, 4.7874917427820460, 6.5792512120101010,
+        8.5251613610654143, 10.604602902745251, 12.801827480081469,
+        15.104412573075516, 17.502307845873887, 19.987214495661885,
+        22.552163853123423, 25.191221182738680, 27.899271383840894,
+    };
+    double x, x2;
+
+    ASSERT(k >= 0);
+    if (k < RANDOM_LOG_FACTORIAL_TABLE) {
+        return table[k];
+    }
+
+    x = (double)k + 1.0;
+    x2 = 1.0 / (x * x);
+    return (x - 0.5) * log(x) - x + 0.91893853320467274 +
+           (1.0 / 12.0 + x2 * (-1.0 / 360.0 + x2 * (1.0 / 1260.0 +
+            x2 * (-1.0 / 1680.0)))) / x;
+}
+
+/*
+ * Below this mean, Poisson/binomial draws just walk the CDF, which
+ * takes O(mean) uniforms.  Above it, they use Hörmann's transformed
+ * rejection with squeeze (PTRS/BTRS, "The transformed rejection method
+ * for generating Poisson random variables", 1993), which averages
+ * about 1.2 rounds no matter the mean.
+ */
+#define RANDOM_TRS_MIN_MEAN 10.0
+
+int64 RandomState_Poisson(RandomState *r, double mean)
+{
+    ASSERT(mean >= 0.0);
+
+    if (mean < RANDOM_TRS_MIN_MEAN) {
+        double limit = exp(-mean);
+        double prod = 1.0 - RandomUnitDouble(r);
+        int64 k = 0;
+
+        while (prod > limit) {
+            prod *= 1.0 - RandomUnitDouble(r);
+            k++;
+        }
+        return k;
+    } else {
+        double slam = sqrt(mean);
+        double loglam = log(mean);
+        double b = 0.931 + 2.53 * slam;
+        double a = -0.059 + 0.02483 * b;
+        double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+        double vr = 0.9277 - 3.6224 / (b - 2.0);
+
+        while (TRUE) {
+            double u = RandomUnitDouble(r) - 0.5;
+            double v = RandomUnitDouble(r);
+            double us = 0.5 - fabs(u);
+            int64 k = (int64)floor((2.0 * a / us + b) * u + mean + 0.43);
+
+            if (us >= 0.07 && v <= vr) {
+                return k;
+            }
+            if (k < 0 || (us < 0.013 && v > us)) {
+                continue;
+            }
+            if (log(v) + log(invalpha) - log(a / (us * us) + b) <=
+                -mean + k * loglam - RandomLogFactorial(k)) {
+                return k;
+            }
+        }
+    }
+}
+
+int64 RandomState_Binomial(RandomState *r, int64 n, double p)
+{
+    double q;
+
+    ASSERT(n >= 0);
+    ASSERT(p >= 0.0 && p <= 1.0);
+
+    if (p > 0.5) {
+        return n - RandomState_Binomial(r, n, 1.0 - p);
+    }
+    if (n == 0 || p == 0.0) {
+        return 0;
+    }
+
+    q = 1.0 - p;
+    if (n * p < RANDOM_TRS_MIN_MEAN) {
+        /*
+         * Inversion, using the recurrence between successive terms of
+         * the pmf.  Rounding can leave u past the last term, in which
+         * case we start over.
+         */
+        double s = p / q;
+        double a = (n + 1) * s;
+        double first = pow(q, (double)n);
+
+        while (TRUE) {
+            double u = RandomUnitDouble(r);
+            double pk = first;
+            int64 k = 0;
+
+            while (u > pk && k < n) {
+                u -= pk;
+                k++;
+                pk *= a / k - s;
+            }
+            if (u <= pk) {
+                return k;
+            }
+        }
+    } else {
+        double spq = sqrt(n * p * q);
+        double b = 1.15 + 2.53 * spq;
+        double a = -0.0873 + 0.0248 * b + 0.01 * p;
+        double c = n * p + 0.5;
+        double vr = 0.92 - 4.2 / b;
+        double alpha = (2.83 + 5.1 / b) * spq;
+        double lpq = log(p / q);
+        int64 m = (int64)floor((n + 1) * p);
+        double h = RandomLogFactorial(m) + RandomLogFactorial(n - m);
+
+        while (TRUE) {
+            double u = RandomUnitDouble(r) - 0.5;
+            double v = RandomUnitDouble(r);
+            double us = 0.5 - fabs(u);
+            int64 k = (int64)floor((2.0 * a / us + b) * u + c);
+
+            if (k < 0 || k > n) {
+                continue;
+            }
+            if (us >= 0.07 && v <= vr) {
+                return k;
+            }
+            v = log(v * alpha / (a / (us * us) + b));
+            if (v <= h - RandomLogFactorial(k) - RandomLogFactorial(n - k) +
+                     (k - m) * lpq) {
+                return k;
+            }
+        }
+    }
+}
+
+/*
+ * Past this many dice per face, it's cheaper to draw how many dice
+ * land on each face, as a chain of binomials, than to roll them all.
+ * That's still exactly the right distribution.
+ */
+#define RANDOM_DICE_PER_FACE_CUTOFF 32
+
+/*
+ * Sum numDice random die, between 1 and diceMax, inclusive.
+ */
+int RandomState_DiceSum(RandomState *r, int numDice, int diceMax)
+{
+    int x;
+    int oup = 0;
+
+    ASSERT(numDice >= 0 );
+    ASSERT(diceMax >= 1);
+
+    if (numDice > RANDOM_DICE_PER_FACE_CUTOFF * diceMax) {
+        int64 left = numDice;
+
+        for (x = 1; x < diceMax && left > 0; x++) {
+            int64 count = RandomState_Binomial(r, left,
+                                               1.0 / (diceMax - x + 1));
+            oup += x * count;
+            left -= count;
+        }
+        return oup + diceMax * left;
+    }
+
+    for (x = 0; x < numDice; x++) {
+        oup += RandomState_Int(r, 1, diceMax);
+    }
+
+    return oup;
+}
+
+/*
+ * Vose's alias method: split the n outcomes into n equal-width columns,
+ * each holding at most two outcomes, so a draw is one column pick and
+ * one coin flip.
+ *
+ * The coin thresholds are scaled to 2^32, and each column keeps both
+ * of its values so a draw only touches one entry.  Full columns alias
+ * to themselves, so either side of the flip gives the same outcome.
+ */
+void RandomEnumSampler_Create(RandomEnumSampler *s,
+                              const EnumDistribution *dist, int numValues)
+{
+    double *scaled;
+    int *small;
+    int *large;
+    int numSmall = 0;
+    int numLarge = 0;
+    double total = 0.0;
+
+    ASSERT(numValues > 0);
+
+    for (int x = 0; x < numValues; x++) {
+        ASSERT(dist[x].probability >= 0.0f);
+        total += dist[x].probability;
+    }
+    VERIFY(total > 0.0);
+
+    s->numValues = numValues;
+    s->columns = malloc(numValues * sizeof(s->columns[0]));
+
+    scaled = malloc(numValues * sizeof(scaled[0]));
+    small = malloc(numValues * sizeof(small[0]));
+    large = malloc(numValues * sizeof(large[0]));
+
+    for (int x = 0; x < numValues; x++) {
+        s->columns[x].value = dist[x].value;
+        scaled[x] = dist[x].probability * numValues / total;
+        if (scaled[x] < 1.0) {
+            small[numSmall++] = x;
+        } else {
+            large[numLarge++] = x;
+        }
+    }
+
+    while (numSmall > 0 && numLarge > 0) {
+        int l = small[--numSmall];
+        int g = large[numLarge - 1];
+
+        s->columns[l].threshold = (uint32)(scaled[l] * 4294967296.0);
+        s->columns[l].aliasValue = dist[g].value;
+
+        scaled[g] = (scaled[g] + scaled[l]) - 1.0;
+        if (scaled[g] < 1.0) {
+            numLarge--;
+            small[numSmall++] = g;
+        }
+    }
+
+    /*
+     * Whatever is left is within rounding error of a full column.
+     */
+    while (numLarge > 0) {
+        int g = large[--numLarge];
+        s->columns[g].threshold = MAX_UINT32;
+        s->columns[g].aliasValue = dist[g].value;
+    }
+    while (numSmall > 0) {
+        int l = small[--numSmall];
+        s->columns[l].threshold = MAX_UINT32;
+        s->columns[l].aliasValue = dist[l].value;
+    }
+
+    free(scaled);
+    free(small);
+    free(large);
+}
+
+void RandomEnumSampler_Destroy(RandomEnumSampler *s)
+{
+    free(s->columns);
+    MBUtil_Zero(s, sizeof(*s));
+}
+
+/*
+ * The coin flip is a coin flip, so keep it branch-free.
+ */
+static INLINE_ALWAYS int
+RandomEnumSamplerPick(const RandomEnumSampler *s, uint32 column, uint32 coin)
+{
+    const RandomEnumColumn *c;
+
+    ASSERT(column < (uint32)s->numValues);
+    c = &s->columns[column];
+    return coin < c->threshold ? c->value : c->aliasValue;
+}
+
+int RandomState_SampleEnum(RandomState *r, const RandomEnumSampler *s)
+{
+    uint32 column = RandomBelow32(r, s->numValues);
+    return RandomEnumSamplerPick(s, column, RandomState_Uint32(r));
+}
+
+/*
+ * Batch draws use the bulk fills for both the columns and the coins,
+ * a chunk at a time so the raw values stay in cache.
+ */
+void RandomState_FillEnum(RandomState *r, const RandomEnumSampler *s,
+                          int *out, int64 numItems)
+{
+    RandomLanes ls;
+    uint32 coins[RANDOM_RANGE_CHUNK];
+    uint32 range = s->numValues;
+    uint32 threshold = (uint32)(-range) % range;
+
+    ASSERT(numItems >= 0);
+    RandomLanesCreate(&ls, r);
+
+    for (int64 c = 0; c < numItems; c += RANDOM_RANGE_CHUNK) {
+        int64 chunkSize = MIN(numItems - c, RANDOM_RANGE_CHUNK);
+        int *o = out + c;
+
+        RANDOM_FILL(RandomLanesFillUint32, uint32, 2 * RANDOM_LANES,
+                    &ls, (uint32 *)o, chunkSize);
+        RandomLanesMapRange(&ls, o, chunkSize, 0, range, threshold);
+        RANDOM_FILL(RandomLanesFillUint32, uint32, 2 * RANDOM_LANES,
+                    &ls, coins, chunkSize);
+
+        for (int64 i = 0; i < chunkSize; i++) {
+            o[i] = RandomEnumSamplerPick(s, o[i], coins[i]);
+        }
+    }
+}
+
+/*
+ * The shuffles draw a block of swap targets up front and prefetch
+ * them, so that on big arrays the cache misses overlap instead of
+ * each swap waiting for the last one.  The targets only depend on
+ * the position, so this is the same shuffle as doing them in order.
+ */
+#define RANDOM_SHUFFLE_BATCH 16
+
+static INLINE_ALWAYS void RandomSwap(uint8 *a, uint8 *b, int itemSize)
+{
+    /*
+     * a and b can be the same item, hence the memmoves.
+     */
+    if (itemSize == sizeof(uint32)) {
+        uint32 t;
+        memcpy(&t, a, sizeof(t));
+        memmove(a, b, sizeof(t));
+        memcpy(b, &t, sizeof(t));
+    } else if (itemSize == sizeof(uint64)) {
+        uint64 t;
+        memcpy(&t, a, sizeof(t));
+        memmove(a, b, sizeof(t));
+        memcpy(b, &t, sizeof(t));
+    } else {
+        uint8 t[64];
+        while (itemSize > 0) {
+            int n = MIN(itemSize, (int)sizeof(t));
+            memcpy(t, a, n);
+            memmove(a, b, n);
+            memcpy(b, t, n);
+            a += n;
+            b += n;
+            itemSize -= n;
+        }
+    }
+}
+
+static INLINE_ALWAYS void
+RandomShuffleSteps(RandomState *r, uint8 *items, int64 numItems,
+                   int itemSize, int64 k)
+{
+    int64 targets[RANDOM_SHUFFLE_BATCH];
+
+    for (int64 i = 0; i < k; i += RANDOM_SHUFFLE_BATCH) {
+        int n = (int)MIN(k - i, RANDOM_SHUFFLE_BATCH);
+
+        for (int b = 0; b < n; b++) {
+            uint64 remaining = numItems - (i + b);
+            uint64 j;
+
+            if (LIKELY(remaining <= MAX_UINT32)) {
+                j = RandomBelow32(r, (uint32)remaining);
+            } else {
+                j = RandomBelow64(r, remaining);
+            }
+            targets[b] = i + b + j;
+            PREFETCH(items + targets[b] * itemSize);
+        }
+
+        for (int b = 0; b < n; b++) {
+            RandomSwap(items + (i + b) * itemSize,
+                       items + targets[b] * itemSize, itemSize);
+        }
+    }
+}
+
+void RandomState_PartialShuffle(RandomState *r, void *items, int64 numItems,
+                                int itemSize, int64 k)
+{
+    ASSERT(numItems >= 0);
+    ASSERT(itemSize > 0);
+    ASSERT(k >= 0);
+
+    /*
+     * The last swap would always be with itself.
+     */
+    k = MIN(k, numItems - 1);
+    if (k <= 0) {
+        return;
+    }
+
+    /*
+     * Give the compiler constant sizes for the common cases.
+     */
+    if (itemSize == sizeof(uint32)) {
+        RandomShuffleSteps(r, items, numItems, sizeof(uint32), k);
+    } else if (itemSize == sizeof(uint64)) {
+        RandomShuffleSteps(r, items, numItems, sizeof(uint64), k);
+    } else {
+        RandomShuffleSteps(r, items, numItems, itemSize, k);
+    }
+}
+
+void RandomState_Shuffle(RandomState *r, void *items, int64 numItems,
+                         int itemSize)
+{
+    RandomState_PartialShuffle(r, items, numItems, itemSize, numItems);
+}
+
+/*
+ * Efraimidis-Spirakis with exponential keys: item i gets the key
+ * E_i / w_i, with E_i a standard exponential, and the sample is the k
+ * smallest keys.  The keys are kept in a max-heap, so the root is the
+ * threshold T a new item has to beat.
+ *
+ * Once the heap is full, the next item to beat T is where the running
+ * total of the weights passes another exponential divided by T (the
+ * A-ExpJ variant), and its key is an exponential truncated to [0, T).
+ * Everything in between is just a subtraction.
+ */
+typedef struct RandomWeightedKey {
+    double key;
+    int64 index;
+} RandomWeightedKey;
+
+static void RandomWeightedSiftUp(RandomWeightedKey *heap, int64 i)
+{
+    RandomWeightedKey x = heap[i];
+
+    while (i > 0) {
+        int64 parent = (i - 1) / 2;
+        if (heap[parent].key >= x.key) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = x;
+}
+
+static void RandomWeightedSiftDown(RandomWeightedKey *heap, int64 size,
+                                   int64 i)
+{
+    RandomWeightedKey x = heap[i];
+
+    while (TRUE) {
+        int64 child = 2 * i + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && heap[child + 1].key > heap[child].key) {
+            child++;
+        }
+        if (heap[child].key <= x.key) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = x;
+}
+
+int64 RandomState_WeightedSample(RandomState *r, const float *weights,
+                                 int64 numItems, int64 *out, int64 k)
+{
+    RandomWeightedKey *heap;
+    int64 size = 0;
+    int64 i = 0;
+
+    ASSERT(numItems >= 0);
+    ASSERT(k >= 0);
+
+    k = MIN(k, numItems);
+    if (k == 0) {
+        return 0;
+    }
+
+    heap = malloc(k * sizeof(heap[0]));
+    VERIFY(heap != NULL);
+
+    for (; i < numItems && size < k; i++) {
+        double w = weights[i];
+
+        ASSERT(w >= 0.0);
+        if (w > 0.0) {
+            heap[size].key = RandomStdExponential(r) / w;
+            heap[size].index = i;
+            RandomWeightedSiftUp(heap, size);
+            size++;
+        }
+    }
+
+    if (size == k && i < numItems) {
+        double threshold = heap[0].key;
+        double skip = RandomStdExponential(r) / threshold;
+
+        for (; i < numItems; i++) {
+            double w = weights[i];
+
+            ASSERT(w >= 0.0);
+            skip -= w;
+            if (LIKELY(skip > 0.0) || w == 0.0) {
+                continue;
+            }
+
+            heap[0].key = -log1p(RandomUnitDouble(r) *
+                                 expm1(-w * threshold)) / w;
+            heap[0].index = i;
+            RandomWeightedSiftDown(heap, k, 0);
+
+            threshold = heap[0].key;
+            skip = RandomStdExponential(r) / threshold;
+        }
+    }
+
+    /*
+     * Sort by key, which is the order successive draws would have
+     * picked them in.
+     */
+    for (int64 n = size - 1; n > 0; n--) {
+        RandomWeightedKey t = heap[0];
+        heap[0] = heap[n];
+        heap[n] = t;
+        RandomWeightedSiftDown(heap, n, 0);
+    }
+    for (int64 n = 0; n < size; n++) {
+        out[n] = heap[n].index;
+    }
+
+    free(heap);
+    return size;
+}
+
+/*
+ * Algorithm L (Li, 1994): W is the largest of k uniform keys, kept as
+ * log(W) so it doesn't underflow on long streams, and the number of
+ * items until one beats it is geometric with success probability W.
+ */
+static void RandomReservoirSkip(RandomReservoir *res, RandomState *r,
+                                int64 i)
+{
+    double u = 1.0 - RandomUnitDouble(r);
+    double skip = floor(log(u) / log1p(-exp(res->logW)));
+
+    /*
+     * The !(skip > 0) also catches the NaN from 0 / -0 when u is 1.
+     */
+    if (!(skip > 0.0)) {
+        res->nextAccept = i + 1;
+    } else if (skip < (double)(MAX_INT64 / 2)) {
+        res->nextAccept = i + 1 + (int64)skip;
+    } else {
+        res->nextAccept = MAX_INT64;
+    }
+}
+
+void RandomReservoir_Create(RandomReservoir *res, RandomState *r, int64 k)
+{
+    ASSERT(k >= 0);
+
+    MBUtil_Zero(res, sizeof(*res));
+    res->k = k;
+
+    if (k == 0) {
+        res->nextAccept = MAX_INT64;
+        return;
+    }
+
+    res->logW = log(1.0 - RandomUnitDouble(r)) / k;
+    RandomReservoirSkip(res, r, k - 1);
+}
+
+int64 RandomReservoirAccept(RandomReservoir *res, RandomState *r)
+{
+    int64 i = res->count - 1;
+    int64 slot;
+
+    ASSERT(i == res->nextAccept);
+    ASSERT(res->k > 0);
+
+    if (res->k <= MAX_UINT32) {
+        slot = RandomBelow32(r, (uint32)res->k);
+    } else {
+        slot = RandomBelow64(r, res->k);
+    }
+
+    res->logW += log(1.0 - RandomUnitDouble(r)) / res->k;
+    RandomReservoirSkip(res, r, i);
+    return slot;
+}
+
+/*
+ * Initializes the random module.
+ * This will generate a random seed if one has not
+ * been previously set.
+ */
+void Random_Init(void)
+{
+    randomData.initializedCount++;
+
+    if (randomData.initializedCount > 1) {
+        return;
+    }
+
+    if (!randomData.haveSeed) {
+        Random_GenerateSeed();
+        ASSERT(randomData.haveSeed);
+    }
+}
+
+void Random_Exit(void)
+{
+    ASSERT(randomData.initializedCount > 0);
+    randomData.initializedCount--;
+
+    if (randomData.initializedCount > 0) {
+        return;
+    }
+
+    randomData.haveSeed = FALSE;
+}
+
+
+void Random_InitThread(uint64 streamId)
+{
+    ASSERT(randomData.initializedCount > 0);
+    ASSERT(randomData.haveSeed);
+    ASSERT(randomThreadState == NULL);
+
+    RandomState_CreateStream(&randomThreadStorage, &randomData.rs, streamId);
+    randomThreadState = &randomThreadStorage;
+}
+
+void Random_ExitThread(void)
+{
+    ASSERT(randomThreadState != NULL);
+    RandomState_Destroy(randomThreadState);
+    randomThreadState = NULL;
+}
+
+/*
+ * Generate a new random seed for the module.
+ */
+void Random_GenerateSeed()
+{
+    uint64 seed;
+
+    bool haveSeed = FALSE;
+
+    int fd;
+
+    fd = open ("/dev/urandom", O_RDONLY);
+
+    if (fd != -1) {
+        int count;
+        count = read(fd, &seed, sizeof(seed));
+        if (count == sizeof(seed)) {
+            haveSeed = TRUE;
+        }
+        close (fd);
+    }
+
+    if (!haveSeed) {
+        pid_t pid = getpid();
+        seed = time(0) * pid + pid;
+        Random_SetSeed(seed);
+
+        Random_Uint64();
+        seed = Random_Uint64();
+        haveSeed = TRUE;
+    }
+
+    ASSERT(haveSeed);
+    Random_SetSeed(seed);
+}
+
+/*
+ * Returns the seed being used for this run.
+ * (At least since the last time it was set...)
+ */
+uint64 Random_GetSeed()
+{
+    ASSERT(randomData.haveSeed);
+    return RandomState_GetSeed(&randomData.rs);
+}
 
 /*
  * May be called before or after initialization.
@@ -373,44 +1896,113 @@ uint32 Random_Uint32(void)
 {
     ASSERT(randomData.initializedCount > 0);
     ASSERT(randomData.haveSeed);
-    return RandomState_Uint32(&randomData.rs);
+    return RandomState_Uint32(RandomGetState());
 }
 
 bool Random_Bit(void)
 {
-    return RandomState_Bit(&randomData.rs);
+    return RandomState_Bit(RandomGetState());
 }
 
 bool Random_Flip(float trueProb)
 {
-    return RandomState_Flip(&randomData.rs, trueProb);
+    return RandomState_Flip(RandomGetState(), trueProb);
 }
 
 float Random_Float(float min, float max)
 {
     ASSERT(randomData.initializedCount > 0);
-    return RandomState_Float(&randomData.rs, min, max);
+    return RandomState_Float(RandomGetState(), min, max);
+}
+
+
+void Random_FillUint32(uint32 *out, int64 numItems)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_FillUint32(RandomGetState(), out, numItems);
+}
+
+void Random_FillUint64(uint64 *out, int64 numItems)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_FillUint64(RandomGetState(), out, numItems);
+}
+
+void Random_FillUnitFloat(float *out, int64 numItems)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_FillUnitFloat(RandomGetState(), out, numItems);
+}
+
+void Random_FillIntRange(int *out, int64 numItems, int min, int max)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_FillIntRange(RandomGetState(), out, numItems, min, max);
+}
+
+int64 Random_Int64(int64 min, int64 max)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_Int64(RandomGetState(), min, max);
+}
+
+void Random_FillInt64Range(int64 *out, int64 numItems, int64 min, int64 max)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_FillInt64Range(RandomGetState(), out, numItems, min, max);
+}
+
+int Random_SampleEnum(const RandomEnumSampler *s)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_SampleEnum(RandomGetState(), s);
+}
+
+void Random_FillEnum(const RandomEnumSampler *s, int *out, int64 numItems)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_FillEnum(RandomGetState(), s, out, numItems);
+}
+
+void Random_Shuffle(void *items, int64 numItems, int itemSize)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_Shuffle(RandomGetState(), items, numItems, itemSize);
+}
+
+void Random_PartialShuffle(void *items, int64 numItems, int itemSize,
+                           int64 k)
+{
+    ASSERT(randomData.initializedCount > 0);
+    RandomState_PartialShuffle(RandomGetState(), items, numItems,
+                               itemSize, k);
 }
 
+int64 Random_WeightedSample(const float *weights, int64 numItems,
+                            int64 *out, int64 k)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_WeightedSample(RandomGetState(), weights, numItems,
+                                      out, k);
+}
 
 int Random_Enum(EnumDistribution *dist, int numValues)
 {
-    return RandomState_Enum(&randomData.rs, dist, numValues);
+    return RandomState_Enum(RandomGetState(), dist, numValues);
 }
 
 uint64 Random_Uint64(void)
 {
-    return RandomState_Uint64(&randomData.rs);
+    return RandomState_Uint64(RandomGetState());
 }
 
 /*
  * Random_Int --
  *   Returns a uniformly distributed int in the range [min, max] (inclusive).
- *   XXX: Not verified for negative values or ranges near max int.
  */
 int Random_Int(int min, int max)
 {
-    return RandomState_Int(&randomData.rs, min, max);
+    return RandomState_Int(RandomGetState(), min, max);
 }
 
 /*
@@ -419,7 +2011,7 @@ int Random_Int(int min, int max)
  */
 float Random_UnitFloat(void)
 {
-    return RandomState_UnitFloat(&randomData.rs);
+    return RandomState_UnitFloat(RandomGetState());
 }
 
 float Random_UnitFloatFromSeed(uint64 seed)
@@ -429,10 +2021,34 @@ float Random_UnitFloatFromSeed(uint64 seed)
     return RandomState_UnitFloat(&lr);
 }
 
+double Random_Normal(double mean, double stddev)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_Normal(RandomGetState(), mean, stddev);
+}
+
+double Random_Exponential(double mean)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_Exponential(RandomGetState(), mean);
+}
+
+int64 Random_Poisson(double mean)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_Poisson(RandomGetState(), mean);
+}
+
+int64 Random_Binomial(int64 n, double p)
+{
+    ASSERT(randomData.initializedCount > 0);
+    return RandomState_Binomial(RandomGetState(), n, p);
+}
+
 /*
  * Sum numDice random die, between 1 and diceMax, inclusive.
  */
 int Random_DiceSum(int numDice, int diceMax)
 {
-    return RandomState_DiceSum(&randomData.rs, numDice, diceMax);
+    return RandomState_DiceSum(RandomGetState(), numDice, diceMax);
 }
@@ -33,13 +33,19 @@
 #include "MBTypes.h"
 #include "MBUtil.h"
 #include "MBAssert.h"
+#include "MBAlloc.h"
 #include <string.h>
 
 typedef struct BitVector {
     uint64 *bits;
-    uint arrSize;
-    uint size;
+    uint64 arrSize;
+    uint64 size;
     bool fill;
+
+    /*
+     * NULL uses malloc/free.
+     */
+    const CMBAllocator *allocator;
 } BitVector;
 
 typedef BitVector CBitVector;
@@ -50,7 +56,12 @@ typedef enum BitVectorWriteType {
     BITVECTOR_WRITE_FLIP,
 } BitVectorWriteType;
 
-void BitVector_CreateWithSize(BitVector *b, int size);
+void BitVector_CreateWithAllocator(BitVector *b, int64 size,
+                                   const CMBAllocator *alloc);
+static inline void BitVector_CreateWithSize(BitVector *b, int64 size)
+{
+    BitVector_CreateWithAllocator(b, size, NULL);
+}
 static inline void BitVector_Create(BitVector *b)
 {
     BitVector_CreateWithSize(b, 0);
@@ -63,14 +74,15 @@ void BitVector_Copy(BitVector *dest, const BitVector *src);
 //It empties dest, copies over everything from src,
 //  and then leaves src empty.
 //Fill is left unchanged in both.
+//The allocator moves with the bits, so dest takes the one from src.
 void BitVector_Consume(BitVector *dest, BitVector *src);
 
-void BitVector_Resize(BitVector *b, int size);
+void BitVector_Resize(BitVector *b, int64 size);
 
 // Helper function for fills
-void BitVectorSetRangeGeneric(BitVector *b, int first, int last);
-void BitVectorResetRangeGeneric(BitVector *b, int first, int last);
-void BitVectorFlipRangeGeneric(BitVector *b, int first, int last);
+void BitVectorSetRangeGeneric(BitVector *b, int64 first, int64 last);
+void BitVectorResetRangeGeneric(BitVector *b, int64 first, int64 last);
+void BitVectorFlipRangeGeneric(BitVector *b, int64 first, int64 last);
 
 static inline uint64 *BitVectorGetPtr(const BitVector *b) {
     BitVector *bv = (BitVector *)b;
@@ -104,13 +116,13 @@ static inline bool BitVector_GetRaw64(int i, uint64 bits)
     return (bits & BVMASK(i)) != 0;
 }
 
-static inline bool BitVector_GetRaw(int i, const uint64 *bits)
+static inline bool BitVector_GetRaw(int64 i, const uint64 *bits)
 {
-#if defined(__GNUC__) && (defined(ARCH_AMD64) || defined(ARCH_x86))
+#if defined(__GNUC__) && defined(ARCH_AMD64)
     if (!CONSTANT(i)) {
         uint32 tmp;
         asm volatile(
-            "btl  %2, (%1); "
+            "btq  %2, (%1); "
             "sbbl %0, %0"
             : "=r" (tmp)
             : "r" (bits), "r" (i)
@@ -122,12 +134,12 @@ static inline bool BitVector_GetRaw(int i, const uint64 *bits)
     return (bits[BVINDEX(i)] & BVMASK(i)) != 0;
 }
 
-static inline void BitVector_SetRaw(int i, uint64 *bits)
+static inline void BitVector_SetRaw(int64 i, uint64 *bits)
 {
-#if defined(__GNUC__) && (defined(ARCH_AMD64) || defined(ARCH_x86))
+#if defined(__GNUC__) && defined(ARCH_AMD64)
     if (!CONSTANT(i)) {
         asm volatile(
-            "btsl %1, (%0)"
+            "btsq %1, (%0)"
             :: "r" (bits), "r" (i)
             : "cc", "memory");
 
@@ -181,12 +193,12 @@ static inline void BitVector_ResetRaw16(int i, uint16 *bits)
 }
 
 
-static inline void BitVector_ResetRaw(int i, uint64 *bits)
+static inline void BitVector_ResetRaw(int64 i, uint64 *bits)
 {
-#if defined(__GNUC__) && (defined(ARCH_AMD64) || defined(ARCH_x86))
+#if defined(__GNUC__) && defined(ARCH_AMD64)
     if (!CONSTANT(i)) {
         asm volatile(
-            "btrl %1, (%0)"
+            "btrq %1, (%0)"
             :: "r" (bits), "r" (i)
             : "cc", "memory");
         return;
@@ -195,12 +207,12 @@ static inline void BitVector_ResetRaw(int i, uint64 *bits)
     bits[BVINDEX(i)] &= ~BVMASK(i);
 }
 
-static inline void BitVector_FlipRaw(int i, uint64 *bits)
+static inline void BitVector_FlipRaw(int64 i, uint64 *bits)
 {
-#if defined(__GNUC__) && (defined(ARCH_AMD64) || defined(ARCH_x86))
+#if defined(__GNUC__) && defined(ARCH_AMD64)
     if (!CONSTANT(i)) {
         asm volatile(
-            "btcl %1, (%0)"
+            "btcq %1, (%0)"
             :: "r" (bits), "r" (i)
             : "cc", "memory");
 
@@ -210,20 +222,20 @@ static inline void BitVector_FlipRaw(int i, uint64 *bits)
     bits[BVINDEX(i)] ^= BVMASK(i);
 }
 
-static inline bool BitVector_Get(const CBitVector *b, int x)
+static inline bool BitVector_Get(const CBitVector *b, int64 x)
 {
     ASSERT(b != NULL);
     ASSERT(x >= 0);
-    ASSERT((uint) x < b->size);
+    ASSERT((uint64) x < b->size);
 
     return BitVector_GetRaw(x, BitVectorGetPtr(b));
 }
 
-static inline void BitVector_Put(BitVector *b, int x, bool v)
+static inline void BitVector_Put(BitVector *b, int64 x, bool v)
 {
     ASSERT(b != NULL);
     ASSERT(x >= 0);
-    ASSERT((uint) x < b->size);
+    ASSERT((uint64) x < b->size);
 
     if (v) {
         BitVector_SetRaw(x, BitVectorGetPtr(b));
@@ -232,35 +244,35 @@ static inline void BitVector_Put(BitVector *b, int x, bool v)
     }
 }
 
-static inline void BitVector_Set(BitVector *b, int x)
+static inline void BitVector_Set(BitVector *b, int64 x)
 {
     ASSERT(b != NULL);
     ASSERT(x >= 0);
-    ASSERT((uint) x < b->size);
+    ASSERT((uint64) x < b->size);
 
     BitVector_SetRaw(x, BitVectorGetPtr(b));
 }
 
-static inline void BitVector_Reset(BitVector *b, int x)
+static inline void BitVector_Reset(BitVector *b, int64 x)
 {
     ASSERT(b != NULL);
     ASSERT(x >= 0);
-    ASSERT((uint) x < b->size);
+    ASSERT((uint64) x < b->size);
 
     BitVector_ResetRaw(x, BitVectorGetPtr(b));
 }
 
-static inline void BitVector_Flip(BitVector *b, int x)
+static inline void BitVector_Flip(BitVector *b, int64 x)
 {
     ASSERT(b != NULL);
     ASSERT(x >= 0);
-    ASSERT((uint) x < b->size);
+    ASSERT((uint64) x < b->size);
 
     BitVector_FlipRaw(x, BitVectorGetPtr(b));
 }
 
 static INLINE_ALWAYS void
-BitVectorWrite(BitVector *b, int x, BitVectorWriteType type)
+BitVectorWrite(BitVector *b, int64 x, BitVectorWriteType type)
 {
     switch (type) {
         case BITVECTOR_WRITE_SET:
@@ -277,7 +289,7 @@ BitVectorWrite(BitVector *b, int x, BitVectorWriteType type)
 
 static INLINE_ALWAYS void
 BitVectorWriteRangeGenericDispatch(BitVector *b,
-                                   int first, int last,
+                                   int64 first, int64 last,
                                    BitVectorWriteType type)
 {
     switch (type) {
@@ -295,7 +307,7 @@ BitVectorWriteRangeGenericDispatch(BitVector *b,
 
 static INLINE_ALWAYS void
 BitVectorWriteRangeOptimized(BitVector *b,
-                             int first, int last,
+                             int64 first, int64 last,
                              BitVectorWriteType type)
 {
     const uint8 alignment = 8;
@@ -305,11 +317,11 @@ BitVectorWriteRangeOptimized(BitVector *b,
     ASSERT(last % alignment == (alignment - 1));
     ASSERT(last != first);
 
-    int x;
+    int64 x;
     uint8 fillByte;
     uint8 *myBytes;
-    int numBytes;
-    uint32 startByte;
+    int64 numBytes;
+    uint64 startByte;
 
     numBytes = (last - first) / alignment + 1;
     myBytes = (uint8 *) BitVectorGetPtr(b);
@@ -339,7 +351,7 @@ BitVectorWriteRangeOptimized(BitVector *b,
 
 static INLINE_ALWAYS void
 BitVectorWriteRangePartial(BitVector *b,
-                           int first, int last, BitVectorWriteType type)
+                           int64 first, int64 last, BitVectorWriteType type)
 {
     ASSERT(b != NULL);
     ASSERT(last - first <= 16);
@@ -353,7 +365,7 @@ BitVectorWriteRangePartial(BitVector *b,
             }
         });
     } else {
-        int x = first;
+        int64 x = first;
         while (x <= last) {
             BitVectorWrite(b, x, type);
             x++;
@@ -363,19 +375,19 @@ BitVectorWriteRangePartial(BitVector *b,
 
 static INLINE_ALWAYS void
 BitVectorWriteRangeGenericImpl(BitVector *b,
-                               int first, int last,
+                               int64 first, int64 last,
                                BitVectorWriteType type)
 {
     ASSERT(b != NULL);
     ASSERT(first >= 0);
-    ASSERT((uint) first < b->size);
+    ASSERT((uint64) first < b->size);
     ASSERT(last >= 0);
-    ASSERT((uint) last < b->size);
+    ASSERT((uint64) last < b->size);
     ASSERT(first <= last);
 
     const uint8 alignment = 8;
-    int alignedLast;
-    int alignedFirst;
+    int64 alignedLast;
+    int64 alignedFirst;
 
     if (last - first + 1 <= alignment * 2) {
         BitVectorWriteRangePartial(b, first, last, type);
@@ -411,14 +423,14 @@ BitVectorWriteRangeGenericImpl(BitVector *b,
     return;
 }
 
-static INLINE_ALWAYS void BitVectorWriteRange(BitVector *b, int first, int last,
+static INLINE_ALWAYS void BitVectorWriteRange(BitVector *b, int64 first, int64 last,
                                               BitVectorWriteType type)
 {
     ASSERT(b != NULL);
     ASSERT(first >= 0);
-    ASSERT((uint) first < b->size);
+    ASSERT((uint64) first < b->size);
     ASSERT(last >= 0);
-    ASSERT((uint) last < b->size);
+    ASSERT((uint64) last < b->size);
     ASSERT(first <= last);
 
     if (CONSTANT(type) && CONSTANT(first) && CONSTANT(last)) {
@@ -431,50 +443,50 @@ static INLINE_ALWAYS void BitVectorWriteRange(BitVector *b, int first, int last,
 
 static INLINE_ALWAYS void BitVector_SetAll(BitVector *b)
 {
-    int first = 0;
-    int last = b->size - 1;
+    int64 first = 0;
+    int64 last = b->size - 1;
 
     BitVectorWriteRange(b, first, last, BITVECTOR_WRITE_SET);
 }
 
 static INLINE_ALWAYS void BitVector_ResetAll(BitVector *b)
 {
-    int first = 0;
-    int last = b->size - 1;
+    int64 first = 0;
+    int64 last = b->size - 1;
 
     BitVectorWriteRange(b, first, last, BITVECTOR_WRITE_RESET);
 }
 
 static INLINE_ALWAYS void BitVector_FlipAll(BitVector *b)
 {
-    int first = 0;
-    int last = b->size - 1;
+    int64 first = 0;
+    int64 last = b->size - 1;
 
     BitVectorWriteRange(b, first, last, BITVECTOR_WRITE_FLIP);
 }
 
-static INLINE_ALWAYS void BitVector_SetRange(BitVector *b, int first, int last)
+static INLINE_ALWAYS void BitVector_SetRange(BitVector *b, int64 first, int64 last)
 {
     BitVectorWriteRange(b, first, last, BITVECTOR_WRITE_SET);
 }
 
-static INLINE_ALWAYS void BitVector_ResetRange(BitVector *b, int first,
-                                               int last)
+static INLINE_ALWAYS void BitVector_ResetRange(BitVector *b, int64 first,
+                                               int64 last)
 {
     BitVectorWriteRange(b, first, last, BITVECTOR_WRITE_RESET);
 }
 
-static INLINE_ALWAYS void BitVector_FlipRange(BitVector *b, int first, int last)
+static INLINE_ALWAYS void BitVector_FlipRange(BitVector *b, int64 first, int64 last)
 {
     BitVectorWriteRange(b, first, last, BITVECTOR_WRITE_FLIP);
 }
 
-static inline bool BitVector_TestAndSet(BitVector *b, int x)
+static inline bool BitVector_TestAndSet(BitVector *b, int64 x)
 {
     bool oup;
     ASSERT(b != NULL);
     ASSERT(x >= 0);
-    ASSERT((uint) x < b->size);
+    ASSERT((uint64) x < b->size);
 
     oup = BitVector_GetRaw(x, BitVectorGetPtr(b));
     BitVector_SetRaw(x, BitVectorGetPtr(b));
@@ -487,7 +499,7 @@ static inline void BitVector_MakeEmpty(BitVector *b)
     b->size = 0;
 }
 
-static inline int BitVector_Size(const BitVector *b)
+static inline int64 BitVector_Size(const BitVector *b)
 {
     ASSERT(b != NULL);
     return b->size;
@@ -505,12 +517,12 @@ static inline void BitVector_SetFillValue(BitVector *b, bool f)
     b->fill = f;
 }
 
-static inline int BitVector_PopCount(const BitVector *b)
+static inline int64 BitVector_PopCount(const BitVector *b)
 {
-    int x;
-    int size;
-    int cellSize;
-    int sum;
+    int64 x;
+    int64 size;
+    int64 cellSize;
+    int64 sum;
 
     int strayBitCount;
     uint64 strayBitMask;
@@ -529,7 +541,7 @@ static inline int BitVector_PopCount(const BitVector *b)
     strayBitMask = (((uint64) 1) << strayBitCount) - 1;
 
     ASSERT(cellSize >= 0);
-    ASSERT((uint) cellSize < b->arrSize);
+    ASSERT((uint64) cellSize < b->arrSize);
     sum += MBUtil_Popcountl(BitVectorGetPtr(b)[cellSize] & strayBitMask);
 
     return sum;
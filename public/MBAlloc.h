@@ -0,0 +1,126 @@
+/*
+ * MBAlloc.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBALLOC_H_202209181402
+#define MBALLOC_H_202209181402
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBTypes.h"
+#include "MBAssert.h"
+
+/*
+ * Optional allocator hooks for the containers.
+ *
+ * Containers hold a const pointer to one of these, so it must outlive
+ * every container created with it.  A NULL allocator means plain
+ * malloc/realloc/free.
+ *
+ * The old size is passed back to reallocFn and freeFn so that
+ * arena/pool allocators don't need to keep their own headers.
+ * reallocFn may be NULL, in which case we fall back to
+ * alloc + copy + free.
+ */
+typedef void *(*CMBAllocFn)(void *cbData, size_t size);
+typedef void *(*CMBReallocFn)(void *cbData, void *ptr,
+                              size_t oldSize, size_t newSize);
+typedef void (*CMBFreeFn)(void *cbData, void *ptr, size_t size);
+
+typedef struct CMBAllocator {
+    CMBAllocFn allocFn;
+    CMBReallocFn reallocFn;
+    CMBFreeFn freeFn;
+    void *cbData;
+} CMBAllocator;
+
+/*
+ * Allocator for very large buffers (eg multi-gigabyte CMBVectors).
+ *
+ * Allocations are page-granular anonymous mappings that are only
+ * committed as they're touched, and growing uses mremap where available,
+ * so the kernel moves the pages instead of us copying the whole buffer.
+ * With hugePages, the mappings are rounded to 2MB and advised for
+ * transparent huge pages.
+ *
+ * This is wasteful for small allocations.
+ */
+const CMBAllocator *MBAlloc_GetMMapAllocator(bool hugePages);
+
+static inline void *
+MBAlloc_Alloc(const CMBAllocator *alloc, size_t size)
+{
+    if (alloc == NULL) {
+        return malloc(size);
+    }
+
+    ASSERT(alloc->allocFn != NULL);
+    return alloc->allocFn(alloc->cbData, size);
+}
+
+static inline void
+MBAlloc_Free(const CMBAllocator *alloc, void *ptr, size_t size)
+{
+    if (alloc == NULL) {
+        free(ptr);
+        return;
+    }
+
+    if (ptr != NULL && alloc->freeFn != NULL) {
+        alloc->freeFn(alloc->cbData, ptr, size);
+    }
+}
+
+static inline void *
+MBAlloc_Realloc(const CMBAllocator *alloc, void *ptr,
+                size_t oldSize, size_t newSize)
+{
+    void *newPtr;
+
+    if (alloc == NULL) {
+        return realloc(ptr, newSize);
+    }
+
+    if (alloc->reallocFn != NULL) {
+        return alloc->reallocFn(alloc->cbData, ptr, oldSize, newSize);
+    }
+
+    newPtr = MBAlloc_Alloc(alloc, newSize);
+    if (newPtr != NULL && ptr != NULL) {
+        memcpy(newPtr, ptr, MIN(oldSize, newSize));
+        MBAlloc_Free(alloc, ptr, oldSize);
+    }
+    return newPtr;
+}
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBALLOC_H_202209181402
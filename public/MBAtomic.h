@@ -0,0 +1,178 @@
+/*
+ * MBAtomic.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBATOMIC_H_202210191130
+#define MBATOMIC_H_202210191130
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBTypes.h"
+#include "MBBasic.h"
+
+/*
+ * Atomic integers and pointers.
+ *
+ * These wrap the compiler's __atomic builtins in types that can't be
+ * touched by accident with a plain load or store.  Every operation
+ * takes an explicit memory order.  A compare-exchange uses the same
+ * order on failure, minus any release part, since a failed exchange
+ * doesn't store anything.
+ *
+ * CompareExchange writes the current value to *expected when it
+ * fails.  The Fetch* operations return the old value.
+ */
+typedef enum MBAtomicOrder {
+    MB_ATOMIC_RELAXED = __ATOMIC_RELAXED,
+    MB_ATOMIC_ACQUIRE = __ATOMIC_ACQUIRE,
+    MB_ATOMIC_RELEASE = __ATOMIC_RELEASE,
+    MB_ATOMIC_ACQ_REL = __ATOMIC_ACQ_REL,
+    MB_ATOMIC_SEQ_CST = __ATOMIC_SEQ_CST,
+} MBAtomicOrder;
+
+typedef struct MBAtomic32 {
+    uint32 value;
+} MBAtomic32;
+
+typedef struct MBAtomic64 {
+    uint64 value __attribute__((aligned(8)));
+} MBAtomic64;
+
+typedef struct MBAtomicPtr {
+    void *value;
+} MBAtomicPtr;
+
+static INLINE_ALWAYS int
+MBAtomicFailureOrder(MBAtomicOrder order)
+{
+    if (order == MB_ATOMIC_RELEASE) {
+        return MB_ATOMIC_RELAXED;
+    } else if (order == MB_ATOMIC_ACQ_REL) {
+        return MB_ATOMIC_ACQUIRE;
+    }
+    return order;
+}
+
+static INLINE_ALWAYS void
+MBAtomic_Fence(MBAtomicOrder order)
+{
+    __atomic_thread_fence(order);
+}
+
+#define MBATOMIC_DEFINE_BASIC(_atype, _suffix, _type)                     \
+    static INLINE_ALWAYS _type                                            \
+    MBAtomic_Load##_suffix(const _atype *a, MBAtomicOrder order)          \
+    {                                                                     \
+        return __atomic_load_n(&a->value, order);                         \
+    }                                                                     \
+                                                                          \
+    static INLINE_ALWAYS void                                             \
+    MBAtomic_Store##_suffix(_atype *a, _type v, MBAtomicOrder order)      \
+    {                                                                     \
+        __atomic_store_n(&a->value, v, order);                            \
+    }                                                                     \
+                                                                          \
+    static INLINE_ALWAYS _type                                            \
+    MBAtomic_Exchange##_suffix(_atype *a, _type v, MBAtomicOrder order)   \
+    {                                                                     \
+        return __atomic_exchange_n(&a->value, v, order);                  \
+    }                                                                     \
+                                                                          \
+    static INLINE_ALWAYS bool                                             \
+    MBAtomic_CompareExchange##_suffix(_atype *a, _type *expected,         \
+                                      _type desired, MBAtomicOrder order) \
+    {                                                                     \
+        return __atomic_compare_exchange_n(&a->value, expected, desired,  \
+                                           FALSE, order,                  \
+                                           MBAtomicFailureOrder(order));  \
+    }
+
+#define MBATOMIC_DEFINE_INT(_atype, _suffix, _type)                       \
+    MBATOMIC_DEFINE_BASIC(_atype, _suffix, _type)                         \
+                                                                          \
+    static INLINE_ALWAYS _type                                            \
+    MBAtomic_FetchAdd##_suffix(_atype *a, _type v, MBAtomicOrder order)   \
+    {                                                                     \
+        return __atomic_fetch_add(&a->value, v, order);                   \
+    }                                                                     \
+                                                                          \
+    static INLINE_ALWAYS _type                                            \
+    MBAtomic_FetchSub##_suffix(_atype *a, _type v, MBAtomicOrder order)   \
+    {                                                                     \
+        return __atomic_fetch_sub(&a->value, v, order);                   \
+    }                                                                     \
+                                                                          \
+    static INLINE_ALWAYS _type                                            \
+    MBAtomic_FetchAnd##_suffix(_atype *a, _type v, MBAtomicOrder order)   \
+    {                                                                     \
+        return __atomic_fetch_and(&a->value, v, order);                   \
+    }                                                                     \
+                                                                          \
+    static INLINE_ALWAYS _type                                            \
+    MBAtomic_FetchOr##_suffix(_atype *a, _type v, MBAtomicOrder order)    \
+    {                                                                     \
+        return __atomic_fetch_or(&a->value, v, order);                    \
+    }
+
+MBATOMIC_DEFINE_INT(MBAtomic32, 32, uint32)
+MBATOMIC_DEFINE_INT(MBAtomic64, 64, uint64)
+MBATOMIC_DEFINE_BASIC(MBAtomicPtr, Ptr, void *)
+
+/*
+ * Keep data that different threads write on separate cache lines, so
+ * they don't bounce the line between CPUs (false sharing).
+ *
+ * MB_CACHE_ALIGNED aligns a type or field to a line.  MB_CACHE_PAD
+ * fills out the rest of a line after usedBytes worth of fields.
+ */
+#if defined(__aarch64__) && defined(MB_MACOS)
+#define MB_CACHE_LINE_SIZE 128
+#else
+#define MB_CACHE_LINE_SIZE 64
+#endif
+
+#define MB_CACHE_ALIGNED __attribute__((aligned(MB_CACHE_LINE_SIZE)))
+#define MB_CACHE_PAD(_name, _usedBytes) \
+    uint8 _name[MB_CACHE_LINE_SIZE - ((_usedBytes) % MB_CACHE_LINE_SIZE)]
+
+/*
+ * Tell the CPU we're spinning.
+ */
+static INLINE_ALWAYS void
+MBAtomic_Pause(void)
+{
+#if defined(__GNUC__) && (defined(ARCH_AMD64) || defined(ARCH_x86))
+    __builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBATOMIC_H_202210191130
@@ -50,6 +50,8 @@
 
 #define NORETURN __attribute__((__noreturn__))
 
+#define THREAD_LOCAL __thread
+
 //It might be possible to check #if HAVE_BUILTIN_EXPECT
 //to determine when this is safe.
 #define LIKELY(x) (__builtin_expect(!!(x), 1))
@@ -57,6 +59,8 @@
 
 #define CONSTANT(x) (__builtin_constant_p(x))
 
+#define PREFETCH(x) (__builtin_prefetch(x))
+
 #define UNUSED_VARIABLE(x) (x) = (x)
 
 // Unroll a for loop from 0 to (n - 1).
@@ -44,24 +44,57 @@ typedef struct CMBComparator {
     uint32 itemSize;
 } CMBComparator;
 
-int MBCompare_FindMin(void *items, uint32 numItems, uint32 itemSize,
-                      CMBCompareFn compareFn, void *cbData);
+int64 MBCompare_FindMin(void *items, uint64 numItems, uint32 itemSize,
+                        CMBCompareFn compareFn, void *cbData);
 
-void MBCompare_SortMinN(uint32 n,
-                        void *items, uint32 numItems, uint32 itemSize,
+/*
+ * Move the n smallest items to the front of the array, in sorted order.
+ * The rest of the array is left in an unspecified order.
+ *
+ * This keeps a bounded heap of the best n, so it's O(numItems log n),
+ * or selects and then sorts the front if n is a large fraction of
+ * numItems.
+ */
+#define MBCOMPARE_SORTMINN_SELECT_RATIO 8
+void MBCompare_SortMinN(uint64 n,
+                        void *items, uint64 numItems, uint32 itemSize,
                         CMBCompareFn compareFn, void *cbData);
 
+/*
+ * Quickselect: put the item that would land at index nth in sorted
+ * order there, with nothing greater before it and nothing less after
+ * it.  O(numItems) on average.
+ */
+void MBCompare_NthElement(uint64 nth,
+                          void *items, uint64 numItems, uint32 itemSize,
+                          CMBCompareFn compareFn, void *cbData);
+
+/*
+ * O(n log n) introsort over a CMBCompareFn: quicksort with
+ * median-of-three pivots, insertion sort for small partitions, and a
+ * heapsort fallback if the partitions go bad.  Not stable.
+ */
+void MBCompare_IntroSort(void *items, uint64 numItems, uint32 itemSize,
+                         CMBCompareFn compareFn, void *cbData);
+
 static inline void
-MBCompare_SortFallback(void *items, uint32 numItems, uint32 itemSize,
+MBCompare_SortFallback(void *items, uint64 numItems, uint32 itemSize,
                        CMBCompareFn compareFn, void *cbData)
 {
-    MBCompare_SortMinN(numItems, items, numItems, itemSize, compareFn, cbData);
+    MBCompare_IntroSort(items, numItems, itemSize, compareFn, cbData);
 }
 
 static inline void
-MBCompare_Sort(void *items, uint32 numItems, uint32 itemSize,
+MBCompare_Sort(void *items, uint64 numItems, uint32 itemSize,
                CMBCompareFn compareFn, void *cbData)
 {
+    /*
+     * Empty vectors can have a NULL items, which qsort_r doesn't allow.
+     */
+    if (numItems < 2) {
+        return;
+    }
+
 #ifdef _GNU_SOURCE
     qsort_r(items, numItems, itemSize, compareFn, cbData);
 #else
@@ -69,4 +102,224 @@ MBCompare_Sort(void *items, uint32 numItems, uint32 itemSize,
 #endif
 }
 
+/*
+ * Stable bottom-up merge sort.  Equal items keep their original order,
+ * so multi-key orderings can be built by sorting on each key in turn.
+ * This needs a scratch copy of the whole array.
+ */
+void MBCompare_StableSort(void *items, uint64 numItems, uint32 itemSize,
+                          CMBCompareFn compareFn, void *cbData);
+
+/*
+ * Merge two sorted arrays into dest, which must not overlap them.
+ * Ties take the item from a first.
+ */
+void MBCompare_MergeSorted(void *dest,
+                           const void *a, uint64 aLen,
+                           const void *b, uint64 bLen, uint32 itemSize,
+                           CMBCompareFn compareFn, void *cbData);
+
+/*
+ * Merge numSrcs sorted arrays into dest with a loser tree, in
+ * O(total log numSrcs).  Ties take the item from the earlier source.
+ */
+void MBCompare_MergeSortedK(void *dest, const void **srcs, const uint64 *lens,
+                            uint32 numSrcs, uint32 itemSize,
+                            CMBCompareFn compareFn, void *cbData);
+
+typedef enum MBCompareKeyType {
+    MBCOMPARE_KEY_UINT32,
+    MBCOMPARE_KEY_INT32,
+    MBCOMPARE_KEY_FLOAT,
+    MBCOMPARE_KEY_UINT64,
+    MBCOMPARE_KEY_INT64,
+    MBCOMPARE_KEY_DOUBLE,
+} MBCompareKeyType;
+
+/*
+ * Stable LSD radix sort of items by a numeric key stored keyOffset bytes
+ * into each item.
+ *
+ * This never calls a comparator, so it's usually much faster than
+ * MBCompare_Sort for large arrays, but it needs a scratch copy of the
+ * whole array.  Floats sort by their bit patterns, so -0.0 comes
+ * before 0.0, and NaNs go to the ends based on their sign bit.
+ */
+void MBCompare_RadixSort(void *items, uint64 numItems, uint32 itemSize,
+                         uint32 keyOffset, MBCompareKeyType keyType);
+
+/*
+ * Split the sort into numThreads pieces (0 for one per worker in the
+ * MBParallel pool), run as tasks on that pool: each piece sorts a
+ * chunk, and then the chunks are merged in parallel.  This needs a
+ * scratch copy of the whole array.
+ *
+ * Below MBCOMPARE_PARALLEL_SORT_THRESHOLD items, or without thread
+ * support, these just call MBCompare_Sort/MBCompare_RadixSort.
+ * The radix version is still stable; the comparator one isn't.
+ */
+#define MBCOMPARE_PARALLEL_SORT_THRESHOLD (64 * 1024)
+void MBCompare_ParallelSort(void *items, uint64 numItems, uint32 itemSize,
+                            CMBCompareFn compareFn, void *cbData,
+                            uint numThreads);
+void MBCompare_ParallelRadixSort(void *items, uint64 numItems,
+                                 uint32 itemSize, uint32 keyOffset,
+                                 MBCompareKeyType keyType, uint numThreads);
+
+static inline void MBCompare_RadixSortUint32(uint32 *items, uint64 numItems)
+{
+    MBCompare_RadixSort(items, numItems, sizeof(items[0]), 0,
+                        MBCOMPARE_KEY_UINT32);
+}
+
+static inline void MBCompare_RadixSortInt32(int32 *items, uint64 numItems)
+{
+    MBCompare_RadixSort(items, numItems, sizeof(items[0]), 0,
+                        MBCOMPARE_KEY_INT32);
+}
+
+static inline void MBCompare_RadixSortFloat(float *items, uint64 numItems)
+{
+    MBCompare_RadixSort(items, numItems, sizeof(items[0]), 0,
+                        MBCOMPARE_KEY_FLOAT);
+}
+
+static inline void MBCompare_RadixSortUint64(uint64 *items, uint64 numItems)
+{
+    MBCompare_RadixSort(items, numItems, sizeof(items[0]), 0,
+                        MBCOMPARE_KEY_UINT64);
+}
+
+static inline void MBCompare_RadixSortInt64(int64 *items, uint64 numItems)
+{
+    MBCompare_RadixSort(items, numItems, sizeof(items[0]), 0,
+                        MBCOMPARE_KEY_INT64);
+}
+
+static inline void MBCompare_RadixSortDouble(double *items, uint64 numItems)
+{
+    MBCompare_RadixSort(items, numItems, sizeof(items[0]), 0,
+                        MBCOMPARE_KEY_DOUBLE);
+}
+
+/*
+ * Declares an inlined introsort for arrays of _type, ordered by the
+ * _less(lhs, rhs) macro or function:
+ *    void _name(_type *items, uint64 numItems);
+ *
+ * This avoids the indirect comparator call per comparison that
+ * MBCompare_Sort pays.  It's not stable.
+ */
+#define MBCOMPARE_INSERTION_SORT_THRESHOLD 16
+
+#define DECLARE_MBCOMPARE_SORT(_type, _name, _less) \
+    static inline void _name ## Insertion \
+    (_type *items, uint64 numItems) \
+    { \
+        for (uint64 i = 1; i < numItems; i++) { \
+            _type tmp = items[i]; \
+            uint64 k = i; \
+            while (k > 0 && _less(tmp, items[k - 1])) { \
+                items[k] = items[k - 1]; \
+                k--; \
+            } \
+            items[k] = tmp; \
+        } \
+    } \
+    static inline void _name ## SiftDown \
+    (_type *items, uint64 root, uint64 numItems) \
+    { \
+        _type tmp = items[root]; \
+        uint64 child; \
+        while ((child = 2 * root + 1) < numItems) { \
+            if (child + 1 < numItems && _less(items[child], items[child + 1])) { \
+                child++; \
+            } \
+            if (!_less(tmp, items[child])) { \
+                break; \
+            } \
+            items[root] = items[child]; \
+            root = child; \
+        } \
+        items[root] = tmp; \
+    } \
+    static inline void _name ## HeapSort \
+    (_type *items, uint64 numItems) \
+    { \
+        for (uint64 i = numItems / 2; i > 0; i--) { \
+            _name ## SiftDown(items, i - 1, numItems); \
+        } \
+        for (uint64 i = numItems - 1; i > 0; i--) { \
+            _type tmp = items[0]; \
+            items[0] = items[i]; \
+            items[i] = tmp; \
+            _name ## SiftDown(items, 0, i); \
+        } \
+    } \
+    static inline void _name ## Loop \
+    (_type *items, uint64 numItems, uint depthLimit) \
+    { \
+        while (numItems > MBCOMPARE_INSERTION_SORT_THRESHOLD) { \
+            if (depthLimit == 0) { \
+                _name ## HeapSort(items, numItems); \
+                return; \
+            } \
+            depthLimit--; \
+            \
+            /* \
+             * Median-of-three into items[0], so it also acts as \
+             * a sentinel for the scans below. \
+             */ \
+            uint64 mid = numItems / 2; \
+            uint64 last = numItems - 1; \
+            _type tmp; \
+            if (_less(items[mid], items[0])) { \
+                tmp = items[mid]; items[mid] = items[0]; items[0] = tmp; \
+            } \
+            if (_less(items[last], items[mid])) { \
+                tmp = items[last]; items[last] = items[mid]; items[mid] = tmp; \
+                if (_less(items[mid], items[0])) { \
+                    tmp = items[mid]; items[mid] = items[0]; items[0] = tmp; \
+                } \
+            } \
+            tmp = items[mid]; items[mid] = items[0]; items[0] = tmp; \
+            _type pivot = items[0]; \
+            \
+            uint64 i = 0; \
+            uint64 k = numItems; \
+            while (TRUE) { \
+                do { i++; } while (i < numItems && _less(items[i], pivot)); \
+                do { k--; } while (_less(pivot, items[k])); \
+                if (i >= k) { \
+                    break; \
+                } \
+                tmp = items[i]; items[i] = items[k]; items[k] = tmp; \
+            } \
+            items[0] = items[k]; \
+            items[k] = pivot; \
+            \
+            /* Recurse on the smaller side to bound the stack depth. */ \
+            if (k < numItems - k - 1) { \
+                _name ## Loop(items, k, depthLimit); \
+                items += k + 1; \
+                numItems -= k + 1; \
+            } else { \
+                _name ## Loop(items + k + 1, numItems - k - 1, depthLimit); \
+                numItems = k; \
+            } \
+        } \
+        _name ## Insertion(items, numItems); \
+    } \
+    static inline void _name \
+    (_type *items, uint64 numItems) \
+    { \
+        uint depthLimit = 0; \
+        for (uint64 n = numItems; n > 1; n >>= 1) { \
+            depthLimit += 2; \
+        } \
+        _name ## Loop(items, numItems, depthLimit); \
+    }
+
+#define MBCOMPARE_LESS(_lhs, _rhs) ((_lhs) < (_rhs))
+
 #endif // MBCOMPARE_H_202008151217
@@ -60,6 +60,12 @@
 #define mb_devel 0
 #endif
 
+#ifdef MB_LOCK_PROFILE
+#define mb_lock_profile 1
+#else
+#define mb_lock_profile 0
+#endif
+
 #ifdef MB_HAS_SDL2
 #define mb_has_sdl2 1
 #else
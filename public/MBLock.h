@@ -26,19 +26,137 @@
 #ifndef _MBLOCK_H_20211110
 #define _MBLOCK_H_20211110
 
+#include <stdio.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
 #include "MBBasic.h"
 #include "MBAssert.h"
+#include "MBAtomic.h"
+#include "MBThread.h"
 
-#define MB_THREAD_ID_INVALID 0
+#define MB_THREAD_ID_INVALID MBTHREAD_ID_INVALID
 
-#ifndef MB_HAS_SDL2
+/*
+ * The lock backend, picked from what the platform has:
+ *
+ *   MBLOCK_FUTEX:    Linux.  Locking and unlocking an uncontended lock
+ *                    are one atomic op each, and only contended locks
+ *                    go to the kernel.
+ *   MBLOCK_PTHREADS: pthread_mutex, for macOS.
+ *   MBLOCK_SDL2:     SDL_mutex, for anything else with SDL2.
+ *
+ * Without any of them, mb_lock is 0 and the MBLock functions aren't
+ * implemented.
+ */
+#if defined(MB_LINUX)
+#define MBLOCK_FUTEX
+#elif defined(MB_MACOS)
+#define MBLOCK_PTHREADS
+#include <pthread.h>
+#elif defined(MB_HAS_SDL2)
+#define MBLOCK_SDL2
+#include <SDL2/SDL_mutex.h>
+#endif
 
+#if defined(MBLOCK_FUTEX) || defined(MBLOCK_PTHREADS) || \
+    defined(MBLOCK_SDL2)
+#define MB_HAS_MBLOCK
+#define mb_lock 1
+#else
 #define mb_lock 0
+#endif
+
+/*
+ * Debug owner tracking, shared by all of the lock types below.
+ * Writers to the owner field always hold the lock, so racing readers
+ * can only see some other thread's ID, never their own.
+ */
+static INLINE_ALWAYS void
+MBLockDebugAcquire(MBThreadID *owner)
+{
+    if (mb_debug) {
+        ASSERT(*owner == MB_THREAD_ID_INVALID);
+        *owner = MBThread_GetID();
+        ASSERT(*owner != MB_THREAD_ID_INVALID);
+    }
+}
+
+static INLINE_ALWAYS void
+MBLockDebugRelease(MBThreadID *owner)
+{
+    if (mb_debug) {
+        ASSERT(*owner == MBThread_GetID());
+        *owner = MB_THREAD_ID_INVALID;
+    }
+}
+
+static INLINE_ALWAYS bool
+MBLockDebugIsHeld(const MBThreadID *owner)
+{
+    if (!mb_debug) {
+        NOT_IMPLEMENTED();
+    }
+
+    if (*owner == MB_THREAD_ID_INVALID) {
+        return FALSE;
+    }
+    return MBThread_GetID() == *owner;
+}
+
+/*
+ * Give up the CPU to another runnable thread.
+ */
+void MBLockYield(void);
+
+/*
+ * Lock profiling.
+ *
+ * When built with MB_LOCK_PROFILE, each MBLock (and MBAdaptiveLock)
+ * keeps track of how often it's taken, how often that meant waiting
+ * for another thread, how long all of that waiting took, and the
+ * longest anyone held it.  MBLock_ReportProfile prints the most
+ * contended locks, including ones that have since been destroyed,
+ * which are merged by name.
+ *
+ * Without MB_LOCK_PROFILE none of this is compiled in, and MBLocks are
+ * the same size as before.  MBLock_SetName is then a no-op, so callers
+ * don't need to check mb_lock_profile themselves.
+ */
+typedef struct MBLockProfile {
+    const char *name;
+    uint64 acquires;
+    uint64 contended;
+    uint64 waitNS;
+    uint64 maxHoldNS;
+} MBLockProfile;
+
+/*
+ * Print up to maxLocks locks, most contended first.  The numbers for
+ * locks that are still in use are only approximate.
+ */
+void MBLock_ReportProfile(FILE *f, uint maxLocks);
+
+#ifndef MB_HAS_MBLOCK
 
 typedef struct MBLock {
     uint8 pad;
 } MBLock;
 
+static inline void
+MBLock_SetName(MBLock *lock, const char *name)
+{
+    NOT_IMPLEMENTED();
+}
+
+static inline bool
+MBLock_GetProfile(MBLock *lock, MBLockProfile *profile)
+{
+    NOT_IMPLEMENTED();
+}
+
 static inline void
 MBLock_Create(MBLock *lock)
 {
@@ -63,65 +181,201 @@ MBLock_Lock(MBLock *lock)
     NOT_IMPLEMENTED();
 }
 
+static inline bool
+MBLock_TryLock(MBLock *lock)
+{
+    NOT_IMPLEMENTED();
+}
+
 static inline void
 MBLock_Unlock(MBLock *lock)
 {
     NOT_IMPLEMENTED();
 }
 
-#else // MB_HAS_SDL2
-
-#define MB_HAS_MBLOCK
-#define mb_lock 1
-
-#include <SDL2/SDL_mutex.h>
-#include <SDL2/SDL_thread.h>
+#else // MB_HAS_MBLOCK
 
 typedef struct MBLock {
+#if defined(MBLOCK_FUTEX)
+    /*
+     * 0 is unlocked, 1 is locked, and 2 is locked with threads
+     * (possibly) sleeping on it.
+     */
+    MBAtomic32 state;
+#elif defined(MBLOCK_PTHREADS)
+    pthread_mutex_t mutex;
+#elif defined(MBLOCK_SDL2)
     SDL_mutex *sdlMutex;
-    SDL_threadID thread;
+#endif
+    MBThreadID thread;
+#ifdef MB_LOCK_PROFILE
+    MBLockProfile profile;
+    uint64 holdStart;
+    struct MBLock *profilePrev;
+    struct MBLock *profileNext;
+#endif
 } MBLock;
 
+/*
+ * The contended paths for the futex backend, in MBLock.c.
+ */
+void MBLockLockSlow(MBLock *lock);
+void MBLockUnlockSlow(MBLock *lock);
+
+#ifdef MB_LOCK_PROFILE
+/*
+ * The profile counters are only written with the lock held.
+ */
+uint64 MBLockProfileNow(void);
+void MBLockProfileRegister(MBLock *lock);
+void MBLockProfileUnregister(MBLock *lock);
+
+static INLINE_ALWAYS void
+MBLockProfileAcquired(MBLock *lock, uint64 waitStart)
+{
+    uint64 now = MBLockProfileNow();
+
+    lock->profile.acquires++;
+    if (waitStart != 0) {
+        lock->profile.contended++;
+        lock->profile.waitNS += now - waitStart;
+    }
+    lock->holdStart = now;
+}
+
+static INLINE_ALWAYS void
+MBLockProfileReleasing(MBLock *lock)
+{
+    uint64 hold = MBLockProfileNow() - lock->holdStart;
+    lock->profile.maxHoldNS = MAX(lock->profile.maxHoldNS, hold);
+}
+#endif
+
 static inline void
 MBLock_Create(MBLock *lock)
 {
     ASSERT(lock != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_Store32(&lock->state, 0, MB_ATOMIC_RELAXED);
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_mutex_init(&lock->mutex, NULL);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
     lock->sdlMutex = SDL_CreateMutex();
     VERIFY(lock->sdlMutex != NULL);
+#endif
 
     if (mb_debug) {
         lock->thread = MB_THREAD_ID_INVALID;
     }
+
+#ifdef MB_LOCK_PROFILE
+    MBLockProfileRegister(lock);
+#endif
 }
 
 static inline
 void MBLock_Destroy(MBLock *lock)
 {
     ASSERT(lock != NULL);
-    ASSERT(lock->sdlMutex != NULL);
 
     if (mb_debug) {
         ASSERT(lock->thread == MB_THREAD_ID_INVALID);
     }
 
+#ifdef MB_LOCK_PROFILE
+    MBLockProfileUnregister(lock);
+#endif
+
+#if defined(MBLOCK_FUTEX)
+    ASSERT(MBAtomic_Load32(&lock->state, MB_ATOMIC_RELAXED) == 0);
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_mutex_destroy(&lock->mutex);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    ASSERT(lock->sdlMutex != NULL);
     SDL_DestroyMutex(lock->sdlMutex);
     lock->sdlMutex = NULL;
+#endif
 }
 
 static inline bool
 MBLock_IsLocked(MBLock *lock)
 {
     ASSERT(lock != NULL);
+    return MBLockDebugIsHeld(&lock->thread);
+}
 
-    if (!mb_debug) {
-        NOT_IMPLEMENTED();
-    }
+/*
+ * Tag the lock for MBLock_ReportProfile.  The name isn't copied, so it
+ * must outlive the lock; the profile keeps its own copy once the lock
+ * is destroyed.
+ */
+static inline void
+MBLock_SetName(MBLock *lock, const char *name)
+{
+    ASSERT(lock != NULL);
+#ifdef MB_LOCK_PROFILE
+    lock->profile.name = name;
+#endif
+}
 
-    if (lock->thread == MB_THREAD_ID_INVALID) {
-        return FALSE;
+/*
+ * Copy out the lock's profile, or return FALSE if lock profiling
+ * isn't compiled in.
+ */
+bool MBLock_GetProfile(MBLock *lock, MBLockProfile *profile);
+
+/*
+ * Take the lock if it's free, without waiting.
+ */
+static INLINE_ALWAYS bool
+MBLockTryAcquire(MBLock *lock)
+{
+#if defined(MBLOCK_FUTEX)
+    uint32 unlocked = 0;
+    return MBAtomic_CompareExchange32(&lock->state, &unlocked, 1,
+                                      MB_ATOMIC_ACQUIRE);
+#elif defined(MBLOCK_PTHREADS)
+    return pthread_mutex_trylock(&lock->mutex) == 0;
+#elif defined(MBLOCK_SDL2)
+    return SDL_TryLockMutex(lock->sdlMutex) == 0;
+#endif
+}
+
+static INLINE_ALWAYS void
+MBLockAcquire(MBLock *lock)
+{
+#if defined(MBLOCK_FUTEX)
+    if (UNLIKELY(!MBLockTryAcquire(lock))) {
+        MBLockLockSlow(lock);
     }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_mutex_lock(&lock->mutex);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    int ret = SDL_LockMutex(lock->sdlMutex);
+    ASSERT(ret == 0);
+#endif
+}
 
-    return SDL_GetThreadID(NULL) == lock->thread;
+static INLINE_ALWAYS void
+MBLockRelease(MBLock *lock)
+{
+#if defined(MBLOCK_FUTEX)
+    if (UNLIKELY(MBAtomic_Exchange32(&lock->state, 0,
+                                     MB_ATOMIC_RELEASE) == 2)) {
+        MBLockUnlockSlow(lock);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_mutex_unlock(&lock->mutex);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    ASSERT(lock->sdlMutex != NULL);
+    int ret = SDL_UnlockMutex(lock->sdlMutex);
+    ASSERT(ret == 0);
+#endif
 }
 
 static inline void
@@ -129,31 +383,754 @@ MBLock_Lock(MBLock *lock)
 {
     ASSERT(lock != NULL);
     ASSERT(!MBLock_IsLocked(lock));
-    int ret = SDL_LockMutex(lock->sdlMutex);
-    ASSERT(ret == 0);
 
-    if (mb_debug) {
-        ASSERT(lock->thread == MB_THREAD_ID_INVALID);
-        lock->thread = SDL_GetThreadID(NULL);
-        ASSERT(lock->thread != MB_THREAD_ID_INVALID);
+#ifdef MB_LOCK_PROFILE
+    uint64 waitStart = 0;
+    if (!MBLockTryAcquire(lock)) {
+        waitStart = MBLockProfileNow();
+        MBLockAcquire(lock);
+    }
+    MBLockProfileAcquired(lock, waitStart);
+#else
+    MBLockAcquire(lock);
+#endif
+
+    MBLockDebugAcquire(&lock->thread);
+}
+
+static inline bool
+MBLock_TryLock(MBLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(!MBLock_IsLocked(lock));
+
+    if (!MBLockTryAcquire(lock)) {
+        return FALSE;
     }
+#ifdef MB_LOCK_PROFILE
+    MBLockProfileAcquired(lock, 0);
+#endif
+    MBLockDebugAcquire(&lock->thread);
+    return TRUE;
 }
 
 static inline void
 MBLock_Unlock(MBLock *lock)
 {
     ASSERT(lock != NULL);
-    ASSERT(lock->sdlMutex != NULL);
+    ASSERT(MBLock_IsLocked(lock));
+
+    MBLockDebugRelease(&lock->thread);
+#ifdef MB_LOCK_PROFILE
+    MBLockProfileReleasing(lock);
+#endif
+    MBLockRelease(lock);
+}
+
+/*
+ * An MBLock that spins for a while before going to sleep, for locks
+ * that are usually held for less time than a sleep/wakeup takes.
+ *
+ * How long it spins adapts to how long it's recently taken to get the
+ * lock by spinning, the same way glibc's PTHREAD_MUTEX_ADAPTIVE_NP
+ * does.  On a single CPU it never spins, since the owner can't run
+ * while we do.
+ */
+typedef struct MBAdaptiveLock {
+    MBLock lock;
+
+    /*
+     * An int32, kept in an MBAtomic32.
+     */
+    MBAtomic32 spinEstimate;
+} MBAdaptiveLock;
+
+void MBAdaptiveLockSpin(MBAdaptiveLock *lock);
+
+static inline void
+MBAdaptiveLock_Create(MBAdaptiveLock *lock)
+{
+    MBLock_Create(&lock->lock);
+    MBAtomic_Store32(&lock->spinEstimate, 0, MB_ATOMIC_RELAXED);
+}
+
+static inline void
+MBAdaptiveLock_Destroy(MBAdaptiveLock *lock)
+{
+    MBLock_Destroy(&lock->lock);
+}
+
+static inline bool
+MBAdaptiveLock_IsLocked(MBAdaptiveLock *lock)
+{
+    return MBLock_IsLocked(&lock->lock);
+}
+
+static inline void
+MBAdaptiveLock_Lock(MBAdaptiveLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(!MBLock_IsLocked(&lock->lock));
+
+#ifdef MB_LOCK_PROFILE
+    uint64 waitStart = 0;
+    if (UNLIKELY(!MBLockTryAcquire(&lock->lock))) {
+        waitStart = MBLockProfileNow();
+        MBAdaptiveLockSpin(lock);
+    }
+    MBLockProfileAcquired(&lock->lock, waitStart);
+#else
+    if (UNLIKELY(!MBLockTryAcquire(&lock->lock))) {
+        MBAdaptiveLockSpin(lock);
+    }
+#endif
+    MBLockDebugAcquire(&lock->lock.thread);
+}
+
+static inline bool
+MBAdaptiveLock_TryLock(MBAdaptiveLock *lock)
+{
+    return MBLock_TryLock(&lock->lock);
+}
+
+static inline void
+MBAdaptiveLock_Unlock(MBAdaptiveLock *lock)
+{
+    MBLock_Unlock(&lock->lock);
+}
+
+/*
+ * A reader-writer lock.  Any number of readers can hold it at once, or
+ * one writer.
+ *
+ * Writers have preference: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers can't starve writers (but
+ * a steady stream of writers can starve readers).  Read locks aren't
+ * recursive, since a second read lock could be stuck behind a waiting
+ * writer.
+ *
+ * The futex version keeps everything in state, and sleeping readers
+ * and writers wait on their own wakeup counters.  On pthreads this is
+ * a pthread_rwlock, whose writer preference depends on the platform.
+ * SDL2 doesn't have one, so there it's an MBLock that readers also
+ * take exclusively.
+ */
+#define MBRWLOCK_READER          ((uint32)1)
+#define MBRWLOCK_READER_MASK     ((uint32)0xFFFF)
+#define MBRWLOCK_WAITING_WRITER  ((uint32)1 << 16)
+#define MBRWLOCK_WAITING_MASK    ((uint32)0x3FFF << 16)
+#define MBRWLOCK_READERS_ASLEEP  ((uint32)1 << 30)
+#define MBRWLOCK_WRITER          ((uint32)1 << 31)
+
+typedef struct MBRWLock {
+#if defined(MBLOCK_FUTEX)
+    MBAtomic32 state;
+    MBAtomic32 readerWakeups;
+    MBAtomic32 writerWakeups;
+#elif defined(MBLOCK_PTHREADS)
+    pthread_rwlock_t rwlock;
+#elif defined(MBLOCK_SDL2)
+    MBLock lock;
+#endif
+    MBThreadID writer;
+} MBRWLock;
+
+/*
+ * The contended paths for the futex backend, in MBLock.c.
+ */
+void MBRWLockReadLockSlow(MBRWLock *lock);
+void MBRWLockWriteLockSlow(MBRWLock *lock);
+void MBRWLockWriteUnlockSlow(MBRWLock *lock);
+void MBRWLockWakeWriter(MBRWLock *lock);
+
+static inline void
+MBRWLock_Create(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_Store32(&lock->state, 0, MB_ATOMIC_RELAXED);
+    MBAtomic_Store32(&lock->readerWakeups, 0, MB_ATOMIC_RELAXED);
+    MBAtomic_Store32(&lock->writerWakeups, 0, MB_ATOMIC_RELAXED);
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_rwlock_init(&lock->rwlock, NULL);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    MBLock_Create(&lock->lock);
+#endif
+
+    if (mb_debug) {
+        lock->writer = MB_THREAD_ID_INVALID;
+    }
+}
+
+static inline void
+MBRWLock_Destroy(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+
+    if (mb_debug) {
+        ASSERT(lock->writer == MB_THREAD_ID_INVALID);
+    }
+
+#if defined(MBLOCK_FUTEX)
+    ASSERT(MBAtomic_Load32(&lock->state, MB_ATOMIC_RELAXED) == 0);
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_rwlock_destroy(&lock->rwlock);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    MBLock_Destroy(&lock->lock);
+#endif
+}
+
+/*
+ * Whether the calling thread holds the write lock (debug only).
+ */
+static inline bool
+MBRWLock_IsWriteLocked(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+    return MBLockDebugIsHeld(&lock->writer);
+}
+
+static inline void
+MBRWLock_ReadLock(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(!MBRWLock_IsWriteLocked(lock));
+
+#if defined(MBLOCK_FUTEX)
+    uint32 s = MBAtomic_Load32(&lock->state, MB_ATOMIC_RELAXED);
+    if (UNLIKELY((s & (MBRWLOCK_WRITER | MBRWLOCK_WAITING_MASK)) != 0 ||
+                 !MBAtomic_CompareExchange32(&lock->state, &s,
+                                             s + MBRWLOCK_READER,
+                                             MB_ATOMIC_ACQUIRE))) {
+        MBRWLockReadLockSlow(lock);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_rwlock_rdlock(&lock->rwlock);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    MBLockAcquire(&lock->lock);
+#endif
+}
+
+static inline void
+MBRWLock_ReadUnlock(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(!MBRWLock_IsWriteLocked(lock));
+
+#if defined(MBLOCK_FUTEX)
+    uint32 s = MBAtomic_FetchSub32(&lock->state, MBRWLOCK_READER,
+                                   MB_ATOMIC_RELEASE) - MBRWLOCK_READER;
+    ASSERT((s & MBRWLOCK_WRITER) == 0);
+    ASSERT((s & MBRWLOCK_READER_MASK) != MBRWLOCK_READER_MASK);
+    if (UNLIKELY((s & MBRWLOCK_READER_MASK) == 0 &&
+                 (s & MBRWLOCK_WAITING_MASK) != 0)) {
+        MBRWLockWakeWriter(lock);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_rwlock_unlock(&lock->rwlock);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    MBLockRelease(&lock->lock);
+#endif
+}
+
+static inline void
+MBRWLock_WriteLock(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(!MBRWLock_IsWriteLocked(lock));
+
+#if defined(MBLOCK_FUTEX)
+    uint32 unlocked = 0;
+    if (UNLIKELY(!MBAtomic_CompareExchange32(&lock->state, &unlocked,
+                                             MBRWLOCK_WRITER,
+                                             MB_ATOMIC_ACQUIRE))) {
+        MBRWLockWriteLockSlow(lock);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_rwlock_wrlock(&lock->rwlock);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    MBLockAcquire(&lock->lock);
+#endif
+
+    MBLockDebugAcquire(&lock->writer);
+}
+
+static inline void
+MBRWLock_WriteUnlock(MBRWLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(MBRWLock_IsWriteLocked(lock));
+
+    MBLockDebugRelease(&lock->writer);
+
+#if defined(MBLOCK_FUTEX)
+    uint32 locked = MBRWLOCK_WRITER;
+    if (UNLIKELY(!MBAtomic_CompareExchange32(&lock->state, &locked, 0,
+                                             MB_ATOMIC_RELEASE))) {
+        MBRWLockWriteUnlockSlow(lock);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_rwlock_unlock(&lock->rwlock);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    MBLockRelease(&lock->lock);
+#endif
+}
+
+/*
+ * A condition variable, for waiting on an MBLock.
+ *
+ * MBCondVar_Wait unlocks the lock, sleeps until the condvar is
+ * signalled, and then locks it again.  Wakeups can be spurious, so
+ * always wait in a loop that rechecks the condition.  Signal wakes at
+ * least one waiter, and Broadcast wakes all of them.  Neither needs
+ * the lock held, but the condition itself must only change with the
+ * lock held, or a waiter could check it and go to sleep just after
+ * the signal.
+ *
+ * The futex version is a sequence number that waiters sleep on, and
+ * Signal skips the syscall when there's nobody waiting.  On pthreads
+ * this is a pthread_cond, and on SDL2 an SDL_cond.
+ */
+typedef struct MBCondVar {
+#if defined(MBLOCK_FUTEX)
+    MBAtomic32 seq;
+    MBAtomic32 numWaiters;
+#elif defined(MBLOCK_PTHREADS)
+    pthread_cond_t cond;
+#elif defined(MBLOCK_SDL2)
+    SDL_cond *sdlCond;
+#endif
+} MBCondVar;
+
+/*
+ * The waking path for the futex backend, in MBLock.c.
+ */
+void MBCondVarWake(MBCondVar *cv, bool all);
+
+static inline void
+MBCondVar_Create(MBCondVar *cv)
+{
+    ASSERT(cv != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_Store32(&cv->seq, 0, MB_ATOMIC_RELAXED);
+    MBAtomic_Store32(&cv->numWaiters, 0, MB_ATOMIC_RELAXED);
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_cond_init(&cv->cond, NULL);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    cv->sdlCond = SDL_CreateCond();
+    VERIFY(cv->sdlCond != NULL);
+#endif
+}
+
+static inline void
+MBCondVar_Destroy(MBCondVar *cv)
+{
+    ASSERT(cv != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    ASSERT(MBAtomic_Load32(&cv->numWaiters, MB_ATOMIC_RELAXED) == 0);
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_cond_destroy(&cv->cond);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    ASSERT(cv->sdlCond != NULL);
+    SDL_DestroyCond(cv->sdlCond);
+    cv->sdlCond = NULL;
+#endif
+}
+
+/*
+ * The lock must be held, and is held again on return.
+ */
+void MBCondVar_Wait(MBCondVar *cv, MBLock *lock);
+
+static inline void
+MBCondVar_Signal(MBCondVar *cv)
+{
+    ASSERT(cv != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    /*
+     * Waiters count themselves before they read seq, and we bump seq
+     * before we read the count, so either we see them, or their
+     * FUTEX_WAIT sees the new seq and doesn't sleep.
+     */
+    MBAtomic_FetchAdd32(&cv->seq, 1, MB_ATOMIC_SEQ_CST);
+    if (UNLIKELY(MBAtomic_Load32(&cv->numWaiters, MB_ATOMIC_SEQ_CST) != 0)) {
+        MBCondVarWake(cv, FALSE);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_cond_signal(&cv->cond);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    int ret = SDL_CondSignal(cv->sdlCond);
+    VERIFY(ret == 0);
+#endif
+}
+
+/*
+ * The waiters all wake up at once, and then take turns with the lock.
+ */
+static inline void
+MBCondVar_Broadcast(MBCondVar *cv)
+{
+    ASSERT(cv != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_FetchAdd32(&cv->seq, 1, MB_ATOMIC_SEQ_CST);
+    if (UNLIKELY(MBAtomic_Load32(&cv->numWaiters, MB_ATOMIC_SEQ_CST) != 0)) {
+        MBCondVarWake(cv, TRUE);
+    }
+#elif defined(MBLOCK_PTHREADS)
+    int ret = pthread_cond_broadcast(&cv->cond);
+    VERIFY(ret == 0);
+#elif defined(MBLOCK_SDL2)
+    int ret = SDL_CondBroadcast(cv->sdlCond);
+    VERIFY(ret == 0);
+#endif
+}
+
+/*
+ * A counting semaphore.
+ *
+ * Post adds one to the count, and Wait sleeps until the count is
+ * above zero and then takes one back off.  With the futex backend,
+ * the count is the futex word, and neither side makes a syscall unless
+ * a Wait has to sleep.  The others build it out of an MBLock and an
+ * MBCondVar.
+ */
+typedef struct MBSemaphore {
+#if defined(MBLOCK_FUTEX)
+    MBAtomic32 count;
+    MBAtomic32 numWaiters;
+#else
+    MBLock lock;
+    MBCondVar cond;
+    uint32 count;
+#endif
+} MBSemaphore;
+
+/*
+ * The contended paths for the futex backend, in MBLock.c.
+ */
+void MBSemaphoreWaitSlow(MBSemaphore *sem);
+void MBSemaphoreWake(MBSemaphore *sem);
+
+static inline void
+MBSemaphore_Create(MBSemaphore *sem, uint32 count)
+{
+    ASSERT(sem != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_Store32(&sem->count, count, MB_ATOMIC_RELAXED);
+    MBAtomic_Store32(&sem->numWaiters, 0, MB_ATOMIC_RELAXED);
+#else
+    MBLock_Create(&sem->lock);
+    MBCondVar_Create(&sem->cond);
+    sem->count = count;
+#endif
+}
+
+static inline void
+MBSemaphore_Destroy(MBSemaphore *sem)
+{
+    ASSERT(sem != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    ASSERT(MBAtomic_Load32(&sem->numWaiters, MB_ATOMIC_RELAXED) == 0);
+#else
+    MBCondVar_Destroy(&sem->cond);
+    MBLock_Destroy(&sem->lock);
+#endif
+}
+
+/*
+ * Take one from the count if it's above zero, without waiting.
+ */
+static inline bool
+MBSemaphore_TryWait(MBSemaphore *sem)
+{
+    ASSERT(sem != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    uint32 count = MBAtomic_Load32(&sem->count, MB_ATOMIC_RELAXED);
+
+    while (count > 0) {
+        if (MBAtomic_CompareExchange32(&sem->count, &count, count - 1,
+                                       MB_ATOMIC_ACQUIRE)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+#else
+    bool taken = FALSE;
+
+    MBLock_Lock(&sem->lock);
+    if (sem->count > 0) {
+        sem->count--;
+        taken = TRUE;
+    }
+    MBLock_Unlock(&sem->lock);
+    return taken;
+#endif
+}
+
+static inline void
+MBSemaphore_Wait(MBSemaphore *sem)
+{
+    ASSERT(sem != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    if (UNLIKELY(!MBSemaphore_TryWait(sem))) {
+        MBSemaphoreWaitSlow(sem);
+    }
+#else
+    MBLock_Lock(&sem->lock);
+    while (sem->count == 0) {
+        MBCondVar_Wait(&sem->cond, &sem->lock);
+    }
+    sem->count--;
+    MBLock_Unlock(&sem->lock);
+#endif
+}
+
+static inline void
+MBSemaphore_Post(MBSemaphore *sem)
+{
+    ASSERT(sem != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_FetchAdd32(&sem->count, 1, MB_ATOMIC_SEQ_CST);
+    if (UNLIKELY(MBAtomic_Load32(&sem->numWaiters, MB_ATOMIC_SEQ_CST) != 0)) {
+        MBSemaphoreWake(sem);
+    }
+#else
+    MBLock_Lock(&sem->lock);
+    sem->count++;
+    ASSERT(sem->count != 0);
+    MBLock_Unlock(&sem->lock);
+    MBCondVar_Signal(&sem->cond);
+#endif
+}
+
+/*
+ * An auto-reset event.
+ *
+ * Set wakes up one waiter, or if nobody's waiting, lets the next Wait
+ * through without sleeping.  Either way the event is clear again once
+ * a waiter has gone through, and setting an event that's already set
+ * doesn't do anything, so several Sets before a Wait only let one
+ * waiter through.  That makes it a cheap way to tell one consumer
+ * there's new work, without counting how much.
+ */
+typedef struct MBEvent {
+#if defined(MBLOCK_FUTEX)
+    MBAtomic32 set;
+    MBAtomic32 numWaiters;
+#else
+    MBLock lock;
+    MBCondVar cond;
+    bool set;
+#endif
+} MBEvent;
+
+/*
+ * The contended paths for the futex backend, in MBLock.c.
+ */
+void MBEventWaitSlow(MBEvent *event);
+void MBEventWake(MBEvent *event);
+
+static inline void
+MBEvent_Create(MBEvent *event, bool set)
+{
+    ASSERT(event != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    MBAtomic_Store32(&event->set, set ? 1 : 0, MB_ATOMIC_RELAXED);
+    MBAtomic_Store32(&event->numWaiters, 0, MB_ATOMIC_RELAXED);
+#else
+    MBLock_Create(&event->lock);
+    MBCondVar_Create(&event->cond);
+    event->set = set;
+#endif
+}
+
+static inline void
+MBEvent_Destroy(MBEvent *event)
+{
+    ASSERT(event != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    ASSERT(MBAtomic_Load32(&event->numWaiters, MB_ATOMIC_RELAXED) == 0);
+#else
+    MBCondVar_Destroy(&event->cond);
+    MBLock_Destroy(&event->lock);
+#endif
+}
+
+/*
+ * Clear the event if it's set, without waiting.
+ */
+static inline bool
+MBEvent_TryWait(MBEvent *event)
+{
+    ASSERT(event != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    uint32 set = 1;
+    return MBAtomic_Load32(&event->set, MB_ATOMIC_RELAXED) != 0 &&
+           MBAtomic_CompareExchange32(&event->set, &set, 0,
+                                      MB_ATOMIC_ACQUIRE);
+#else
+    bool wasSet;
+
+    MBLock_Lock(&event->lock);
+    wasSet = event->set;
+    event->set = FALSE;
+    MBLock_Unlock(&event->lock);
+    return wasSet;
+#endif
+}
+
+static inline void
+MBEvent_Wait(MBEvent *event)
+{
+    ASSERT(event != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    if (UNLIKELY(!MBEvent_TryWait(event))) {
+        MBEventWaitSlow(event);
+    }
+#else
+    MBLock_Lock(&event->lock);
+    while (!event->set) {
+        MBCondVar_Wait(&event->cond, &event->lock);
+    }
+    event->set = FALSE;
+    MBLock_Unlock(&event->lock);
+#endif
+}
+
+static inline void
+MBEvent_Set(MBEvent *event)
+{
+    ASSERT(event != NULL);
+
+#if defined(MBLOCK_FUTEX)
+    if (MBAtomic_Exchange32(&event->set, 1, MB_ATOMIC_SEQ_CST) == 0 &&
+        UNLIKELY(MBAtomic_Load32(&event->numWaiters,
+                                 MB_ATOMIC_SEQ_CST) != 0)) {
+        MBEventWake(event);
+    }
+#else
+    bool wasSet;
+
+    MBLock_Lock(&event->lock);
+    wasSet = event->set;
+    event->set = TRUE;
+    MBLock_Unlock(&event->lock);
+    if (!wasSet) {
+        MBCondVar_Signal(&event->cond);
+    }
+#endif
+}
+
+#endif // MB_HAS_MBLOCK
+
+/*
+ * A ticket spinlock, for very short critical sections.
+ *
+ * Threads get the lock in the order they asked for it.  Waiters back
+ * off exponentially between checks, and yield the CPU once the backoff
+ * maxes out, in case the owner isn't running.  This doesn't need any
+ * OS support, so it's available even when mb_lock is 0.
+ *
+ * Since the order is fixed, everyone waits whenever the next thread in
+ * line isn't running, so these fall apart with more threads than CPUs.
+ */
+#define MBSPINLOCK_MAX_BACKOFF 1024
+
+typedef struct MBSpinLock {
+    MBAtomic32 next;
+    MBAtomic32 owner;
+    MBThreadID thread;
+} MBSpinLock;
+
+void MBSpinLockWait(MBSpinLock *lock, uint32 ticket);
+
+static inline void
+MBSpinLock_Create(MBSpinLock *lock)
+{
+    ASSERT(lock != NULL);
+    MBAtomic_Store32(&lock->next, 0, MB_ATOMIC_RELAXED);
+    MBAtomic_Store32(&lock->owner, 0, MB_ATOMIC_RELAXED);
 
     if (mb_debug) {
-        ASSERT(MBLock_IsLocked(lock));
         lock->thread = MB_THREAD_ID_INVALID;
     }
+}
 
-    int ret = SDL_UnlockMutex(lock->sdlMutex);
-    ASSERT(ret == 0);
+static inline void
+MBSpinLock_Destroy(MBSpinLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(MBAtomic_Load32(&lock->next, MB_ATOMIC_RELAXED) ==
+           MBAtomic_Load32(&lock->owner, MB_ATOMIC_RELAXED));
+
+    if (mb_debug) {
+        ASSERT(lock->thread == MB_THREAD_ID_INVALID);
+    }
+}
+
+static inline bool
+MBSpinLock_IsLocked(MBSpinLock *lock)
+{
+    ASSERT(lock != NULL);
+    return MBLockDebugIsHeld(&lock->thread);
 }
 
-#endif // MB_HAS_SDL2
+static inline void
+MBSpinLock_Lock(MBSpinLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(!MBSpinLock_IsLocked(lock));
+
+    uint32 ticket = MBAtomic_FetchAdd32(&lock->next, 1, MB_ATOMIC_RELAXED);
+    if (UNLIKELY(MBAtomic_Load32(&lock->owner, MB_ATOMIC_ACQUIRE) !=
+                 ticket)) {
+        MBSpinLockWait(lock, ticket);
+    }
+
+    MBLockDebugAcquire(&lock->thread);
+}
+
+static inline void
+MBSpinLock_Unlock(MBSpinLock *lock)
+{
+    ASSERT(lock != NULL);
+    ASSERT(MBSpinLock_IsLocked(lock));
+
+    MBLockDebugRelease(&lock->thread);
+
+    /*
+     * Only the owner ever writes this, so the relaxed load can't race.
+     */
+    MBAtomic_Store32(&lock->owner,
+                     MBAtomic_Load32(&lock->owner, MB_ATOMIC_RELAXED) + 1,
+                     MB_ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+    }
+#endif
 
 #endif // _MBLOCK_H_20211110
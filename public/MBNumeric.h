@@ -0,0 +1,150 @@
+/*
+ * MBNumeric.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBNUMERIC_H_202209251030
+#define MBNUMERIC_H_202209251030
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBTypes.h"
+#include "MBVector.h"
+
+/*
+ * Bulk kernels over plain int32/float arrays.
+ *
+ * These are written so the compiler can vectorize them, and on x86_64
+ * Linux they're built for both AVX2 and the SSE2 baseline with the
+ * best one picked at load time.  Results don't depend on which one
+ * runs: the float reductions use a fixed lane order instead of
+ * relying on fast-math reassociation.
+ *
+ * Integer arithmetic wraps on overflow.  The float min/max kernels
+ * ignore NaNs unless every item is NaN.
+ */
+int64 MBNumeric_SumInt32(const int32 *items, int64 numItems);
+double MBNumeric_SumFloat(const float *items, int64 numItems);
+
+/*
+ * Return the index of the first minimum/maximum item, or -1 if empty.
+ */
+int64 MBNumeric_MinInt32(const int32 *items, int64 numItems);
+int64 MBNumeric_MaxInt32(const int32 *items, int64 numItems);
+int64 MBNumeric_MinFloat(const float *items, int64 numItems);
+int64 MBNumeric_MaxFloat(const float *items, int64 numItems);
+
+/*
+ * Return the index of the first item equal to value, or -1.
+ */
+int64 MBNumeric_FindInt32(const int32 *items, int64 numItems, int32 value);
+int64 MBNumeric_CountInt32(const int32 *items, int64 numItems, int32 value);
+
+void MBNumeric_FillInt32(int32 *items, int64 numItems, int32 value);
+void MBNumeric_FillFloat(float *items, int64 numItems, float value);
+
+/*
+ * dest[i] += src[i]
+ */
+void MBNumeric_AddInt32(int32 *dest, const int32 *src, int64 numItems);
+void MBNumeric_AddFloat(float *dest, const float *src, int64 numItems);
+
+/*
+ * items[i] = items[i] * scale + offset
+ */
+void MBNumeric_ScaleInt32(int32 *items, int64 numItems,
+                          int32 scale, int32 offset);
+void MBNumeric_ScaleFloat(float *items, int64 numItems,
+                          float scale, float offset);
+
+/*
+ * Inclusive prefix sum, in place.
+ */
+void MBNumeric_PrefixSumInt32(int32 *items, int64 numItems);
+void MBNumeric_PrefixSumFloat(float *items, int64 numItems);
+
+/*
+ * CMBIntVec/CMBFloatVec wrappers.
+ */
+static inline int64 CMBIntVec_Sum(const CMBIntVec *v)
+{
+    return MBNumeric_SumInt32((const int32 *)v->v.items, CMBIntVec_Size(v));
+}
+
+static inline int64 CMBIntVec_FindMin(const CMBIntVec *v)
+{
+    return MBNumeric_MinInt32((const int32 *)v->v.items, CMBIntVec_Size(v));
+}
+
+static inline int64 CMBIntVec_FindMax(const CMBIntVec *v)
+{
+    return MBNumeric_MaxInt32((const int32 *)v->v.items, CMBIntVec_Size(v));
+}
+
+static inline int64 CMBIntVec_Find(const CMBIntVec *v, int value)
+{
+    return MBNumeric_FindInt32((const int32 *)v->v.items,
+                               CMBIntVec_Size(v), value);
+}
+
+static inline int64 CMBIntVec_Count(const CMBIntVec *v, int value)
+{
+    return MBNumeric_CountInt32((const int32 *)v->v.items,
+                                CMBIntVec_Size(v), value);
+}
+
+static inline void CMBIntVec_Fill(CMBIntVec *v, int value)
+{
+    MBNumeric_FillInt32((int32 *)v->v.items, CMBIntVec_Size(v), value);
+}
+
+static inline double CMBFloatVec_Sum(const CMBFloatVec *v)
+{
+    return MBNumeric_SumFloat((const float *)v->v.items,
+                              CMBFloatVec_Size(v));
+}
+
+static inline int64 CMBFloatVec_FindMin(const CMBFloatVec *v)
+{
+    return MBNumeric_MinFloat((const float *)v->v.items,
+                              CMBFloatVec_Size(v));
+}
+
+static inline int64 CMBFloatVec_FindMax(const CMBFloatVec *v)
+{
+    return MBNumeric_MaxFloat((const float *)v->v.items,
+                              CMBFloatVec_Size(v));
+}
+
+static inline void CMBFloatVec_Fill(CMBFloatVec *v, float value)
+{
+    MBNumeric_FillFloat((float *)v->v.items, CMBFloatVec_Size(v), value);
+}
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBNUMERIC_H_202209251030
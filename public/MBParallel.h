@@ -0,0 +1,127 @@
+/*
+ * MBParallel.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBPARALLEL_H_202210191700
+#define MBPARALLEL_H_202210191700
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBTypes.h"
+#include "MBThreadPool.h"
+#include "MBVector.h"
+
+/*
+ * Data-parallel loops over an index range, run on a shared
+ * MBThreadPool.
+ *
+ * The range [start, end) is split in half, over and over, until the
+ * pieces are at most grain items long.  The halves are submitted as
+ * pool tasks as they're split off, so idle workers steal the biggest
+ * remaining pieces first, and the calling thread works on the range
+ * too.  A grain of 0 picks one that gives about
+ * MBPARALLEL_CHUNKS_PER_THREAD pieces per thread.
+ *
+ * The loops can be nested: a loop body may run another parallel loop,
+ * and the inner loop's pieces go to the same pool.
+ *
+ * Without MB_HAS_MBTHREAD, everything runs on the calling thread.
+ */
+#define MBPARALLEL_CHUNKS_PER_THREAD 8
+
+/*
+ * Called on each piece [start, end) of the range.
+ */
+typedef void (*MBParallelForFn)(void *ctx, int64 start, int64 end);
+
+/*
+ * MBParallel_Reduce calls reduceFn to fold each piece of the range
+ * into its own accumulator, and then combineFn to fold the
+ * accumulator of the piece on the right into the one on the left.
+ */
+typedef void (*MBParallelReduceFn)(void *ctx, int64 start, int64 end,
+                                   void *accum);
+typedef void (*MBParallelCombineFn)(void *ctx, void *accum,
+                                    const void *other);
+
+/*
+ * numWorkers of 0 means one per CPU.
+ *
+ * Calling MBParallel_Init is optional: the first parallel loop creates
+ * the pool with the default size if there isn't one already.
+ */
+void MBParallel_Init(uint numWorkers);
+void MBParallel_Exit(void);
+MBThreadPool *MBParallel_GetPool(void);
+
+void MBParallel_For(int64 start, int64 end, int64 grain,
+                    MBParallelForFn fn, void *ctx);
+
+/*
+ * On entry, result holds the identity value for combineFn, which every
+ * accumulator starts from, and on exit it holds the result.
+ * Accumulators are copied with memcpy.
+ *
+ * Pieces are always combined in index order, and where the range gets
+ * split only depends on the range and the grain.  So with a fixed
+ * grain, the result is the same from run to run, and with any number
+ * of workers, even if combineFn isn't associative (like float
+ * addition).
+ */
+void MBParallel_Reduce(int64 start, int64 end, int64 grain,
+                       MBParallelReduceFn reduceFn,
+                       MBParallelCombineFn combineFn,
+                       void *ctx, void *result, uint32 resultSize);
+
+/*
+ * Loop over the indices of a CMBVector.  The vector is pinned for the
+ * duration, and mustn't be resized by fn.
+ */
+static inline void CMBVector_ParallelFor(CMBVector *vector, int64 grain,
+                                         MBParallelForFn fn, void *ctx)
+{
+    CMBVector_Pin(vector);
+    MBParallel_For(0, CMBVector_Size(vector), grain, fn, ctx);
+    CMBVector_Unpin(vector);
+}
+
+static inline void CMBVector_ParallelReduce(CMBVector *vector, int64 grain,
+                                            MBParallelReduceFn reduceFn,
+                                            MBParallelCombineFn combineFn,
+                                            void *ctx, void *result,
+                                            uint32 resultSize)
+{
+    CMBVector_Pin(vector);
+    MBParallel_Reduce(0, CMBVector_Size(vector), grain, reduceFn, combineFn,
+                      ctx, result, resultSize);
+    CMBVector_Unpin(vector);
+}
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBPARALLEL_H_202210191700
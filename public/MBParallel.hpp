@@ -0,0 +1,155 @@
+/*
+ * MBParallel.hpp -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBPARALLEL_HPP_202210191700
+#define MBPARALLEL_HPP_202210191700
+
+#include <type_traits>
+
+#include "MBParallel.h"
+#include "MBVector.hpp"
+
+/*
+ * Lambda versions of the MBParallel loops.  See MBParallel.h for how
+ * the range gets split, and what grain means.
+ */
+template<class Fn>
+static void MBParallelForRangeHelper(void *ctx, int64 start, int64 end)
+{
+    (*(const Fn *)ctx)(start, end);
+}
+
+template<class Fn>
+static void MBParallelForHelper(void *ctx, int64 start, int64 end)
+{
+    const Fn &fn = *(const Fn *)ctx;
+
+    for (int64 i = start; i < end; i++) {
+        fn(i);
+    }
+}
+
+template<class T, class Fn, class CombineFn>
+struct MBParallelReduceHelper {
+    const Fn &fn;
+    const CombineFn &combineFn;
+
+    static void reduce(void *ctx, int64 start, int64 end, void *accum)
+    {
+        MBParallelReduceHelper *h = (MBParallelReduceHelper *)ctx;
+        T &a = *(T *)accum;
+
+        for (int64 i = start; i < end; i++) {
+            h->fn(a, i);
+        }
+    }
+
+    static void combine(void *ctx, void *accum, const void *other)
+    {
+        MBParallelReduceHelper *h = (MBParallelReduceHelper *)ctx;
+        h->combineFn(*(T *)accum, *(const T *)other);
+    }
+};
+
+/*
+ * Call fn(start, end) on each piece of [start, end).
+ */
+template<class Fn>
+void MBParallel_ForRange(int64 start, int64 end, const Fn &fn,
+                         int64 grain = 0)
+{
+    MBParallel_For(start, end, grain, MBParallelForRangeHelper<Fn>,
+                   (void *)&fn);
+}
+
+/*
+ * Call fn(i) for each i in [start, end).
+ */
+template<class Fn>
+void MBParallel_For(int64 start, int64 end, const Fn &fn, int64 grain = 0)
+{
+    MBParallel_For(start, end, grain, MBParallelForHelper<Fn>, (void *)&fn);
+}
+
+/*
+ * Call fn(accum, i) for each i in [start, end), where accum is a T &
+ * that starts out as a copy of identity, and then combineFn(accum,
+ * other) to merge the accumulators, in index order.
+ *
+ * The accumulators are copied with memcpy, so T must be trivially
+ * copyable.
+ */
+template<class T, class Fn, class CombineFn>
+T MBParallel_Reduce(int64 start, int64 end, const T &identity,
+                    const Fn &fn, const CombineFn &combineFn,
+                    int64 grain = 0)
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "MBParallel_Reduce needs a trivially copyable type");
+    MBParallelReduceHelper<T, Fn, CombineFn> h = { fn, combineFn };
+    T result = identity;
+
+    MBParallel_Reduce(start, end, grain,
+                      MBParallelReduceHelper<T, Fn, CombineFn>::reduce,
+                      MBParallelReduceHelper<T, Fn, CombineFn>::combine,
+                      &h, &result, sizeof(result));
+    return result;
+}
+
+/*
+ * Call fn(item) for each item of the vector.  The vector is pinned for
+ * the duration.
+ */
+template<class itemType, class Fn>
+void MBParallel_ForEach(MBVector<itemType> &v, const Fn &fn,
+                        int64 grain = 0)
+{
+    itemType *items = v.getCArray();
+
+    v.pin();
+    MBParallel_For(0, v.size(),
+                   [items, &fn](int64 i) { fn(items[i]); },
+                   grain);
+    v.unpin();
+}
+
+/*
+ * Fold each item of the vector into a T, with fn(accum, item).
+ */
+template<class T, class itemType, class Fn, class CombineFn>
+T MBParallel_Reduce(const MBVector<itemType> &v, const T &identity,
+                    const Fn &fn, const CombineFn &combineFn,
+                    int64 grain = 0)
+{
+    const itemType *items = v.getCArray();
+
+    return MBParallel_Reduce(0, v.size(), identity,
+                             [items, &fn](T &accum, int64 i) {
+                                 fn(accum, items[i]);
+                             },
+                             combineFn, grain);
+}
+
+#endif // MBPARALLEL_HPP_202210191700
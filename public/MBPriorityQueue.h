@@ -0,0 +1,207 @@
+/*
+ * MBPriorityQueue.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBPRIORITYQUEUE_H_202210021200
+#define MBPRIORITYQUEUE_H_202210021200
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBVector.h"
+#include "MBCompare.h"
+
+/*
+ * A d-ary min-heap stored in a CMBVector, ordered by a CMBComparator:
+ * the item that compares smallest comes out first.  Equal items come
+ * out in no particular order.
+ *
+ * Arity 2 is a plain binary heap.  Arity 4 has shallower trees and
+ * better locality for pops, at the cost of more compares per level.
+ */
+#define CMBPRIORITYQUEUE_DEFAULT_ARITY 4
+
+typedef struct CMBPriorityQueue {
+    CMBVector v;
+    CMBComparator comp;
+    uint32 arity;
+} CMBPriorityQueue;
+
+void CMBPriorityQueue_CreateWithArity(CMBPriorityQueue *pq,
+                                      const CMBComparator *comp,
+                                      uint32 arity);
+
+static inline void CMBPriorityQueue_Create(CMBPriorityQueue *pq,
+                                           const CMBComparator *comp)
+{
+    CMBPriorityQueue_CreateWithArity(pq, comp,
+                                     CMBPRIORITYQUEUE_DEFAULT_ARITY);
+}
+
+/*
+ * Take over the items in src, and heapify them in O(n).
+ * src is left empty.
+ */
+void CMBPriorityQueue_CreateFromVector(CMBPriorityQueue *pq,
+                                       CMBVector *src,
+                                       const CMBComparator *comp,
+                                       uint32 arity);
+
+static inline void CMBPriorityQueue_Destroy(CMBPriorityQueue *pq)
+{
+    ASSERT(pq != NULL);
+    CMBVector_Destroy(&pq->v);
+}
+
+static inline int64 CMBPriorityQueue_Size(const CMBPriorityQueue *pq)
+{
+    return CMBVector_Size(&pq->v);
+}
+
+static inline bool CMBPriorityQueue_IsEmpty(const CMBPriorityQueue *pq)
+{
+    return CMBVector_IsEmpty(&pq->v);
+}
+
+static inline void CMBPriorityQueue_MakeEmpty(CMBPriorityQueue *pq)
+{
+    CMBVector_MakeEmpty(&pq->v);
+}
+
+/*
+ * The item is copied in.  It must not point into the queue.
+ */
+void CMBPriorityQueue_Push(CMBPriorityQueue *pq, const void *item);
+
+/*
+ * Returns a pointer to the smallest item, which is only valid until the
+ * queue is next modified.
+ */
+static inline void *CMBPriorityQueue_Peek(CMBPriorityQueue *pq)
+{
+    ASSERT(!CMBPriorityQueue_IsEmpty(pq));
+    return CMBVector_GetPtr(&pq->v, 0);
+}
+
+/*
+ * Remove the smallest item, copying it into item if that's not NULL.
+ */
+void CMBPriorityQueue_Pop(CMBPriorityQueue *pq, void *item);
+
+/*
+ * Indexed d-ary min-heap over dense int ids, each with a double key.
+ *
+ * position[id] tracks where each id sits in the heap (or -1), so ids
+ * can have their keys changed or be removed in O(log n) without lazy
+ * deletion.  Memory is O(max id), so this is meant for small dense ids
+ * like graph node numbers.
+ */
+typedef struct CMBIndexedHeapEntry {
+    double key;
+    int id;
+} CMBIndexedHeapEntry;
+
+DECLARE_CMBVECTOR_TYPE(CMBIndexedHeapEntry, CMBIndexedHeapVec);
+
+typedef struct CMBIndexedHeap {
+    CMBIndexedHeapVec heap;
+    CMBIntVec position;
+    uint32 arity;
+} CMBIndexedHeap;
+
+void CMBIndexedHeap_CreateWithArity(CMBIndexedHeap *h, uint32 arity);
+
+static inline void CMBIndexedHeap_Create(CMBIndexedHeap *h)
+{
+    CMBIndexedHeap_CreateWithArity(h, CMBPRIORITYQUEUE_DEFAULT_ARITY);
+}
+
+void CMBIndexedHeap_Destroy(CMBIndexedHeap *h);
+void CMBIndexedHeap_MakeEmpty(CMBIndexedHeap *h);
+
+static inline int64 CMBIndexedHeap_Size(const CMBIndexedHeap *h)
+{
+    return CMBIndexedHeapVec_Size(&h->heap);
+}
+
+static inline bool CMBIndexedHeap_IsEmpty(const CMBIndexedHeap *h)
+{
+    return CMBIndexedHeap_Size(h) == 0;
+}
+
+static inline bool CMBIndexedHeap_Contains(const CMBIndexedHeap *h, int id)
+{
+    ASSERT(id >= 0);
+    return id < CMBIntVec_Size(&h->position) &&
+           CMBIntVec_GetValue(&h->position, id) >= 0;
+}
+
+double CMBIndexedHeap_GetKey(const CMBIndexedHeap *h, int id);
+
+/*
+ * Insert an id that isn't already in the heap.
+ */
+void CMBIndexedHeap_Push(CMBIndexedHeap *h, int id, double key);
+
+/*
+ * Change the key of an id that's already in the heap.  The Decrease and
+ * Increase versions assert which way it's going, and save a compare.
+ */
+void CMBIndexedHeap_DecreaseKey(CMBIndexedHeap *h, int id, double key);
+void CMBIndexedHeap_IncreaseKey(CMBIndexedHeap *h, int id, double key);
+void CMBIndexedHeap_UpdateKey(CMBIndexedHeap *h, int id, double key);
+
+/*
+ * Push the id if it's not there, or lower its key if the new one is
+ * smaller.  Returns whether anything changed.  This is the usual
+ * Dijkstra relax step.
+ */
+bool CMBIndexedHeap_PushOrDecrease(CMBIndexedHeap *h, int id, double key);
+
+void CMBIndexedHeap_Remove(CMBIndexedHeap *h, int id);
+
+static inline int CMBIndexedHeap_PeekId(CMBIndexedHeap *h)
+{
+    ASSERT(!CMBIndexedHeap_IsEmpty(h));
+    return CMBIndexedHeapVec_GetPtr(&h->heap, 0)->id;
+}
+
+static inline double CMBIndexedHeap_PeekKey(CMBIndexedHeap *h)
+{
+    ASSERT(!CMBIndexedHeap_IsEmpty(h));
+    return CMBIndexedHeapVec_GetPtr(&h->heap, 0)->key;
+}
+
+/*
+ * Remove the id with the smallest key, and return it.  If key isn't
+ * NULL, it gets the id's key.
+ */
+int CMBIndexedHeap_Pop(CMBIndexedHeap *h, double *key);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBPRIORITYQUEUE_H_202210021200
@@ -0,0 +1,92 @@
+/*
+ * MBPriorityQueue.hpp -- part of MBLib
+ *
+ * Copyright (c) 2020 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBPRIORITYQUEUE_HPP_202210021200
+#define MBPRIORITYQUEUE_HPP_202210021200
+
+#include "MBTypes.h"
+#include "MBCompare.hpp"
+
+extern "C" {
+#include "MBPriorityQueue.h"
+}
+
+/*
+ * Min-heap of itemType, ordered by a CMBComparator.  Items are moved
+ * around with memcpy, so itemType should be plain old data.
+ */
+template<class itemType>
+class MBPriorityQueue
+{
+  public:
+    MBPriorityQueue(const CMBComparator *comp,
+                    uint32 arity = CMBPRIORITYQUEUE_DEFAULT_ARITY) {
+        ASSERT(comp != NULL);
+        ASSERT(comp->itemSize == sizeof(itemType));
+        CMBPriorityQueue_CreateWithArity(&myQueue, comp, arity);
+    }
+
+    ~MBPriorityQueue() {
+        CMBPriorityQueue_Destroy(&myQueue);
+    }
+
+    bool isEmpty() const {
+        return CMBPriorityQueue_IsEmpty(&myQueue);
+    }
+
+    int64 size() const {
+        return CMBPriorityQueue_Size(&myQueue);
+    }
+
+    void push(const itemType &item) {
+        CMBPriorityQueue_Push(&myQueue, &item);
+    }
+
+    const itemType &peek() {
+        return *(const itemType *)CMBPriorityQueue_Peek(&myQueue);
+    }
+
+    itemType pop() {
+        itemType item;
+        CMBPriorityQueue_Pop(&myQueue, &item);
+        return item;
+    }
+
+    void pop(itemType &item) {
+        CMBPriorityQueue_Pop(&myQueue, &item);
+    }
+
+    void makeEmpty() {
+        CMBPriorityQueue_MakeEmpty(&myQueue);
+    }
+
+  private:
+    MBPriorityQueue(const MBPriorityQueue &);
+    const MBPriorityQueue &operator=(const MBPriorityQueue &);
+
+    CMBPriorityQueue myQueue;
+};
+
+#endif // MBPRIORITYQUEUE_HPP_202210021200
@@ -28,6 +28,7 @@
 
 #include "MBTypes.h"
 #include "MBBasic.h"
+#include "MBAlloc.h"
 
 #ifdef __cplusplus
     extern "C" {
@@ -37,6 +38,13 @@ struct MBRegistry;
 typedef struct MBRegistry MBRegistry;
 
 MBRegistry *MBRegistry_Alloc();
+
+/*
+ * The registry, its buckets and its string table all come from alloc
+ * (NULL for malloc/free).  A copy uses the same allocator as the
+ * registry it was copied from.
+ */
+MBRegistry *MBRegistry_AllocWithAllocator(const CMBAllocator *alloc);
 MBRegistry *MBRegistry_AllocCopy(MBRegistry *toCopy);
 void MBRegistry_Free(MBRegistry *mreg);
 
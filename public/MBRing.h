@@ -34,19 +34,25 @@
 
 typedef struct MBRing {
     CMBVector vector;
-    uint head;
-    uint tail;
+    uint64 head;
+    uint64 tail;
 } MBRing;
 
-static inline void MBRing_Create(MBRing *ring, int itemSize)
+static inline void MBRing_CreateWithAllocator(MBRing *ring, int itemSize,
+                                              const CMBAllocator *alloc)
 {
     ASSERT(ring != NULL);
     ASSERT(itemSize > 0);
-    CMBVector_CreateWithSize(&ring->vector, itemSize, 8);
+    CMBVector_CreateWithAllocator(&ring->vector, itemSize, 8, 8, alloc);
     ring->head = 0;
     ring->tail = 0;
 }
 
+static inline void MBRing_Create(MBRing *ring, int itemSize)
+{
+    MBRing_CreateWithAllocator(ring, itemSize, NULL);
+}
+
 static inline void MBRing_Destroy(MBRing *ring)
 {
     ASSERT(ring != NULL);
@@ -60,7 +66,7 @@ static inline void MBRing_MakeEmpty(MBRing *ring)
     ring->tail = 0;
 }
 
-static inline int MBRing_Size(const MBRing *ring)
+static inline int64 MBRing_Size(const MBRing *ring)
 {
     if (ring->tail >= ring->head) {
         return ring->tail - ring->head;
@@ -71,12 +77,12 @@ static inline int MBRing_Size(const MBRing *ring)
 
 void MBRingResizeHelper(MBRing *ring);
 
-static inline uint MBRingGetMask(const MBRing *ring)
+static inline uint64 MBRingGetMask(const MBRing *ring)
 {
-    int size = CMBVector_Size(&ring->vector);
+    int64 size = CMBVector_Size(&ring->vector);
     ASSERT(size > 0);
-    ASSERT(MBUtil_IsPow2(size));
-    return ((uint)size) - 1;
+    ASSERT(MBUtil_Popcountl(size) == 1);
+    return ((uint64)size) - 1;
 }
 
 static inline void MBRing_InsertHead(MBRing *ring, const void *item,
@@ -133,7 +139,7 @@ static inline void MBRing_RemoveTail(MBRing *ring, void *item, uint itemSize)
     ASSERT(itemSize == CMBVector_ItemSize(&ring->vector));
     ASSERT(MBRing_Size(ring) > 0);
 
-    int lastItem = (ring->tail - 1) & MBRingGetMask(ring);
+    uint64 lastItem = (ring->tail - 1) & MBRingGetMask(ring);
 
     void *src = CMBVector_GetPtr(&ring->vector, lastItem);
     memcpy(item, src, CMBVector_ItemSize(&ring->vector));
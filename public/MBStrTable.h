@@ -39,7 +39,15 @@ void MBStrTable_Init();
 void MBStrTable_Exit();
 
 MBStrTable *MBStrTable_Alloc();
+
+/*
+ * The table, its string list and the strings it copies all come from
+ * alloc (NULL for malloc/free).  Child tables use their parent's
+ * allocator.
+ */
+MBStrTable *MBStrTable_AllocWithAllocator(const CMBAllocator *alloc);
 MBStrTable *MBStrTable_AllocChild(MBStrTable *parent);
+const CMBAllocator *MBStrTable_GetAllocator(const MBStrTable *st);
 void MBStrTable_Free(MBStrTable *st);
 
 void MBStrTable_Reference(MBStrTable *st);
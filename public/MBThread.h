@@ -0,0 +1,107 @@
+/*
+ * MBThread.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBTHREAD_H_202210011000
+#define MBTHREAD_H_202210011000
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBBasic.h"
+#include "MBAssert.h"
+
+/*
+ * Minimal native threads: start a function, and wait for it to finish.
+ *
+ * This uses pthreads on Linux/macOS, and SDL2 elsewhere if we have it.
+ * Without either, MB_HAS_MBTHREAD isn't defined and callers should run
+ * their work serially instead.
+ */
+#if defined(MB_LINUX) || defined(MB_MACOS)
+#define MB_HAS_MBTHREAD
+#define MBTHREAD_PTHREADS
+#include <pthread.h>
+#elif defined(MB_HAS_SDL2)
+#define MB_HAS_MBTHREAD
+#define MBTHREAD_SDL2
+#include <SDL2/SDL_thread.h>
+#endif
+
+#ifdef MB_HAS_MBTHREAD
+#define mb_has_mbthread 1
+#else
+#define mb_has_mbthread 0
+#endif
+
+typedef void (*MBThreadFn)(void *data);
+
+typedef struct MBThread {
+#if defined(MBTHREAD_PTHREADS)
+    pthread_t thread;
+#elif defined(MBTHREAD_SDL2)
+    SDL_Thread *thread;
+#endif
+    MBThreadFn fn;
+    void *data;
+} MBThread;
+
+/*
+ * A nonzero ID for the calling thread, unique among the threads that
+ * are currently running.
+ */
+typedef uintptr_t MBThreadID;
+
+#define MBTHREAD_ID_INVALID ((MBThreadID)0)
+
+static inline MBThreadID MBThread_GetID(void)
+{
+#if defined(MBTHREAD_PTHREADS)
+    return (MBThreadID)pthread_self();
+#elif defined(MBTHREAD_SDL2)
+    return (MBThreadID)SDL_GetThreadID(NULL);
+#else
+    return 1;
+#endif
+}
+
+/*
+ * The MBThread must stay valid until MBThread_Join returns.
+ */
+void MBThread_Create(MBThread *t, MBThreadFn fn, void *data);
+void MBThread_Join(MBThread *t);
+
+/*
+ * Number of CPUs available to this process, at least 1.
+ */
+uint MBThread_GetNumCPUs(void);
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBTHREAD_H_202210011000
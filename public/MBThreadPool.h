@@ -0,0 +1,108 @@
+/*
+ * MBThreadPool.h -- part of MBLib
+ *
+ * Copyright (c) 2022 Michael Banack <github@banack.net>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MBTHREADPOOL_H_202210191500
+#define MBTHREADPOOL_H_202210191500
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#include "MBBasic.h"
+#include "MBAtomic.h"
+
+/*
+ * A work-stealing thread pool.
+ *
+ * Each worker has its own deque of tasks (Chase-Lev).  Tasks submitted
+ * from a worker go on the bottom of its own deque, where it'll find
+ * them again most-recent-first while they're still in cache, and idle
+ * workers steal the oldest tasks from the top of other deques.  Tasks
+ * submitted from other threads go on a shared queue that every worker
+ * checks.
+ *
+ * MBThreadPool_Wait doesn't just block: the waiting thread runs
+ * other tasks until its counter drops to zero, so tasks can submit and
+ * wait on their own subtasks without tying up a worker, and a thread
+ * waiting on the pool adds to it.  (Once waits are nested deep
+ * enough, a waiter only runs the tasks it submitted itself, to bound
+ * its stack.)  Idle workers and waiters spin briefly and then sleep
+ * until there's more work.
+ *
+ * Without MB_HAS_MBTHREAD, the pool has no workers and Submit runs
+ * each task right away.
+ */
+typedef void (*MBThreadPoolFn)(void *data);
+
+/*
+ * Counts a group of submitted tasks that haven't finished yet.
+ */
+typedef struct MBThreadPoolCounter {
+    MBAtomic64 pending;
+} MBThreadPoolCounter;
+
+struct MBThreadPool;
+typedef struct MBThreadPool MBThreadPool;
+
+/*
+ * numWorkers of 0 means one per CPU.
+ */
+MBThreadPool *MBThreadPool_Create(uint numWorkers);
+
+/*
+ * All submitted tasks must have finished.
+ */
+void MBThreadPool_Destroy(MBThreadPool *pool);
+uint MBThreadPool_GetNumWorkers(MBThreadPool *pool);
+
+/*
+ * Run fn(data) on the pool.  If counter is non-NULL, it's bumped now
+ * and dropped again once fn returns.
+ */
+void MBThreadPool_Submit(MBThreadPool *pool, MBThreadPoolCounter *counter,
+                         MBThreadPoolFn fn, void *data);
+
+/*
+ * Run tasks until every task submitted with counter has finished.
+ */
+void MBThreadPool_Wait(MBThreadPool *pool, MBThreadPoolCounter *counter);
+
+static inline void
+MBThreadPoolCounter_Create(MBThreadPoolCounter *counter)
+{
+    MBAtomic_Store64(&counter->pending, 0, MB_ATOMIC_RELAXED);
+}
+
+static inline bool
+MBThreadPoolCounter_IsDone(MBThreadPoolCounter *counter)
+{
+    return MBAtomic_Load64(&counter->pending, MB_ATOMIC_ACQUIRE) == 0;
+}
+
+#ifdef __cplusplus
+    }
+#endif
+
+#endif // MBTHREADPOOL_H_202210191500
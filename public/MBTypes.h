@@ -108,6 +108,9 @@ typedef unsigned long ulong;
 #define MAX_UINT32 0xFFFFFFFF
 #define MAX_INT32  0x7FFFFFFF
 #define MIN_INT32  (-2147483648)
+#define MAX_UINT64 0xFFFFFFFFFFFFFFFFULL
+#define MAX_INT64  0x7FFFFFFFFFFFFFFFLL
+#define MIN_INT64  (-MAX_INT64 - 1)
 
 #if (WORD_BIT == 32)
 #define MAX_UINT MAX_UINT32
@@ -26,6 +26,8 @@
 #ifndef _MBUNITTEST_H_202209111159
 #define _MBUNITTEST_H_202209111159
 
+#include "MBTypes.h"
+
 #ifdef __cplusplus
 	extern "C" {
 #endif
@@ -33,6 +35,12 @@
 void MBUnitTest_RunTests();
 void MBUnitTest_RunBenchmark();
 
+/*
+ * Standalone benchmarks, outside the weighted benchmark loop.
+ */
+void MBUnitTest_AllocBenchmark(uint64 numItems);
+void MBUnitTest_SortBenchmark(uint64 numItems);
+
 void MBUnitTest_MBString();
 void MBUnitTest_MBVector();
 void MBUnitTest_CMBVector();
@@ -46,9 +54,23 @@ void MBUnitTest_MBQueue();
 void MBUnitTest_MBRegistry();
 void MBUnitTest_MBCompare();
 void MBUnitTest_MBLock();
+void MBUnitTest_MBCondVar();
+void MBUnitTest_MBAtomic();
+void MBUnitTest_MBThreadPool();
+void MBUnitTest_MBParallel();
 void MBUnitTest_MBRing();
 void MBUnitTest_Types();
 void MBUnitTest_Random();
+void MBUnitTest_RandomEngines();
+void MBUnitTest_RandomFill();
+void MBUnitTest_RandomInt();
+void MBUnitTest_RandomEnum();
+void MBUnitTest_RandomStreams();
+void MBUnitTest_RandomDistributions();
+void MBUnitTest_RandomSample();
+void MBUnitTest_MBAlloc();
+void MBUnitTest_MBNumeric();
+void MBUnitTest_MBPriorityQueue();
 
 #ifdef __cplusplus
 	}
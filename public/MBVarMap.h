@@ -57,6 +57,7 @@ typedef CMBVarMap CMBIntMap;
 typedef CMBVarMapIterator CMBIntMapIterator;
 
 void CMBVarMap_Create(CMBVarMap *map);
+void CMBVarMap_CreateWithAllocator(CMBVarMap *map, const CMBAllocator *alloc);
 void CMBVarMap_Destroy(CMBVarMap *map);
 
 void CMBVarMap_SetEmptyValue(CMBVarMap *map, MBVar emptyValue);
@@ -152,6 +153,13 @@ static inline void CMBIntMap_Create(CMBIntMap *map)
     CMBVarMap_Create(map);
 }
 
+static inline void CMBIntMap_CreateWithAllocator(CMBIntMap *map,
+                                                 const CMBAllocator *alloc)
+{
+    VERIFY(sizeof(int) == sizeof(int32));
+    CMBVarMap_CreateWithAllocator(map, alloc);
+}
+
 static inline void CMBIntMap_Destroy(CMBIntMap *map)
 {
     CMBVarMap_Destroy(map);
@@ -33,18 +33,25 @@
 #endif
 
 #include "MBAssert.h"
+#include "MBAlloc.h"
 #include "MBCompare.h"
 #include "MBTypes.h"
+#include "Random.h"
 
 #define CMBVECTOR_MAGIC 0xD0B0B4A4A87BE62A
 
 typedef struct CMBVector {
-    int size;
-    int capacity;
+    int64 size;
+    int64 capacity;
     int itemSize;
     int pinCount;
     void *items;
 
+    /*
+     * NULL uses malloc/free.
+     */
+    const CMBAllocator *allocator;
+
     /*
      * This is only used in debug checks, but sometimes causes
      * incremental build problems if it's actually ifdef'ed.
@@ -52,16 +59,25 @@ typedef struct CMBVector {
     DEBUG_ONLY(uint64 magic);
 } CMBVector;
 
-void CMBVector_EnsureCapacity(CMBVector *vector, int capacity);
+void CMBVector_EnsureCapacity(CMBVector *vector, int64 capacity);
 
-static inline void CMBVector_Create(CMBVector *vector, int itemSize,
-                                    int size, int capacity)
+/*
+ * Replace dest's contents with the stable merge of the sorted srcs.
+ * dest must not be one of the srcs.
+ */
+void CMBVector_MergeSorted(CMBVector *dest, CMBVector * const *srcs,
+                           uint32 numSrcs, const CMBComparator *comp);
+
+static inline void CMBVector_CreateWithAllocator(CMBVector *vector,
+                                                 int itemSize,
+                                                 int64 size, int64 capacity,
+                                                 const CMBAllocator *alloc)
 {
     ASSERT(itemSize > 0);
     ASSERT(itemSize < MAX_INT32 / 2);
-    ASSERT(capacity < MAX_INT32 / 2);
+    ASSERT(capacity < MAX_INT64 / 2 / itemSize);
     ASSERT(size >= 0);
-    ASSERT(size < MAX_INT32 / 2);
+    ASSERT(size < MAX_INT64 / 2 / itemSize);
 
     ASSERT(capacity >= size);
 
@@ -70,21 +86,29 @@ static inline void CMBVector_Create(CMBVector *vector, int itemSize,
     vector->capacity = capacity;
     vector->itemSize = itemSize;
     vector->pinCount = 0;
+    vector->allocator = alloc;
 
     if (capacity > 0) {
-        vector->items = malloc(itemSize * vector->capacity);
+        vector->items = MBAlloc_Alloc(alloc,
+                                      (size_t)itemSize * vector->capacity);
     } else {
         vector->items = NULL;
     }
 }
 
+static inline void CMBVector_Create(CMBVector *vector, int itemSize,
+                                    int64 size, int64 capacity)
+{
+    CMBVector_CreateWithAllocator(vector, itemSize, size, capacity, NULL);
+}
+
 static inline void CMBVector_CreateEmpty(CMBVector *vector, int itemSize)
 {
     CMBVector_Create(vector, itemSize, 0, 1);
 }
 
 static inline void CMBVector_CreateWithSize(CMBVector *vector, int itemSize,
-                                            int size)
+                                            int64 size)
 {
     CMBVector_Create(vector, itemSize, size, size);
 }
@@ -96,10 +120,18 @@ static inline void CMBVector_Destroy(CMBVector *vector)
 
     DEBUG_ONLY(vector->magic = 0);
 
-    free(vector->items);
+    MBAlloc_Free(vector->allocator, vector->items,
+                 (size_t)vector->itemSize * vector->capacity);
     vector->items = NULL;
 }
 
+static inline const CMBAllocator *
+CMBVector_GetAllocator(const CMBVector *vector)
+{
+    ASSERT(vector->magic == CMBVECTOR_MAGIC);
+    return vector->allocator;
+}
+
 static inline int CMBVector_ItemSize(const CMBVector *vector)
 {
     ASSERT(vector != NULL);
@@ -124,14 +156,14 @@ static inline void CMBVector_Unpin(CMBVector *vector)
     }
 }
 
-static inline int CMBVector_Size(const CMBVector *vector)
+static inline int64 CMBVector_Size(const CMBVector *vector)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     ASSERT(vector->size >= 0);
     return vector->size;
 }
 
-static inline void CMBVector_Resize(CMBVector *vector, int size)
+static inline void CMBVector_Resize(CMBVector *vector, int64 size)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     ASSERT(size >= 0);
@@ -140,7 +172,7 @@ static inline void CMBVector_Resize(CMBVector *vector, int size)
     vector->size = size;
 }
 
-static inline void CMBVector_GrowBy(CMBVector *vector, int increment)
+static inline void CMBVector_GrowBy(CMBVector *vector, int64 increment)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     ASSERT(increment >= 0);
@@ -153,7 +185,7 @@ static inline void CMBVector_Grow(CMBVector *vector)
     CMBVector_GrowBy(vector, 1);
 }
 
-static inline void CMBVector_ShrinkBy(CMBVector *vector, int decrement)
+static inline void CMBVector_ShrinkBy(CMBVector *vector, int64 decrement)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     ASSERT(decrement >= 0);
@@ -179,7 +211,7 @@ static inline void CMBVector_MakeEmpty(CMBVector *vector)
 }
 
 static inline void *
-CMBVectorGetHelper(CMBVector *vector, int index, int itemSize)
+CMBVectorGetHelper(CMBVector *vector, int64 index, int itemSize)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     ASSERT(index >= 0);
@@ -190,7 +222,8 @@ CMBVectorGetHelper(CMBVector *vector, int index, int itemSize)
 }
 
 static inline const void *
-CMBVectorGetHelperConst(const CMBVector *vector, int index, int itemSize)
+CMBVectorGetHelperConst(const CMBVector *vector, int64 index,
+                        int itemSize)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     ASSERT(index >= 0);
@@ -200,7 +233,7 @@ CMBVectorGetHelperConst(const CMBVector *vector, int index, int itemSize)
     return ((uint8 *)vector->items) + (index * itemSize);
 }
 
-static inline void *CMBVector_GetPtr(CMBVector *vector, int index)
+static inline void *CMBVector_GetPtr(CMBVector *vector, int64 index)
 {
     ASSERT(vector->magic == CMBVECTOR_MAGIC);
     return CMBVectorGetHelper(vector, index, vector->itemSize);
@@ -246,10 +279,16 @@ static inline void CMBVector_Consume(CMBVector *dest, CMBVector *src)
     ASSERT(dest->pinCount == 0);
     ASSERT(src->pinCount == 0);
 
-    free(dest->items);
+    /*
+     * The items travel with the allocator that owns them, so dest
+     * picks up the allocator from src.
+     */
+    MBAlloc_Free(dest->allocator, dest->items,
+                 (size_t)dest->itemSize * dest->capacity);
     dest->items = src->items;
     dest->size = src->size;
     dest->capacity = src->capacity;
+    dest->allocator = src->allocator;
 
     /*
      * We just ASSERTed these were both zero, so this shouldn't
@@ -259,7 +298,7 @@ static inline void CMBVector_Consume(CMBVector *dest, CMBVector *src)
      */
     dest->pinCount = src->pinCount;
 
-    CMBVector_CreateEmpty(src, dest->itemSize);
+    CMBVector_CreateWithAllocator(src, dest->itemSize, 0, 1, dest->allocator);
 }
 
 static inline void *CMBVector_GetCArray(CMBVector *vector)
@@ -281,6 +320,46 @@ static inline void CMBVector_Sort(CMBVector *v, const CMBComparator *comp)
                    comp->cbData);
 }
 
+static inline void CMBVector_StableSort(CMBVector *v,
+                                        const CMBComparator *comp)
+{
+    ASSERT(v->magic == CMBVECTOR_MAGIC);
+    ASSERT(v != NULL);
+    ASSERT(comp != NULL);
+    ASSERT((uint32)v->itemSize == comp->itemSize);
+    MBCompare_StableSort(v->items, v->size, v->itemSize, comp->compareFn,
+                         comp->cbData);
+}
+
+static inline void CMBVector_ParallelSort(CMBVector *v,
+                                          const CMBComparator *comp,
+                                          uint numThreads)
+{
+    ASSERT(v->magic == CMBVECTOR_MAGIC);
+    ASSERT(v != NULL);
+    ASSERT(comp != NULL);
+    ASSERT((uint32)v->itemSize == comp->itemSize);
+    MBCompare_ParallelSort(v->items, v->size, v->itemSize, comp->compareFn,
+                           comp->cbData, numThreads);
+}
+
+static inline void CMBVector_Shuffle(CMBVector *v, RandomState *r)
+{
+    ASSERT(v->magic == CMBVECTOR_MAGIC);
+    RandomState_Shuffle(r, v->items, v->size, v->itemSize);
+}
+
+/*
+ * Leave a uniform random sample of k items at the front of the vector.
+ */
+static inline void CMBVector_PartialShuffle(CMBVector *v, RandomState *r,
+                                            int64 k)
+{
+    ASSERT(v->magic == CMBVECTOR_MAGIC);
+    ASSERT(k <= v->size);
+    RandomState_PartialShuffle(r, v->items, v->size, v->itemSize, k);
+}
+
 
 #define DECLARE_CMBVECTOR_TYPE(_type, _name) \
     typedef struct _name { \
@@ -288,13 +367,17 @@ static inline void CMBVector_Sort(CMBVector *v, const CMBComparator *comp)
     } _name ; \
     \
     static inline void _name ## _Create \
-    (_name *v, int size, int capacity) \
+    (_name *v, int64 size, int64 capacity) \
     { CMBVector_Create(&v->v, sizeof(_type), size, capacity); } \
     static inline void _name ## _CreateEmpty \
     (_name *v) \
     { CMBVector_CreateEmpty(&v->v, sizeof(_type)); } \
+    static inline void _name ## _CreateWithAllocator \
+    (_name *v, int64 size, int64 capacity, const CMBAllocator *alloc) \
+    { CMBVector_CreateWithAllocator(&v->v, sizeof(_type), size, capacity, \
+                                    alloc); } \
     static inline void _name ## _CreateWithSize \
-    (_name *v, int size) \
+    (_name *v, int64 size) \
     { CMBVector_CreateWithSize(&v->v, sizeof(_type), size); } \
     static inline void _name ## _Destroy \
     (_name *v) \
@@ -305,20 +388,20 @@ static inline void CMBVector_Sort(CMBVector *v, const CMBComparator *comp)
     static inline void _name ## _Unpin \
     (_name *v) \
     { CMBVector_Unpin(&v->v); } \
-    static inline int _name ## _Size \
+    static inline int64 _name ## _Size \
     (const _name *v) \
     { return CMBVector_Size(&v->v); } \
     static inline void _name ## _Resize \
-    (_name *v, int size) \
+    (_name *v, int64 size) \
     { CMBVector_Resize(&v->v, size); } \
     static inline void _name ## _GrowBy \
-    (_name *v, int increment) \
+    (_name *v, int64 increment) \
     { CMBVector_GrowBy(&v->v, increment); } \
     static inline void _name ## _Grow \
     (_name *v) \
     { CMBVector_Grow(&v->v); } \
     static inline void _name ## _ShrinkBy \
-    (_name *v, int decrement) \
+    (_name *v, int64 decrement) \
     { CMBVector_ShrinkBy(&v->v, decrement); } \
     static inline void _name ## _Shrink \
     (_name *v) \
@@ -333,16 +416,16 @@ static inline void CMBVector_Sort(CMBVector *v, const CMBComparator *comp)
     (_name *v) \
     { return (_type *)CMBVector_GetCArray(&v->v); } \
     static inline _type *_name ## _GetPtr \
-    (_name *v, int index) \
+    (_name *v, int64 index) \
     { return (_type *)CMBVectorGetHelper(&v->v, index, sizeof(_type)); } \
     static inline _type *_name ## _GetLastPtr \
     (_name *v) \
     { return (_type *)CMBVectorGetLastPtrHelper(&v->v, sizeof(_type)); } \
     static inline _type _name ## _GetValue \
-    (const _name *v, int index) \
+    (const _name *v, int64 index) \
     { return *(_type *)CMBVectorGetHelperConst(&v->v, index, sizeof(_type)); } \
     static inline void _name ## _PutValue \
-    (_name *v, int index, _type value) \
+    (_name *v, int64 index, _type value) \
     { \
        _type *item = (_type *)CMBVectorGetHelper(&v->v, index, sizeof(_type)); \
       *item = value; \
@@ -361,17 +444,97 @@ static inline void CMBVector_Sort(CMBVector *v, const CMBComparator *comp)
     (_name *dest, _name *src) \
     { CMBVector_Consume(&dest->v, &src->v); } \
     static inline void _name ## _EnsureCapacity \
-    (_name *v, int capacity) \
-    { CMBVector_EnsureCapacity(&v->v, capacity); }
+    (_name *v, int64 capacity) \
+    { CMBVector_EnsureCapacity(&v->v, capacity); } \
+    static inline void _name ## _Shuffle \
+    (_name *v, RandomState *r) \
+    { CMBVector_Shuffle(&v->v, r); } \
+    static inline void _name ## _PartialShuffle \
+    (_name *v, RandomState *r, int64 k) \
+    { CMBVector_PartialShuffle(&v->v, r, k); }
 
 
 DECLARE_CMBVECTOR_TYPE(int, CMBIntVec);
+DECLARE_CMBVECTOR_TYPE(float, CMBFloatVec);
 DECLARE_CMBVECTOR_TYPE(void *, CMBPtrVec);
 DECLARE_CMBVECTOR_TYPE(MBVar, CMBVarVec);
 DECLARE_CMBVECTOR_TYPE(const char *, CMBCStrVec);
 
+/*
+ * Declares _name_Sort, an inlined introsort over a vector declared
+ * with DECLARE_CMBVECTOR_TYPE, using the _less macro/function instead
+ * of a CMBComparator.
+ */
+#define DECLARE_CMBVECTOR_SORT(_type, _name, _less) \
+    DECLARE_MBCOMPARE_SORT(_type, _name ## SortHelper, _less) \
+    static inline void _name ## _Sort \
+    (_name *v) \
+    { \
+        _name ## SortHelper((_type *)CMBVector_GetCArray(&v->v), \
+                            CMBVector_Size(&v->v)); \
+    }
+
+/*
+ * Above this, the radix sort is faster than the introsort for the
+ * numeric vectors.
+ */
+#define CMBVECTOR_RADIX_SORT_THRESHOLD 512
+
+DECLARE_MBCOMPARE_SORT(int, CMBIntVecIntroSort, MBCOMPARE_LESS);
+DECLARE_MBCOMPARE_SORT(float, CMBFloatVecIntroSort, MBCOMPARE_LESS);
+
+static inline void CMBIntVec_Sort(CMBIntVec *v)
+{
+    int64 size = CMBIntVec_Size(v);
+    int *items = CMBIntVec_GetCArray(v);
+
+    if (size >= CMBVECTOR_RADIX_SORT_THRESHOLD) {
+        MBCompare_RadixSortInt32(items, size);
+    } else {
+        CMBIntVecIntroSort(items, size);
+    }
+}
+
+/*
+ * NaNs aren't ordered by the introsort, so they'll end up somewhere
+ * arbitrary for small vectors.
+ */
+static inline void CMBFloatVec_Sort(CMBFloatVec *v)
+{
+    int64 size = CMBFloatVec_Size(v);
+    float *items = CMBFloatVec_GetCArray(v);
+
+    if (size >= CMBVECTOR_RADIX_SORT_THRESHOLD) {
+        MBCompare_RadixSortFloat(items, size);
+    } else {
+        CMBFloatVecIntroSort(items, size);
+    }
+}
+
+static inline void CMBIntVec_ParallelSort(CMBIntVec *v, uint numThreads)
+{
+    if (CMBIntVec_Size(v) < MBCOMPARE_PARALLEL_SORT_THRESHOLD) {
+        CMBIntVec_Sort(v);
+    } else {
+        MBCompare_ParallelRadixSort(CMBIntVec_GetCArray(v), CMBIntVec_Size(v),
+                                    sizeof(int), 0, MBCOMPARE_KEY_INT32,
+                                    numThreads);
+    }
+}
+
+static inline void CMBFloatVec_ParallelSort(CMBFloatVec *v, uint numThreads)
+{
+    if (CMBFloatVec_Size(v) < MBCOMPARE_PARALLEL_SORT_THRESHOLD) {
+        CMBFloatVec_Sort(v);
+    } else {
+        MBCompare_ParallelRadixSort(CMBFloatVec_GetCArray(v),
+                                    CMBFloatVec_Size(v), sizeof(float), 0,
+                                    MBCOMPARE_KEY_FLOAT, numThreads);
+    }
+}
+
 static inline int
-CMBIntVec_DecrementValue(CMBIntVec *vec, int index)
+CMBIntVec_DecrementValue(CMBIntVec *vec, int64 index)
 {
     int v = CMBIntVec_GetValue(vec, index);
     v--;
@@ -380,7 +543,7 @@ CMBIntVec_DecrementValue(CMBIntVec *vec, int index)
 }
 
 static inline int
-CMBIntVec_IncrementValue(CMBIntVec *vec, int index)
+CMBIntVec_IncrementValue(CMBIntVec *vec, int64 index)
 {
     int v = CMBIntVec_GetValue(vec, index);
     v++;
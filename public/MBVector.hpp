@@ -158,7 +158,7 @@ class MBVector
         }
 
         void fill(const itemType &fill) {
-            for (uint i = 0; i < mySize; i++) {
+            for (int i = 0; i < mySize; i++) {
                 myItems[i] = fill;
             }
         }
@@ -228,6 +228,19 @@ class MBVector
             myPinCount++;
         }
 
+        /*
+         * Consider pinning the vector if you're using this function.
+         */
+        itemType *getCArray()
+        {
+            return myItems;
+        }
+
+        const itemType *getCArray() const
+        {
+            return myItems;
+        }
+
         void unpin()
         {
             ASSERT(myPinCount > 0);
@@ -267,12 +280,53 @@ class MBVector
                                comp.getCompareFn(), comp.getCBData());
         }
 
+        void nthElement(const MBComparator<itemType> &comp, int nth) {
+            ASSERT(nth >= 0);
+            ASSERT(nth < mySize);
+            ASSERT(myPinCount == 0);
+            MBCompare_NthElement(nth, myItems, mySize, sizeof(itemType),
+                                 comp.getCompareFn(), comp.getCBData());
+        }
+
         void sort(const MBComparator<itemType> &comp) {
             ASSERT(myPinCount == 0);
             MBCompare_Sort(myItems, mySize, sizeof(itemType),
                            comp.getCompareFn(), comp.getCBData());
         }
 
+        void stableSort(const MBComparator<itemType> &comp) {
+            ASSERT(myPinCount == 0);
+            MBCompare_StableSort(myItems, mySize, sizeof(itemType),
+                                 comp.getCompareFn(), comp.getCBData());
+        }
+
+        /*
+         * numThreads of 0 means one per MBParallel pool worker.
+         */
+        void parallelSort(const MBComparator<itemType> &comp,
+                          uint numThreads = 0) {
+            ASSERT(myPinCount == 0);
+            MBCompare_ParallelSort(myItems, mySize, sizeof(itemType),
+                                   comp.getCompareFn(), comp.getCBData(),
+                                   numThreads);
+        }
+
+        void shuffle(RandomState *r) {
+            ASSERT(myPinCount == 0);
+            RandomState_Shuffle(r, myItems, mySize, sizeof(itemType));
+        }
+
+        /*
+         * Leave a uniform random sample of k items at the front.
+         */
+        void partialShuffle(RandomState *r, int k) {
+            ASSERT(k >= 0);
+            ASSERT(k <= mySize);
+            ASSERT(myPinCount == 0);
+            RandomState_PartialShuffle(r, myItems, mySize, sizeof(itemType),
+                                       k);
+        }
+
         int findMin(const MBComparator<itemType> &comp, int start, int num) {
             ASSERT(start >= 0);
             ASSERT(start < mySize ||
@@ -32,11 +32,35 @@
 
 #include "MBTypes.h"
 
+/*
+ * The generator behind a RandomState.
+ *
+ * The LCG is the original engine, and stays the default so that
+ * existing seeds keep producing the same sequences.  The others are
+ * seeded by running the seed through SplitMix64.
+ *
+ *   LCG:        64-bit LCG, returning the high bits.  Fast, but the low
+ *               bits of the state are weak and Uint64 needs two steps.
+ *   XOSHIRO256: xoshiro256**.  Fast, 256 bits of state, and a good
+ *               default for new code.
+ *   PCG64:      PCG XSL-RR 128/64.  Slower, but very well tested.
+ *   SPLITMIX64: SplitMix64.  Tiny state, mostly useful for seeding.
+ */
+typedef enum RandomEngineType {
+    RANDOM_ENGINE_LCG,
+    RANDOM_ENGINE_XOSHIRO256,
+    RANDOM_ENGINE_PCG64,
+    RANDOM_ENGINE_SPLITMIX64,
+    RANDOM_ENGINE_MAX,
+} RandomEngineType;
+
 typedef struct RandomState {
     uint64 value;
     uint64 seed;
     uint32 bitBucket;
     int bitBucketSize;
+    RandomEngineType engine;
+    uint64 state[4];
 } RandomState;
 
 typedef struct EnumDistribution {
@@ -44,15 +68,68 @@ typedef struct EnumDistribution {
     float probability;
 } EnumDistribution;
 
+/*
+ * A prebuilt sampler for an EnumDistribution, using Vose's alias
+ * method: O(n) to build, and then O(1) per draw.  The probabilities
+ * don't need to sum to 1, they're normalized against their total.
+ */
+typedef struct RandomEnumColumn {
+    uint32 threshold;
+    int value;
+    int aliasValue;
+} RandomEnumColumn;
+
+typedef struct RandomEnumSampler {
+    int numValues;
+    RandomEnumColumn *columns;
+} RandomEnumSampler;
+
 void RandomState_Create(RandomState *r);
 void RandomState_CreateWithSeed(RandomState *r, uint64 seed);
+void RandomState_CreateWithEngine(RandomState *r, RandomEngineType engine,
+                                  uint64 seed);
+RandomEngineType RandomState_GetEngine(RandomState *r);
+const char *RandomState_GetEngineName(RandomEngineType engine);
 void RandomState_Destroy(RandomState *r);
 void RandomState_GenerateSeed(RandomState *r);
 uint64 RandomState_GetSeed(RandomState *r);
 void RandomState_SetSeed(RandomState *r, uint64 seed);
+
+/*
+ * Independent streams for parallel work.
+ *
+ * RandomState_Jump advances r exactly as much as n calls to
+ * RandomState_Uint32 would, in O(log n).  (RandomState_Uint64 is two
+ * steps of the LCG engine, and one of the others.)
+ *
+ * RandomState_Split creates a child with the same engine, seeded from
+ * one RandomState_Uint64 draw of r.
+ *
+ * RandomState_CreateStream derives stream streamId from the parent's
+ * seed, without touching the parent's state, so each worker/entity
+ * can get the same stream no matter which thread asks for it or in
+ * what order.
+ */
+void RandomState_Jump(RandomState *r, uint64 n);
+void RandomState_Split(RandomState *r, RandomState *child);
+void RandomState_CreateStream(RandomState *r, const RandomState *parent,
+                              uint64 streamId);
 bool RandomState_Flip(RandomState *r, float trueProb);
 bool RandomState_Bit(RandomState *r);
+
+/*
+ * Uniformly distributed ints in [min, max], inclusive, for any range
+ * up to the whole type.  These are unbiased.
+ */
 int RandomState_Int(RandomState *r, int min, int max);
+int64 RandomState_Int64(RandomState *r, int64 min, int64 max);
+
+/*
+ * Uniformly distributed in [0, bound), for bound > 0.
+ */
+uint32 RandomState_Uint32Below(RandomState *r, uint32 bound);
+uint64 RandomState_Uint64Below(RandomState *r, uint64 bound);
+
 float RandomState_Float(RandomState *r, float min, float max);
 uint32 RandomState_Uint32(RandomState *r);
 uint64 RandomState_Uint64(RandomState *r);
@@ -61,9 +138,120 @@ int RandomState_Enum(RandomState *r, EnumDistribution *dst,
                      int numValues);
 int RandomState_DiceSum(RandomState *r, int numDice, int diceMax);
 
+/*
+ * Non-uniform distributions.
+ *
+ * Normal and Exponential use ziggurat tables, so most draws are one
+ * Uint64 and a multiply.  Poisson and Binomial take O(1) expected time
+ * for large means, and walk the CDF for small ones.
+ */
+double RandomState_Normal(RandomState *r, double mean, double stddev);
+double RandomState_Exponential(RandomState *r, double mean);
+int64 RandomState_Poisson(RandomState *r, double mean);
+int64 RandomState_Binomial(RandomState *r, int64 n, double p);
+
+void RandomEnumSampler_Create(RandomEnumSampler *s,
+                              const EnumDistribution *dist, int numValues);
+void RandomEnumSampler_Destroy(RandomEnumSampler *s);
+int RandomState_SampleEnum(RandomState *r, const RandomEnumSampler *s);
+void RandomState_FillEnum(RandomState *r, const RandomEnumSampler *s,
+                          int *out, int64 numItems);
+
+/*
+ * Fill whole arrays with random values.
+ *
+ * These run 8 interleaved xoshiro256** streams side by side, so the
+ * generation loop vectorizes.  The streams are seeded from one
+ * RandomState_Uint64 call on r, whatever r's engine is, and the output
+ * only depends on r's state: it's the same with or without AVX2, and a
+ * shorter fill from the same state is a prefix of a longer one.
+ *
+ * FillUnitFloat is in [0, 1), and FillIntRange/FillInt64Range are the
+ * batch versions of RandomState_Int/Int64, for many values in the
+ * same range.
+ */
+void RandomState_FillUint32(RandomState *r, uint32 *out, int64 numItems);
+void RandomState_FillUint64(RandomState *r, uint64 *out, int64 numItems);
+void RandomState_FillUnitFloat(RandomState *r, float *out, int64 numItems);
+void RandomState_FillIntRange(RandomState *r, int *out, int64 numItems,
+                              int min, int max);
+void RandomState_FillInt64Range(RandomState *r, int64 *out, int64 numItems,
+                                int64 min, int64 max);
+
+/*
+ * Fisher-Yates shuffle of numItems items, each itemSize bytes.
+ *
+ * RandomState_PartialShuffle stops after the first k swaps, which
+ * leaves a uniform random sample of k items, in random order, at the
+ * front of the array for O(k) work.
+ */
+void RandomState_Shuffle(RandomState *r, void *items, int64 numItems,
+                         int itemSize);
+void RandomState_PartialShuffle(RandomState *r, void *items, int64 numItems,
+                                int itemSize, int64 k);
+
+/*
+ * Weighted sampling without replacement (Efraimidis-Spirakis).
+ *
+ * Picks min(k, number of positive weights) distinct indices, writes
+ * them to out in the order they'd have come out of k successive
+ * weighted draws, and returns how many there were.  Items with a
+ * weight of 0 are never picked.
+ *
+ * This makes one pass over the weights, but uses exponential jumps
+ * past the first k items, so it only needs O(k log(numItems / k))
+ * random draws.
+ */
+int64 RandomState_WeightedSample(RandomState *r, const float *weights,
+                                 int64 numItems, int64 *out, int64 k);
+
+/*
+ * Reservoir sampling of k items from a stream of unknown length.
+ *
+ * Call RandomReservoir_Offer once per item in the stream: it returns
+ * the slot in [0, k) to store that item in, or -1 to drop it.  Once
+ * the stream ends, the slots hold a uniform random sample of
+ * min(k, stream length) of its items.
+ *
+ * This uses Li's Algorithm L, which precomputes how many items to
+ * skip, so dropped items don't need any random draws.
+ */
+typedef struct RandomReservoir {
+    int64 k;
+    int64 count;
+    int64 nextAccept;
+    double logW;
+} RandomReservoir;
+
+void RandomReservoir_Create(RandomReservoir *res, RandomState *r, int64 k);
+int64 RandomReservoirAccept(RandomReservoir *res, RandomState *r);
+
+static inline int64 RandomReservoir_Offer(RandomReservoir *res,
+                                          RandomState *r)
+{
+    int64 i = res->count++;
+
+    if (i < res->k) {
+        return i;
+    } else if (i < res->nextAccept) {
+        return -1;
+    }
+    return RandomReservoirAccept(res, r);
+}
+
 void Random_Init(void);
 void Random_Exit(void);
 
+/*
+ * By default every thread shares one RandomState behind the Random_*
+ * functions, without any locking.  After Random_InitThread, the
+ * calling thread uses its own RandomState_CreateStream of the module
+ * seed instead, until Random_ExitThread.  Random_SetSeed/GetSeed
+ * still refer to the module seed.
+ */
+void Random_InitThread(uint64 streamId);
+void Random_ExitThread(void);
+
 void Random_GenerateSeed();
 
 uint64 Random_GetSeed();
@@ -83,6 +271,7 @@ bool Random_Bit();
  * Uniformly distributed random number in the given range.
  */
 int Random_Int(int min, int max);
+int64 Random_Int64(int64 min, int64 max);
 float Random_Float(float min, float max);
 
 uint32 Random_Uint32(void);
@@ -91,13 +280,33 @@ float Random_UnitFloat(void);
 
 float Random_UnitFloatFromSeed(uint64 seed);
 
+void Random_FillUint32(uint32 *out, int64 numItems);
+void Random_FillUint64(uint64 *out, int64 numItems);
+void Random_FillUnitFloat(float *out, int64 numItems);
+void Random_FillIntRange(int *out, int64 numItems, int min, int max);
+void Random_FillInt64Range(int64 *out, int64 numItems,
+                           int64 min, int64 max);
+
 int Random_Enum(EnumDistribution *dist, int numValues);
+int Random_SampleEnum(const RandomEnumSampler *s);
+void Random_FillEnum(const RandomEnumSampler *s, int *out, int64 numItems);
+
+void Random_Shuffle(void *items, int64 numItems, int itemSize);
+void Random_PartialShuffle(void *items, int64 numItems, int itemSize,
+                           int64 k);
+int64 Random_WeightedSample(const float *weights, int64 numItems,
+                            int64 *out, int64 k);
 
 /*
  * Sum numDice random die, between 1 and diceMax, inclusive.
  */
 int Random_DiceSum(int numDice, int diceMax);
 
+double Random_Normal(double mean, double stddev);
+double Random_Exponential(double mean);
+int64 Random_Poisson(double mean);
+int64 Random_Binomial(int64 n, double p);
+
 #ifdef __cplusplus
 	}
 #endif
@@ -47,6 +47,10 @@ int main(int argc, char *argv[])
     MBOption opts[] = {
         { "-b", "--benchmark", FALSE, "Run the benchmark"   },
         { "-t", "--tests",     FALSE, "Run the unit tests"  },
+        { "-a", "--allocBenchmark", TRUE,
+          "Append N ints to a vector with each allocator" },
+        { "-s", "--sortBenchmark", TRUE,
+          "Parallel sort N ints on 1 to all CPUs" },
     };
 
     MBOpt_SetProgram(PROGRAM_NAME, MBLIB_VERSION_STRING);
@@ -59,7 +63,11 @@ int main(int argc, char *argv[])
         benchmark = FALSE;
     }
 
-    if (benchmark) {
+    if (MBOpt_IsPresent("allocBenchmark")) {
+        MBUnitTest_AllocBenchmark(MBOpt_GetUint64("allocBenchmark"));
+    } else if (MBOpt_IsPresent("sortBenchmark")) {
+        MBUnitTest_SortBenchmark(MBOpt_GetUint64("sortBenchmark"));
+    } else if (benchmark) {
         MBUnitTest_RunBenchmark();
     } else {
         MBUnitTest_RunTests();